@@ -23,13 +23,104 @@
 #include <time.h>
 #include <sys/stat.h>
 #include "config.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "babl-internal.h"
 #include "git-version.h"
 
+/* The fish cache is a binary file that is memory mapped read-only at
+ * startup, fishes are only created from it when babl_fish () first asks
+ * for a pair of formats. All integers are in native byte order, a cache
+ * written on a machine with a different byte order or by another version
+ * of babl is ignored.
+ *
+ *   FishCacheHeader
+ *   FishCacheRecord   records[n_records]
+ *   uint32_t          buckets[n_buckets]         record index + 1, 0 if empty
+ *   uint32_t          conversions[n_conversions] string offsets
+ *   char              strings[strings_size]      NUL terminated names
+ *
+ * Formats and conversions are referred to by name, records are found by
+ * hashing the names of source and destination into the open addressed
+ * buckets. Fishes of babl_fast_fish () are stored with the tolerance they
+ * were searched with, those of babl_fish () with a tolerance of 0.
+ *
+ * Two caches can be mapped, a read-only system cache generated when babl
+ * is built, and the cache of the user which is layered on top of it and
+ * rewritten by babl_exit (). Fishes are looked up in the user cache first.
+ */
+
+#define FISH_CACHE_MAGIC       "babl-fsh"
+#define FISH_CACHE_VERSION     2
+#define FISH_CACHE_BYTE_ORDER  0x01020304
+
+#define FISH_RECORD_REFERENCE  (1 << 0)  /* no path within tolerance */
+
+typedef struct
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t build;          /* string offset of the writers cache_header () */
+  uint32_t n_records;
+  uint32_t records;        /* file offsets of the sections */
+  uint32_t n_buckets;      /* a power of two */
+  uint32_t buckets;
+  uint32_t n_conversions;
+  uint32_t conversions;
+  uint32_t strings_size;
+  uint32_t strings;
+  uint32_t reserved;
+} FishCacheHeader;
+
+typedef struct
+{
+  uint32_t source;         /* string offsets of the format names */
+  uint32_t destination;
+  uint32_t flags;
+  uint32_t cost;
+  uint32_t n_conversions;
+  uint32_t conversions;    /* index of the first conversion name */
+  double   error;
+  int64_t  pixels;
+  double   tolerance;
+} FishCacheRecord;
+
+typedef struct
+{
+  const char            *data;
+  size_t                 size;
+  const FishCacheHeader *header;      /* NULL unless mapped and valid */
+  const FishCacheRecord *records;
+  const uint32_t        *buckets;
+  const uint32_t        *conversions;
+  const char            *strings;
+  char                  *used;        /* per record: 0 unused, 1 in use,
+                                         2 dropped */
+#ifdef _WIN32
+  HANDLE                 file_handle;
+  HANDLE                 mapping;
+#endif
+} FishCache;
+
+static FishCache user_cache;
+static FishCache system_cache;
+static int       cache_drop;
+
+#define FISH_CACHE_FILE  "babl-fishes-cce210.bin"
+
+#ifdef DATADIR
+#define SYSTEM_CACHE_PATH  DATADIR BABL_DIR_SEPARATOR BABL_LIBRARY \
+                           BABL_DIR_SEPARATOR FISH_CACHE_FILE
+#endif
+
 #ifdef _WIN32
-#define FALLBACK_CACHE_PATH  "C:/babl-fishes-cce210.txt"
+#define FALLBACK_CACHE_PATH  "C:/" FISH_CACHE_FILE
 #else
-#define FALLBACK_CACHE_PATH  "/tmp/babl-fishes-cce210.txt"
+#define FALLBACK_CACHE_PATH  "/tmp/" FISH_CACHE_FILE
 #endif
 
 static int
@@ -79,20 +170,28 @@ fish_cache_path (void)
   struct stat stat_buf;
   static char path[4096];
 
+  if (getenv ("BABL_FISH_CACHE") && getenv ("BABL_FISH_CACHE")[0])
+    {
+      strncpy (path, getenv ("BABL_FISH_CACHE"), 4096);
+      path[sizeof (path) - 1] = '\0';
+      mk_ancestry (path);
+      return path;
+    }
+
   strncpy (path, FALLBACK_CACHE_PATH, 4096);
   path[sizeof (path) - 1] = '\0';
 #ifndef _WIN32
   if (getenv ("XDG_CACHE_HOME"))
-    snprintf (path, sizeof (path), "%s/babl/babl-fishes-cce210.txt", getenv("XDG_CACHE_HOME"));
+    snprintf (path, sizeof (path), "%s/babl/" FISH_CACHE_FILE, getenv("XDG_CACHE_HOME"));
   else if (getenv ("HOME"))
-    snprintf (path, sizeof (path), "%s/.cache/babl/babl-fishes-cce210.txt", getenv("HOME"));
+    snprintf (path, sizeof (path), "%s/.cache/babl/" FISH_CACHE_FILE, getenv("HOME"));
 #else
 {
   char win32path[4096];
   if (SHGetFolderPathA (NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, win32path) == S_OK)
-    snprintf (path, sizeof (path), "%s\\%s\\babl-fishes-cce210.txt", win32path, BABL_LIBRARY);
+    snprintf (path, sizeof (path), "%s\\%s\\" FISH_CACHE_FILE, win32path, BABL_LIBRARY);
   else if (getenv ("TEMP"))
-    snprintf (path, sizeof (path), "%s\\babl-fishes-cce210.txt", getenv("TEMP"));
+    snprintf (path, sizeof (path), "%s\\" FISH_CACHE_FILE, getenv("TEMP"));
 }
 #endif
 
@@ -105,61 +204,19 @@ fish_cache_path (void)
   return path;
 }
 
-static char *
-babl_fish_serialize (Babl *fish, char *dest, int n)
-{
-  char *d = dest;
-  if (fish->class_type != BABL_FISH &&
-      fish->class_type != BABL_FISH_PATH)
-  {
-    return NULL;
-  }
-
-  snprintf (d, n, "%s\n%s\n",
-  babl_get_name (fish->fish.source),
-  babl_get_name (fish->fish.destination));
-  n -= strlen (d);d += strlen (d);
-
-  snprintf (d, n, "\tpixels=%li", fish->fish.pixels);
-  n -= strlen (d);d += strlen (d);
-
-  if (fish->class_type == BABL_FISH_PATH)
-  {
-    snprintf (d, n, " cost=%d", (int)fish->fish_path.cost);
-    n -= strlen (d);d += strlen (d);
-  }
-
-  snprintf (d, n, " error=%f", fish->fish.error);
-  n -= strlen (d);d += strlen (d);
-
-  if (fish->class_type == BABL_FISH)
-  {
-    snprintf (d, n, " [reference]");
-    n -= strlen (d);d += strlen (d);
-  }
-
-  snprintf (d, n, "\n");
-  n -= strlen (d);d += strlen (d);
-
-  if (fish->class_type == BABL_FISH_PATH)
-  {
-    for (int i = 0; i < fish->fish_path.conversion_list->count; i++)
-    {
-      snprintf (d, n, "\t%s\n",
-        babl_get_name(fish->fish_path.conversion_list->items[i]  ));
-      n -= strlen (d);d += strlen (d);
-    }
-  }
-
-  return dest;
-}
-
-static int 
-compare_fish_pixels (const void *a, const void *b)
+/* the system cache is read from BABL_FISH_DB when set, an empty value
+ * disables it.
+ */
+static const char *
+system_cache_path (void)
 {
-  const Babl **fa = (void*)a;
-  const Babl **fb = (void*)b;
-  return ((*fb)->fish.pixels - (*fa)->fish.pixels);
+  if (getenv ("BABL_FISH_DB"))
+    return getenv ("BABL_FISH_DB")[0] ? getenv ("BABL_FISH_DB") : NULL;
+#ifdef SYSTEM_CACHE_PATH
+  return SYSTEM_CACHE_PATH;
+#else
+  return NULL;
+#endif
 }
 
 static const char *
@@ -177,211 +234,681 @@ cache_header (void)
   return buf;
 }
 
-void 
-babl_store_db (void)
+static uint32_t
+fish_cache_hash (const char *source,
+                 const char *destination)
 {
-  BablDb *db = babl_fish_db ();
-  int i;
-  char *tmpp = calloc(8000,1);
-  FILE *dbfile;
+  uint32_t hash = 2166136261u;
+
+  while (*source)
+    hash = (hash ^ (unsigned char) *source++) * 16777619u;
+  hash = (hash ^ 0xff) * 16777619u;
+  while (*destination)
+    hash = (hash ^ (unsigned char) *destination++) * 16777619u;
+  return hash;
+}
 
-  if (!tmpp)
-    return;
-  snprintf (tmpp, 8000, "%s~", fish_cache_path ());
-  dbfile  = fopen (tmpp, "w");
-  if (!dbfile)
-  {
-    free (tmpp);
+static inline const char *
+cache_string (const FishCache *cache,
+              uint32_t         offset)
+{
+  return cache->strings + offset;
+}
+
+static void
+fish_cache_unmap (FishCache *cache)
+{
+  if (!cache->data)
     return;
-  }
-  fprintf (dbfile, "%s\n", cache_header ());
 
-  /* sort the list of fishes by usage, making next run more efficient -
-   * and the data easier to approach as data for targeted optimization
-   */
-  qsort (db->babl_list->items, db->babl_list->count,
-         sizeof (Babl*), compare_fish_pixels);
-
-  for (i = 0; i< db->babl_list->count; i++)
-  {
-    Babl *fish = db->babl_list->items[i];
-    char tmp[8192];
-    if (babl_fish_serialize (fish, tmp, 4096))
-      fprintf (dbfile, "%s----\n", tmp);
-  }
-  fclose (dbfile);
+#if defined(HAVE_SYS_MMAN_H)
+  munmap ((void *) cache->data, cache->size);
+#elif defined(_WIN32)
+  UnmapViewOfFile (cache->data);
+  CloseHandle (cache->mapping);
+  CloseHandle (cache->file_handle);
+#else
+  free ((void *) cache->data);
+#endif
 
-#ifdef _WIN32
-  remove (fish_cache_path ());
+  babl_free (cache->used);
+  memset (cache, 0, sizeof (FishCache));
+}
+
+static int
+fish_cache_map (FishCache  *cache,
+                const char *path)
+{
+#if defined(HAVE_SYS_MMAN_H)
+  struct stat stat_buf;
+  int         fd = open (path, O_RDONLY);
+  void       *data;
+
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &stat_buf) != 0 || stat_buf.st_size <= 0)
+    {
+      close (fd);
+      return -1;
+    }
+  data = mmap (NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    return -1;
+  cache->data = data;
+  cache->size = stat_buf.st_size;
+#elif defined(_WIN32)
+  LARGE_INTEGER size;
+
+  cache->file_handle = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (cache->file_handle == INVALID_HANDLE_VALUE)
+    return -1;
+  if (!GetFileSizeEx (cache->file_handle, &size) || size.QuadPart <= 0 ||
+      !(cache->mapping = CreateFileMappingA (cache->file_handle, NULL,
+                                             PAGE_READONLY, 0, 0, NULL)))
+    {
+      CloseHandle (cache->file_handle);
+      return -1;
+    }
+  cache->data = MapViewOfFile (cache->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!cache->data)
+    {
+      CloseHandle (cache->mapping);
+      CloseHandle (cache->file_handle);
+      return -1;
+    }
+  cache->size = size.QuadPart;
+#else
+  char *contents = NULL;
+  long  length   = -1;
+
+  _babl_file_get_contents (path, &contents, &length, NULL);
+  if (!contents)
+    return -1;
+  cache->data = contents;
+  cache->size = length;
 #endif
-  rename (tmpp, fish_cache_path());
-  free (tmpp);
+  return 0;
+}
+
+/* checks that the sections of the header lie within the mapped file,
+ * the contents of the records are checked when they are used.
+ */
+static int
+fish_cache_validate (FishCache *cache)
+{
+  const FishCacheHeader *header = (const void *) cache->data;
+  size_t                 size   = cache->size;
+
+  if (size < sizeof (FishCacheHeader) ||
+      memcmp (header->magic, FISH_CACHE_MAGIC, sizeof (header->magic)) ||
+      header->version != FISH_CACHE_VERSION ||
+      header->byte_order != FISH_CACHE_BYTE_ORDER)
+    return 0;
+
+#define SECTION_FITS(offset, count, item_size) \
+  ((offset) % 4 == 0 && (offset) <= size && \
+   (uint64_t) (count) * (item_size) <= size - (offset))
+
+  if (!SECTION_FITS (header->records, header->n_records,
+                     sizeof (FishCacheRecord)) ||
+      header->records % 8 != 0 ||
+      !SECTION_FITS (header->buckets, header->n_buckets, sizeof (uint32_t)) ||
+      !SECTION_FITS (header->conversions, header->n_conversions,
+                     sizeof (uint32_t)) ||
+      !SECTION_FITS (header->strings, header->strings_size, 1))
+    return 0;
+
+#undef SECTION_FITS
+
+  if (header->n_buckets == 0 ||
+      (header->n_buckets & (header->n_buckets - 1)) != 0 ||
+      header->n_buckets <= header->n_records ||
+      header->strings_size == 0 ||
+      cache->data[header->strings + header->strings_size - 1] != '\0' ||
+      header->build >= header->strings_size)
+    return 0;
+
+  cache->records     = (const void *) (cache->data + header->records);
+  cache->buckets     = (const void *) (cache->data + header->buckets);
+  cache->conversions = (const void *) (cache->data + header->conversions);
+  cache->strings     = cache->data + header->strings;
+
+  /* if babl has changed in git .. drop whole cache */
+  if (strcmp (cache_string (cache, header->build), cache_header ()))
+    return 0;
+
+  cache->header = header;
+  cache->used   = babl_calloc (1, header->n_records + 1);
+  return 1;
 }
 
-int
-_babl_fish_path_destroy (void *data);
+static void
+fish_cache_load (FishCache  *cache,
+                 const char *path)
+{
+  fish_cache_unmap (cache);
+
+  if (!path || fish_cache_map (cache, path) != 0)
+    return;
 
-char *
-_babl_fish_create_name (char       *buf,
-                        const Babl *source,
-                        const Babl *destination,
-                        int         is_reference);
+  if (!fish_cache_validate (cache))
+    fish_cache_unmap (cache);
+}
 
-void 
+static int
+record_is_valid (const FishCache       *cache,
+                 const FishCacheRecord *record)
+{
+  uint32_t strings_size  = cache->header->strings_size;
+  uint32_t n_conversions = cache->header->n_conversions;
+  uint32_t i;
+
+  if (record->source >= strings_size ||
+      record->destination >= strings_size ||
+      record->conversions > n_conversions ||
+      record->n_conversions > n_conversions - record->conversions)
+    return 0;
+
+  for (i = 0; i < record->n_conversions; i++)
+    if (cache->conversions[record->conversions + i] >= strings_size)
+      return 0;
+
+  return 1;
+}
+
+static long
+find_record (const FishCache *cache,
+             const Babl      *source,
+             const Babl      *destination,
+             double           tolerance)
+{
+  const char *source_name      = babl_get_name (source);
+  const char *destination_name = babl_get_name (destination);
+  uint32_t    mask             = cache->header->n_buckets - 1;
+  uint32_t    i;
+  uint32_t    probes;
+
+  i = fish_cache_hash (source_name, destination_name) & mask;
+  for (probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+    {
+      uint32_t               index = cache->buckets[i];
+      const FishCacheRecord *record;
+
+      if (index == 0 || index > cache->header->n_records)
+        return -1;
+
+      record = &cache->records[index - 1];
+      if (record_is_valid (cache, record) &&
+          record->tolerance == tolerance &&
+          !strcmp (cache_string (cache, record->source), source_name) &&
+          !strcmp (cache_string (cache, record->destination), destination_name))
+        return index - 1;
+    }
+  return -1;
+}
+
+static int
+resolve_conversions (const FishCache       *cache,
+                     const FishCacheRecord *record,
+                     BablList              *list)
+{
+  uint32_t i;
+
+  list->count = 0;
+  for (i = 0; i < record->n_conversions; i++)
+    {
+      const char *name = cache_string (cache,
+                           cache->conversions[record->conversions + i]);
+      Babl       *conv = babl_db_find (babl_conversion_db (), name);
+
+      if (!conv)
+        return 0;
+      babl_list_insert_last (list, conv);
+    }
+  return 1;
+}
+
+static Babl *
+fish_cache_create (FishCache  *cache,
+                   const Babl *source,
+                   const Babl *destination,
+                   double      tolerance,
+                   const char *name)
+{
+  const FishCacheRecord *record;
+  long                   index;
+  Babl                  *babl;
+
+  if (!cache->header)
+    return NULL;
+
+  index = find_record (cache, source, destination, tolerance);
+  if (index < 0 || cache->used[index])
+    return NULL;
+
+  record = &cache->records[index];
+  cache->used[index] = 2;
+
+  /* 1% chance of individual cached conversions being dropped -
+   * making sure mis-measured conversions do not
+     stick around for a long time. The paths of the system cache are
+     not measured on this machine, they are kept, and are what a pair
+     dropped from the user cache falls back to.*/
+  if (cache == &user_cache && record->pixels % 100 == cache_drop)
+    return NULL;
+
+  if (record->flags & FISH_RECORD_REFERENCE)
+    {
+      /* there isn't a suitable path for requested formats,
+       * let's create a dummy BABL_FISH instance and insert
+       * it into the fish database to indicate that such path
+       * does not exist.
+       */
+      babl = _babl_fish_missing_new (source, destination, tolerance);
+      if (tolerance <= 0.0)
+        babl->fish.data = (void*) 1; /* signals babl_fish() to
+                                      * show a "missing fash path"
+                                      * warning upon the first
+                                      * lookup
+                                      */
+    }
+  else
+    {
+      babl = babl_calloc (1, sizeof (BablFishPath) +
+                          strlen (name) + 1);
+      babl_set_destructor (babl, _babl_fish_path_destroy);
+
+      babl->class_type     = BABL_FISH_PATH;
+      babl->instance.id    = babl_fish_get_id (source, destination);
+      babl->instance.name  = ((char *) babl) + sizeof (BablFishPath);
+      strcpy (babl->instance.name, name);
+      babl->fish.source               = source;
+      babl->fish.destination          = destination;
+      babl->fish.tolerance            = tolerance;
+      babl->fish_path.cost            = record->cost;
+      babl->fish_path.conversion_list =
+        babl_list_init_with_size (record->n_conversions + 1);
+
+      /* conversions for formats in other spaces than sRGB are only
+       * registered on demand
+       */
+      if (!resolve_conversions (cache, record, babl->fish_path.conversion_list))
+        {
+          babl_mutex_lock (babl_format_mutex);
+          _babl_fish_prepare_spaces (source, destination);
+          babl_mutex_unlock (babl_format_mutex);
+
+          if (!resolve_conversions (cache, record,
+                                    babl->fish_path.conversion_list))
+            {
+              babl_free (babl);
+              return NULL;
+            }
+        }
+
+      _babl_fish_prepare_bpp (babl);
+      _babl_fish_rig_dispatch (babl);
+    }
+
+  babl->fish.error  = record->error;
+  babl->fish.pixels = record->pixels;
+
+  cache->used[index] = 1;
+  return babl;
+}
+
+Babl *
+babl_fish_cache_materialize (const Babl *source,
+                             const Babl *destination,
+                             double      tolerance)
+{
+  Babl   *babl;
+  BablDb *db;
+  char    name[4096];
+
+  if (!user_cache.header && !system_cache.header)
+    return NULL;
+
+  if (tolerance > 0.0)
+    {
+      db = babl_fast_fish_db ();
+      _babl_fish_create_fast_name (name, source, destination, tolerance);
+    }
+  else
+    {
+      db = babl_fish_db ();
+      _babl_fish_create_name (name, source, destination, 1);
+    }
+  if (babl_db_exist_by_name (db, name))
+    return NULL;
+
+  babl = fish_cache_create (&user_cache, source, destination, tolerance, name);
+  if (!babl)
+    babl = fish_cache_create (&system_cache, source, destination, tolerance,
+                              name);
+  if (babl)
+    babl_db_insert (db, babl);
+  return babl;
+}
+
+void
 babl_init_db (void)
 {
-  const char *path = fish_cache_path ();
-  long  length = -1;
-  char  seps[] = "\n\r";
-  Babl *babl   = NULL;
-  char *contents = NULL;
-  char *token;
-  char *tokp;
-  const Babl  *from_format = NULL;
-  const Babl  *to_format   = NULL;
   time_t tim = time (NULL);
 
+  fish_cache_unmap (&user_cache);
+  fish_cache_unmap (&system_cache);
+
   if (getenv ("BABL_DEBUG_CONVERSIONS"))
     return;
 
-  _babl_file_get_contents (path, &contents, &length, NULL);
-  if (!contents)
-    return;
+  fish_cache_load (&system_cache, system_cache_path ());
+  fish_cache_load (&user_cache, fish_cache_path ());
+  cache_drop = tim % 100;
+}
+
+/* writing the cache */
 
-  token = strtok_r (contents, seps, &tokp);
-  while( token != NULL )
+typedef struct
+{
+  const Babl            *fish;    /* either a fish from the fish db */
+  const FishCacheRecord *record;  /* or an unused record of the old user
+                                     cache */
+  int64_t                pixels;
+} CacheEntry;
+
+typedef struct
+{
+  char     *data;
+  uint32_t  size;
+  uint32_t  allocated;
+  uint32_t *hash;       /* string offset + 1, 0 if empty */
+  uint32_t  hash_mask;
+  uint32_t  hash_count;
+} StringTable;
+
+static void
+string_table_grow_hash (StringTable *table);
+
+static uint32_t
+string_table_add (StringTable *table,
+                  const char  *string)
+{
+  uint32_t hash = fish_cache_hash (string, "");
+  uint32_t i;
+  uint32_t length;
+  uint32_t offset;
+
+  for (i = hash & table->hash_mask; table->hash[i];
+       i = (i + 1) & table->hash_mask)
+    if (!strcmp (table->data + table->hash[i] - 1, string))
+      return table->hash[i] - 1;
+
+  length = strlen (string) + 1;
+  if (table->size + length > table->allocated)
     {
-      switch (token[0])
+      table->allocated = (table->size + length) * 2;
+      table->data      = babl_realloc (table->data, table->allocated);
+    }
+  offset = table->size;
+  memcpy (table->data + offset, string, length);
+  table->hash[i] = offset + 1;
+  table->size   += length;
+
+  if (++table->hash_count * 2 > table->hash_mask)
+    string_table_grow_hash (table);
+
+  return offset;
+}
+
+static void
+string_table_grow_hash (StringTable *table)
+{
+  uint32_t *old      = table->hash;
+  uint32_t  old_mask = table->hash_mask;
+  uint32_t  i;
+
+  table->hash_mask = old_mask * 2 + 1;
+  table->hash      = babl_calloc (table->hash_mask + 1, sizeof (uint32_t));
+
+  for (i = 0; i <= old_mask; i++)
+    if (old[i])
       {
-        case '-': /* finalize */
-          if (babl)
-          {
-            if ((babl->fish.pixels) == (tim % 100))
-            {
-              /* 1% chance of individual cached conversions being dropped -
-               * making sure mis-measured conversions do not
-                 stick around for a long time*/
-              babl_free (babl);
-            }
-            else
-              babl_db_insert (babl_fish_db(), babl);
-          }
-          from_format = NULL;
-          to_format = NULL;
-          babl=NULL;
-          break;
-        case '#':
-          /* if babl has changed in git .. drop whole cache */
-          {
-            if (strcmp ( token, cache_header ()))
-            {
-              free (contents);
-              return;
-            }
-          }
-          break;
-        case '\t':
-          if (to_format && strchr (token, '='))
-          {
-            char seps2[] = " ";
-            char *tokp2;
-            char *token2;
-            char name[4096];
-
-            _babl_fish_create_name (name, from_format, to_format, 1);
-            babl = babl_db_exist_by_name (babl_fish_db (), name);
-            if (babl)
-            {
-              fprintf (stderr, "%s:%i: loading of cache failed\n",
-                              __FUNCTION__, __LINE__);
-              free (contents);
-              return;
-            }
+        uint32_t j = fish_cache_hash (table->data + old[i] - 1, "") &
+                     table->hash_mask;
+        while (table->hash[j])
+          j = (j + 1) & table->hash_mask;
+        table->hash[j] = old[i];
+      }
+  babl_free (old);
+}
 
-            if (strstr (token, "[reference]"))
-            {
-              /* there isn't a suitable path for requested formats,
-               * let's create a dummy BABL_FISH instance and insert
-               * it into the fish database to indicate that such path
-               * does not exist.
-               */
-              const char *name = "X"; /* name does not matter */
-              babl = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
-
-              babl->class_type       = BABL_FISH;
-              babl->instance.id      = babl_fish_get_id (from_format,
-                                                         to_format);
-              babl->instance.name    = ((char *) babl) + sizeof (BablFish);
-              strcpy (babl->instance.name, name);
-              babl->fish.source      = from_format;
-              babl->fish.destination = to_format;
-              babl->fish.data        = (void*) 1; /* signals babl_fish() to
-                                                   * show a "missing fash path"
-                                                   * warning upon the first
-                                                   * lookup
-                                                   */
-            }
-            else
-            {
-              babl = babl_calloc (1, sizeof (BablFishPath) +
-                                  strlen (name) + 1);
-              babl_set_destructor (babl, _babl_fish_path_destroy);
-
-              babl->class_type     = BABL_FISH_PATH;
-              babl->instance.id    = babl_fish_get_id (from_format, to_format);
-              babl->instance.name  = ((char *) babl) + sizeof (BablFishPath);
-              strcpy (babl->instance.name, name);
-              babl->fish.source               = from_format;
-              babl->fish.destination          = to_format;
-              babl->fish_path.conversion_list = babl_list_init_with_size (10);
-              _babl_fish_prepare_bpp (babl);
-              _babl_fish_rig_dispatch (babl);
-            }
+static int
+compare_entry_pixels (const void *a,
+                      const void *b)
+{
+  const CacheEntry *ea = a;
+  const CacheEntry *eb = b;
+  if (eb->pixels > ea->pixels)
+    return 1;
+  if (eb->pixels < ea->pixels)
+    return -1;
+  return 0;
+}
+
+/* adds the fishes of db that are worth keeping to entries */
+static void
+collect_fishes (BablDb     *db,
+                CacheEntry *entries,
+                int        *n_entries,
+                int        *n_conversions)
+{
+  int i;
 
-            token2 = strtok_r (&token[1], seps2, &tokp2);
-            while( token2 != NULL )
+  for (i = 0; i < db->babl_list->count; i++)
+    {
+      Babl *fish = db->babl_list->items[i];
+
+      /* path fishes still waiting for their background search are skipped */
+      if (fish->class_type == BABL_FISH ||
+          (fish->class_type == BABL_FISH_PATH &&
+           fish->fish_path.conversion_list->count > 0))
+        {
+          entries[*n_entries].fish   = fish;
+          entries[*n_entries].pixels = fish->fish.pixels +
+                                       _babl_fish_stats_pixels (fish);
+          if (fish->class_type == BABL_FISH_PATH)
+            *n_conversions += fish->fish_path.conversion_list->count;
+          (*n_entries)++;
+        }
+    }
+}
+
+static const char *
+entry_source (const CacheEntry *entry)
+{
+  if (entry->fish)
+    return babl_get_name (entry->fish->fish.source);
+  return cache_string (&user_cache, entry->record->source);
+}
+
+static const char *
+entry_destination (const CacheEntry *entry)
+{
+  if (entry->fish)
+    return babl_get_name (entry->fish->fish.destination);
+  return cache_string (&user_cache, entry->record->destination);
+}
+
+void
+babl_store_db (void)
+{
+  BablDb          *db = babl_fish_db ();
+  BablDb          *fast_db = babl_fast_fish_db ();
+  CacheEntry      *entries;
+  int              n_entries = 0;
+  int              n_conversions = 0;
+  FishCacheHeader  header;
+  FishCacheRecord *records;
+  uint32_t        *buckets;
+  uint32_t        *conversions;
+  StringTable      strings = {NULL, 0, 0, NULL, 63, 0};
+  uint32_t         n_buckets;
+  char            *tmpp;
+  FILE            *dbfile;
+  int              i;
+  uint32_t         j;
+
+  tmpp = calloc(8000,1);
+  if (!tmpp)
+    {
+      fish_cache_unmap (&user_cache);
+      fish_cache_unmap (&system_cache);
+      return;
+    }
+
+  entries = babl_calloc (db->babl_list->count + fast_db->babl_list->count +
+                         (user_cache.header ? user_cache.header->n_records : 0) + 1,
+                         sizeof (CacheEntry));
+
+  collect_fishes (db, entries, &n_entries, &n_conversions);
+  collect_fishes (fast_db, entries, &n_entries, &n_conversions);
+
+  /* keep the records no fish was made from in this session */
+  if (user_cache.header)
+    for (j = 0; j < user_cache.header->n_records; j++)
+      if (!user_cache.used[j] &&
+          record_is_valid (&user_cache, &user_cache.records[j]))
+        {
+          entries[n_entries].record = &user_cache.records[j];
+          entries[n_entries].pixels = user_cache.records[j].pixels;
+          n_conversions += user_cache.records[j].n_conversions;
+          n_entries++;
+        }
+
+  /* sort the list of fishes by usage, making the data easier to approach
+   * as data for targeted optimization
+   */
+  qsort (entries, n_entries, sizeof (CacheEntry), compare_entry_pixels);
+
+  for (n_buckets = 64; n_buckets < (uint32_t) n_entries * 2; n_buckets *= 2);
+
+  records     = babl_calloc (n_entries + 1, sizeof (FishCacheRecord));
+  buckets     = babl_calloc (n_buckets, sizeof (uint32_t));
+  conversions = babl_calloc (n_conversions + 1, sizeof (uint32_t));
+  strings.hash = babl_calloc (strings.hash_mask + 1, sizeof (uint32_t));
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, FISH_CACHE_MAGIC, sizeof (header.magic));
+  header.version    = FISH_CACHE_VERSION;
+  header.byte_order = FISH_CACHE_BYTE_ORDER;
+  header.build      = string_table_add (&strings, cache_header ());
+
+  n_conversions = 0;
+  for (i = 0; i < n_entries; i++)
+    {
+      CacheEntry      *entry  = &entries[i];
+      FishCacheRecord *record = &records[i];
+      uint32_t         bucket;
+
+      record->source      = string_table_add (&strings, entry_source (entry));
+      record->destination = string_table_add (&strings, entry_destination (entry));
+      record->pixels      = entry->pixels;
+      record->conversions = n_conversions;
+
+      if (entry->fish)
+        {
+          const Babl *fish = entry->fish;
+
+          record->error     = fish->fish.error;
+          record->tolerance = fish->fish.tolerance;
+          if (fish->class_type == BABL_FISH)
             {
-              if (!strncmp (token2, "error=", 6))
-              {
-                babl->fish.error = babl_parse_double (token2 + 6);
-              }
-              else if (!strncmp (token2, "cost=", 5))
-              {
-                if (babl->class_type == BABL_FISH_PATH)
-                  babl->fish_path.cost = babl_parse_double (token2 + 5);
-              }
-              else if (!strncmp (token2, "pixels=", 7))
-              {
-                babl->fish.pixels = strtol (token2 + 7, NULL, 10);
-              }
-              token2 = strtok_r (NULL, seps2, &tokp2);
+              record->flags = FISH_RECORD_REFERENCE;
             }
-          }
-          else if (to_format && babl && babl->class_type == BABL_FISH_PATH)
-          {
-            Babl *conv = (void*)babl_db_find(babl_conversion_db(), &token[1]);
-            if (!conv)
+          else
             {
-              babl_free (babl);
-              babl = NULL;
+              BablList *list = fish->fish_path.conversion_list;
+
+              record->cost          = fish->fish_path.cost;
+              record->n_conversions = list->count;
+              for (j = 0; j < (uint32_t) list->count; j++)
+                conversions[n_conversions++] =
+                  string_table_add (&strings, babl_get_name (list->items[j]));
             }
-            else
-              babl_list_insert_last (babl->fish_path.conversion_list, conv);
-          }
-          break;
-        default:
-          if (!from_format)
-          {
-            from_format = (void*)babl_db_find(babl_format_db(), token);
-          }
-          else
-          {
-            to_format = (void*)babl_db_find(babl_format_db(), token);
-          }
-          break;
-      }
-      token = strtok_r (NULL, seps, &tokp);
+        }
+      else
+        {
+          const FishCacheRecord *old = entry->record;
+
+          record->error         = old->error;
+          record->tolerance     = old->tolerance;
+          record->flags         = old->flags;
+          record->cost          = old->cost;
+          record->n_conversions = old->n_conversions;
+          for (j = 0; j < old->n_conversions; j++)
+            conversions[n_conversions++] =
+              string_table_add (&strings,
+                cache_string (&user_cache,
+                              user_cache.conversions[old->conversions + j]));
+        }
+
+      bucket = fish_cache_hash (entry_source (entry),
+                                entry_destination (entry)) & (n_buckets - 1);
+      while (buckets[bucket])
+        bucket = (bucket + 1) & (n_buckets - 1);
+      buckets[bucket] = i + 1;
     }
-  if (contents)
-    free (contents);
+
+  header.n_records     = n_entries;
+  header.records       = sizeof (FishCacheHeader);
+  header.n_buckets     = n_buckets;
+  header.buckets       = header.records + n_entries * sizeof (FishCacheRecord);
+  header.n_conversions = n_conversions;
+  header.conversions   = header.buckets + n_buckets * sizeof (uint32_t);
+  header.strings_size  = strings.size;
+  header.strings       = header.conversions + n_conversions * sizeof (uint32_t);
+
+  /* the old cache might still be mapped from this file */
+  fish_cache_unmap (&user_cache);
+  fish_cache_unmap (&system_cache);
+
+  snprintf (tmpp, 8000, "%s~", fish_cache_path ());
+  dbfile = fopen (tmpp, "wb");
+  if (dbfile)
+    {
+      int ok =
+        fwrite (&header, sizeof (header), 1, dbfile) == 1 &&
+        fwrite (records, sizeof (FishCacheRecord), n_entries, dbfile) ==
+          (size_t) n_entries &&
+        fwrite (buckets, sizeof (uint32_t), n_buckets, dbfile) == n_buckets &&
+        fwrite (conversions, sizeof (uint32_t), n_conversions, dbfile) ==
+          (size_t) n_conversions &&
+        fwrite (strings.data, 1, strings.size, dbfile) == strings.size;
+
+      if (fclose (dbfile) != 0)
+        ok = 0;
+
+      if (ok)
+        {
+#ifdef _WIN32
+          remove (fish_cache_path ());
+#endif
+          rename (tmpp, fish_cache_path());
+        }
+      else
+        {
+          remove (tmpp);
+        }
+    }
+
+  babl_free (strings.hash);
+  babl_free (strings.data);
+  babl_free (conversions);
+  babl_free (buckets);
+  babl_free (records);
+  babl_free (entries);
+  free (tmpp);
 }
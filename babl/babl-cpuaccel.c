@@ -117,6 +117,7 @@ enum
 {
   ARCH_X86_INTEL_FEATURE_PNI      = 1 << 0,
   ARCH_X86_INTEL_FEATURE_SSSE3    = 1 << 9,
+  ARCH_X86_INTEL_FEATURE_FMA      = 1 << 12,
   ARCH_X86_INTEL_FEATURE_SSE4_1   = 1 << 19,
   ARCH_X86_INTEL_FEATURE_SSE4_2   = 1 << 20,
   ARCH_X86_INTEL_FEATURE_AVX      = 1 << 28,
@@ -259,6 +260,9 @@ arch_accel_intel (void)
     if (ecx & ARCH_X86_INTEL_FEATURE_F16C)
       caps |= BABL_CPU_ACCEL_X86_F16C;
 
+    if (ecx & ARCH_X86_INTEL_FEATURE_FMA)
+      caps |= BABL_CPU_ACCEL_X86_FMA;
+
     cpuid (0, eax, ebx, ecx, edx);
 
     if (eax >= 7)
@@ -36,6 +36,7 @@ typedef enum
   /* BABL_CPU_ACCEL_X86_AVX     = 0x00080000, */
   BABL_CPU_ACCEL_X86_F16C    = 0x00040000,
   BABL_CPU_ACCEL_X86_AVX2    = 0x00020000,
+  BABL_CPU_ACCEL_X86_FMA     = 0x00010000,
 
   /* powerpc accelerations */
   BABL_CPU_ACCEL_PPC_ALTIVEC = 0x04000000,
@@ -78,6 +78,33 @@ babl_hash_by_int (BablHashTable *htab,
  return _babl_hash_by_int (htab, id);
 }
 
+unsigned int
+babl_digest (unsigned int  digest,
+             const void   *data,
+             int           length)
+{
+  const unsigned char *bytes = data;
+  int                  i;
+
+  for (i = 0; i < length; i++)
+    {
+      digest ^= bytes[i];
+      digest *= 16777619u;
+    }
+  return digest;
+}
+
+int
+babl_hash_by_digest (BablHashTable *htab,
+                     unsigned int   digest)
+{
+  digest ^= digest >> 16;
+  digest *= 0x85ebca6bu;
+  digest ^= digest >> 13;
+
+  return (digest & htab->mask);
+}
+
 static int
 db_find_by_name (Babl *item, 
                  void *data)
@@ -178,6 +205,18 @@ babl_db_insert (BablDb *db,
   return item;
 }
 
+void
+babl_db_remove_matching (BablDb           *db,
+                         BablEachFunction  match,
+                         void             *user_data)
+{
+  babl_mutex_lock (db->mutex);
+  babl_hash_table_remove_matching (db->id_hash, match, user_data);
+  babl_hash_table_remove_matching (db->name_hash, match, user_data);
+  babl_list_remove_matching (db->babl_list, match, user_data);
+  babl_mutex_unlock (db->mutex);
+}
+
 void
 babl_db_each (BablDb          *db,
               BablEachFunction each_fun,
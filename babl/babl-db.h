@@ -73,4 +73,12 @@ Babl *
 babl_db_find (BablDb     *db,
               const char *name);
 
+/* removes the items for which match returns non-zero from db, without
+ * freeing them
+ */
+void
+babl_db_remove_matching (BablDb           *db,
+                         BablEachFunction  match,
+                         void             *user_data);
+
 #endif
@@ -0,0 +1,184 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Background construction of path fishes. When enabled with the
+ * BABL_FISH_ASYNC environment variable, babl_fish () does not block on
+ * the path search for a new pair of formats; it registers a path fish that
+ * uses the reference code path and queues it here. A single worker thread,
+ * started on first use, runs the search for queued fishes one at a time
+ * and swaps in the optimized dispatch when done.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+static BablMutex *async_mutex;
+static BablCond  *async_work_cond;
+static BablCond  *async_idle_cond;
+static BablList  *async_queue;
+static int        async_queue_head;
+static int        async_busy;
+static int        async_quit;
+static int        async_started;
+#ifdef _WIN32
+static HANDLE     async_thread;
+#else
+static pthread_t  async_thread;
+#endif
+
+int
+babl_fish_async_enabled (void)
+{
+  static int enabled = -1;
+
+  if (enabled < 0)
+    {
+      const char *env = getenv ("BABL_FISH_ASYNC");
+      enabled = (env && env[0] != '\0' && strcmp (env, "0")) ? 1 : 0;
+    }
+  return enabled;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+async_main (LPVOID data)
+#else
+static void *
+async_main (void *data)
+#endif
+{
+  babl_mutex_lock (async_mutex);
+  for (;;)
+    {
+      Babl *fish;
+
+      while (!async_quit && async_queue_head >= babl_list_size (async_queue))
+        {
+          async_queue_head  = 0;
+          async_queue->count = 0;
+          babl_cond_broadcast (async_idle_cond);
+          babl_cond_wait (async_work_cond, async_mutex);
+        }
+
+      if (async_quit)
+        break;
+
+      fish = babl_list_get_n (async_queue, async_queue_head++);
+      async_busy = 1;
+      babl_mutex_unlock (async_mutex);
+
+      _babl_fish_path_upgrade (fish);
+
+      babl_mutex_lock (async_mutex);
+      async_busy = 0;
+    }
+  async_busy = 0;
+  babl_cond_broadcast (async_idle_cond);
+  babl_mutex_unlock (async_mutex);
+
+  return 0;
+}
+
+void
+babl_fish_async_queue (Babl *fish)
+{
+  babl_mutex_lock (async_mutex);
+  if (async_quit)
+    {
+      babl_mutex_unlock (async_mutex);
+      return;
+    }
+
+  if (!async_started)
+    {
+#ifdef _WIN32
+      async_thread = CreateThread (NULL, 0, async_main, NULL, 0, NULL);
+      async_started = async_thread != NULL;
+#else
+      async_started = pthread_create (&async_thread, NULL, async_main, NULL) == 0;
+#endif
+      if (!async_started)
+        {
+          /* without a worker, do the search on the calling thread */
+          babl_mutex_unlock (async_mutex);
+          _babl_fish_path_upgrade (fish);
+          return;
+        }
+    }
+
+  babl_list_insert_last (async_queue, fish);
+  babl_cond_signal (async_work_cond);
+  babl_mutex_unlock (async_mutex);
+}
+
+void
+babl_fish_async_wait (void)
+{
+  babl_mutex_lock (async_mutex);
+  while (async_started && !async_quit &&
+         (async_busy || async_queue_head < babl_list_size (async_queue)))
+    babl_cond_wait (async_idle_cond, async_mutex);
+  babl_mutex_unlock (async_mutex);
+}
+
+void
+babl_fish_async_init (void)
+{
+  async_mutex      = babl_mutex_new ();
+  async_work_cond  = babl_cond_new ();
+  async_idle_cond  = babl_cond_new ();
+  async_queue      = babl_list_init ();
+  async_queue_head = 0;
+  async_busy       = 0;
+  async_quit       = 0;
+  async_started    = 0;
+}
+
+/* lets a search in progress finish and drops the fishes still queued,
+ * those keep using the reference code path; called before the fish
+ * database is stored and torn down.
+ */
+void
+babl_fish_async_stop (void)
+{
+  babl_mutex_lock (async_mutex);
+  async_quit = 1;
+  babl_cond_broadcast (async_work_cond);
+  babl_mutex_unlock (async_mutex);
+
+  if (async_started)
+    {
+#ifdef _WIN32
+      WaitForSingleObject (async_thread, INFINITE);
+      CloseHandle (async_thread);
+#else
+      pthread_join (async_thread, NULL);
+#endif
+      async_started = 0;
+    }
+}
+
+void
+babl_fish_async_destroy (void)
+{
+  babl_free (async_queue);
+  async_queue = NULL;
+  babl_cond_destroy (async_work_cond);
+  babl_cond_destroy (async_idle_cond);
+  babl_mutex_destroy (async_mutex);
+}
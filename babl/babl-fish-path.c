@@ -28,18 +28,37 @@
 
 #define BABL_TEST_ITER             16
 
+/* number of complete paths, in order of estimated cost, that get their
+ * actual cost and error measured during a path search
+ */
+#define BABL_PATH_CANDIDATES       4
+
 #ifndef MIN
 #define MIN(a, b) (((a) > (b)) ? (b) : (a))
 #endif
+#ifndef MAX
+#define MAX(a, b) (((a) < (b)) ? (b) : (a))
+#endif
 
 #define MAX_BUFFER_SIZE            512
 #define ITERATIONS                 4
 
+/* requests smaller than this number of pixels are not worth waking up the
+ * worker pool for in babl_process_rows_parallel
+ */
+#define PARALLEL_MIN_PIXELS        (128 * MAX_BUFFER_SIZE)
+/* upper bound on the size of the chunks handed to worker threads, in
+ * multiples of the intermediate buffers of process_conversion_path
+ */
+#define PARALLEL_MAX_CHUNK_BUFFERS 16
+
 int   babl_in_fish_path = 0;
 
 typedef struct _FishPathInstrumentation
 {
   const Babl   *fmt_rgba_double;
+  const Babl   *fmt_source;
+  const Babl   *fmt_destination;
   int     num_test_pixels;
   void   *source;
   void   *destination;
@@ -57,12 +76,15 @@ typedef struct PathContext {
   Babl     *fish_path;
   Babl     *to_format;
   BablList *current_path;
+  /* the source and destination do not change during a search, the
+   * reference measurements are made once for the first candidate path
+   * and shared by all later candidates.
+   */
+  FishPathInstrumentation fpi;
 } PathContext;
 
 static void
-init_path_instrumentation (FishPathInstrumentation *fpi,
-                           Babl                    *fmt_source,
-                           Babl                    *fmt_destination);
+init_path_instrumentation (FishPathInstrumentation *fpi);
 
 static void
 destroy_path_instrumentation (FishPathInstrumentation *fpi);
@@ -81,12 +103,19 @@ process_conversion_path (BablList   *path,
                          int         source_bpp,
                          void       *destination_buffer,
                          int         dest_bpp,
-                         long        n);
+                         long        n,
+                         const Babl *timed_fish);
+
+static void
+babl_fish_path_process (const Babl *babl,
+                        const char *source,
+                        char       *destination,
+                        long        n,
+                        void       *data);
 
 static void
 get_conversion_path (PathContext *pc,
-                     Babl        *current_format,
-                     int          current_length,
+                     Babl        *source,
                      int          max_length,
                      double       legal_error);
 
@@ -195,58 +224,183 @@ bad_idea (const Babl *from, const Babl *to, const Babl *format)
  * the shortest path in a graph where formats are the vertices
  * and conversions are the edges. However, there is an additional
  * constraint to the shortest path, that limits conversion error
- * introduced by such a path to be less than BABL_TOLERANCE. This
- * prohibits usage of any reasonable shortest path construction
- * algorithm such as Dijkstra's algorithm. The shortest path is
- * constructed by enumerating all available paths that are less
- * than BABL_PATH_LENGTH long, computing their costs and
- * conversion errors and backtracking. The backtracking is
- * implemented by recursive function get_conversion_path ().
+ * introduced by such a path to be less than BABL_TOLERANCE, and
+ * the cost and error of a path are only known accurately after
+ * measuring the path as a whole.
+ *
+ * Partial paths are explored best-first, ordered by a cost estimate
+ * accumulated from the measured costs of the individual conversions;
+ * partial paths whose estimated error already exceeds the tolerance
+ * are dropped, as are paths whose estimated cost exceeds that of the
+ * BABL_PATH_CANDIDATES cheapest complete paths found so far. The
+ * complete paths are popped in order of estimated cost, and only those
+ * BABL_PATH_CANDIDATES first candidates get their actual cost and error
+ * measured by get_path_instrumentation ().
  */
 
+typedef struct PathNode
+{
+  double  cost;   /* estimated cost,  sum of conversion cost * 10 + 1 */
+  double  error;  /* estimated error, product of (1.0 + conversion error) */
+  int     length;
+  Babl   *conversions[BABL_HARD_MAX_PATH_LENGTH];
+} PathNode;
+
+typedef struct PathQueue
+{
+  PathNode *nodes;
+  int       count;
+  int       size;
+} PathQueue;
+
+static void
+path_queue_push (PathQueue      *queue,
+                 const PathNode *node)
+{
+  int i;
+
+  if (queue->count == queue->size)
+    {
+      queue->size  = queue->size ? queue->size * 2 : 64;
+      queue->nodes = babl_realloc (queue->nodes,
+                                   sizeof (PathNode) * queue->size);
+    }
+
+  /* sift up */
+  for (i = queue->count++; i > 0; i = (i - 1) / 2)
+    {
+      int parent = (i - 1) / 2;
+      if (queue->nodes[parent].cost <= node->cost)
+        break;
+      queue->nodes[i] = queue->nodes[parent];
+    }
+  queue->nodes[i] = *node;
+}
+
+static void
+path_queue_pop (PathQueue *queue,
+                PathNode  *node)
+{
+  PathNode *last;
+  int       i = 0;
+
+  *node = queue->nodes[0];
+  last  = &queue->nodes[--queue->count];
+
+  /* sift down */
+  for (;;)
+    {
+      int child = i * 2 + 1;
+      if (child >= queue->count)
+        break;
+      if (child + 1 < queue->count &&
+          queue->nodes[child + 1].cost < queue->nodes[child].cost)
+        child++;
+      if (last->cost <= queue->nodes[child].cost)
+        break;
+      queue->nodes[i] = queue->nodes[child];
+      i = child;
+    }
+  queue->nodes[i] = *last;
+}
+
+static const Babl *
+path_node_format (const PathNode *node,
+                  const Babl     *source)
+{
+  if (node->length == 0)
+    return source;
+  return node->conversions[node->length - 1]->conversion.destination;
+}
+
+static int
+path_node_visits (const PathNode *node,
+                  const Babl     *source,
+                  const Babl     *format)
+{
+  int i;
+
+  if (format == source)
+    return 1;
+  for (i = 0; i < node->length; i++)
+    if (node->conversions[i]->conversion.destination == format)
+      return 1;
+  return 0;
+}
+
+/* keeps the estimated costs of the BABL_PATH_CANDIDATES cheapest complete
+ * paths seen, in increasing order, returns the resulting bound.
+ */
+static double
+path_bound_add (double *best,
+                int    *n_best,
+                double  cost)
+{
+  int i;
+
+  if (*n_best < BABL_PATH_CANDIDATES)
+    (*n_best)++;
+  else if (cost >= best[BABL_PATH_CANDIDATES - 1])
+    return best[BABL_PATH_CANDIDATES - 1];
+
+  for (i = *n_best - 1; i > 0 && best[i - 1] > cost; i--)
+    best[i] = best[i - 1];
+  best[i] = cost;
+
+  if (*n_best < BABL_PATH_CANDIDATES)
+    return BABL_MAX_COST_VALUE * 1000.0;
+  return best[BABL_PATH_CANDIDATES - 1];
+}
+
 static void
 get_conversion_path (PathContext *pc,
-                     Babl        *current_format,
-                     int          current_length,
+                     Babl        *source,
                      int          max_length,
                      double       legal_error)
 {
-  if (current_length > max_length)
+  PathQueue queue  = {NULL, 0, 0};
+  PathNode  node;
+  double    best[BABL_PATH_CANDIDATES];
+  int       n_best = 0;
+  double    bound  = BABL_MAX_COST_VALUE * 1000.0;
+  int       timed  = 0;
+
+  node.cost   = 0.0;
+  node.error  = 1.0;
+  node.length = 0;
+  path_queue_push (&queue, &node);
+
+  while (queue.count && timed < BABL_PATH_CANDIDATES)
     {
-      /* We have reached the maximum recursion
-       * depth, let's bail out */
-      return;
-    }
-  else if ((current_length > 0) && (current_format == pc->to_format))
-    {
-       /* We have found a candidate path, let's
-        * see about it's properties */
-      double path_cost  = 0.0;
-      double ref_cost   = 0.0;
-      double path_error = 1.0;
-#if 1
-      int    i;
-      for (i = 0; i < babl_list_size (pc->current_path); i++)
-        {
-          path_error *= (1.0 + babl_conversion_error ((BablConversion *) pc->current_path->items[i]));
-        }
+      const Babl *current_format;
+      BablList   *list;
+      int         i;
 
-      if (path_error - 1.0 <= legal_error )
-                /* check this before the more accurate measurement of error -
-                   to bail earlier, this also leads to a stricter
-                   discarding of bad fast paths  */
-#endif
-        {
-          FishPathInstrumentation fpi;
-          memset (&fpi, 0, sizeof (fpi));
+      path_queue_pop (&queue, &node);
 
-          fpi.source = (Babl*) babl_list_get_first (pc->current_path)->conversion.source;
-          fpi.destination = pc->to_format;
+      if (node.cost > bound)
+        continue;
 
-          get_path_instrumentation (&fpi, pc->current_path, &path_cost, &ref_cost, &path_error);
-          if(debug_conversions && current_length == 1)
-            fprintf (stderr, "%s  error:%f cost:%f  \n",
-                 babl_get_name (pc->current_path->items[0]), path_error, path_cost);
+      current_format = path_node_format (&node, source);
+
+      if (node.length > 0 && current_format == pc->to_format)
+        {
+          /* We have found a candidate path, let's
+           * see about it's properties */
+          double path_cost  = 0.0;
+          double ref_cost   = 0.0;
+          double path_error = 1.0;
+
+          pc->current_path->count = 0;
+          for (i = 0; i < node.length; i++)
+            babl_list_insert_last (pc->current_path, node.conversions[i]);
+
+          get_path_instrumentation (&pc->fpi, pc->current_path, &path_cost, &ref_cost, &path_error);
+          timed++;
+          if(debug_conversions)
+            fprintf (stderr, "%s (%i steps) estimate:%f error:%f cost:%f  \n",
+                 babl_get_name (pc->current_path->items[0]), node.length,
+                 node.cost, path_error, path_cost);
 
           if ((path_cost < ref_cost) && /* do not use paths that took longer to compute than reference */
               (path_cost < pc->fish_path->fish_path.cost) && // best thus far
@@ -260,42 +414,54 @@ get_conversion_path (PathContext *pc,
               babl_list_copy (pc->current_path,
                               pc->fish_path->fish_path.conversion_list);
             }
-
-          destroy_path_instrumentation (&fpi);
+          continue;
         }
-    }
-  else
-    {
-      /*
-       * we have to search deeper...
-       */
-      BablList *list;
-      int i;
 
-      list = current_format->format.from_list;
-      if (list)
-        {
-          /* Mark the current format in conversion path as visited */
-          current_format->format.visited = 1;
+      if (node.length >= max_length)
+        continue;
 
-          /* Iterate through unvisited formats from the current format ...*/
-          for (i = 0; i < babl_list_size (list); i++)
-            {
-              Babl *next_conversion = BABL (list->items[i]);
-              Babl *next_format = BABL (next_conversion->conversion.destination);
-              if (!next_format->format.visited && !bad_idea (current_format, pc->to_format, next_format))
-                {
-                  /* next_format is not in the current path, we can pay a visit */
-                  babl_list_insert_last (pc->current_path, next_conversion);
-                  get_conversion_path (pc, next_format, current_length + 1, max_length, legal_error);
-                  babl_list_remove_last (pc->current_path);
-                }
-            }
+      list = current_format->format.from_list;
+      if (!list)
+        continue;
 
-          /* Remove the current format from current path */
-          current_format->format.visited = 0;
+      for (i = 0; i < babl_list_size (list); i++)
+        {
+          Babl       *next_conversion = BABL (list->items[i]);
+          const Babl *next_format = next_conversion->conversion.destination;
+          PathNode    child;
+
+          if (path_node_visits (&node, source, next_format) ||
+              bad_idea (current_format, pc->to_format, next_format))
+            continue;
+
+          /* the estimated error only grows along a path, check this
+           * before the more accurate measurement of error - to bail
+           * earlier, this also leads to a stricter discarding of bad
+           * fast paths */
+          child.error = node.error *
+            (1.0 + babl_conversion_error ((BablConversion *) next_conversion));
+          if (child.error - 1.0 > legal_error)
+            continue;
+
+          child.cost = node.cost +
+            babl_conversion_cost ((BablConversion *) next_conversion) * 10 + 1;
+          if (child.cost > bound)
+            continue;
+
+          if (next_format == pc->to_format)
+            bound = path_bound_add (best, &n_best, child.cost);
+          else if (node.length + 1 >= max_length)
+            continue;
+
+          memcpy (child.conversions, node.conversions,
+                  sizeof (Babl *) * node.length);
+          child.conversions[node.length] = next_conversion;
+          child.length = node.length + 1;
+          path_queue_push (&queue, &child);
         }
-   }
+    }
+
+  babl_free (queue.nodes);
 }
 
 char *
@@ -310,6 +476,36 @@ _babl_fish_create_name (char       *buf,
   return buf;
 }
 
+char *
+_babl_fish_create_fast_name (char       *buf,
+                             const Babl *source,
+                             const Babl *destination,
+                             double      tolerance)
+{
+  uint64_t bits;
+
+  /* the bits of the tolerance keep the name exact and are cheaper to
+   * format than the value
+   */
+  memcpy (&bits, &tolerance, sizeof (bits));
+  snprintf (buf, BABL_MAX_NAME_LEN, "%s %p %p ~%llx", "",
+            source, destination, (unsigned long long) bits);
+  return buf;
+}
+
+/* fishes handed out by babl_fast_fish () are kept apart from the fishes of
+ * babl_fish (), a pair of formats has one for each tolerance asked for.
+ */
+static BablDb *fast_fish_db = NULL;
+
+BablDb *
+babl_fast_fish_db (void)
+{
+  if (!fast_fish_db)
+    fast_fish_db = babl_db_init ();
+  return fast_fish_db;
+}
+
 int
 _babl_fish_path_destroy (void *data);
 
@@ -500,70 +696,44 @@ _babl_fish_missing_fast_path_warning (const Babl *source,
 }
 
 
-static Babl *
-babl_fish_path2 (const Babl *source,
-                 const Babl *destination,
-                 double      tolerance)
+/* registers the conversions needed for paths between formats in the spaces
+ * of source and destination, the first time these spaces are seen - marking
+ * them prepared; must be called with babl_format_mutex held.
+ */
+void
+_babl_fish_prepare_spaces (const Babl *source,
+                           const Babl *destination)
 {
-  Babl *babl = NULL;
   const Babl *sRGB = babl_space ("sRGB");
-  char name[BABL_MAX_NAME_LEN];
-  int is_fast = 0;
-
-  _babl_fish_create_name (name, source, destination, 1);
-  babl_mutex_lock (babl_format_mutex);
-  babl = babl_db_exist_by_name (babl_fish_db (), name);
-
-  if (tolerance <= 0.0)
-  {
-    is_fast = 0;
-    tolerance = _babl_legal_error ();
-  }
-  else
-    is_fast = 1;
-
-  if (!is_fast)
-  {
-  if (babl)
-    {
-      /* There is an instance already registered by the required name,
-       * returning the preexistent one instead.
-       */
-      babl_mutex_unlock (babl_format_mutex);
-      return babl;
-    }
-  }
 
   if ((source->format.space != sRGB) ||
       (destination->format.space != sRGB))
   {
-    static const Babl *run_once[512]={NULL};
-    int i;
+    Babl *source_space      = (Babl *) source->format.space;
+    Babl *destination_space = (Babl *) destination->format.space;
     int done = 0;
-    for (i = 0; run_once[i]; i++)
-    {
-      if (run_once[i] == source->format.space)
-        done |= 1;
-      else if (run_once[i] == destination->format.space)
-        done |= 2;
-    }
 
-    /* source space not in initialization array */
-    if ((done & 1) == 0 && (source->format.space != sRGB))
+    if (source_space->space.prepared)
+      done |= 1;
+    if (destination_space->space.prepared)
+      done |= 2;
+
+    /* source space not prepared yet */
+    if ((done & 1) == 0 && (source_space != sRGB))
     {
-      run_once[i++] = source->format.space;
-      babl_conversion_class_for_each (alias_conversion, (void*)source->format.space);
+      source_space->space.prepared = 1;
+      babl_conversion_class_for_each (alias_conversion, source_space);
 
-      _babl_space_add_universal_rgb (source->format.space);
+      _babl_space_add_universal_rgb (source_space);
     }
 
-    /* destination space not in initialization array */
-    if ((done & 2) == 0 && (destination->format.space != source->format.space) && (destination->format.space != sRGB))
+    /* destination space not prepared yet */
+    if ((done & 2) == 0 && (destination_space != source_space) && (destination_space != sRGB))
     {
-      run_once[i++] = destination->format.space;
-      babl_conversion_class_for_each (alias_conversion, (void*)destination->format.space);
+      destination_space->space.prepared = 1;
+      babl_conversion_class_for_each (alias_conversion, destination_space);
 
-      _babl_space_add_universal_rgb (destination->format.space);
+      _babl_space_add_universal_rgb (destination_space);
     }
 
     if (!done && 0)
@@ -572,36 +742,37 @@ babl_fish_path2 (const Babl *source,
     }
 
   }
+}
 
-  babl = babl_calloc (1, sizeof (BablFishPath) +
-                      strlen (name) + 1);
-  babl_set_destructor (babl, _babl_fish_path_destroy);
+/* fills in the conversion list, cost and error of babl with the best path
+ * found, must be called with babl_format_mutex held.
+ */
+static void
+fish_path_search (Babl   *babl,
+                  double  tolerance)
+{
+  const Babl *source      = babl->fish.source;
+  const Babl *destination = babl->fish.destination;
 
-  babl->class_type                = BABL_FISH_PATH;
-  babl->instance.id               = babl_fish_get_id (source, destination);
-  babl->instance.name             = ((char *) babl) + sizeof (BablFishPath);
-  strcpy (babl->instance.name, name);
-  babl->fish.source               = source;
-  babl->fish.destination          = destination;
-  babl->fish.pixels               = 0;
-  babl->fish.error                = BABL_MAX_COST_VALUE;
-  babl->fish_path.cost            = BABL_MAX_COST_VALUE;
-  babl->fish_path.conversion_list = babl_list_init_with_size (BABL_HARD_MAX_PATH_LENGTH);
+  _babl_fish_prepare_spaces (source, destination);
 
   {
     PathContext pc;
     pc.current_path = babl_list_init_with_size (BABL_HARD_MAX_PATH_LENGTH);
     pc.fish_path = babl;
     pc.to_format = (Babl *) destination;
-
-    /* we hold a global lock whilerunning get_conversion_path since
-     * it depends on keeping the various format.visited members in
-     * a consistent state, this code path is not performance critical
-     * since created fishes are cached.
+    memset (&pc.fpi, 0, sizeof (pc.fpi));
+    pc.fpi.fmt_source = source;
+    pc.fpi.fmt_destination = destination;
+
+    /* the search keeps its state in the queue of get_conversion_path,
+     * babl_format_mutex held by the caller keeps the conversions of the
+     * formats from changing under it; this code path is not performance
+     * critical since created fishes are cached.
      */
     babl_in_fish_path++;
 
-    get_conversion_path (&pc, (Babl *) source, 0, max_path_length (), tolerance);
+    get_conversion_path (&pc, (Babl *) source, max_path_length (), tolerance);
 
     /* attempt with path length + 3 */
     if (babl->fish_path.conversion_list->count == 0)
@@ -610,7 +781,7 @@ babl_fish_path2 (const Babl *source,
       if  (max_length > BABL_HARD_MAX_PATH_LENGTH)
         max_length = BABL_HARD_MAX_PATH_LENGTH;
 
-      get_conversion_path (&pc, (Babl *) source, 0, max_length, tolerance);
+      get_conversion_path (&pc, (Babl *) source, max_length, tolerance);
       if (!babl->fish_path.conversion_list->count)
       {
          static int show_missing = -1;
@@ -629,8 +800,170 @@ babl_fish_path2 (const Babl *source,
     }
 
     babl_in_fish_path--;
+    destroy_path_instrumentation (&pc.fpi);
     babl_free (pc.current_path);
   }
+}
+
+static Babl *
+fish_path_new (const Babl *source,
+               const Babl *destination,
+               const char *name)
+{
+  Babl *babl = babl_calloc (1, sizeof (BablFishPath) +
+                            strlen (name) + 1);
+  babl_set_destructor (babl, _babl_fish_path_destroy);
+
+  babl->class_type                = BABL_FISH_PATH;
+  babl->instance.id               = babl_fish_get_id (source, destination);
+  babl->instance.name             = ((char *) babl) + sizeof (BablFishPath);
+  strcpy (babl->instance.name, name);
+  babl->fish.source               = source;
+  babl->fish.destination          = destination;
+  babl->fish.pixels               = 0;
+  babl->fish.error                = BABL_MAX_COST_VALUE;
+  babl->fish_path.cost            = BABL_MAX_COST_VALUE;
+  babl->fish_path.conversion_list = babl_list_init_with_size (BABL_HARD_MAX_PATH_LENGTH);
+  return babl;
+}
+
+/* marks a pair of formats for which no path within tolerance exists */
+Babl *
+_babl_fish_missing_new (const Babl *source,
+                        const Babl *destination,
+                        double      tolerance)
+{
+  const char *name = "X"; /* name does not matter */
+  Babl       *babl = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
+
+  babl->class_type       = BABL_FISH;
+  babl->instance.id      = babl_fish_get_id (source, destination);
+  babl->instance.name    = ((char *) babl) + sizeof (BablFish);
+  strcpy (babl->instance.name, name);
+  babl->fish.source      = source;
+  babl->fish.destination = destination;
+  babl->fish.tolerance   = tolerance;
+  return babl;
+}
+
+typedef struct
+{
+  const Babl *source;
+  const Babl *destination;
+  double      tolerance;
+  Babl       *fish;
+} FindFastFish;
+
+static int
+find_fast_fish (Babl *item,
+                void *data)
+{
+  FindFastFish *ffish = data;
+
+  if (item->fish.source == ffish->source &&
+      item->fish.destination == ffish->destination &&
+      item->fish.tolerance == ffish->tolerance)
+    {
+      ffish->fish = item;
+      return 1;
+    }
+  return 0;
+}
+
+/* looks up a fast fish by its id rather than its name, which spares
+ * formatting the name for every lookup.
+ */
+static Babl *
+fast_fish_find (BablDb     *db,
+                const Babl *source,
+                const Babl *destination,
+                double      tolerance)
+{
+  FindFastFish ffish = {source, destination, tolerance, NULL};
+
+  babl_hash_table_find (db->id_hash,
+                        babl_hash_by_int (db->id_hash,
+                                          babl_fish_get_id (source, destination)),
+                        find_fast_fish, &ffish);
+  return ffish.fish;
+}
+
+static Babl *
+babl_fast_fish_path (const Babl *source,
+                     const Babl *destination,
+                     double      tolerance)
+{
+  BablDb *db = babl_fast_fish_db ();
+  Babl   *babl;
+
+  /* fast fishes are asked for per tile or row, only take the lock of
+   * their database for the lookup, so it does not wait on path searches
+   * for other pairs of formats.
+   */
+  babl_mutex_lock (db->mutex);
+  babl = fast_fish_find (db, source, destination, tolerance);
+  babl_mutex_unlock (db->mutex);
+
+  if (!babl)
+    {
+      babl_mutex_lock (babl_format_mutex);
+      babl = fast_fish_find (db, source, destination, tolerance);
+      if (!babl)
+        babl = babl_fish_cache_materialize (source, destination, tolerance);
+      if (!babl)
+        {
+          char name[BABL_MAX_NAME_LEN];
+
+          _babl_fish_create_fast_name (name, source, destination, tolerance);
+          babl = fish_path_new (source, destination, name);
+          babl->fish.tolerance = tolerance;
+          fish_path_search (babl, tolerance);
+
+          if (babl_list_size (babl->fish_path.conversion_list) == 0)
+            {
+              babl_free (babl);
+              babl = _babl_fish_missing_new (source, destination, tolerance);
+            }
+          else
+            {
+              _babl_fish_prepare_bpp (babl);
+              _babl_fish_rig_dispatch (babl);
+            }
+          babl_db_insert (db, babl);
+        }
+      babl_mutex_unlock (babl_format_mutex);
+    }
+
+  if (babl->class_type == BABL_FISH)
+    return NULL;
+  return babl;
+}
+
+static Babl *
+babl_fish_path2 (const Babl *source,
+                 const Babl *destination,
+                 double      tolerance)
+{
+  Babl *babl = NULL;
+  char name[BABL_MAX_NAME_LEN];
+
+  if (tolerance > 0.0)
+    return babl_fast_fish_path (source, destination, tolerance);
+
+  _babl_fish_create_name (name, source, destination, 1);
+  babl_mutex_lock (babl_format_mutex);
+  babl = babl_db_exist_by_name (babl_fish_db (), name);
+  if (babl)
+    {
+      /* There is an instance already registered by the required name,
+       * returning the preexistent one instead.
+       */
+      babl_mutex_unlock (babl_format_mutex);
+      return babl;
+    }
+
+  babl = fish_path_new (source, destination, name);
+  fish_path_search (babl, _babl_legal_error ());
 
   if (babl_list_size (babl->fish_path.conversion_list) == 0)
     {
@@ -645,14 +978,85 @@ babl_fish_path2 (const Babl *source,
   /* Since there is not an already registered instance by the required
    * name, inserting newly created class into database.
    */
-  if (!is_fast)
-  {
-    babl_db_insert (babl_fish_db (), babl);
-  }
+  babl_db_insert (babl_fish_db (), babl);
+  babl_mutex_unlock (babl_format_mutex);
+  return babl;
+}
+
+/* processes a fish of babl_fish_path_async () with its reference fish,
+ * until a path has been found for it.
+ */
+static void
+fish_path_pending_process (const Babl *babl,
+                           const char *source,
+                           char       *destination,
+                           long        n,
+                           void       *data)
+{
+  babl_fish_reference_process (babl->fish_path.reference,
+                               source, destination, n, data);
+}
+
+Babl *
+babl_fish_path_async (const Babl *source,
+                      const Babl *destination)
+{
+  Babl *babl = NULL;
+  char name[BABL_MAX_NAME_LEN];
+
+  _babl_fish_create_name (name, source, destination, 1);
+  babl_mutex_lock (babl_format_mutex);
+  babl = babl_db_exist_by_name (babl_fish_db (), name);
+  if (babl)
+    {
+      babl_mutex_unlock (babl_format_mutex);
+      return babl;
+    }
+
+  /* the path fish is registered right away with an empty conversion
+   * list, and processes through the reference code path until
+   * _babl_fish_path_upgrade has run for it on the background thread.
+   */
+  babl = fish_path_new (source, destination, name);
+  babl->fish.error    = 0.0;
+  babl->fish.data     = (void*)&(babl->fish.data);
+  babl->fish.dispatch = fish_path_pending_process;
+  babl->fish_path.reference = babl_fish_reference (source, destination);
+  babl_db_insert (babl_fish_db (), babl);
   babl_mutex_unlock (babl_format_mutex);
+
+  babl_fish_async_queue (babl);
   return babl;
 }
 
+void
+_babl_fish_path_upgrade (Babl *babl)
+{
+  void (*dispatch) (const Babl *babl, const char *src, char *dst,
+                    long n, void *data) = babl_fish_path_process;
+
+  babl_mutex_lock (babl_format_mutex);
+  fish_path_search (babl, _babl_legal_error ());
+
+  if (babl_list_size (babl->fish_path.conversion_list) == 0)
+    {
+      /* no path within tolerance, keep using the reference code path */
+      babl->fish.error = 0.0;
+      babl_mutex_unlock (babl_format_mutex);
+      return;
+    }
+
+  _babl_fish_prepare_bpp (babl);
+
+  /* fish.data is not touched, babl_fish_path_process ignores it; this
+   * lets threads already using the fish observe a single pointer change,
+   * which is also why the single conversion short-circuit of
+   * _babl_fish_rig_dispatch is not used here.
+   */
+  __atomic_store_n (&babl->fish.dispatch, dispatch, __ATOMIC_RELEASE);
+  babl_mutex_unlock (babl_format_mutex);
+}
+
 const Babl * 
 babl_fast_fish (const void *source_format,
                 const void *destination_format,
@@ -667,7 +1071,7 @@ babl_fast_fish (const void *source_format,
     tolerance=0.0000000001;
   else if (!strcmp (performance, "precise"))
     tolerance=0.00001;
-  if (!strcmp (performance, "fast"))
+  else if (!strcmp (performance, "fast"))
     tolerance=0.001;
   else if (!strcmp (performance, "glitch"))
     tolerance=0.01;
@@ -698,7 +1102,8 @@ babl_fish_path_process (const Babl *babl,
                            babl->fish_path.source_bpp,
                            destination,
                            babl->fish_path.dest_bpp,
-                           n);
+                           n,
+                           babl_fish_stats_level > 1 ? babl : NULL);
 }
 
 static void
@@ -778,9 +1183,17 @@ _babl_process (const Babl *cbabl,
                long        n)
 {
   Babl *babl = (void*)cbabl;
-  babl->fish.dispatch (babl, source, destination, n, *babl->fish.data);
-  if (_babl_instrument)
-    babl->fish.pixels += n;
+
+  if (babl_fish_stats_level)
+    {
+      int64_t start = babl_nanoseconds ();
+      babl->fish.dispatch (babl, source, destination, n, *babl->fish.data);
+      _babl_fish_stats_add (babl, n, babl_nanoseconds () - start);
+    }
+  else
+    {
+      babl->fish.dispatch (babl, source, destination, n, *babl->fish.data);
+    }
   return n;
 }
 
@@ -802,9 +1215,10 @@ babl_process_rows (const Babl *fish,
                    long        n,
                    int         rows)
 {
-  Babl          *babl = (Babl*)fish;
-  const uint8_t *src  = source;
-  uint8_t       *dst  = dest;
+  Babl          *babl  = (Babl*)fish;
+  const uint8_t *src   = source;
+  uint8_t       *dst   = dest;
+  int64_t        start = 0;
   int            row;
 
   babl_assert (babl && BABL_IS_BABL (babl) && source && dest);
@@ -812,8 +1226,8 @@ babl_process_rows (const Babl *fish,
   if (n <= 0)
     return 0;
 
-  if (_babl_instrument)
-    babl->fish.pixels += n * rows;
+  if (babl_fish_stats_level)
+    start = babl_nanoseconds ();
   for (row = 0; row < rows; row++)
     {
       babl->fish.dispatch (babl, (void*)src, (void*)dst, n, *babl->fish.data);
@@ -821,9 +1235,133 @@ babl_process_rows (const Babl *fish,
       src += source_stride;
       dst += dest_stride;
     }
+  if (babl_fish_stats_level)
+    _babl_fish_stats_add (babl, n * rows, babl_nanoseconds () - start);
   return n * rows;
 }
 
+typedef struct ParallelRowsContext
+{
+  Babl          *babl;
+  const uint8_t *source;
+  int            source_stride;
+  int            source_bpp;
+  uint8_t       *dest;
+  int            dest_stride;
+  int            dest_bpp;
+  long           n;
+  int            rows;
+  int            chunks_per_row; /* > 1 when single rows are split */
+  long           chunk_pixels;
+  int            rows_per_chunk;
+} ParallelRowsContext;
+
+static void
+process_rows_chunk (int   chunk,
+                    void *data)
+{
+  ParallelRowsContext *prc  = data;
+  Babl                *babl = prc->babl;
+
+  if (prc->chunks_per_row > 1)
+    {
+      long row    = chunk / prc->chunks_per_row;
+      long offset = (chunk % prc->chunks_per_row) * prc->chunk_pixels;
+      long count  = MIN (prc->n - offset, prc->chunk_pixels);
+
+      babl->fish.dispatch (babl,
+                           (void*)(prc->source + row * prc->source_stride +
+                                   offset * prc->source_bpp),
+                           (void*)(prc->dest + row * prc->dest_stride +
+                                   offset * prc->dest_bpp),
+                           count, *babl->fish.data);
+    }
+  else
+    {
+      long row  = (long) chunk * prc->rows_per_chunk;
+      long last = MIN (row + prc->rows_per_chunk, prc->rows);
+
+      for (; row < last; row++)
+        babl->fish.dispatch (babl,
+                             (void*)(prc->source + row * prc->source_stride),
+                             (void*)(prc->dest + row * prc->dest_stride),
+                             prc->n, *babl->fish.data);
+    }
+}
+
+long
+babl_process_rows_parallel (const Babl *fish,
+                            const void *source,
+                            int         source_stride,
+                            void       *dest,
+                            int         dest_stride,
+                            long        n,
+                            int         rows)
+{
+  Babl                *babl      = (Babl*)fish;
+  int                  n_threads = babl_parallel_get_n_threads ();
+  long                 pixels    = n * rows;
+  long                 chunk_pixels;
+  int                  n_chunks;
+  ParallelRowsContext  prc;
+
+  babl_assert (babl && BABL_IS_BABL (babl) && source && dest);
+
+  if (n <= 0 || rows <= 0)
+    return 0;
+
+  if (n_threads <= 1 || pixels < PARALLEL_MIN_PIXELS)
+    return babl_process_rows (fish, source, source_stride,
+                              dest, dest_stride, n, rows);
+
+  /* aim for a few chunks per thread to even out the load, keeping the
+   * chunks whole multiples of the intermediate buffers used by path fishes
+   */
+  chunk_pixels = pixels / (n_threads * 4);
+  chunk_pixels -= chunk_pixels % MAX_BUFFER_SIZE;
+  if (chunk_pixels < MAX_BUFFER_SIZE)
+    chunk_pixels = MAX_BUFFER_SIZE;
+  else if (chunk_pixels > PARALLEL_MAX_CHUNK_BUFFERS * MAX_BUFFER_SIZE)
+    chunk_pixels = PARALLEL_MAX_CHUNK_BUFFERS * MAX_BUFFER_SIZE;
+
+  prc.babl          = babl;
+  prc.source        = source;
+  prc.source_stride = source_stride;
+  prc.source_bpp    = babl_format_get_bytes_per_pixel (babl->fish.source);
+  prc.dest          = dest;
+  prc.dest_stride   = dest_stride;
+  prc.dest_bpp      = babl_format_get_bytes_per_pixel (babl->fish.destination);
+  prc.n             = n;
+  prc.rows          = rows;
+  prc.chunk_pixels  = chunk_pixels;
+
+  if (n > chunk_pixels && prc.source_bpp && prc.dest_bpp)
+    {
+      prc.chunks_per_row = (n + chunk_pixels - 1) / chunk_pixels;
+      prc.rows_per_chunk = 1;
+      n_chunks           = prc.chunks_per_row * rows;
+    }
+  else
+    {
+      prc.chunks_per_row = 1;
+      prc.rows_per_chunk = MAX (1, chunk_pixels / n);
+      n_chunks           = (rows + prc.rows_per_chunk - 1) / prc.rows_per_chunk;
+    }
+
+  if (babl_fish_stats_level)
+    {
+      int64_t start = babl_nanoseconds ();
+      babl_parallel_distribute (n_chunks, process_rows_chunk, &prc);
+      _babl_fish_stats_add (babl, pixels, babl_nanoseconds () - start);
+    }
+  else
+    {
+      babl_parallel_distribute (n_chunks, process_rows_chunk, &prc);
+    }
+
+  return pixels;
+}
+
 #include <stdint.h>
 
 #define BABL_ALIGN 16
@@ -834,22 +1372,47 @@ static void inline *align_16 (unsigned char *ret)
   return ret;
 }
 
+/* runs one conversion of a path, timing it for the statistics of
+ * timed_fish when that is not NULL
+ */
+static inline void
+process_step (const Babl *timed_fish,
+              int         step,
+              const Babl *conversion,
+              const void *source,
+              void       *destination,
+              long        n)
+{
+  if (timed_fish)
+    {
+      int64_t start = babl_nanoseconds ();
+      babl_conversion_process (conversion, source, destination, n);
+      _babl_fish_stats_add_step (timed_fish, step, babl_nanoseconds () - start);
+    }
+  else
+    {
+      babl_conversion_process (conversion, source, destination, n);
+    }
+}
+
 static inline void
 process_conversion_path (BablList   *path,
                          const void *source_buffer,
                          int         source_bpp,
                          void       *destination_buffer,
                          int         dest_bpp,
-                         long        n)
+                         long        n,
+                         const Babl *timed_fish)
 {
   int conversions = babl_list_size (path);
 
   if (conversions == 1)
     {
-      babl_conversion_process (BABL (babl_list_get_first (path)),
-                               source_buffer,
-                               destination_buffer,
-                               n);
+      process_step (timed_fish, 0,
+                    BABL (babl_list_get_first (path)),
+                    source_buffer,
+                    destination_buffer,
+                    n);
     }
   else
     {
@@ -875,20 +1438,22 @@ process_conversion_path (BablList   *path,
           void *aux2_buffer = temp_buffer2;
 
           /* The first conversion goes from source_buffer to aux1_buffer */
-          babl_conversion_process (babl_list_get_first (path),
-                                   (void*)(((unsigned char*)source_buffer) +
-                                                          (j * source_bpp)),
-                                   aux1_buffer,
-                                   c);
+          process_step (timed_fish, 0,
+                        babl_list_get_first (path),
+                        (void*)(((unsigned char*)source_buffer) +
+                                               (j * source_bpp)),
+                        aux1_buffer,
+                        c);
 
           /* Process, if any, conversions between the first and the last
            * conversion in the path, in a loop */
           for (i = 1; i < conversions - 1; i++)
             {
-              babl_conversion_process (path->items[i],
-                                       aux1_buffer,
-                                       aux2_buffer,
-                                       c);
+              process_step (timed_fish, i,
+                            path->items[i],
+                            aux1_buffer,
+                            aux2_buffer,
+                            c);
               {
                 /* Swap the auxiliary buffers */
                 void *swap_buffer = aux1_buffer;
@@ -898,24 +1463,25 @@ process_conversion_path (BablList   *path,
             }
 
           /* The last conversion goes from aux1_buffer to destination_buffer */
-          babl_conversion_process (babl_list_get_last (path),
-                                   aux1_buffer,
-                                   (void*)((unsigned char*)destination_buffer +
-                                                           (j * dest_bpp)),
-                                   c);
+          process_step (timed_fish, conversions - 1,
+                        babl_list_get_last (path),
+                        aux1_buffer,
+                        (void*)((unsigned char*)destination_buffer +
+                                                (j * dest_bpp)),
+                        c);
         }
   }
 }
 
 static void
-init_path_instrumentation (FishPathInstrumentation *fpi,
-                           Babl                    *fmt_source,
-                           Babl                    *fmt_destination)
+init_path_instrumentation (FishPathInstrumentation *fpi)
 {
   long   ticks_start = 0;
   long   ticks_end   = 0;
 
-  const double *test_pixels = babl_get_path_test_pixels ();
+  const Babl   *fmt_source      = fpi->fmt_source;
+  const Babl   *fmt_destination = fpi->fmt_destination;
+  const double *test_pixels     = babl_get_path_test_pixels ();
 
   if (!fpi->fmt_rgba_double)
     {
@@ -999,8 +1565,8 @@ get_path_instrumentation (FishPathInstrumentation *fpi,
   long   ticks_start = 0;
   long   ticks_end   = 0;
 
-  Babl *babl_source = fpi->source;
-  Babl *babl_destination = fpi->destination;
+  const Babl *babl_source = fpi->fmt_source;
+  const Babl *babl_destination = fpi->fmt_destination;
 
   int source_bpp = 0;
   int dest_bpp = 0;
@@ -1035,15 +1601,20 @@ get_path_instrumentation (FishPathInstrumentation *fpi,
       /* this initialization can be done only once since the
        * source and destination formats do not change during
        * the search */
-      init_path_instrumentation (fpi, babl_source, babl_destination);
+      init_path_instrumentation (fpi);
       fpi->init_instrumentation_done = 1;
     }
 
-  /* calculate this path's view of what the result should be */
+  /* calculate this path's view of what the result should be, the first
+   * run is not timed, keeping one time setup of conversions - like the
+   * shared lookup tables of TRCs - out of the cost of the path
+   */
+  process_conversion_path (path, fpi->source, source_bpp, fpi->destination,
+                           dest_bpp, fpi->num_test_pixels, NULL);
   ticks_start = babl_ticks ();
   for (int i = 0; i < BABL_TEST_ITER; i ++)
   process_conversion_path (path, fpi->source, source_bpp, fpi->destination,
-                           dest_bpp, fpi->num_test_pixels);
+                           dest_bpp, fpi->num_test_pixels, NULL);
   ticks_end = babl_ticks ();
   *path_cost = (ticks_end - ticks_start);
 
@@ -36,6 +36,23 @@ assert_conversion_find (const void *source,
   return ret;
 }
 
+/* a conversion resolved by reference_prepare (), or a fatal error naming
+ * the models it would have converted between
+ */
+static Babl *
+assert_conversion (const Babl *conversion,
+                   const void *source,
+                   const void *destination)
+{
+  if (!conversion)
+    babl_fatal ("failed finding conversion between %s and %s aborting",
+                babl_get_name (source), babl_get_name (destination));
+
+  return (Babl *) conversion;
+}
+
+static void reference_prepare (Babl *babl);
+
 static int
 create_name_internal (char *buf,
                       size_t maxlen,
@@ -114,12 +131,17 @@ babl_fish_reference (const Babl *source,
 
   babl_assert (name);
 
+  /* held while the fish is prepared, which can create models, formats and
+   * conversions for other spaces
+   */
+  babl_mutex_lock (babl_format_mutex);
   babl = babl_db_exist_by_name (babl_fish_db (), name);
   if (babl)
     {
       /* There is an instance already registered by the required name,
        * returning the preexistent one instead.
        */
+      babl_mutex_unlock (babl_format_mutex);
 #ifndef HAVE_TLS
       free (name);
 #endif
@@ -146,12 +168,14 @@ babl_fish_reference (const Babl *source,
   babl->fish.error       = 0.0;  /* assuming the provided reference conversions for types
                                     and models are as exact as possible
                                   */
+  reference_prepare (babl);
   _babl_fish_rig_dispatch (babl);
 
   /* Since there is not an already registered instance by the required
    * name, inserting newly created class into database.
    */
   babl_db_insert (babl_fish_db (), babl);
+  babl_mutex_unlock (babl_format_mutex);
 #ifndef HAVE_TLS
   free (name);
 #endif
@@ -159,260 +183,305 @@ babl_fish_reference (const Babl *source,
 }
 
 
-static void
-convert_to_double (BablFormat      *source_fmt,
-                   const char      *source_buf,
-                   char            *double_buf,
-                   int              n)
+typedef enum _Kind Kind;
+enum _Kind { KIND_RGB, KIND_CMYK};
+
+typedef enum
+{
+  REFERENCE_COPY,        /* same format in source/destination */
+  REFERENCE_TYPES,       /* same model and space, only convert types */
+  REFERENCE_COMPONENTS,  /* converting to a n_component format */
+  REFERENCE_FLOAT,       /* through "RGBA float" */
+  REFERENCE_DOUBLE       /* through "RGBA" or "cmykA" doubles */
+} ReferenceKind;
+
+/* one component converted by the plane conversion between two types, or
+ * filled in with a value when the source has no such component
+ */
+typedef struct
+{
+  const Babl *conversion;
+  int         source_offset;
+  int         destination_offset;
+  double      value;
+} ReferenceComponent;
+
+/* the type conversions between pixels of a format and the interleaved
+ * float or double components of its model
+ */
+typedef struct
+{
+  int                components;
+  int                source_pitch;
+  int                destination_pitch;
+  int                size;    /* of the float or double components */
+  int                scale;   /* all components are converted in one go */
+  ReferenceComponent component[BABL_MAX_COMPONENTS];
+} ReferenceTypes;
+
+#define REFERENCE_BUFFERS 4
+
+/* what a reference fish does, worked out when it is created: processing
+ * only allocates the buffers and runs through it.
+ */
+struct _BablReferencePlan
 {
-  int        i;
+  ReferenceKind  kind;
+  Kind           source_kind;
+  Kind           destination_kind;
+  ReferenceTypes unpack;   /* from the source to the source buffer */
+  ReferenceTypes pack;     /* from the destination buffer to the destination */
+  int            source_direct;       /* the source is used as source buffer */
+  const Babl    *source_model;        /* "RGBA" or "cmykA" in the spaces of */
+  const Babl    *destination_model;   /* source and destination */
+  const Babl    *to_model;            /* source model to source_model */
+  const Babl    *from_model;          /* destination_model to destination model */
+  int            source_components;   /* of the models of the buffers */
+  int            destination_components;
+  int            has_matrix;
+  int            avx2_matrix;         /* matrixf applied 8 pixels at a time */
+  double         matrix[9];
+  float          matrixf[9];
+  void          *cmyk_transform;      /* lcms transform between CMYK spaces */
+
+  /* bytes per pixel of the source, source model, destination model and
+   * destination buffers, 0 for those not used
+   */
+  int            buffer_size[REFERENCE_BUFFERS];
+};
 
-  BablImage *src_img;
-  BablImage *dst_img;
+/* an image of interleaved components in a buffer, for planar conversions */
+typedef struct
+{
+  BablImage  image;
+  char      *data[BABL_MAX_COMPONENTS];
+  int        pitch[BABL_MAX_COMPONENTS];
+  int        stride[BABL_MAX_COMPONENTS];
+} ReferenceImage;
 
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+static Babl *
+reference_image (ReferenceImage *image,
+                 int             components,
+                 int             size,
+                 char           *buffer)
+{
+  int i;
 
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  dst_img->pitch[0] =
-    (dst_img->type[0]->bits / 8) * source_fmt->model->components;
-  dst_img->stride[0] = 0;
+  memset (&image->image, 0, sizeof (BablImage));
+  image->image.instance.class_type = BABL_IMAGE;
+  image->image.components = components;
+  image->image.data       = image->data;
+  image->image.pitch      = image->pitch;
+  image->image.stride     = image->stride;
 
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  src_img->pitch[0]  = source_fmt->bytes_per_pixel;
-  src_img->stride[0] = 0;
+  for (i = 0; i < components; i++)
+    {
+      image->data[i]   = buffer + size * i;
+      image->pitch[i]  = size * components;
+      image->stride[i] = 0;
+    }
+  return (Babl *) image;
+}
 
-  {
-  /* i is dest position */
-  for (i = 0; i < source_fmt->model->components; i++)
+static void
+process_model_conversion (const Babl *conversion,
+                          char       *source,
+                          int         source_components,
+                          char       *destination,
+                          int         destination_components,
+                          int         size,
+                          long        n)
+{
+  if (conversion->class_type == BABL_CONVERSION_PLANAR)
     {
-      int j;
-      int found = 0;
+      ReferenceImage source_image;
+      ReferenceImage destination_image;
+
+      babl_conversion_process (conversion,
+        (void*)reference_image (&source_image, source_components, size, source),
+        (void*)reference_image (&destination_image, destination_components,
+                                size, destination),
+        n);
+    }
+  else if (conversion->class_type == BABL_CONVERSION_LINEAR)
+    {
+      babl_conversion_process (conversion, source, destination, n);
+    }
+  else babl_fatal ("oops");
+}
 
-      dst_img->data[0] =
-        double_buf + (dst_img->type[0]->bits / 8) * i;
+static void
+process_types (const ReferenceTypes *types,
+               const char           *source,
+               char                 *destination,
+               long                  n)
+{
+  int i;
 
-      src_img->data[0] = (char *)source_buf;
+  for (i = 0; i < types->components; i++)
+    {
+      const ReferenceComponent *component = &types->component[i];
+      char *dst_ptr = destination + component->destination_offset;
 
-      /* j is source position */
-      for (j = 0; j < source_fmt->components; j++)
+      if (component->conversion)
         {
-          src_img->type[0] = source_fmt->type[j];
+          BablConversion *conversion = (void*)component->conversion;
+
+          if (_babl_instrument)
+            __atomic_fetch_add (&conversion->pixels, n * types->scale,
+                                __ATOMIC_RELAXED);
+          conversion->function.plane (conversion,
+                                      source + component->source_offset,
+                                      dst_ptr,
+                                      types->source_pitch,
+                                      types->destination_pitch,
+                                      n * types->scale,
+                                      conversion->data);
+        }
+      else if (types->size == sizeof (double))
+        {
+          long j;
+          for (j = 0; j < n; j++, dst_ptr += types->destination_pitch)
+            *(double *) dst_ptr = component->value;
+        }
+      else
+        {
+          long j;
+          for (j = 0; j < n; j++, dst_ptr += types->destination_pitch)
+            *(float *) dst_ptr = component->value;
+        }
+    }
+}
 
-          if (source_fmt->component[j] ==
-              source_fmt->model->component[i])
-            {
-              babl_conversion_process (assert_conversion_find (src_img->type[0], dst_img->type[0]),
-                                       (void*)src_img, (void*)dst_img, n);
-              found = 1;
-              break;
-            }
+/* the component wise conversion of the pixels of format to the interleaved
+ * components of its model, of type
+ */
+static void
+types_unpack (ReferenceTypes *types,
+              const Babl     *format,
+              const Babl     *type)
+{
+  const BablModel *model = format->format.model;
+  int i;
 
-          src_img->data[0] += src_img->type[0]->bits / 8;
-        }
+  types->size              = type->type.bits / 8;
+  types->scale             = 1;
+  types->components        = model->components;
+  types->source_pitch      = format->format.bytes_per_pixel;
+  types->destination_pitch = types->size * model->components;
 
-      if (!found)
-        {
-          char *dst_ptr = dst_img->data[0];
-          double value;
+  /* i is dest position */
+  for (i = 0; i < model->components; i++)
+    {
+      ReferenceComponent *component = &types->component[i];
+      int offset = 0;
+      int j;
 
-          value = source_fmt->model->component[i]->instance.id == BABL_ALPHA ? 1.0 : 0.0;
+      component->conversion         = NULL;
+      component->destination_offset = types->size * i;
+      component->value = model->component[i]->instance.id == BABL_ALPHA ? 1.0 : 0.0;
 
-          for (j = 0; j < n; j++)
+      /* j is source position */
+      for (j = 0; j < format->format.components; j++)
+        {
+          if (format->format.component[j] == model->component[i])
             {
-              double *dst_component = (double *) dst_ptr;
-
-              *dst_component = value;
-              dst_ptr += dst_img->pitch[0];
+              component->conversion =
+                assert_conversion_find (format->format.type[j], type);
+              component->source_offset = offset;
+              break;
             }
+          offset += format->format.type[j]->bits / 8;
         }
     }
-  }
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
-
+/* the component wise conversion from the interleaved components of type of
+ * the model of format, to its pixels
+ */
 static void
-convert_from_double (BablFormat *source_fmt,
-                     BablFormat *destination_fmt,
-                     char       *destination_double_buf,
-                     char       *destination_buf,
-                     int         n)
+types_pack (ReferenceTypes *types,
+            const Babl     *source_format,
+            const Babl     *format,
+            const Babl     *type)
 {
-  int        i;
-
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  src_img->pitch[0]  = (src_img->type[0]->bits / 8) * destination_fmt->model->components;
-  src_img->stride[0] = 0;
+  const BablModel *model = format->format.model;
+  int offset = 0;
+  int i;
 
-  dst_img->data[0]  = destination_buf;
-  dst_img->pitch[0] = destination_fmt->bytes_per_pixel;
-  dst_img->stride[0] = 0;
+  types->size              = type->type.bits / 8;
+  types->scale             = 1;
+  types->components        = 0;
+  types->source_pitch      = types->size * model->components;
+  types->destination_pitch = format->format.bytes_per_pixel;
 
-  for (i = 0; i < destination_fmt->components; i++)
+  for (i = 0; i < format->format.components; i++)
     {
       int j;
       int can_be_used = 1;
 
-      dst_img->type[0] = destination_fmt->type[i];
-
-      if (source_fmt->model == destination_fmt->model)
+      if (source_format->format.model == format->format.model)
       {
         can_be_used = 0;
-        for (j = 0; j < source_fmt->components; j++)
+        for (j = 0; j < source_format->format.components; j++)
         {
-          if (destination_fmt->component[i] == source_fmt->component[j])
+          if (format->format.component[i] == source_format->format.component[j])
           {
             can_be_used = 1;
           }
         }
       }
-      else
-      {
-      }
-         //fprintf (stderr, "%s %s %i\n", babl_get_name (source_fmt), babl_get_name (destination_fmt), can_be_used);
 
       if (can_be_used)
-      for (j = 0; j < destination_fmt->model->components; j++)
+      for (j = 0; j < model->components; j++)
         {
-          if (destination_fmt->component[i] ==
-              destination_fmt->model->component[j])
+          if (format->format.component[i] == model->component[j])
             {
-              src_img->data[0] =
-                destination_double_buf + (src_img->type[0]->bits / 8) * j;
+              ReferenceComponent *component =
+                &types->component[types->components++];
 
-              babl_conversion_process (assert_conversion_find (src_img->type[0],
-                                       dst_img->type[0]),
-                                       (void*)src_img, (void*)dst_img, n);
+              component->conversion =
+                assert_conversion_find (type, format->format.type[i]);
+              component->source_offset      = types->size * j;
+              component->destination_offset = offset;
               break;
             }
         }
 
-      dst_img->data[0] += dst_img->type[0]->bits / 8;
+      offset += format->format.type[i]->bits / 8;
     }
-  babl_free (src_img);
-  babl_free (dst_img);
-}
-
-
-static void
-ncomponent_convert_to_double (BablFormat       *source_fmt,
-                              char             *source_buf,
-                              char             *source_double_buf,
-                              int               n)
-{
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  dst_img->pitch[0] = (dst_img->type[0]->bits / 8);
-  dst_img->stride[0] = 0;
-
-  src_img->data[0] = source_buf;
-  src_img->type[0] = source_fmt->type[0];
-  src_img->pitch[0] = source_fmt->type[0]->bits / 8;
-  src_img->stride[0] = 0;
-
-  dst_img->data[0] = source_double_buf;
-
-  babl_conversion_process (
-    assert_conversion_find (src_img->type[0], dst_img->type[0]),
-    (void*)src_img, (void*)dst_img,
-    n * source_fmt->components);
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
+/* converting all the components of format, which are of the same type, to
+ * or from type in one go
+ */
 static void
-ncomponent_convert_from_double (BablFormat *destination_fmt,
-                                char       *destination_double_buf,
-                                char       *destination_buf,
-                                int         n)
+types_n_component (ReferenceTypes *types,
+                   const Babl     *format,
+                   const Babl     *type,
+                   int             unpack)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  src_img->pitch[0]  = (src_img->type[0]->bits / 8);
-  src_img->stride[0] = 0;
-
-  dst_img->data[0]  = destination_buf;
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_DOUBLE);
-  dst_img->pitch[0] = destination_fmt->type[0]->bits/8;
-  dst_img->stride[0] = 0;
-
-  dst_img->type[0] = destination_fmt->type[0];
-  src_img->data[0] = destination_double_buf;
-
-  babl_conversion_process (
-    assert_conversion_find (src_img->type[0], dst_img->type[0]),
-    (void*)src_img, (void*)dst_img,
-    n * destination_fmt->components);
-
-  dst_img->data[0] += dst_img->type[0]->bits / 8;
-  babl_free (src_img);
-  babl_free (dst_img);
-}
-
-
-static int
-process_to_n_component (const Babl  *babl,
-                        const char *source,
-                        char       *destination,
-                        long        n)
-{
-  void *double_buf;
-#ifndef MAX
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#endif
-  int components = MAX(BABL (babl->fish.source)->format.model->components,
-                       BABL (babl->fish.source)->format.components);
-  components = MAX(components, BABL (babl->fish.destination)->format.components);
-  components = MAX(components, BABL (babl->fish.destination)->model.components);
+  ReferenceComponent *component = &types->component[0];
+  const Babl *format_type = (void*)format->format.type[0];
 
-  double_buf = babl_malloc (sizeof (double) * n * components);
-      memset (double_buf, 0,sizeof (double) * n * components);
+  types->size       = type->type.bits / 8;
+  types->scale      = format->format.components;
+  types->components = 1;
 
- /* a single precision path could be added here*/
+  component->source_offset      = 0;
+  component->destination_offset = 0;
+  if (unpack)
     {
-      ncomponent_convert_to_double (
-        (BablFormat *) BABL (babl->fish.source),
-        (char *) source,
-        double_buf,
-        n
-      );
-
-      ncomponent_convert_from_double (
-        (BablFormat *) BABL (babl->fish.destination),
-        double_buf,
-        (char *) destination,
-        n
-      );
+      component->conversion    = assert_conversion_find (format_type, type);
+      types->source_pitch      = format_type->type.bits / 8;
+      types->destination_pitch = types->size;
+    }
+  else
+    {
+      component->conversion    = assert_conversion_find (type, format_type);
+      types->source_pitch      = types->size;
+      types->destination_pitch = format_type->type.bits / 8;
     }
-
-  babl_free (double_buf);
-  return 0;
 }
 
 static int compatible_components (const BablFormat *a,
@@ -427,954 +496,570 @@ static int compatible_components (const BablFormat *a,
   return 1;
 }
 
-static void
-ncomponent_convert_to_float (BablFormat       *source_fmt,
-                             char             *source_buf,
-                             char             *source_float_buf,
-                             int               n)
+static int format_has_cmyk_model (const Babl *format)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
-  dst_img->pitch[0] = (dst_img->type[0]->bits / 8);
-  dst_img->stride[0] = 0;
-
-  src_img->data[0] = source_buf;
-  src_img->type[0] = source_fmt->type[0];
-  src_img->pitch[0] = source_fmt->type[0]->bits / 8;
-  src_img->stride[0] = 0;
-
-  dst_img->data[0] = source_float_buf;
-
-  babl_conversion_process (
-    assert_conversion_find (src_img->type[0], dst_img->type[0]),
-    (void*)src_img, (void*)dst_img,
-    n * source_fmt->components);
-  babl_free (src_img);
-  babl_free (dst_img);
+  return format->format.model->flags & BABL_MODEL_FLAG_CMYK;
 }
 
-static void
-ncomponent_convert_from_float (BablFormat *source_fmt,
-                               BablFormat *destination_fmt,
-                               char       *destination_float_buf,
-                               char       *destination_buf,
-                               int         n)
+static int
+reference_destroy (void *data)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_FLOAT);
-  src_img->pitch[0]  = (src_img->type[0]->bits / 8);
-  src_img->stride[0] = 0;
-
-  dst_img->data[0]  = destination_buf;
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
-  dst_img->pitch[0] = destination_fmt->type[0]->bits/8;
-  dst_img->stride[0] = 0;
-
-  dst_img->type[0] = destination_fmt->type[0];
-  src_img->data[0] = destination_float_buf;
-
-  babl_conversion_process (
-    assert_conversion_find (src_img->type[0], dst_img->type[0]),
-    (void*)src_img, (void*)dst_img,
-    n * destination_fmt->components);
-
-  dst_img->data[0] += dst_img->type[0]->bits / 8;
-  babl_free (src_img);
-  babl_free (dst_img);
+  Babl *babl = data;
+  BablReferencePlan *plan = babl->fish_reference.plan;
+
+  if (!plan)
+    return 0;
+#if HAVE_LCMS
+  if (plan->cmyk_transform)
+    cmsDeleteTransform (plan->cmyk_transform);
+#endif
+  babl_free (plan);
+  babl->fish_reference.plan = NULL;
+  return 0;
 }
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 static void
-convert_to_float (BablFormat *source_fmt,
-                  const char *source_buf,
-                  char       *float_buf,
-                  int         n)
+prepare_same_model (BablReferencePlan *plan,
+                    const Babl        *source,
+                    const Babl        *destination)
 {
-  int        i;
+  const Babl *type_float = babl_type_from_id (BABL_FLOAT);
+  const Babl *type = babl_type_from_id (BABL_DOUBLE);
 
-  BablImage *src_img;
-  BablImage *dst_img;
+  if ((source->format.type[0]->bits < 32 ||
+       source->format.type[0] == (void*)type_float) &&
+      (destination->format.type[0]->bits < 32 ||
+       destination->format.type[0] == (void*)type_float))
+    type = type_float;
 
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  plan->kind = REFERENCE_TYPES;
+  plan->buffer_size[0] = type->type.bits / 8 *
+                         MAX (source->format.model->components,
+                              source->format.components);
 
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
-  dst_img->pitch[0] =
-    (dst_img->type[0]->bits / 8) * source_fmt->model->components;
-  dst_img->stride[0] = 0;
-
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_FLOAT);
-  src_img->pitch[0]  = source_fmt->bytes_per_pixel;
-  src_img->stride[0] = 0;
-
-  {
-  /* i is dest position */
-  for (i = 0; i < source_fmt->model->components; i++)
+  if (compatible_components ((void*)source, (void*)destination))
     {
-      int j;
-      int found = 0;
-
-      dst_img->data[0] =
-        float_buf + (dst_img->type[0]->bits / 8) * i;
+      types_n_component (&plan->unpack, source, type, 1);
+      types_n_component (&plan->pack, destination, type, 0);
+    }
+  else
+    {
+      types_unpack (&plan->unpack, source, type);
+      types_pack (&plan->pack, source, destination, type);
+    }
+}
 
-      src_img->data[0] = (char *)source_buf;
+static void
+prepare_n_component (BablReferencePlan *plan,
+                     const Babl        *source,
+                     const Babl        *destination)
+{
+  const Babl *type_double = babl_type_from_id (BABL_DOUBLE);
+  int components = MAX(source->format.model->components,
+                       source->format.components);
+  components = MAX(components, destination->format.components);
+  components = MAX(components, destination->format.model->components);
 
-      /* j is source position */
-      for (j = 0; j < source_fmt->components; j++)
-        {
-          src_img->type[0] = source_fmt->type[j];
+  plan->kind = REFERENCE_COMPONENTS;
+  plan->buffer_size[0] = sizeof (double) * components;
 
-          if (source_fmt->component[j] ==
-              source_fmt->model->component[i])
-            {
-              babl_conversion_process (assert_conversion_find (src_img->type[0], dst_img->type[0]),
-                                       (void*)src_img, (void*)dst_img, n);
-              found = 1;
-              break;
-            }
+ /* a single precision path could be added here*/
+  types_n_component (&plan->unpack, source, type_double, 1);
+  types_n_component (&plan->pack, destination, type_double, 0);
+}
 
-          src_img->data[0] += src_img->type[0]->bits / 8;
-        }
+/* both source and destination are either single precision float or <32bit component,
+   we then do a similar to the double reference - using the first registered
+   float conversions - note that this makes the first registered float conversion of
+   a given type a reference, and we thus rely on the *first* float conversion regsitered
+   to be correct, this will be the case if the code paths are duplicated and we register
+   either a planar or linear conversion to and from "RGBA float" at the same time as
+   registering conversions for double. When needed conversions do not exist, we defer
+   to the double code paths
+ */
+static int
+prepare_float (BablReferencePlan *plan,
+               const Babl        *source,
+               const Babl        *destination)
+{
+  const Babl *source_space      = source->format.space;
+  const Babl *destination_space = destination->format.space;
+  const Babl *type_float        = babl_type_from_id (BABL_FLOAT);
+  const Babl *source_float;
+  const Babl *destination_float;
+  const Babl *source_rgba_float;
+  const Babl *destination_rgba_float;
+  char name[256];
+
+  snprintf (name, sizeof (name), "%s float",
+            babl_get_name ((void*)source->format.model));
+  source_float = babl_format_with_space (name, source_space);
+  snprintf (name, sizeof (name), "%s float",
+            babl_get_name ((void*)destination->format.model));
+  destination_float = babl_format_with_space (name, destination_space);
+
+  source_rgba_float      = babl_format_with_space ("RGBA float", source_space);
+  destination_rgba_float = babl_format_with_space ("RGBA float", destination_space);
+
+  plan->to_model   = babl_conversion_find (source_float, source_rgba_float);
+  plan->from_model = babl_conversion_find (destination_rgba_float,
+                                           destination_float);
+  if (!plan->to_model || !plan->from_model)
+    {
+      /* needed float conversions not found, using double code path instead */
+      plan->to_model   = NULL;
+      plan->from_model = NULL;
+      return 0;
+    }
 
-      if (!found)
-        {
-          char *dst_ptr = dst_img->data[0];
-          float value;
+  plan->kind                   = REFERENCE_FLOAT;
+  plan->source_model           = source_rgba_float;
+  plan->destination_model      = destination_rgba_float;
+  plan->source_components      = source_float->format.components;
+  plan->destination_components = destination_float->format.components;
 
-          value = source_fmt->model->component[i]->instance.id == BABL_ALPHA ? 1.0 : 0.0;
+  types_unpack (&plan->unpack, source, type_float);
+  types_pack (&plan->pack, source, destination, type_float);
 
-          for (j = 0; j < n; j++)
-            {
-              float *dst_component = (float *) dst_ptr;
+  plan->buffer_size[0] = sizeof (float) * source->format.model->components;
+  plan->buffer_size[1] = sizeof (float) * 4;
+  if (destination_rgba_float != destination_float)
+    plan->buffer_size[3] = sizeof (float) * destination->format.model->components;
 
-              *dst_component = value;
-              dst_ptr += dst_img->pitch[0];
-            }
-        }
+  if (source_space != destination_space)
+    {
+      plan->has_matrix = 1;
+      babl_matrix_mul_matrixf (destination_space->space.XYZtoRGBf,
+                               source_space->space.RGBtoXYZf,
+                               plan->matrixf);
+#if defined(USE_AVX2) && defined(USE_FMA)
+      plan->avx2_matrix =
+        (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_AVX2) &&
+        (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_FMA);
+#endif
     }
-  }
-  babl_free (src_img);
-  babl_free (dst_img);
+  return 1;
 }
 
-
 static void
-convert_from_float (BablFormat *source_fmt,
-                    BablFormat *destination_fmt,
-                     char      *destination_float_buf,
-                     char      *destination_buf,
-                     int        n)
+prepare_double (BablReferencePlan *plan,
+                const Babl        *source,
+                const Babl        *destination)
 {
-  int        i;
+  const Babl *source_space      = source->format.space;
+  const Babl *destination_space = destination->format.space;
+  const Babl *type_double       = babl_type_from_id (BABL_DOUBLE);
 
-  BablImage *src_img;
-  BablImage *dst_img;
+  /* This is not the full/only condition XXX */
 
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  /* XXX : sometimes is_cmyk is neither 0 or 1 */
 
-  src_img->type[0]   = (BablType *) babl_type_from_id (BABL_FLOAT);
-  src_img->pitch[0]  = (src_img->type[0]->bits / 8) * destination_fmt->model->components;
-  src_img->stride[0] = 0;
+  plan->kind             = REFERENCE_DOUBLE;
+  plan->source_kind      = format_has_cmyk_model (source) ? KIND_CMYK : KIND_RGB;
+  plan->destination_kind = format_has_cmyk_model (destination) ? KIND_CMYK : KIND_RGB;
 
-  dst_img->data[0]  = destination_buf;
-  dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
-  dst_img->pitch[0] = destination_fmt->bytes_per_pixel;
-  dst_img->stride[0] = 0;
+  if (source->format.type[0] == (void*)type_double &&
+      source->format.components == source->format.model->components)
+    plan->source_direct = 1;
+  else
+    plan->buffer_size[0] = sizeof (double) * source->format.model->components;
+  types_unpack (&plan->unpack, source, type_double);
+  types_pack (&plan->pack, source, destination, type_double);
 
-  for (i = 0; i < destination_fmt->components; i++)
+  if (plan->source_kind == KIND_CMYK)
     {
-      int j;
-      int can_be_used = 1;
-
-      dst_img->type[0] = destination_fmt->type[i];
-
-      if (source_fmt->model == destination_fmt->model)
-      {
-        can_be_used = 0;
-        for (j = 0; j < source_fmt->components; j++)
-        {
-          if (destination_fmt->component[i] == source_fmt->component[j])
-          {
-            can_be_used = 1;
-          }
-        }
-      }
-
-      if (can_be_used)
-      for (j = 0; j < destination_fmt->model->components; j++)
-        {
-          if (destination_fmt->component[i] ==
-              destination_fmt->model->component[j])
-            {
-              src_img->data[0] =
-                destination_float_buf + (src_img->type[0]->bits / 8) * j;
-
-              babl_conversion_process (assert_conversion_find (src_img->type[0],
-                                       dst_img->type[0]),
-                                       (void*)src_img, (void*)dst_img, n);
-              break;
-            }
-        }
-
-      dst_img->data[0] += dst_img->type[0]->bits / 8;
+      if (babl_model_is ((void*)source->format.model, "cmykA"))
+        plan->source_model = (void*)source->format.model;
+      else
+        plan->source_model = babl_remodel_with_space (babl_model ("cmykA"),
+                                                      source_space);
     }
-  babl_free (src_img);
-  babl_free (dst_img);
-}
-
-
-
-static void
-process_same_model (const Babl  *babl,
-                    const char *source,
-                    char       *destination,
-                    long        n)
-{
-  const void *type_float = babl_type_from_id (BABL_FLOAT);
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-
-  if ((babl->fish.source->format.type[0]->bits < 32 ||
-       babl->fish.source->format.type[0] == type_float) &&
-      (babl->fish.destination->format.type[0]->bits < 32 ||
-       babl->fish.destination->format.type[0] == type_float))
-  {
-     void *float_buf = babl_malloc (sizeof (float) * n *
-                            MAX (BABL (babl->fish.source)->format.model->components,
-                                 BABL (babl->fish.source)->format.components));
-    if (compatible_components ((void*)babl->fish.source,
-                               (void*)babl->fish.destination))
+  else
     {
-        ncomponent_convert_to_float (
-          (BablFormat *) BABL (babl->fish.source),
-          (char *) source,
-          float_buf,
-          n);
-        ncomponent_convert_from_float (
-          (BablFormat *) BABL (babl->fish.source),
-          (BablFormat *) BABL (babl->fish.destination),
-          float_buf,
-          (char *) destination,
-          n);
+      plan->source_model =
+        babl_remodel_with_space (babl_model_from_id (BABL_RGBA), source_space);
     }
-    else
+  if (plan->source_model != (void*)source->format.model ||
+      plan->source_kind == KIND_RGB)
     {
-        convert_to_float (
-          (BablFormat *) BABL (babl->fish.source),
-          (char *) source,
-          float_buf,
-          n);
-
-        convert_from_float (
-          (BablFormat *) BABL (babl->fish.source),
-          (BablFormat *) BABL (babl->fish.destination),
-          float_buf,
-          (char *) destination,
-          n);
+      plan->to_model = babl_conversion_find (source->format.model,
+                                             plan->source_model);
+      plan->buffer_size[1] = sizeof (double) * plan->source_model->model.components;
     }
-    babl_free (float_buf);
-  }
-  else
-  {
-     void *double_buf = babl_malloc (sizeof (double) * n *
-                            MAX (BABL (babl->fish.source)->format.model->components,
-                                 BABL (babl->fish.source)->format.components));
-#undef MAX
-    if (compatible_components ((void*)babl->fish.source,
-                               (void*)babl->fish.destination))
+
+  plan->destination_model =
+    babl_remodel_with_space (plan->destination_kind == KIND_CMYK ?
+                               babl_model ("cmykA") :
+                               babl_model_from_id (BABL_RGBA),
+                             destination_space);
+  if (plan->destination_kind != plan->source_kind)
+    plan->buffer_size[2] = sizeof (double) *
+                           plan->destination_model->model.components;
+  if (plan->destination_model != (void*)destination->format.model)
     {
-        ncomponent_convert_to_double (
-          (BablFormat *) BABL (babl->fish.source),
-          (char *) source,
-          double_buf,
-          n);
-        ncomponent_convert_from_double (
-          (BablFormat *) BABL (babl->fish.destination),
-          double_buf,
-          (char *) destination,
-          n);
+      plan->from_model = babl_conversion_find (plan->destination_model,
+                                               destination->format.model);
+      plan->buffer_size[3] = sizeof (double) *
+                             destination->format.model->components;
     }
-    else
+
+  plan->source_components      = source->format.model->components;
+  plan->destination_components = destination->format.model->components;
+
+  if (plan->source_kind      == KIND_RGB &&
+      plan->destination_kind == KIND_RGB &&
+      source_space != destination_space)
     {
-        convert_to_double (
-          (BablFormat *) BABL (babl->fish.source),
-          (char *) source,
-          double_buf,
-          n);
-
-        convert_from_double (
-          (BablFormat *) BABL (babl->fish.source),
-          (BablFormat *) BABL (babl->fish.destination),
-          double_buf,
-          (char *) destination,
-          n);
+      plan->has_matrix = 1;
+      babl_matrix_mul_matrix (destination_space->space.XYZtoRGB,
+                              source_space->space.RGBtoXYZ,
+                              plan->matrix);
+    }
+  else if (plan->source_kind      == KIND_CMYK &&
+           plan->destination_kind == KIND_RGB &&
+           babl_space ("scRGB") != destination_space)
+    {
+      plan->has_matrix = 1;
+      babl_matrix_mul_matrix (destination_space->space.XYZtoRGB,
+                              babl_space ("scRGB")->space.RGBtoXYZ,
+                              plan->matrix);
     }
-    babl_free (double_buf);
-  }
-}
 
-typedef enum _Kind Kind;
-enum _Kind { KIND_RGB, KIND_CMYK};
+#if HAVE_LCMS
+/* these are not defined by lcms2.h we hope that following the existing pattern of pixel-format definitions work */
+#ifndef TYPE_CMYKA_DBL
+#define TYPE_CMYKA_DBL      (FLOAT_SH(1)|COLORSPACE_SH(PT_CMYK)|EXTRA_SH(1)|CHANNELS_SH(4)|BYTES_SH(0))
+#endif
 
-static int format_has_cmyk_model (const Babl *format)
-{
-  return format->format.model->flags & BABL_MODEL_FLAG_CMYK;
+  if (plan->source_kind      == KIND_CMYK &&
+      plan->destination_kind == KIND_CMYK &&
+      source_space != destination_space &&
+      source_space->space.cmyk.lcms_profile &&
+      destination_space->space.cmyk.lcms_profile)
+    {
+      cmsHPROFILE src_profile = cmsOpenProfileFromMem (source_space->space.icc_profile,
+                                                       source_space->space.icc_length);
+      cmsHPROFILE dst_profile = cmsOpenProfileFromMem (destination_space->space.icc_profile,
+                                                       destination_space->space.icc_length);
+
+      plan->cmyk_transform = cmsCreateTransform (src_profile, TYPE_CMYKA_DBL,
+                                                 dst_profile, TYPE_CMYKA_DBL,
+                                                 INTENT_RELATIVE_COLORIMETRIC,
+                                                 cmsFLAGS_BLACKPOINTCOMPENSATION);
+      cmsCloseProfile (src_profile);
+      cmsCloseProfile (dst_profile);
+    }
+#endif
 }
 
+/* works out the plan of the fish, resolving the models, formats and
+ * conversions the reference code path uses, and creating those in other
+ * spaces than sRGB as needed. This is done once when the fish is created,
+ * processing then only reads the plan, and needs no locking.
+ */
 static void
-babl_fish_reference_process_double (const Babl *babl,
-                                    const char *source,
-                                    char       *destination,
-                                    long        n,
-                                    void       *data)
+reference_prepare (Babl *babl)
 {
-  Kind  source_kind             = KIND_RGB;
-  Kind  destination_kind        = KIND_RGB;
-  Babl *source_image            = NULL;
-  Babl *rgba_image              = NULL;
-  Babl *cmyka_image             = NULL;
-  Babl *destination_image       = NULL;
-
-
+  BablReferencePlan *plan;
+  const Babl *source      = babl->fish.source;
+  const Babl *destination = babl->fish.destination;
+  const void *type_float  = babl_type_from_id (BABL_FLOAT);
+  static int  allow_float_reference = -1;
 
-  void *source_double_buf_alloc = NULL;
-  void *source_double_buf       = NULL;
-  void *rgba_double_buf_alloc   = NULL;
-  void *rgba_double_buf         = NULL;
-  void *cmyka_double_buf_alloc  = NULL;
-  void *cmyka_double_buf        = NULL;
-  void *destination_double_buf_alloc = NULL;
-  void *destination_double_buf;
-  const void *type_double  = babl_type_from_id (BABL_DOUBLE);
-
-  const Babl *source_space = BABL (BABL ((babl->fish.source))->format.space);
-  const Babl *destination_space = BABL (BABL ((babl->fish.destination))->format.space);
-
-  /* This is not the full/only condition XXX */
+  plan = babl_calloc (1, sizeof (BablReferencePlan));
+  babl->fish_reference.plan = plan;
+  babl_set_destructor (babl, reference_destroy);
 
-  /* XXX : sometimes is_cmyk is neither 0 or 1 */
-
-  if (format_has_cmyk_model (babl->fish.source))
-    source_kind = KIND_CMYK;
-  if (format_has_cmyk_model (babl->fish.destination))
-    destination_kind = KIND_CMYK;
+  if (allow_float_reference == -1)
+    allow_float_reference = getenv ("BABL_REFERENCE_NOFLOAT") ? 0 : 1;
 
-  if (babl->fish.source->format.type[0] == type_double &&
-      BABL(babl->fish.source)->format.components ==
-      BABL(babl->fish.source)->format.model->components)
-  {
-    source_double_buf = (void*)source;
-    source_image = babl_image_from_linear (
-       source_double_buf, BABL (BABL ((babl->fish.source))->format.model));
-  }
+  if (source == destination)
+    plan->kind = REFERENCE_COPY;
+  else if (source->format.model == destination->format.model &&
+           source->format.space == destination->format.space)
+    prepare_same_model (plan, source, destination);
+  else if (babl_format_is_format_n (destination))
+    prepare_n_component (plan, source, destination);
+  else if (allow_float_reference &&
+           !format_has_cmyk_model (source) &&
+           !format_has_cmyk_model (destination) &&
+           (source->format.type[0]->bits < 32 ||
+            source->format.type[0] == type_float) &&
+           (destination->format.type[0]->bits < 32 ||
+            destination->format.type[0] == type_float) &&
+           !babl_format_is_palette (source) &&
+           !babl_format_is_palette (destination) &&
+           prepare_float (plan, source, destination))
+    ;
   else
-  {
-    source_double_buf =
-    source_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                BABL (babl->fish.source)->format.model->components);
-
-    source_image = babl_image_from_linear (
-      source_double_buf, BABL (BABL ((babl->fish.source))->format.model));
-    convert_to_double (
-      (BablFormat *) BABL (babl->fish.source),
-      source,
-      source_double_buf,
-      n
-    );
-  }
-
-  babl_mutex_lock (babl_reference_mutex);
-  switch (source_kind)
-  {
-    case KIND_RGB:
-     {
-       Babl *conv = assert_conversion_find (
-           BABL (babl->fish.source)->format.model,
-       babl_remodel_with_space (babl_model_from_id (BABL_RGBA),
-                         source_space));
-
-       rgba_double_buf       =
-       rgba_double_buf_alloc = babl_malloc (sizeof (double) * n * 4);
-
-       rgba_image = babl_image_from_linear (
-          rgba_double_buf, babl_remodel_with_space (babl_model_from_id (BABL_RGBA), source_space));
-
-       if (conv->class_type == BABL_CONVERSION_PLANAR)
-       {
-          babl_conversion_process (conv,
-               (void*)source_image, (void*)rgba_image, n);
-       }
-       else if (conv->class_type == BABL_CONVERSION_LINEAR)
-       {
-         babl_conversion_process (conv, source_double_buf, rgba_double_buf, n);
-       }
-       else babl_fatal ("oops");
-      }
-      break;
-    case KIND_CMYK:
-      if (babl_model_is ((void*)babl->fish.source->format.model, "cmykA"))
-      {
-        cmyka_double_buf = source_double_buf;
-        cmyka_image = babl_image_from_linear (cmyka_double_buf,
-                                (void*)babl->fish.source->format.model);
-      }
-      else
-      {
-        Babl *conv = assert_conversion_find (
-                   BABL (babl->fish.source)->format.model,
-                   babl_remodel_with_space (babl_model ("cmykA"),
-                         source_space));
-
-        cmyka_double_buf       =
-        cmyka_double_buf_alloc = babl_malloc (sizeof (double) * n * 5);
-
-        cmyka_image = babl_image_from_linear (
-          cmyka_double_buf, babl_remodel_with_space (babl_model ("cmykA"),
-          source_space));
+    prepare_double (plan, source, destination);
+}
 
-        if (conv->class_type == BABL_CONVERSION_PLANAR)
-        {
-          babl_conversion_process (conv,
-           (void*)source_image, (void*)cmyka_image, n);
-        }
-        else if (conv->class_type == BABL_CONVERSION_LINEAR)
-        {
-          babl_conversion_process (conv,source_double_buf, cmyka_double_buf, n);
-        }
-        else babl_fatal ("oops");
-      }
-      break;
-  }
+/* takes the buffers of the plan from the scratch memory of the thread in
+ * one go, each aligned and with room for an extra pixel - which masks a
+ * valgrind 'invalid read of size 16' false positive.
+ */
+static void *
+reference_buffers (const BablReferencePlan *plan,
+                   long                     n,
+                   char                   **buffers)
+{
+  long  size = 0;
+  long  offsets[REFERENCE_BUFFERS];
+  char *memory;
+  int   i;
 
-  if (source_kind      == KIND_RGB &&
-      destination_kind == KIND_RGB)
-  {
-    if (source_space != destination_space)
+  for (i = 0; i < REFERENCE_BUFFERS; i++)
     {
-      double matrix[9];
-      double *rgba = rgba_double_buf;
-      babl_matrix_mul_matrix (
-        destination_space->space.XYZtoRGB,
-        source_space->space.RGBtoXYZ,
-        matrix);
-
-      babl_matrix_mul_vector_buf4 (matrix, rgba, rgba, n);
+      offsets[i] = size;
+      size += (plan->buffer_size[i] * (n + 1) + 15) & ~15L;
     }
-  }
-  else if (source_kind      == KIND_RGB &&
-           destination_kind == KIND_CMYK)
-  {
-    cmyka_double_buf        =
-    cmyka_double_buf_alloc  = babl_malloc (sizeof (double) * n * 5);
-    cmyka_image = babl_image_from_linear (
-        cmyka_double_buf, babl_remodel_with_space (babl_model ("cmykA"),
-        destination_space));
 
+  memory = babl_scratch_alloc (size);
+  for (i = 0; i < REFERENCE_BUFFERS; i++)
+    buffers[i] = plan->buffer_size[i] ? memory + offsets[i] : NULL;
+  return memory;
+}
+
+static void
+process_rgb_to_cmyk (const Babl *destination_space,
+                     double     *rgba,
+                     double     *cmyka,
+                     long        n)
+{
+  long i;
 #if HAVE_LCMS
-    if (destination_space->space.cmyk.lcms_profile)
+  if (destination_space->space.cmyk.lcms_profile)
+  {
+    /* lcms expect floats with normalized range 0.0-100.0 for CMYK data,
+       we also do our inversion from profile here.
+     */
+    /* use lcms for doing conversion from RGBA */
+    cmsDoTransform (destination_space->space.cmyk.lcms_from_rgba,
+       rgba, cmyka, n);
+
+    for (i = 0; i < n; i++)
     {
-      /* lcms expect floats with normalized range 0.0-100.0 for CMYK data,
-         we also do our inversion from profile here.
-       */
-      double *rgba=rgba_double_buf;
-      double *cmyka=cmyka_double_buf;
-      int i;
-      /* use lcms for doing conversion from RGBA */
-      cmsDoTransform (destination_space->space.cmyk.lcms_from_rgba,
-         rgba_double_buf, cmyka_double_buf, n);
-
-      for (i = 0; i < n; i++)
-      {
-        cmyka[i * 5 + 0] = 1.0-(cmyka[i * 5 + 0])/100.0;
-        cmyka[i * 5 + 1] = 1.0-(cmyka[i * 5 + 1])/100.0;
-        cmyka[i * 5 + 2] = 1.0-(cmyka[i * 5 + 2])/100.0;
-        cmyka[i * 5 + 3] = 1.0-(cmyka[i * 5 + 3])/100.0;
-        cmyka[i * 5 + 4] = rgba[i * 4 + 3];
-      }
+      cmyka[i * 5 + 0] = 1.0-(cmyka[i * 5 + 0])/100.0;
+      cmyka[i * 5 + 1] = 1.0-(cmyka[i * 5 + 1])/100.0;
+      cmyka[i * 5 + 2] = 1.0-(cmyka[i * 5 + 2])/100.0;
+      cmyka[i * 5 + 3] = 1.0-(cmyka[i * 5 + 3])/100.0;
+      cmyka[i * 5 + 4] = rgba[i * 4 + 3];
     }
-    else
+    return;
+  }
 #endif
-    {
-      double *rgba=rgba_double_buf;
-      double *cmyka=cmyka_double_buf;
-      int i;
-      for (i = 0; i < n; i++)
-      {
-        /* A very naive conversion - but it is usable */
-        double key=1.0;
-        cmyka[i * 5 + 0] = 1.0 - rgba[i * 4 + 0];
-        cmyka[i * 5 + 1] = 1.0 - rgba[i * 4 + 1];
-        cmyka[i * 5 + 2] = 1.0 - rgba[i * 4 + 2];
+  for (i = 0; i < n; i++)
+  {
+    /* A very naive conversion - but it is usable */
+    double key=1.0;
+    cmyka[i * 5 + 0] = 1.0 - rgba[i * 4 + 0];
+    cmyka[i * 5 + 1] = 1.0 - rgba[i * 4 + 1];
+    cmyka[i * 5 + 2] = 1.0 - rgba[i * 4 + 2];
 
-        if (cmyka[i * 5 + 0] < key) key = cmyka[i*5+0];
-        if (cmyka[i * 5 + 1] < key) key = cmyka[i*5+1];
-        if (cmyka[i * 5 + 2] < key) key = cmyka[i*5+2];
+    if (cmyka[i * 5 + 0] < key) key = cmyka[i*5+0];
+    if (cmyka[i * 5 + 1] < key) key = cmyka[i*5+1];
+    if (cmyka[i * 5 + 2] < key) key = cmyka[i*5+2];
 
-        key *= 1.0; // pullout - XXX tune default pullout?;
+    key *= 1.0; // pullout - XXX tune default pullout?;
 
-        if (key < 1.0)
-        {
-          cmyka[i * 5 + 0] = (cmyka[i * 5 + 0] - key) / (1.0-key);
-          cmyka[i * 5 + 1] = (cmyka[i * 5 + 1] - key) / (1.0-key);
-          cmyka[i * 5 + 2] = (cmyka[i * 5 + 2] - key) / (1.0-key);
-        }
-        cmyka[i * 5 + 0] = 1.0-cmyka[i * 5 + 0];
-        cmyka[i * 5 + 1] = 1.0-cmyka[i * 5 + 1];
-        cmyka[i * 5 + 2] = 1.0-cmyka[i * 5 + 2];
-        cmyka[i * 5 + 3] = 1.0-key;
-        cmyka[i * 5 + 4] = rgba[i * 4 + 3];
-      }
+    if (key < 1.0)
+    {
+      cmyka[i * 5 + 0] = (cmyka[i * 5 + 0] - key) / (1.0-key);
+      cmyka[i * 5 + 1] = (cmyka[i * 5 + 1] - key) / (1.0-key);
+      cmyka[i * 5 + 2] = (cmyka[i * 5 + 2] - key) / (1.0-key);
     }
- }
- else if (source_kind      == KIND_CMYK &&
-          destination_kind == KIND_RGB)
- {
-    /* */
-    rgba_double_buf_alloc  = babl_malloc (sizeof (double) * n * 4);
-    rgba_double_buf        = rgba_double_buf_alloc;
-    rgba_image = babl_image_from_linear (
-        rgba_double_buf, babl_remodel_with_space (babl_model_from_id (BABL_RGBA),
-        destination_space));
+    cmyka[i * 5 + 0] = 1.0-cmyka[i * 5 + 0];
+    cmyka[i * 5 + 1] = 1.0-cmyka[i * 5 + 1];
+    cmyka[i * 5 + 2] = 1.0-cmyka[i * 5 + 2];
+    cmyka[i * 5 + 3] = 1.0-key;
+    cmyka[i * 5 + 4] = rgba[i * 4 + 3];
+  }
+}
 
+static void
+process_cmyk_to_rgb (const Babl *source_space,
+                     double     *cmyka,
+                     double     *rgba,
+                     long        n)
+{
+  long i;
 #if HAVE_LCMS
-    if (source_space->space.cmyk.lcms_profile)
-    {
+  if (source_space->space.cmyk.lcms_profile)
+  {
+    /* lcms expect floats with normalized range 0.0-100.0 for CMYK data,
+       we also do our inversion from profile here.
+     */
+    for (i = 0; i < n; i++)
     {
-      /* lcms expect floats with normalized range 0.0-100.0 for CMYK data,
-         we also do our inversion from profile here.
-       */
-      double *cmyka=cmyka_double_buf;
-      int i;
-      for (i = 0; i < n; i++)
-      {
-        cmyka[i * 5 + 0] = (1.0-cmyka[i * 5 + 0])*100.0;
-        cmyka[i * 5 + 1] = (1.0-cmyka[i * 5 + 1])*100.0;
-        cmyka[i * 5 + 2] = (1.0-cmyka[i * 5 + 2])*100.0;
-        cmyka[i * 5 + 3] = (1.0-cmyka[i * 5 + 3])*100.0;
-      }
+      cmyka[i * 5 + 0] = (1.0-cmyka[i * 5 + 0])*100.0;
+      cmyka[i * 5 + 1] = (1.0-cmyka[i * 5 + 1])*100.0;
+      cmyka[i * 5 + 2] = (1.0-cmyka[i * 5 + 2])*100.0;
+      cmyka[i * 5 + 3] = (1.0-cmyka[i * 5 + 3])*100.0;
     }
     /* use lcms for doing conversion to RGBA */
     cmsDoTransform (source_space->space.cmyk.lcms_to_rgba,
-       cmyka_double_buf, rgba_double_buf, n);
+       cmyka, rgba, n);
 
+    for (i = 0; i < n; i++)
     {
-      double *rgba=rgba_double_buf;
-      double *cmyka=cmyka_double_buf;
-      int i;
-      for (i = 0; i < n; i++)
-      {
-        rgba[i * 4 + 3] = cmyka[i * 5 + 4];
-      }
-    }
+      rgba[i * 4 + 3] = cmyka[i * 5 + 4];
     }
-    else
+  }
+  else
 #endif
-    {
-      double *rgba=rgba_double_buf;
-      double *cmyka=cmyka_double_buf;
-      int i;
-      for (i = 0; i < n; i++)
-      {
-        /* A very naive conversion - but it is usable */
-        rgba[i * 4 + 0] = cmyka[i * 5 + 0]*cmyka[i*5+3];
-        rgba[i * 4 + 1] = cmyka[i * 5 + 1]*cmyka[i*5+3];
-        rgba[i * 4 + 2] = cmyka[i * 5 + 2]*cmyka[i*5+3];
-        rgba[i * 4 + 3] = cmyka[i * 5 + 4];
-      }
-    }
+  for (i = 0; i < n; i++)
+  {
+    /* A very naive conversion - but it is usable */
+    rgba[i * 4 + 0] = cmyka[i * 5 + 0]*cmyka[i*5+3];
+    rgba[i * 4 + 1] = cmyka[i * 5 + 1]*cmyka[i*5+3];
+    rgba[i * 4 + 2] = cmyka[i * 5 + 2]*cmyka[i*5+3];
+    rgba[i * 4 + 3] = cmyka[i * 5 + 4];
+  }
+}
 
-    /* color space conversions */
-     if ((babl_space ("scRGB")!=
-        ((babl->fish.destination)->format.space)))
-    {
-      double matrix[9];
-      double *rgba = rgba_double_buf;
-      babl_matrix_mul_matrix (
-        (babl->fish.destination)->format.space->space.XYZtoRGB,
-        babl_space("scRGB")->space.RGBtoXYZ,
-        matrix);
-
-      babl_matrix_mul_vector_buf4 (matrix, rgba, rgba, n);
-    }
- }
- else if (source_kind      == KIND_CMYK &&
-          destination_kind == KIND_CMYK)
- {
-    if (source_space != destination_space
-#if HAVE_LCMS
-        && source_space->space.cmyk.lcms_profile
-        && destination_space->space.cmyk.lcms_profile
-#endif
- )
-    {
+static void
+process_cmyk_to_cmyk (const BablReferencePlan *plan,
+                      double                  *cmyka,
+                      long                     n)
+{
 #if HAVE_LCMS
+  long i;
 
-#define MAX_CMYK_CMYK  64
-     static int cmyk_cmyk_count = 0;
-     static const Babl *cmyk_cmyk_source[MAX_CMYK_CMYK];
-     static const Babl *cmyk_cmyk_destination[MAX_CMYK_CMYK];
-     static cmsHTRANSFORM cmyk_cmyk_transform[MAX_CMYK_CMYK];
-
-     int cmyk_cmyk_no;
-      double *cmyka = cmyka_double_buf;
-     for (cmyk_cmyk_no = 0; cmyk_cmyk_no < cmyk_cmyk_count; cmyk_cmyk_no++)
-     {
-       if (cmyk_cmyk_source[cmyk_cmyk_no] == source_space &&
-           cmyk_cmyk_destination[cmyk_cmyk_no] == destination_space)
-         break;
-     }
-
-/* these are not defined by lcms2.h we hope that following the existing pattern of pixel-format definitions work */
-#ifndef TYPE_CMYKA_DBL
-#define TYPE_CMYKA_DBL      (FLOAT_SH(1)|COLORSPACE_SH(PT_CMYK)|EXTRA_SH(1)|CHANNELS_SH(4)|BYTES_SH(0))
-#endif
-
-     if (cmyk_cmyk_no >= cmyk_cmyk_count)
-     {
-       cmsHPROFILE src_profile = cmsOpenProfileFromMem(source_space->space.icc_profile, source_space->space.icc_length);
-       cmsHPROFILE dst_profile = cmsOpenProfileFromMem(destination_space->space.icc_profile, source_space->space.icc_length);
-
-       cmyk_cmyk_source[cmyk_cmyk_no] = source_space;
-       cmyk_cmyk_destination[cmyk_cmyk_no] = destination_space;
-       cmyk_cmyk_transform[cmyk_cmyk_no] = cmsCreateTransform(src_profile, TYPE_CMYKA_DBL,
-  dst_profile, TYPE_CMYKA_DBL,
-  INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_BLACKPOINTCOMPENSATION);
-       cmsCloseProfile (src_profile);
-       cmsCloseProfile (dst_profile);
-
-       cmyk_cmyk_count ++;
-     }
-      for (int i = 0; i < n; i++)
-      {
-        cmyka[i * 5 + 0] = (1.0-cmyka[i * 5 + 0])*100.0;
-        cmyka[i * 5 + 1] = (1.0-cmyka[i * 5 + 1])*100.0;
-        cmyka[i * 5 + 2] = (1.0-cmyka[i * 5 + 2])*100.0;
-        cmyka[i * 5 + 3] = (1.0-cmyka[i * 5 + 3])*100.0;
-      }
+  if (!plan->cmyk_transform)
+    return;
 
-     cmsDoTransform (cmyk_cmyk_transform[cmyk_cmyk_no],
-                     cmyka_double_buf, cmyka_double_buf, n);
+  for (i = 0; i < n; i++)
+  {
+    cmyka[i * 5 + 0] = (1.0-cmyka[i * 5 + 0])*100.0;
+    cmyka[i * 5 + 1] = (1.0-cmyka[i * 5 + 1])*100.0;
+    cmyka[i * 5 + 2] = (1.0-cmyka[i * 5 + 2])*100.0;
+    cmyka[i * 5 + 3] = (1.0-cmyka[i * 5 + 3])*100.0;
+  }
 
-      for (int i = 0; i < n; i++)
-      {
-        cmyka[i * 5 + 0] = 1.0-(cmyka[i * 5 + 0])/100.0;
-        cmyka[i * 5 + 1] = 1.0-(cmyka[i * 5 + 1])/100.0;
-        cmyka[i * 5 + 2] = 1.0-(cmyka[i * 5 + 2])/100.0;
-        cmyka[i * 5 + 3] = 1.0-(cmyka[i * 5 + 3])/100.0;
-      }
+  cmsDoTransform (plan->cmyk_transform, cmyka, cmyka, n);
 
+  for (i = 0; i < n; i++)
+  {
+    cmyka[i * 5 + 0] = 1.0-(cmyka[i * 5 + 0])/100.0;
+    cmyka[i * 5 + 1] = 1.0-(cmyka[i * 5 + 1])/100.0;
+    cmyka[i * 5 + 2] = 1.0-(cmyka[i * 5 + 2])/100.0;
+    cmyka[i * 5 + 3] = 1.0-(cmyka[i * 5 + 3])/100.0;
+  }
 #endif
-     }
- }
-
+}
 
-  switch (destination_kind) /* XXX: the cases can share logic */
-  {
-    case KIND_CMYK:
-      {
-        const Babl *destination_cmyka_format =
-          babl_remodel_with_space (babl_model ("cmykA"), destination_space);
-        if(BABL (babl->fish.destination)->format.model == (void*)destination_cmyka_format)
-        {
-           destination_double_buf = cmyka_double_buf;
-        }
-        else
-        {
-          Babl *conv =
-            assert_conversion_find (destination_cmyka_format,
-                             BABL (babl->fish.destination)->format.model);
-          destination_double_buf =
-          destination_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                          BABL (babl->fish.destination)->format.model->components);
-          if (conv->class_type == BABL_CONVERSION_PLANAR)
-          {
-            destination_image = babl_image_from_linear (
-              destination_double_buf, BABL (BABL ((babl->fish.destination))->format.model));
-            babl_conversion_process (conv,
-              (void*)cmyka_image, (void*)destination_image, n);
-          }
-          else if (conv->class_type == BABL_CONVERSION_LINEAR)
-          {
-            babl_conversion_process (conv,
-                           cmyka_double_buf, destination_double_buf, n);
-          }
-          else
-          {
-            babl_fatal ("oops");
-          }
-        }
-     }
-     break;
-  case KIND_RGB:
-      {
-        const Babl *destination_rgba_format =
-          babl_remodel_with_space (babl_model_from_id (BABL_RGBA),
-               destination_space);
+static void
+babl_fish_reference_process_double (const Babl *babl,
+                                    const char *source,
+                                    char       *destination,
+                                    long        n)
+{
+  const BablReferencePlan *plan = babl->fish_reference.plan;
+  char *buffers[REFERENCE_BUFFERS];
+  void *memory = reference_buffers (plan, n, buffers);
+  char *source_double_buf      = buffers[0];
+  char *model_double_buf       = buffers[1];  /* in the model of the source kind */
+  char *other_double_buf       = buffers[2];  /* in the model of the other kind */
+  char *destination_double_buf = buffers[3];
+
+  if (plan->source_direct)
+    source_double_buf = (char *) source;
+  else
+    process_types (&plan->unpack, source, source_double_buf, n);
 
-        if(BABL (babl->fish.destination)->format.model == (void*)destination_rgba_format)
-        {
-           destination_double_buf = rgba_double_buf;
-        }
-        else
-        {
-        Babl *conv =
-          assert_conversion_find (destination_rgba_format,
-             BABL (babl->fish.destination)->format.model);
-           destination_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                            BABL (babl->fish.destination)->format.model->components);
-           destination_double_buf = destination_double_buf_alloc;
-
-        if (conv->class_type == BABL_CONVERSION_PLANAR)
-          {
-            destination_image = babl_image_from_linear (
-              destination_double_buf, BABL (BABL ((babl->fish.destination))->format.model));
-            babl_conversion_process (
-              conv,
-              (void*)rgba_image, (void*)destination_image,
-              n);
-          }
-        else if (conv->class_type == BABL_CONVERSION_LINEAR)
-          {
-            babl_conversion_process (
-              conv,
-              rgba_double_buf, destination_double_buf,
-              n);
-          }
-        else
-          {
-            babl_fatal ("oops");
-          }
-        }
-     }
-   break;
-  }
-  babl_mutex_unlock (babl_reference_mutex);
+  if (!model_double_buf)
+    model_double_buf = source_double_buf;  /* the source is "cmykA" */
+  else
+    process_model_conversion (
+      assert_conversion (plan->to_model, babl->fish.source->format.model,
+                         plan->source_model),
+      source_double_buf, plan->source_components,
+      model_double_buf, plan->source_model->model.components,
+      sizeof (double), n);
+
+  if (plan->source_kind == KIND_RGB &&
+      plan->destination_kind == KIND_CMYK)
+    process_rgb_to_cmyk (babl->fish.destination->format.space,
+                         (void*)model_double_buf,
+                         (void*)other_double_buf, n);
+  else if (plan->source_kind == KIND_CMYK &&
+           plan->destination_kind == KIND_RGB)
+    process_cmyk_to_rgb (babl->fish.source->format.space,
+                         (void*)model_double_buf,
+                         (void*)other_double_buf, n);
+  else if (plan->source_kind == KIND_CMYK)
+    process_cmyk_to_cmyk (plan, (void*)model_double_buf, n);
+
+  if (!other_double_buf)
+    other_double_buf = model_double_buf;
+
+  /* color space conversions */
+  if (plan->has_matrix)
+    babl_matrix_mul_vector_buf4 (plan->matrix, (void*)other_double_buf,
+                                 (void*)other_double_buf, n);
+
+  if (!destination_double_buf)
+    destination_double_buf = other_double_buf;
+  else
+    process_model_conversion (
+      assert_conversion (plan->from_model, plan->destination_model,
+                         babl->fish.destination->format.model),
+      other_double_buf, plan->destination_model->model.components,
+      destination_double_buf, plan->destination_components,
+      sizeof (double), n);
 
  /* convert from double model backing target pixel format to final representation */
-  convert_from_double (
-    (BablFormat *) BABL (babl->fish.source),
-    (BablFormat *) BABL (babl->fish.destination),
-    destination_double_buf,
-    destination,
-    n
-  );
-
-  if (destination_double_buf_alloc)
-    babl_free (destination_double_buf_alloc);
-  if (rgba_double_buf_alloc)
-    babl_free (rgba_double_buf_alloc);
-  if (cmyka_double_buf_alloc)
-    babl_free (cmyka_double_buf_alloc);
-  if (source_double_buf_alloc)
-    babl_free (source_double_buf_alloc);
-  if (source_image)
-    babl_free (source_image);
-  if (rgba_image)
-    babl_free (rgba_image);
-  if (cmyka_image)
-    babl_free (cmyka_image);
-  if (destination_image)
-    babl_free (destination_image);
+  process_types (&plan->pack, destination_double_buf, destination, n);
+
+  babl_scratch_free (memory);
 }
 
 static void
 babl_fish_reference_process_float (const Babl *babl,
                                    const char *source,
                                    char       *destination,
-                                   long        n,
-                                   void       *data)
+                                   long        n)
 {
-  const void *type_float = babl_type_from_id (BABL_FLOAT);
-    Babl *source_image = NULL;
-    Babl *rgba_image = NULL;
-    Babl *destination_image = NULL;
-    void *source_float_buf_alloc = NULL;
-    void *source_float_buf;
-    void *rgba_float_buf_alloc = NULL;
-    void *rgba_float_buf;
-    void *destination_float_buf_alloc = NULL;
-    void *destination_float_buf;
-    const Babl *destination_float_format;
-    Babl *conv_to_rgba;
-    Babl *conv_from_rgba;
-    char dst_name[256];
-
-
-    {
-    char src_name[256];
-    sprintf (src_name, "%s float", babl_get_name((void*)babl->fish.source->format.model));
-    conv_to_rgba =
-        babl_conversion_find (
-        babl_format_with_space (src_name,
-                   BABL (BABL ((babl->fish.source))->format.space)),
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.source))->format.space)));
-    }
-    {
-      sprintf (dst_name, "%s float", babl_get_name((void*)babl->fish.destination->format.model));
-      destination_float_format =
-        babl_format_with_space (dst_name,
-                   BABL (BABL ((babl->fish.destination))->format.space));
-      conv_from_rgba  =
-        babl_conversion_find (
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.destination))->format.space)),
-                   destination_float_format);
-    }
-
-    if (!conv_to_rgba || !conv_from_rgba)
-    {
-      /* needed float conversions not found, using double code path instead */
-      babl_fish_reference_process_double (babl, source, destination, n, data);
-      return;
-    }
-
-    babl_mutex_lock (babl_reference_mutex);
-    if (babl->fish.source->format.type[0] == type_float &&
-        BABL(babl->fish.source)->format.components ==
-        BABL(babl->fish.source)->format.model->components && 0)
-    {
-      source_float_buf = (void*)source;
-      source_image = babl_image_from_linear (
-         source_float_buf,
-         babl_format_with_model_as_type ((void*)((babl->fish.source))->format.model,
-         type_float));
-    }
-    else
-    {
-      /* the +1 is to mask a valgrind 'invalid read of size 16' false positive  */
-      source_float_buf_alloc = babl_malloc (sizeof (float) * (n+1) *
-                                  (BABL (babl->fish.source)->format.model->components));
-
-      source_float_buf = source_float_buf_alloc;
-      source_image = babl_image_from_linear (
-        source_float_buf,
-      babl_format_with_model_as_type (BABL(BABL ((babl->fish.source))->format.model),
-         type_float));
-      convert_to_float (
-        (BablFormat *) BABL (babl->fish.source),
-        source,
-        source_float_buf,
-        n
-      );
-    }
-
-    if (babl_model_is ((void*)babl->fish.source->format.model, "RGBA") && 0)
-    {
-      rgba_float_buf = source_float_buf;
-      rgba_image = babl_image_from_linear (
-          rgba_float_buf,
-          (void*)babl->fish.source->format.model);
-    }
-    else
-    {
-      rgba_float_buf_alloc  = babl_malloc (sizeof (float) * n * 4);
-      rgba_float_buf        = rgba_float_buf_alloc;
-
-      rgba_image = babl_image_from_linear (
-          rgba_float_buf,
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.source))->format.space)));
-
-
-    if (conv_to_rgba->class_type == BABL_CONVERSION_PLANAR)
-      {
-        babl_conversion_process (
-          conv_to_rgba,
-          (void*)source_image, (void*)rgba_image,
-          n);
-      }
-    else if (conv_to_rgba->class_type == BABL_CONVERSION_LINEAR)
-      {
-        babl_conversion_process (
-          conv_to_rgba,
-          source_float_buf, rgba_float_buf,
-          n);
-      }
-    }
-    babl_mutex_unlock (babl_reference_mutex);
-
-    if (((babl->fish.source)->format.space !=
-        ((babl->fish.destination)->format.space)))
-    {
-      float matrix[9];
-      float *rgba = rgba_float_buf;
-      babl_matrix_mul_matrixf (
-        (babl->fish.destination)->format.space->space.XYZtoRGBf,
-        (babl->fish.source)->format.space->space.RGBtoXYZf,
-        matrix);
-
-      babl_matrix_mul_vectorff_buf4 (matrix, rgba, rgba, n);
-    }
+  const BablReferencePlan *plan = babl->fish_reference.plan;
+  char *buffers[REFERENCE_BUFFERS];
+  void *memory = reference_buffers (plan, n, buffers);
+  char *source_float_buf      = buffers[0];
+  char *rgba_float_buf        = buffers[1];
+  char *destination_float_buf = buffers[3];
+
+  process_types (&plan->unpack, source, source_float_buf, n);
+
+  process_model_conversion (plan->to_model,
+                            source_float_buf, plan->source_components,
+                            rgba_float_buf, 4, sizeof (float), n);
+
+#if defined(USE_AVX2) && defined(USE_FMA)
+  if (plan->avx2_matrix)
+    babl_matrix_mul_vectorff_buf4_avx2 (plan->matrixf, (void*)rgba_float_buf,
+                                        (void*)rgba_float_buf, n);
+  else
+#endif
+  if (plan->has_matrix)
+    babl_matrix_mul_vectorff_buf4 (plan->matrixf, (void*)rgba_float_buf,
+                                   (void*)rgba_float_buf, n);
 
-    {
-      if(babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.destination))->format.space)) ==
-         babl_format_with_space (dst_name,
-                   BABL (BABL ((babl->fish.destination))->format.space)))
-      {
-        destination_float_buf = rgba_float_buf;
-      }
-      else
-      {
-        destination_float_buf_alloc = babl_malloc (sizeof (float) * n *
-                                        BABL (babl->fish.destination)->format.model->components);
-        destination_float_buf = destination_float_buf_alloc;
+  if (!destination_float_buf)
+    destination_float_buf = rgba_float_buf;
+  else
+    process_model_conversion (plan->from_model,
+                              rgba_float_buf, 4,
+                              destination_float_buf,
+                              plan->destination_components,
+                              sizeof (float), n);
 
-        if (conv_from_rgba->class_type == BABL_CONVERSION_PLANAR)
-        {
-           destination_image = babl_image_from_linear (
-             destination_float_buf, destination_float_format);
-             babl_conversion_process (
-               conv_from_rgba,
-               (void*)rgba_image, (void*)destination_image,
-             n);
-        }
-        else if (conv_from_rgba->class_type == BABL_CONVERSION_LINEAR)
-        {
-          babl_conversion_process (conv_from_rgba, rgba_float_buf,
-                                   destination_float_buf, n);
-        }
-      }
-    }
+  process_types (&plan->pack, destination_float_buf, destination, n);
 
-    convert_from_float (
-      (BablFormat *) BABL (babl->fish.source),
-      (BablFormat *) BABL (babl->fish.destination),
-      destination_float_buf,
-      destination,
-      n
-    );
-
-    if (destination_float_buf_alloc)
-      babl_free (destination_float_buf_alloc);
-    if (rgba_float_buf_alloc)
-      babl_free (rgba_float_buf_alloc);
-    if (source_float_buf_alloc)
-      babl_free (source_float_buf_alloc);
-    if (source_image)
-      babl_free (source_image);
-    if (rgba_image)
-      babl_free (rgba_image);
-    if (destination_image)
-      babl_free (destination_image);
+  babl_scratch_free (memory);
 }
 
 void
@@ -1384,71 +1069,35 @@ babl_fish_reference_process (const Babl *babl,
                              long        n,
                              void       *data)
 {
-  static const void *type_float = NULL;
-  static int allow_float_reference = -1;
-
-  if (!type_float) type_float = babl_type_from_id (BABL_FLOAT);
+  const BablReferencePlan *plan = babl->fish_reference.plan;
 
-  /* same format in source/destination */
-  if (BABL (babl->fish.source) == BABL (babl->fish.destination))
+  switch (plan->kind)
   {
-    if (source == destination)
-    {
-      memcpy (destination, source, n * babl->fish.source->format.bytes_per_pixel);
-    }
-    return;
-  }
-
-  /* same model and space, only convert type */
-  if ((BABL (babl->fish.source)->format.model ==
-       BABL (babl->fish.destination)->format.model) &&
-      (BABL (babl->fish.source)->format.space ==
-       BABL (babl->fish.destination)->format.space)
-      )
-  {
-    process_same_model (babl, source, destination, n);
-    return;
-  }
-
-  /* we're converting to a n_component format - special case   */
-  if (babl_format_is_format_n (BABL (babl->fish.destination)))
-  {
-    process_to_n_component (babl, source, destination, n);
-    return;
-  }
+    case REFERENCE_COPY:
+      if (source != destination)
+        memcpy (destination, source, n * babl->fish.source->format.bytes_per_pixel);
+      break;
 
-  if (format_has_cmyk_model (babl->fish.source) ||
-      format_has_cmyk_model (babl->fish.destination))
-  {
-    babl_fish_reference_process_double (babl, source, destination, n, data);
-    return;
-  }
+    case REFERENCE_TYPES:
+    case REFERENCE_COMPONENTS:
+      {
+        char *buffers[REFERENCE_BUFFERS];
+        void *memory = reference_buffers (plan, n, buffers);
+
+        if (plan->kind == REFERENCE_COMPONENTS)
+          memset (buffers[0], 0, plan->buffer_size[0] * n);
+        process_types (&plan->unpack, source, buffers[0], n);
+        process_types (&plan->pack, buffers[0], destination, n);
+        babl_scratch_free (memory);
+      }
+      break;
 
-  if (allow_float_reference == -1)
-    allow_float_reference = getenv ("BABL_REFERENCE_NOFLOAT") ? 0 : 1;
+    case REFERENCE_FLOAT:
+      babl_fish_reference_process_float (babl, source, destination, n);
+      break;
 
-  /* both source and destination are either single precision float or <32bit component,
-     we then do a similar to the double reference - using the first registered
-     float conversions - note that this makes the first registered float conversion of
-     a given type a reference, and we thus rely on the *first* float conversion regsitered
-     to be correct, this will be the case if the code paths are duplicated and we register
-     either a planar or linear conversion to and from "RGBA float" at the same time as
-     registering conversions for double. When needed conversions do not exist, we defer
-     to the double code paths
-   */
-  if (allow_float_reference &&
-      (babl->fish.source->format.type[0]->bits < 32 ||
-      babl->fish.source->format.type[0] == type_float) &&
-      (babl->fish.destination->format.type[0]->bits < 32 ||
-      babl->fish.destination->format.type[0] == type_float) &&
-      !babl_format_is_palette (babl->fish.source) &&
-      !babl_format_is_palette (babl->fish.destination))
-  {
-    babl_fish_reference_process_float (babl, source, destination, n, data);
-  }
-  else /*   double  */
-  {
-    babl_fish_reference_process_double (babl, source, destination, n, data);
+    case REFERENCE_DOUBLE:
+      babl_fish_reference_process_double (babl, source, destination, n);
+      break;
   }
-
 }
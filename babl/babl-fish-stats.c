@@ -0,0 +1,276 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Runtime statistics of fishes, enabled with the BABL_STATS environment
+ * variable. The counters of a fish are split into shards, each on cache
+ * lines of its own; a thread always adds to the same shard, so threads
+ * using the same fish rarely touch the same cache line. Reading the
+ * statistics sums up the shards. The counters of a fish are allocated
+ * when it is first used with statistics enabled, and are prepended to a
+ * list that babl_fish_stats_foreach () walks without locking. The counters
+ * of freed fishes are detached and taken off the list when releasing a
+ * space, which other threads must not overlap with.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#define STATS_SHARDS 16
+
+typedef union
+{
+  struct
+  {
+    int64_t calls;
+    int64_t pixels;
+    int64_t nanoseconds;
+    int64_t step_nanoseconds[BABL_FISH_STATS_MAX_STEPS];
+  } counts;
+  char cache_lines[128];
+} StatsShard;
+
+struct _BablFishStatsBlock
+{
+  BablFishStatsBlock *next;
+  const Babl         *fish;
+  StatsShard  shards[STATS_SHARDS];
+};
+
+int babl_fish_stats_level = 0;
+
+static BablMutex          *stats_mutex;
+static BablFishStatsBlock *stats_blocks;
+static int                 stats_next_shard;
+
+#ifdef HAVE_TLS
+static __thread int stats_shard = -1;
+#endif
+
+static inline int
+get_shard (void)
+{
+#ifdef HAVE_TLS
+  if (stats_shard < 0)
+    stats_shard = __atomic_fetch_add (&stats_next_shard, 1, __ATOMIC_RELAXED) %
+                  STATS_SHARDS;
+  return stats_shard;
+#else
+  return 0;
+#endif
+}
+
+static BablFishStatsBlock *
+get_block (Babl *fish)
+{
+  BablFishStatsBlock *block = __atomic_load_n (&fish->fish.stats,
+                                               __ATOMIC_ACQUIRE);
+  if (block)
+    return block;
+
+  babl_mutex_lock (stats_mutex);
+  block = fish->fish.stats;
+  if (!block)
+    {
+      block = babl_calloc (1, sizeof (BablFishStatsBlock));
+      block->fish = fish;
+      block->next = stats_blocks;
+      __atomic_store_n (&stats_blocks, block, __ATOMIC_RELEASE);
+      __atomic_store_n (&fish->fish.stats, block, __ATOMIC_RELEASE);
+    }
+  babl_mutex_unlock (stats_mutex);
+  return block;
+}
+
+void
+_babl_fish_stats_add (const Babl *fish,
+                      long        pixels,
+                      int64_t     nanoseconds)
+{
+  StatsShard *shard = &get_block ((Babl *) fish)->shards[get_shard ()];
+
+  __atomic_fetch_add (&shard->counts.calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&shard->counts.pixels, pixels, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&shard->counts.nanoseconds, nanoseconds,
+                      __ATOMIC_RELAXED);
+}
+
+void
+_babl_fish_stats_add_step (const Babl *fish,
+                           int         step,
+                           int64_t     nanoseconds)
+{
+  StatsShard *shard = &get_block ((Babl *) fish)->shards[get_shard ()];
+
+  if (step < BABL_FISH_STATS_MAX_STEPS)
+    __atomic_fetch_add (&shard->counts.step_nanoseconds[step], nanoseconds,
+                        __ATOMIC_RELAXED);
+}
+
+static void
+sum_shards (const BablFishStatsBlock *block,
+            int                       step,
+            BablFishStats            *stats)
+{
+  int i;
+
+  memset (stats, 0, sizeof (BablFishStats));
+  if (!block)
+    return;
+
+  for (i = 0; i < STATS_SHARDS; i++)
+    {
+      const StatsShard *shard = &block->shards[i];
+
+      stats->calls  += __atomic_load_n (&shard->counts.calls, __ATOMIC_RELAXED);
+      stats->pixels += __atomic_load_n (&shard->counts.pixels, __ATOMIC_RELAXED);
+      if (step < 0)
+        stats->nanoseconds += __atomic_load_n (&shard->counts.nanoseconds,
+                                               __ATOMIC_RELAXED);
+      else
+        stats->nanoseconds +=
+          __atomic_load_n (&shard->counts.step_nanoseconds[step],
+                           __ATOMIC_RELAXED);
+    }
+}
+
+long
+_babl_fish_stats_pixels (const Babl *fish)
+{
+  BablFishStats stats;
+
+  sum_shards (__atomic_load_n (&fish->fish.stats, __ATOMIC_ACQUIRE), -1,
+              &stats);
+  return stats.pixels;
+}
+
+int
+babl_fish_get_stats (const Babl    *fish,
+                     BablFishStats *stats)
+{
+  sum_shards (__atomic_load_n (&fish->fish.stats, __ATOMIC_ACQUIRE), -1,
+              stats);
+  return babl_fish_stats_level > 0;
+}
+
+int
+babl_fish_get_step_stats (const Babl     *fish,
+                          int             step,
+                          const Babl    **conversion,
+                          BablFishStats  *stats)
+{
+  BablList *list;
+
+  if (fish->class_type != BABL_FISH_PATH || step < 0 ||
+      step >= BABL_FISH_STATS_MAX_STEPS)
+    return 0;
+
+  list = fish->fish_path.conversion_list;
+  if (step >= babl_list_size (list))
+    return 0;
+
+  if (conversion)
+    *conversion = list->items[step];
+
+  /* single conversion paths dispatch straight to the conversion, the time
+   * of the fish is that of its only step
+   */
+  sum_shards (__atomic_load_n (&fish->fish.stats, __ATOMIC_ACQUIRE),
+              babl_list_size (list) == 1 ? -1 : step, stats);
+  return 1;
+}
+
+void
+_babl_fish_stats_forget (const Babl *fish)
+{
+  babl_mutex_lock (stats_mutex);
+  if (fish->fish.stats)
+    __atomic_store_n (&fish->fish.stats->fish, NULL, __ATOMIC_RELEASE);
+  babl_mutex_unlock (stats_mutex);
+}
+
+void
+_babl_fish_stats_free_forgotten (void)
+{
+  BablFishStatsBlock **link;
+
+  babl_mutex_lock (stats_mutex);
+  link = &stats_blocks;
+  while (*link)
+    {
+      BablFishStatsBlock *block = *link;
+
+      if (block->fish)
+        {
+          link = &block->next;
+          continue;
+        }
+      __atomic_store_n (link, block->next, __ATOMIC_RELEASE);
+      babl_free (block);
+    }
+  babl_mutex_unlock (stats_mutex);
+}
+
+void
+babl_fish_stats_foreach (BablFishStatsFunc func,
+                         void             *user_data)
+{
+  BablFishStatsBlock *block;
+
+  for (block = __atomic_load_n (&stats_blocks, __ATOMIC_ACQUIRE);
+       block; block = block->next)
+    {
+      const Babl    *fish = __atomic_load_n (&block->fish, __ATOMIC_ACQUIRE);
+      BablFishStats  stats;
+
+      if (!fish)
+        continue;
+      sum_shards (block, -1, &stats);
+      if (func (fish, &stats, user_data))
+        return;
+    }
+}
+
+void
+babl_fish_stats_init (void)
+{
+  const char *env = getenv ("BABL_STATS");
+
+  stats_mutex  = babl_mutex_new ();
+  stats_blocks = NULL;
+
+  if (env && !strcmp (env, "steps"))
+    babl_fish_stats_level = 2;
+  else if (env && env[0] != '\0' && strcmp (env, "0"))
+    babl_fish_stats_level = 1;
+  else if (getenv ("BABL_INSTRUMENT") && getenv ("BABL_INSTRUMENT")[0])
+    babl_fish_stats_level = 1; /* which used to count the pixels of fishes */
+  else
+    babl_fish_stats_level = 0;
+}
+
+void
+babl_fish_stats_destroy (void)
+{
+  while (stats_blocks)
+    {
+      BablFishStatsBlock *next = stats_blocks->next;
+      babl_free (stats_blocks);
+      stats_blocks = next;
+    }
+  babl_mutex_destroy (stats_mutex);
+}
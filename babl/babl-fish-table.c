@@ -0,0 +1,254 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Lookup table mapping a pair of source and destination formats to the fish
+ * babl_fish () hands out for them, built for many concurrent readers and
+ * rare writers.
+ *
+ * The table uses open addressing with linear probing and is kept at most
+ * half full, so a probe always ends at an empty slot. Slots are never
+ * emptied; a writer fills in the destination and the fish of a slot before
+ * publishing it by storing the source, readers take no locks and stop at
+ * the first slot without a source. Removed fishes leave their slot with
+ * the source and without a destination, which no lookup matches, until
+ * the table is next rebuilt. Rebuilding copies the live slots into a new
+ * table which is then published in one pointer store; readers that still
+ * hold the old table keep seeing a consistent snapshot. The new table is
+ * twice the size, or the same size when most of the used slots were left
+ * by removed fishes, so spaces coming and going do not grow the table.
+ * Old tables are kept until babl_fish_table_free_retired (), since there
+ * is no cheap way of knowing when the last reader has left them.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#define FISH_TABLE_INITIAL_SIZE 512
+
+typedef struct FishTableSlot
+{
+  const Babl *source;      /* published last, NULL for empty slots */
+  const Babl *destination;
+  const Babl *fish;
+} FishTableSlot;
+
+typedef struct FishTable
+{
+  struct FishTable *retired;  /* the table this one replaced */
+  unsigned long     mask;
+  long              count;    /* used slots, live ones and left ones */
+  long              live;     /* slots with a fish */
+  FishTableSlot     slots[];
+} FishTable;
+
+static FishTable *fish_table;
+static BablMutex *fish_table_mutex;
+
+static inline unsigned long
+fish_table_hash (const Babl *source,
+                 const Babl *destination)
+{
+  /* babl objects are heap allocated, so the low bits carry little
+   * information, fold the pointers with a multiplicative mix.
+   */
+  uint64_t hash = ((uint64_t)(size_t) source * 0x9E3779B97F4A7C15ull) ^
+                  ((uint64_t)(size_t) destination);
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ull;
+  hash ^= hash >> 32;
+  return (unsigned long) hash;
+}
+
+static FishTable *
+fish_table_new (unsigned long size)
+{
+  FishTable *table = babl_calloc (1, sizeof (FishTable) +
+                                     size * sizeof (FishTableSlot));
+  table->mask = size - 1;
+  return table;
+}
+
+/* must be called with fish_table_mutex held, on a table not yet visible
+ * to readers or on the current table.
+ */
+static void
+fish_table_store (FishTable  *table,
+                  const Babl *source,
+                  const Babl *destination,
+                  const Babl *fish)
+{
+  unsigned long i = fish_table_hash (source, destination) & table->mask;
+
+  for (;; i = (i + 1) & table->mask)
+    {
+      FishTableSlot *slot = &table->slots[i];
+
+      if (slot->source == NULL)
+        {
+          slot->destination = destination;
+          __atomic_store_n (&slot->fish, fish, __ATOMIC_RELEASE);
+          __atomic_store_n (&slot->source, source, __ATOMIC_RELEASE);
+          table->count++;
+          table->live++;
+          return;
+        }
+      if (slot->source == source && slot->destination == destination)
+        {
+          if (slot->fish != fish)
+            {
+              __atomic_store_n (&slot->fish, fish, __ATOMIC_RELEASE);
+              babl_fish_cache_invalidate ();
+            }
+          return;
+        }
+    }
+}
+
+const Babl *
+babl_fish_table_lookup (const Babl *source,
+                        const Babl *destination)
+{
+  FishTable     *table = __atomic_load_n (&fish_table, __ATOMIC_ACQUIRE);
+  unsigned long  i;
+
+  if (!table)
+    return NULL;
+
+  i = fish_table_hash (source, destination) & table->mask;
+  for (;; i = (i + 1) & table->mask)
+    {
+      const FishTableSlot *slot = &table->slots[i];
+      const Babl          *slot_source;
+
+      slot_source = __atomic_load_n (&slot->source, __ATOMIC_ACQUIRE);
+      if (slot_source == NULL)
+        return NULL;
+      if (slot_source == source && slot->destination == destination)
+        return __atomic_load_n (&slot->fish, __ATOMIC_ACQUIRE);
+    }
+}
+
+void
+babl_fish_table_insert (const Babl *source,
+                        const Babl *destination,
+                        const Babl *fish)
+{
+  FishTable *table;
+
+  babl_mutex_lock (fish_table_mutex);
+  table = fish_table;
+
+  if ((table->count + 1) * 2 > (long) table->mask + 1)
+    {
+      unsigned long  size = table->mask + 1;
+      FishTable     *rebuilt;
+      unsigned long  i;
+
+      /* less than a quarter of the slots live, the rest are left by
+       * removed fishes
+       */
+      if ((table->live + 1) * 4 > (long) size)
+        size *= 2;
+
+      rebuilt = fish_table_new (size);
+      for (i = 0; i <= table->mask; i++)
+        if (table->slots[i].source && table->slots[i].destination)
+          fish_table_store (rebuilt, table->slots[i].source,
+                                     table->slots[i].destination,
+                                     table->slots[i].fish);
+      rebuilt->retired = table;
+      __atomic_store_n (&fish_table, rebuilt, __ATOMIC_RELEASE);
+      table = rebuilt;
+    }
+
+  fish_table_store (table, source, destination, fish);
+  babl_mutex_unlock (fish_table_mutex);
+}
+
+void
+babl_fish_table_remove_matching (BablEachFunction match,
+                                 void            *user_data)
+{
+  FishTable     *table;
+  unsigned long  i;
+
+  babl_mutex_lock (fish_table_mutex);
+  table = fish_table;
+  for (i = 0; i <= table->mask; i++)
+    {
+      FishTableSlot *slot = &table->slots[i];
+
+      if (slot->source && slot->destination &&
+          match ((Babl *) slot->fish, user_data))
+        {
+          __atomic_store_n (&slot->destination, NULL, __ATOMIC_RELEASE);
+          __atomic_store_n (&slot->fish, NULL, __ATOMIC_RELEASE);
+          table->live--;
+        }
+    }
+  babl_mutex_unlock (fish_table_mutex);
+  babl_fish_cache_invalidate ();
+}
+
+void
+babl_fish_table_free_retired (void)
+{
+  FishTable *retired;
+
+  babl_mutex_lock (fish_table_mutex);
+  retired = fish_table->retired;
+  fish_table->retired = NULL;
+  babl_mutex_unlock (fish_table_mutex);
+
+  while (retired)
+    {
+      FishTable *next = retired->retired;
+      babl_free (retired);
+      retired = next;
+    }
+}
+
+long
+babl_fish_table_size (void)
+{
+  FishTable *table = __atomic_load_n (&fish_table, __ATOMIC_ACQUIRE);
+
+  return table ? (long) table->mask + 1 : 0;
+}
+
+void
+babl_fish_table_init (void)
+{
+  fish_table_mutex = babl_mutex_new ();
+  fish_table       = fish_table_new (FISH_TABLE_INITIAL_SIZE);
+}
+
+void
+babl_fish_table_destroy (void)
+{
+  FishTable *table = fish_table;
+
+  fish_table = NULL;
+  while (table)
+    {
+      FishTable *retired = table->retired;
+      babl_free (table);
+      table = retired;
+    }
+  babl_mutex_destroy (fish_table_mutex);
+}
@@ -37,6 +37,49 @@ typedef struct _BablFindFish
 } _BablFishFish;
 
 
+/* bumped whenever a fish handed out earlier might no longer be the right
+ * one for its arguments, invalidating the per-thread caches below.
+ */
+static long babl_fish_generation = 1;
+
+#ifdef HAVE_TLS
+
+/* a small direct-mapped cache of recent babl_fish () calls per thread that
+ * name one or both formats, sparing the babl_format () lookups. It is
+ * keyed on the argument pointers as passed, and the names are compared as
+ * well since a caller might reuse a buffer for different names. Calls with
+ * two formats go straight to the lock-free fish table, which is cheaper
+ * than getting at thread local storage from a shared library.
+ */
+#define FISH_CACHE_SIZE 64 /* the index below takes the top 6 bits of a hash */
+
+typedef struct FishCacheEntry
+{
+  const void *source;
+  const void *destination;
+  const Babl *fish;
+  long        generation;
+} FishCacheEntry;
+
+static __thread FishCacheEntry fish_cache[FISH_CACHE_SIZE];
+
+static inline FishCacheEntry *
+fish_cache_entry (const void *source,
+                  const void *destination)
+{
+  uint32_t hash = (uint32_t)(((size_t) source >> 3) * 31 +
+                             ((size_t) destination >> 3)) * 0x9E3779B1u;
+  return &fish_cache[hash >> 26];
+}
+
+#endif
+
+void
+babl_fish_cache_invalidate (void)
+{
+  __atomic_add_fetch (&babl_fish_generation, 1, __ATOMIC_RELEASE);
+}
+
 static int
 match_conversion (Babl *conversion,
                   void *inout);
@@ -194,12 +237,142 @@ babl_fish_get_id (const Babl *source,
   return id;
 }
 
+/* looks up or creates the fish babl_fish () returns for a pair of formats,
+ * must be called with babl_fish_mutex held.
+ */
+static const Babl *
+babl_fish_find (const Babl *source_format,
+                const Babl *destination_format)
+{
+  int            hashval;
+  BablHashTable *id_htable;
+  BablFindFish   ffish = {(Babl *) NULL,
+                          (Babl *) NULL,
+                          (Babl *) NULL,
+                          0,
+                          (Babl *) NULL,
+                          (Babl *) NULL};
+
+  /* some vendor compilers can't compile non-constant elements of
+   * compound struct initializers
+   */
+  ffish.source = source_format;
+  ffish.destination = destination_format;
+
+  id_htable = (babl_fish_db ())->id_hash;
+  hashval = babl_hash_by_int (id_htable, babl_fish_get_id (source_format, destination_format));
+
+  if (source_format == destination_format)
+    {
+      /* In the case of equal source and destination formats
+       * we will search through the fish database for reference fish
+       * to handle the memcpy */
+      babl_hash_table_find (id_htable, hashval, find_memcpy_fish, (void *) &ffish);
+    }
+  else
+    {
+      /* In the case of different source and destination formats
+       * we will search through the fish database for appropriate fish path
+       * to handle the conversion. In the case that preexistent
+       * fish path is found, we'll return it. In the case BABL_FISH
+       * instance with the same source/destination is found, we'll
+       * return reference fish.
+       * In the case neither fish path nor BABL_FISH path are found,
+       * we'll try to construct new fish path for requested
+       * source/destination. In the case new fish path is found, we'll
+       * return it, otherwise we'll create dummy BABL_FISH instance and
+       * insert it into the fish database to indicate non-existent fish
+       * path.
+       */
+      babl_hash_table_find (id_htable, hashval, find_fish_path, (void *) &ffish);
+
+      /* fishes from the on-disk cache are only created when first asked for */
+      if (!ffish.fish_path && !ffish.fish_fish &&
+          babl_fish_cache_materialize (source_format, destination_format, 0.0))
+        {
+          ffish.fishes = 0;
+          babl_hash_table_find (id_htable, hashval, find_fish_path, (void *) &ffish);
+        }
+
+      if (ffish.fish_path)
+        {
+          /* we have found suitable fish path in the database */
+          return ffish.fish_path;
+        }
+
+      if (!ffish.fish_fish)
+        {
+          const Babl *src_space = (void*)source_format->format.space;
+          const Babl *dst_space = (void*)destination_format->format.space;
+          /* we haven't tried to search for suitable path yet */
+
+          if (!babl_space_is_cmyk (src_space) &&
+              !babl_space_is_cmyk (dst_space))
+            {
+              Babl *fish_path;
+
+              if (babl_fish_async_enabled ())
+                fish_path = babl_fish_path_async (source_format, destination_format);
+              else
+                fish_path = babl_fish_path (source_format, destination_format);
+
+              if (fish_path)
+                {
+                  return fish_path;
+                }
+#if 1
+              else
+                {
+                  /* there isn't a suitable path for requested formats,
+                   * let's create a dummy BABL_FISH instance and insert
+                   * it into the fish database to indicate that such path
+                   * does not exist.
+                   */
+                  babl_db_insert (babl_fish_db (),
+                                  _babl_fish_missing_new (source_format,
+                                                          destination_format,
+                                                          0.0));
+                }
+#endif
+              }
+        }
+      else if (ffish.fish_fish->fish.data)
+        {
+          /* the dummy fish was created by the cache, and we need to manually
+           * show a "missing fast path" warning for it on the first lookup.
+           */
+#if 0
+          _babl_fish_missing_fast_path_warning (ffish.fish_fish->fish.source,
+                                                ffish.fish_fish->fish.destination);
+#endif
+
+          ffish.fish_fish->fish.data = NULL;
+        }
+    }
+
+  if (ffish.fish_ref)
+    {
+      /* we have already found suitable reference fish */
+      return ffish.fish_ref;
+    }
+  else
+    {
+      /* we have to create new reference fish */
+      return babl_fish_reference (source_format, destination_format);
+    }
+}
+
 const Babl *
 babl_fish (const void *source,
            const void *destination)
 {
   const Babl *source_format      = NULL;
   const Babl *destination_format = NULL;
+  const Babl *fish;
+#ifdef HAVE_TLS
+  FishCacheEntry *entry      = NULL;
+  long            generation = 0;
+#endif
 
   babl_assert (source);
   babl_assert (destination);
@@ -207,6 +380,26 @@ babl_fish (const void *source,
   if (BABL_IS_BABL (source))
     source_format = source;
 
+  if (BABL_IS_BABL (destination))
+    destination_format = destination;
+
+#ifdef HAVE_TLS
+  if (!source_format || !destination_format)
+    {
+      generation = __atomic_load_n (&babl_fish_generation, __ATOMIC_ACQUIRE);
+      entry      = fish_cache_entry (source, destination);
+
+      if (entry->source == source &&
+          entry->destination == destination &&
+          entry->generation == generation &&
+          (source_format ||
+           !strcmp (source, entry->fish->fish.source->instance.name)) &&
+          (destination_format ||
+           !strcmp (destination, entry->fish->fish.destination->instance.name)))
+        return entry->fish;
+    }
+#endif
+
   if (!source_format)
     source_format = babl_format ((char *) source);
 
@@ -216,9 +409,6 @@ babl_fish (const void *source,
       return NULL;
     }
 
-  if (BABL_IS_BABL (destination))
-    destination_format = destination;
-
   if (!destination_format)
     destination_format = babl_format ((char *) destination);
 
@@ -228,135 +418,28 @@ babl_fish (const void *source,
       return NULL;
     }
 
-  {
-    int            hashval;
-    BablHashTable *id_htable;
-    BablFindFish   ffish = {(Babl *) NULL,
-                            (Babl *) NULL,
-                            (Babl *) NULL,
-                            0,
-                            (Babl *) NULL,
-                            (Babl *) NULL};
-
-    /* some vendor compilers can't compile non-constant elements of
-     * compound struct initializers
-     */
-    ffish.source = source_format;
-    ffish.destination = destination_format;
-
-    id_htable = (babl_fish_db ())->id_hash;
-    hashval = babl_hash_by_int (id_htable, babl_fish_get_id (source_format, destination_format));
-
-    if (source_format == destination_format)
-      {
-        /* In the case of equal source and destination formats
-         * we will search through the fish database for reference fish
-         * to handle the memcpy */
-        babl_hash_table_find (id_htable, hashval, find_memcpy_fish, (void *) &ffish);
-      }
-    else
-      {
-        /* In the case of different source and destination formats
-         * we will search through the fish database for appropriate fish path
-         * to handle the conversion. In the case that preexistent
-         * fish path is found, we'll return it. In the case BABL_FISH
-         * instance with the same source/destination is found, we'll
-         * return reference fish.
-         * In the case neither fish path nor BABL_FISH path are found,
-         * we'll try to construct new fish path for requested
-         * source/destination. In the case new fish path is found, we'll
-         * return it, otherwise we'll create dummy BABL_FISH instance and
-         * insert it into the fish database to indicate non-existent fish
-         * path.
-         */
-        babl_hash_table_find (id_htable, hashval, find_fish_path, (void *) &ffish);
-        if (ffish.fish_path)
-          {
-            /* we have found suitable fish path in the database */
-            return ffish.fish_path;
-          }
-
-        babl_mutex_lock (babl_fish_mutex);
-        /* do a second look in the database, in case another thread held the
-           mutex and made the fish
-         */
-        if (!ffish.fish_fish)
-        {
-        babl_hash_table_find (id_htable, hashval, find_fish_path, (void *) &ffish);
-        if (ffish.fish_path)
-          {
-            /* we have found suitable fish path in the database */
-            babl_mutex_unlock (babl_fish_mutex);
-            return ffish.fish_path;
-          }
-        }
+  /* fishes that have been handed out before are found without locking */
+  fish = babl_fish_table_lookup (source_format, destination_format);
+  if (!fish)
+    {
+      babl_mutex_lock (babl_fish_mutex);
+      fish = babl_fish_find (source_format, destination_format);
+      if (fish)
+        babl_fish_table_insert (source_format, destination_format, fish);
+      babl_mutex_unlock (babl_fish_mutex);
+    }
 
-        if (!ffish.fish_fish)
-          {
-            const Babl *src_space = (void*)source_format->format.space;
-            const Babl *dst_space = (void*)destination_format->format.space;
-            /* we haven't tried to search for suitable path yet */
-
-            if (!babl_space_is_cmyk (src_space) &&
-                !babl_space_is_cmyk (dst_space))
-              {
-                Babl *fish_path = babl_fish_path (source_format, destination_format);
-
-                if (fish_path)
-                  {
-                    babl_mutex_unlock (babl_fish_mutex);
-                    return fish_path;
-                  }
-#if 1
-                else
-                  {
-                    /* there isn't a suitable path for requested formats,
-                     * let's create a dummy BABL_FISH instance and insert
-                     * it into the fish database to indicate that such path
-                     * does not exist.
-                     */
-                    char *name = "X"; /* name does not matter */
-                    Babl *fish = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
-
-                    fish->class_type                = BABL_FISH;
-                    fish->instance.id               = babl_fish_get_id (source_format, destination_format);
-                    fish->instance.name             = ((char *) fish) + sizeof (BablFish);
-                    strcpy (fish->instance.name, name);
-                    fish->fish.source               = source_format;
-                    fish->fish.destination          = destination_format;
-                    babl_db_insert (babl_fish_db (), fish);
-                  }
-#endif
-                }
-          }
-        else if (ffish.fish_fish->fish.data)
-          {
-            /* the dummy fish was created by the cache, and we need to manually
-             * show a "missing fast path" warning for it on the first lookup.
-             */
-#if 0
-            _babl_fish_missing_fast_path_warning (ffish.fish_fish->fish.source,
-                                                  ffish.fish_fish->fish.destination);
+#ifdef HAVE_TLS
+  if (entry && fish)
+    {
+      entry->source      = source;
+      entry->destination = destination;
+      entry->fish        = fish;
+      entry->generation  = generation;
+    }
 #endif
 
-            ffish.fish_fish->fish.data = NULL;
-          }
-      }
-
-    if (ffish.fish_ref)
-      {
-        /* we have already found suitable reference fish */
-        babl_mutex_unlock (babl_fish_mutex);
-        return ffish.fish_ref;
-      }
-    else
-      {
-        /* we have to create new reference fish */
-        Babl *ret = babl_fish_reference (source_format, destination_format);
-        babl_mutex_unlock (babl_fish_mutex);
-        return ret;
-      }
-  }
+  return fish;
 }
 
 BABL_CLASS_MINIMAL_IMPLEMENT (fish);
@@ -35,6 +35,10 @@ typedef struct
   void          **data;      /* user data - only used for conversion redirect  */
   long            pixels;      /* number of pixels translates */
   double          error;    /* the amount of noise introduced by the fish */
+  double          tolerance; /* asked for in babl_fast_fish (), 0.0 for the
+                                fishes of babl_fish () */
+  struct _BablFishStatsBlock *stats; /* counters of babl_fish_get_stats (),
+                                        NULL until first used */
   /* instrumentation */
 } BablFish;
 
@@ -58,10 +62,10 @@ typedef struct
  * from the reference types / model conversions, and optimized format to
  * format conversion.
  *
- * This is the most advanced scheduled species of fish, some future
- * version of babl might even be evovling path fishes in a background
- * thread, based on the fish instrumentation. For this to work in a future
- * version transmogrification between the fish classes would be used.
+ * This is the most advanced scheduled species of fish. With BABL_FISH_ASYNC
+ * set, path fishes are handed out with an empty conversion_list and the
+ * reference dispatch, the path search then runs in a background thread
+ * (babl-fish-async.c) and swaps in the path dispatch when done.
  */
 typedef struct
 {
@@ -70,6 +74,8 @@ typedef struct
   int        source_bpp;
   int        dest_bpp;
   BablList  *conversion_list;
+  const Babl *reference; /* processes for a fish of babl_fish_path_async ()
+                            until its path has been searched for */
 } BablFishPath;
 
 /* BablFishReference
@@ -80,14 +86,16 @@ typedef struct
  *
  * One of the contributions that would be welcome are new fish factories.
  *
- * TODO:
- *   * make optimal use of a single allocation containing enough space
- *     for the maximum amount of memory needed in two adjecant buffers
- *     at any time.
+ * What a reference fish does is planned when it is created, processing
+ * allocates all the buffers it needs in one allocation and runs through
+ * the plan.
  */
+typedef struct _BablReferencePlan BablReferencePlan;
+
 typedef struct
 {
-  BablFish         fish;
+  BablFish           fish;
+  BablReferencePlan *plan;  /* worked out when the fish is created */
 } BablFishReference;
 
 #endif
@@ -122,7 +122,6 @@ format_new (const char      *name,
   }
 
   babl->format.loss = -1.0;
-  babl->format.visited = 0;
   babl->format.image_template = NULL;
   babl->format.format_n = 0;
   babl->format.palette = 0;
@@ -146,6 +145,14 @@ format_new_from_format_with_space (const Babl *format,
   if (ret)
     return ret;
 
+  babl_mutex_lock (babl_format_mutex);
+  ret = babl_db_find (babl_format_db(), new_name);
+  if (ret)
+    {
+      babl_mutex_unlock (babl_format_mutex);
+      return ret;
+    }
+
   ret = format_new (new_name,
                     0,
                     format->format.planar, format->format.components,
@@ -155,6 +162,7 @@ format_new_from_format_with_space (const Babl *format,
 
   ret->format.encoding = babl_get_name(format);
   babl_db_insert (db, (void*)ret);
+  babl_mutex_unlock (babl_format_mutex);
   return ret;
 }
 
@@ -655,9 +663,6 @@ babl_format_loss (const Babl *babl)
 
   loss = babl_rel_avg_error (clipped, test, test_pixels * 4);
 
-  fish_to->fish.pixels        -= test_pixels * 2;
-  fish_from->fish.pixels      -= test_pixels * 2;
-
   babl_free (original);
   babl_free (clipped);
   babl_free (destination);
@@ -39,8 +39,6 @@ typedef struct
   int              planar;
   double           loss; /*< average relative error when converting
                              from and to RGBA double */
-  int              visited; /* for convenience in code while searching
-                               for conversion paths */
   int              format_n; /* whether the format is a format_n type or not */
   int              palette;
   const char      *encoding;
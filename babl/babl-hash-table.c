@@ -153,6 +153,40 @@ babl_hash_table_insert (BablHashTable *htab,
   return hash_insert (htab, item);
 }
 
+void
+babl_hash_table_remove_matching (BablHashTable       *htab,
+                                 BablHashFindFunction match,
+                                 void                *data)
+{
+  Babl **items;
+  int    count = 0;
+  int    i;
+
+  babl_assert (htab);
+  babl_assert (match);
+
+  items = babl_malloc (sizeof (Babl *) * (htab->count + 1));
+  for (i = 0; i < babl_hash_table_size (htab); i++)
+    {
+      Babl *item = htab->data_table[i];
+
+      if (item && !match (item, data))
+        items[count++] = item;
+    }
+
+  if (count < htab->count)
+    {
+      memset (htab->data_table, 0,
+              sizeof (BablInstance *) * babl_hash_table_size (htab));
+      memset (htab->chain_table, -1,
+              sizeof (int) * babl_hash_table_size (htab));
+      htab->count = 0;
+      for (i = 0; i < count; i++)
+        hash_insert (htab, items[i]);
+    }
+  babl_free (items);
+}
+
 Babl *
 babl_hash_table_find (BablHashTable       *htab,
                       int                  hash,
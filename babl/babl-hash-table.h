@@ -52,6 +52,21 @@ int
 babl_hash_by_int (BablHashTable *htab,
                   int           id);
 
+/* a digest of the bytes of data, FNV-1a, for hashing items by content;
+ * digests of several parts are made by passing on the digest of the ones
+ * before, starting with BABL_DIGEST_INIT
+ */
+#define BABL_DIGEST_INIT  2166136261u
+
+unsigned int
+babl_digest (unsigned int  digest,
+             const void   *data,
+             int           length);
+
+int
+babl_hash_by_digest (BablHashTable *htab,
+                     unsigned int   digest);
+
 int
 babl_hash_table_size (BablHashTable *htab);
 
@@ -65,4 +80,14 @@ babl_hash_table_find (BablHashTable       *htab,
                       BablHashFindFunction find_func,
                       void                *data);
 
+/* removes the items for which match returns non-zero; the chains of
+ * coalesced hashing run through each other, so the table is rebuilt from
+ * the remaining items, removing many items at once is no more expensive
+ * than removing one.
+ */
+void
+babl_hash_table_remove_matching (BablHashTable       *htab,
+                                 BablHashFindFunction match,
+                                 void                *data);
+
 #endif
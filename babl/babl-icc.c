@@ -446,7 +446,10 @@ babl_trc_from_icc (ICC         *state,
 
         ret = babl_trc_lut_find (lut, count);
         if (ret)
+        {
+          babl_free (lut);
           return ret;
+        }
 
         ret = babl_trc_lut (NULL, count, lut);
         babl_free (lut);
@@ -921,6 +924,25 @@ decode_string (ICC        *state,
 static cmsHPROFILE sRGBProfile = 0;
 #endif
 
+/* drops the references to the TRCs read from a profile, a space made from
+ * them holds references of its own
+ */
+static void
+icc_unref_trcs (const Babl *trc_red,
+                const Babl *trc_green,
+                const Babl *trc_blue,
+                const Babl *trc_gray)
+{
+  if (trc_red)
+    babl_trc_unref (trc_red);
+  if (trc_green)
+    babl_trc_unref (trc_green);
+  if (trc_blue)
+    babl_trc_unref (trc_blue);
+  if (trc_gray)
+    babl_trc_unref (trc_gray);
+}
+
 const Babl *
 babl_space_from_icc (const char   *icc_data,
                      int           icc_length,
@@ -958,9 +980,6 @@ babl_space_from_icc (const char   *icc_data,
        ret = _babl_space_for_lcms (icc_data, icc_length);
        if (ret->space.icc_type == BablICCTypeCMYK)
          return ret;
-       ret->space.icc_length = icc_length;
-       ret->space.icc_profile = malloc (icc_length);
-       memcpy (ret->space.icc_profile, icc_data, icc_length);
 
 #ifdef HAVE_LCMS
        if (sRGBProfile == 0)
@@ -1056,6 +1075,17 @@ babl_space_from_icc (const char   *icc_data,
       break;
   }
 
+  /* a profile imported before gives the same space again */
+  if (!*error)
+  {
+    ret = _babl_space_for_icc (icc_data, icc_length);
+    if (ret)
+    {
+      babl_free (state);
+      return ret;
+    }
+  }
+
   {
      int offset, element_size;
      if (!*error && icc_tag (state, "rTRC", &offset, &element_size))
@@ -1093,7 +1123,7 @@ babl_space_from_icc (const char   *icc_data,
 
   if (*error)
   {
-
+    icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
     babl_free (state);
     return NULL;
   }
@@ -1108,9 +1138,8 @@ babl_space_from_icc (const char   *icc_data,
     //   wZ = icc_read (s15f16, offset + 8 + 4 * 2);
     }
     ret  = (void*)babl_space_from_gray_trc (NULL, trc_gray, 1);
-    ret->space.icc_length = icc_length;
-    ret->space.icc_profile = malloc (icc_length);
-    memcpy (ret->space.icc_profile, icc_data, icc_length);
+    _babl_space_set_icc (ret, icc_data, icc_length);
+    icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
     babl_free (state);
     return ret;
 
@@ -1156,6 +1185,7 @@ babl_space_from_icc (const char   *icc_data,
         {
            *error = "Inconsistent ICC profile detected, profile contains both cLUTs and a matrix with swapped primaries, this likely means it is an intentionally inconsistent Argyll profile is in use; this profile is only capable of high accuracy rendering and does not permit acceleration for interactive previews.";
            fprintf (stderr, "babl ICC warning: %s\n", *error);
+           icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
            babl_free (state);
            return NULL;
         }
@@ -1165,6 +1195,8 @@ babl_space_from_icc (const char   *icc_data,
                                         rx, ry, rz, gx, gy, gz, bx, by, bz);
      if (ret)
      {
+        babl_space_ref (ret);
+        icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
         babl_free (state);
         return ret;
      }
@@ -1178,9 +1210,8 @@ babl_space_from_icc (const char   *icc_data,
                 trc_red, trc_green, trc_blue);
 
        babl_free (state);
-       ret->space.icc_length = icc_length;
-       ret->space.icc_profile = malloc (icc_length);
-       memcpy (ret->space.icc_profile, icc_data, icc_length);
+       _babl_space_set_icc (ret, icc_data, icc_length);
+       icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
        return ret;
      }
   }
@@ -1198,11 +1229,15 @@ babl_space_from_icc (const char   *icc_data,
      if (phosporant != 0)
      {
        *error = "unhandled phosporants, please report bug against babl with profile";
+       icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
+       babl_free (state);
        return NULL;
      }
      if (channels != 3)
      {
        *error = "unexpected non 3 count of channels";
+       icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
+       babl_free (state);
        return NULL;
      }
 
@@ -1228,9 +1263,8 @@ babl_space_from_icc (const char   *icc_data,
                      blue_x, blue_y,
                      trc_red, trc_green, trc_blue, 1);
 
-       ret->space.icc_length = icc_length;
-       ret->space.icc_profile = malloc (icc_length);
-       memcpy (ret->space.icc_profile, icc_data, icc_length);
+       _babl_space_set_icc (ret, icc_data, icc_length);
+       icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
 
        return ret;
      }
@@ -1238,6 +1272,7 @@ babl_space_from_icc (const char   *icc_data,
   *error = "didnt find RGB primaries";
   }
 
+  icc_unref_trcs (trc_red, trc_green, trc_blue, trc_gray);
   babl_free (state);
   return NULL;
 }
@@ -26,9 +26,11 @@ static int
 babl_image_destruct (void *babl)
 {
   BablFormat *format = BABL (babl)->image.format;
-  if (format && format->image_template == NULL)
+  void       *none   = NULL;
+  if (format &&
+      __atomic_compare_exchange_n (&format->image_template, &none, babl, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
     {
-      format->image_template = babl;
       return -1; /* this should avoid freeing images created for formats,. */
     }
   return 0;
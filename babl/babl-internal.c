@@ -83,7 +83,6 @@ BablMutex *babl_format_mutex;
 #if BABL_DEBUG_MEM
 BablMutex *babl_debug_mutex;
 #endif
-BablMutex *babl_reference_mutex;
 
 void
 babl_internal_init (void)
@@ -92,18 +91,26 @@ babl_internal_init (void)
   babl_set_free (free);
   babl_fish_mutex = babl_mutex_new ();
   babl_format_mutex = babl_mutex_new ();
-  babl_reference_mutex = babl_mutex_new ();
 #if BABL_DEBUG_MEM
   babl_debug_mutex = babl_mutex_new ();
 #endif
+  babl_parallel_init ();
+  babl_fish_async_init ();
+  babl_fish_table_init ();
+  babl_fish_stats_init ();
+  babl_scratch_init ();
 }
 
 void
 babl_internal_destroy (void)
 {
+  babl_scratch_destroy ();
+  babl_fish_stats_destroy ();
+  babl_fish_table_destroy ();
+  babl_fish_async_destroy ();
+  babl_parallel_destroy ();
   babl_mutex_destroy (babl_fish_mutex);
   babl_mutex_destroy (babl_format_mutex);
-  babl_mutex_destroy (babl_reference_mutex);
 #if BABL_DEBUG_MEM
   babl_mutex_destroy (babl_debug_mutex);
 #endif
@@ -29,6 +29,7 @@
 
 #define BABL_MAX_COMPONENTS       32
 #define BABL_CONVERSIONS          5
+#define BABL_MAX_THREADS          64
 
 
 #include <stdlib.h>
@@ -87,6 +88,9 @@ Babl   * babl_fish_reference            (const Babl     *source,
 Babl   * babl_fish_simple               (BablConversion *conversion);
 Babl   * babl_fish_path                 (const Babl     *source,
                                          const Babl     *destination);
+Babl   * babl_fish_path_async           (const Babl     *source,
+                                         const Babl     *destination);
+void     _babl_fish_path_upgrade        (Babl           *babl);
 
 int      babl_fish_get_id               (const Babl     *source,
                                          const Babl     *destination);
@@ -248,7 +252,6 @@ extern int   babl_hmpf_on_name_lookups;
 extern int   babl_in_fish_path;
 extern BablMutex *babl_format_mutex;
 extern BablMutex *babl_fish_mutex;
-extern BablMutex *babl_reference_mutex;
 
 #define BABL_DEBUG_MEM 0
 #if BABL_DEBUG_MEM
@@ -259,6 +262,90 @@ const char  *babl_class_name       (BablClassType klass);
 void         babl_internal_init    (void);
 void         babl_internal_destroy (void);
 
+/* the worker pool, func is called once for each chunk in 0..n_chunks-1,
+ * from the calling thread and up to babl_parallel_get_n_threads()-1
+ * workers, the call returns when all chunks have been processed.
+ */
+typedef void (*BablParallelFunc) (int chunk, void *data);
+
+void         babl_parallel_init          (void);
+void         babl_parallel_destroy       (void);
+int          babl_parallel_get_n_threads (void);
+void         babl_parallel_distribute    (int              n_chunks,
+                                          BablParallelFunc func,
+                                          void            *data);
+
+/* asynchronous fish construction, enabled by setting BABL_FISH_ASYNC;
+ * babl_fish () then hands out path fishes that process through the
+ * reference code path until a background thread has found their
+ * conversion path and swapped in the optimized dispatch.
+ */
+void         babl_fish_async_init        (void);
+void         babl_fish_async_stop        (void);
+void         babl_fish_async_destroy     (void);
+int          babl_fish_async_enabled     (void);
+void         babl_fish_async_queue       (Babl            *fish);
+void         babl_fish_async_wait        (void);
+
+/* runtime statistics of fishes, collected when the BABL_STATS environment
+ * variable is set; babl_fish_stats_level is 1 for counting calls, pixels
+ * and time of fishes, and 2 when the steps of path fishes are timed too.
+ */
+#define BABL_FISH_STATS_MAX_STEPS 8
+
+typedef struct _BablFishStatsBlock BablFishStatsBlock;
+
+extern int   babl_fish_stats_level;
+
+void         babl_fish_stats_init        (void);
+void         babl_fish_stats_destroy     (void);
+void         _babl_fish_stats_add        (const Babl      *fish,
+                                          long             pixels,
+                                          int64_t          nanoseconds);
+void         _babl_fish_stats_add_step   (const Babl      *fish,
+                                          int              step,
+                                          int64_t          nanoseconds);
+long         _babl_fish_stats_pixels     (const Babl      *fish);
+/* detaches the counters of a fish about to be freed, they stay allocated
+ * since babl_fish_stats_foreach () walks them without locking, until
+ * _babl_fish_stats_free_forgotten () which is only safe when no other
+ * thread can be using fishes or reading their statistics
+ */
+void         _babl_fish_stats_forget     (const Babl      *fish);
+void         _babl_fish_stats_free_forgotten (void);
+
+/* the table of fishes handed out by babl_fish (), lookups are lock-free
+ * and safe to do concurrently with inserts, inserting a pair of formats
+ * that is already present replaces its fish. babl_fish () keeps a small
+ * per-thread cache in front of it, babl_fish_cache_invalidate () must be
+ * called when earlier results might have become stale.
+ */
+void         babl_fish_cache_invalidate  (void);
+void         babl_fish_table_init        (void);
+void         babl_fish_table_destroy     (void);
+const Babl * babl_fish_table_lookup      (const Babl      *source,
+                                          const Babl      *destination);
+void         babl_fish_table_insert      (const Babl      *source,
+                                          const Babl      *destination,
+                                          const Babl      *fish);
+void         babl_fish_table_remove_matching (BablEachFunction match,
+                                              void            *user_data);
+/* frees the tables replaced by rebuilding the table, only safe when no
+ * other thread can be looking up fishes
+ */
+void         babl_fish_table_free_retired (void);
+/* the number of slots of the table */
+long         babl_fish_table_size        (void);
+
+/* per-thread scratch memory for the intermediate buffers of conversions,
+ * 64 byte aligned. Buffers should be freed in the reverse order of their
+ * allocation, and on the thread that allocated them.
+ */
+void         babl_scratch_init           (void);
+void         babl_scratch_destroy        (void);
+void *       babl_scratch_alloc          (size_t           size);
+void         babl_scratch_free           (void            *ptr);
+
 
 /* this template is expanded in the files including babl-internal.h,
  * generating code, the declarations for these functions are found in
@@ -359,15 +446,26 @@ _conversion_new (const char    *name,
 double _babl_legal_error (void);
 void babl_init_db (void);
 void babl_store_db (void);
+Babl *babl_fish_cache_materialize (const Babl *source,
+                                    const Babl *destination,
+                                    double      tolerance);
+BablDb *babl_fast_fish_db (void);
 int _babl_max_path_len (void);
 
 
+/* TRCs are returned with a reference added, the TRCs made at babl_init
+ * and by extensions keep theirs; a space holds references to its TRCs.
+ * babl_trc () looks a TRC up without adding one.
+ */
 const Babl *
 babl_trc_new (const char *name,
               BablTRCType type,
               double      gamma,
               int         n_lut,
               float      *lut);
+const Babl *babl_trc_ref   (const Babl *trc);
+/* frees the TRC and its tables when the last reference is released */
+void        babl_trc_unref (const Babl *trc);
 
 void babl_space_to_xyz   (const Babl *space, const double *rgb, double *xyz);
 void babl_space_from_xyz (const Babl *space, const double *xyz, double *rgb);
@@ -442,6 +540,20 @@ void _babl_fish_missing_fast_path_warning (const Babl *source,
                                            const Babl *destination);
 void _babl_fish_rig_dispatch (Babl *babl);
 void _babl_fish_prepare_bpp (Babl *babl);
+void _babl_fish_prepare_spaces (const Babl *source,
+                                const Babl *destination);
+int  _babl_fish_path_destroy (void *data);
+char *_babl_fish_create_name (char       *buf,
+                              const Babl *source,
+                              const Babl *destination,
+                              int         is_reference);
+char *_babl_fish_create_fast_name (char       *buf,
+                                   const Babl *source,
+                                   const Babl *destination,
+                                   double      tolerance);
+Babl *_babl_fish_missing_new (const Babl *source,
+                              const Babl *destination,
+                              double      tolerance);
 
 
 /* babl_space_to_icc:
@@ -463,6 +575,18 @@ char *babl_space_to_icc (const Babl  *space,
                          BablICCFlags flags,
                          int         *icc_length);
 Babl *
-_babl_space_for_lcms (const char *icc_data, int icc_length); // XXX pass profile for dedup?
+_babl_space_for_lcms (const char *icc_data, int icc_length);
+
+/* the space an identical ICC profile was imported as, if any, with a
+ * reference added
+ */
+Babl *
+_babl_space_for_icc (const char *icc_data, int icc_length);
+
+/* makes a copy of icc_data the profile of space, and the space the one
+ * found for it, unless the space already has an imported profile
+ */
+void
+_babl_space_set_icc (Babl *space, const char *icc_data, int icc_length);
 
 #endif
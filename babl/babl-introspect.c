@@ -176,7 +176,8 @@ conversion_introspect (Babl *babl)
 static void
 fish_introspect (Babl *babl)
 {
-  babl_log ("\t\tpixels:%li", babl->fish.pixels);
+  babl_log ("\t\tpixels:%li", babl->fish.pixels +
+                                _babl_fish_stats_pixels (babl));
 }
 
 static void
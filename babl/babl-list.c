@@ -88,6 +88,23 @@ babl_list_remove_last (BablList *list)
   list->count--;
 }
 
+void
+babl_list_remove_matching (BablList         *list,
+                           BablEachFunction  match,
+                           void             *user_data)
+{
+  int i, kept = 0;
+
+  babl_assert (list);
+  babl_assert (match);
+
+  for (i = 0; i < list->count; i++)
+    if (!match (list->items[i], user_data))
+      list->items[kept++] = list->items[i];
+  memset (list->items + kept, 0, (list->count - kept) * sizeof (BablInstance *));
+  list->count = kept;
+}
+
 void
 babl_list_copy (BablList *from,
                 BablList *to)
@@ -46,6 +46,14 @@ babl_list_insert_last (BablList *list,
 void
 babl_list_remove_last (BablList *list);
 
+/* removes the items for which match returns non-zero, keeping the order
+ * of the others
+ */
+void
+babl_list_remove_matching (BablList         *list,
+                           BablEachFunction  match,
+                           void             *user_data);
+
 #define babl_list_get_n(list,n)   (list->items[(n)])
 #define babl_list_get_first(list) (babl_list_get_n(list,0))
 #define babl_list_size(list)      (list->count)
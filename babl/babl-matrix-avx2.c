@@ -0,0 +1,177 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* 3x3 matrix transforms of RGB and RGBA float buffers 8 pixels at a time.
+ * The pixels are loaded into registers of their red, green and blue
+ * components - in an order of the lanes that differs from the order of
+ * the pixels, the same for all components - transformed with fused
+ * multiply-adds and stored back the way they were loaded. Alpha is
+ * copied. Pixels that do not fill 8 are done by the scalar functions of
+ * babl-matrix.h.
+ *
+ * This file is built with the avx2 and fma compiler flags, its functions
+ * are only used when babl_cpu_accel_get_support () reports both.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#if defined(USE_AVX2) && defined(USE_FMA)
+
+#include <immintrin.h>
+
+typedef struct
+{
+  __m256 m[9];
+} Matrix;
+
+static inline void
+matrix_prepare (Matrix      *matrix,
+                const float *mat)
+{
+  int i;
+
+  for (i = 0; i < 9; i++)
+    matrix->m[i] = _mm256_set1_ps (mat[i]);
+}
+
+static inline void
+matrix_apply (const Matrix *matrix,
+              __m256       *r,
+              __m256       *g,
+              __m256       *b)
+{
+  const __m256 *m = matrix->m;
+  __m256 r_out = _mm256_fmadd_ps (m[0], *r, _mm256_fmadd_ps (m[1], *g,
+                                  _mm256_mul_ps (m[2], *b)));
+  __m256 g_out = _mm256_fmadd_ps (m[3], *r, _mm256_fmadd_ps (m[4], *g,
+                                  _mm256_mul_ps (m[5], *b)));
+  __m256 b_out = _mm256_fmadd_ps (m[6], *r, _mm256_fmadd_ps (m[7], *g,
+                                  _mm256_mul_ps (m[8], *b)));
+
+  *r = r_out;
+  *g = g_out;
+  *b = b_out;
+}
+
+void
+babl_matrix_mul_vectorff_buf3_avx2 (const float *mat,
+                                    const float *v_in,
+                                    float       *v_out,
+                                    int          samples)
+{
+  Matrix matrix;
+  int    i;
+
+  matrix_prepare (&matrix, mat);
+
+  for (i = 0; i + 8 <= samples; i += 8)
+    {
+      /* pixels 0 and 4, 1 and 5, 2 and 6, 3 and 7 in the halves */
+      __m256 p04 = _mm256_insertf128_ps (
+                     _mm256_castps128_ps256 (_mm_loadu_ps (v_in)),
+                     _mm_loadu_ps (v_in + 12), 1);
+      __m256 p15 = _mm256_insertf128_ps (
+                     _mm256_castps128_ps256 (_mm_loadu_ps (v_in + 4)),
+                     _mm_loadu_ps (v_in + 16), 1);
+      __m256 p26 = _mm256_insertf128_ps (
+                     _mm256_castps128_ps256 (_mm_loadu_ps (v_in + 8)),
+                     _mm_loadu_ps (v_in + 20), 1);
+      __m256 rg  = _mm256_shuffle_ps (p15, p26, _MM_SHUFFLE (2, 1, 3, 2));
+      __m256 gb  = _mm256_shuffle_ps (p04, p15, _MM_SHUFFLE (1, 0, 2, 1));
+      __m256 r   = _mm256_shuffle_ps (p04, rg,  _MM_SHUFFLE (2, 0, 3, 0));
+      __m256 g   = _mm256_shuffle_ps (gb,  rg,  _MM_SHUFFLE (3, 1, 2, 0));
+      __m256 b   = _mm256_shuffle_ps (gb,  p26, _MM_SHUFFLE (3, 0, 3, 1));
+      __m256 br;
+
+      matrix_apply (&matrix, &r, &g, &b);
+
+      br  = _mm256_shuffle_ps (b, r, _MM_SHUFFLE (3, 1, 2, 0));
+      rg  = _mm256_shuffle_ps (r, g, _MM_SHUFFLE (2, 0, 2, 0));
+      gb  = _mm256_shuffle_ps (g, b, _MM_SHUFFLE (3, 1, 3, 1));
+      p04 = _mm256_shuffle_ps (rg, br, _MM_SHUFFLE (2, 0, 2, 0));
+      p15 = _mm256_shuffle_ps (gb, rg, _MM_SHUFFLE (3, 1, 2, 0));
+      p26 = _mm256_shuffle_ps (br, gb, _MM_SHUFFLE (3, 1, 3, 1));
+
+      _mm_storeu_ps (v_out,      _mm256_castps256_ps128 (p04));
+      _mm_storeu_ps (v_out + 4,  _mm256_castps256_ps128 (p15));
+      _mm_storeu_ps (v_out + 8,  _mm256_castps256_ps128 (p26));
+      _mm_storeu_ps (v_out + 12, _mm256_extractf128_ps (p04, 1));
+      _mm_storeu_ps (v_out + 16, _mm256_extractf128_ps (p15, 1));
+      _mm_storeu_ps (v_out + 20, _mm256_extractf128_ps (p26, 1));
+
+      v_in  += 24;
+      v_out += 24;
+    }
+
+  babl_matrix_mul_vectorff_buf3 (mat, v_in, v_out, samples - i);
+}
+
+void
+babl_matrix_mul_vectorff_buf4_avx2 (const float *mat,
+                                    const float *v_in,
+                                    float       *v_out,
+                                    int          samples)
+{
+  Matrix matrix;
+  int    i;
+
+  matrix_prepare (&matrix, mat);
+
+  for (i = 0; i + 8 <= samples; i += 8)
+    {
+      /* a 4x4 transpose in each half, giving the components of pixels
+       * 0, 2, 4, 6 in the low and 1, 3, 5, 7 in the high half
+       */
+      __m256 p01 = _mm256_loadu_ps (v_in);
+      __m256 p23 = _mm256_loadu_ps (v_in + 8);
+      __m256 p45 = _mm256_loadu_ps (v_in + 16);
+      __m256 p67 = _mm256_loadu_ps (v_in + 24);
+      __m256 rg0 = _mm256_unpacklo_ps (p01, p23);
+      __m256 ba0 = _mm256_unpackhi_ps (p01, p23);
+      __m256 rg1 = _mm256_unpacklo_ps (p45, p67);
+      __m256 ba1 = _mm256_unpackhi_ps (p45, p67);
+      __m256 r   = _mm256_shuffle_ps (rg0, rg1, _MM_SHUFFLE (1, 0, 1, 0));
+      __m256 g   = _mm256_shuffle_ps (rg0, rg1, _MM_SHUFFLE (3, 2, 3, 2));
+      __m256 b   = _mm256_shuffle_ps (ba0, ba1, _MM_SHUFFLE (1, 0, 1, 0));
+      __m256 a   = _mm256_shuffle_ps (ba0, ba1, _MM_SHUFFLE (3, 2, 3, 2));
+
+      matrix_apply (&matrix, &r, &g, &b);
+
+      rg0 = _mm256_unpacklo_ps (r, g);
+      rg1 = _mm256_unpackhi_ps (r, g);
+      ba0 = _mm256_unpacklo_ps (b, a);
+      ba1 = _mm256_unpackhi_ps (b, a);
+
+      _mm256_storeu_ps (v_out,
+                        _mm256_shuffle_ps (rg0, ba0, _MM_SHUFFLE (1, 0, 1, 0)));
+      _mm256_storeu_ps (v_out + 8,
+                        _mm256_shuffle_ps (rg0, ba0, _MM_SHUFFLE (3, 2, 3, 2)));
+      _mm256_storeu_ps (v_out + 16,
+                        _mm256_shuffle_ps (rg1, ba1, _MM_SHUFFLE (1, 0, 1, 0)));
+      _mm256_storeu_ps (v_out + 24,
+                        _mm256_shuffle_ps (rg1, ba1, _MM_SHUFFLE (3, 2, 3, 2)));
+
+      v_in  += 32;
+      v_out += 32;
+    }
+
+  babl_matrix_mul_vectorff_buf4 (mat, v_in, v_out, samples - i);
+}
+
+#endif /* defined(USE_AVX2) && defined(USE_FMA) */
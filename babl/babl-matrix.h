@@ -217,6 +217,14 @@ static inline void babl_matrix_mul_vector_buf4 (const double *mat, const double
   }
 }
 
+/* babl_matrix_mul_vectorff_buf3 () and _buf4 () 8 pixels at a time, see
+ * babl-matrix-avx2.c
+ */
+void babl_matrix_mul_vectorff_buf3_avx2 (const float *mat, const float *v_in, float *v_out,
+                                         int samples);
+
+void babl_matrix_mul_vectorff_buf4_avx2 (const float *mat, const float *v_in, float *v_out,
+                                         int samples);
 
 #undef m
 #endif
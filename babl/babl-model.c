@@ -369,9 +369,6 @@ babl_model_is_symmetric (const Babl *cbabl)
   babl_process (fish_to, clipped, destination, test_pixels);
   babl_process (fish_from, destination, transformed, test_pixels);
 
-  fish_to->fish.pixels        -= test_pixels * 2;
-  fish_from->fish.pixels      -= test_pixels * 2;
-
   {
     int i;
     int log = 0;
@@ -420,18 +417,13 @@ babl_model_is_symmetric (const Babl *cbabl)
 
 BABL_CLASS_IMPLEMENT (model)
 
-/* XXX: probably better to do like with babl_format, add a -suffix and
- *      insert in normal database than to have this static cache list
- */
-static const Babl *babl_remodels[512]={NULL,};
-int          babl_n_remodels = 0;
-
 const Babl *
 babl_remodel_with_space (const Babl *model, 
                          const Babl *space)
 {
-  Babl *ret;
-  int i;
+  Babl       *ret;
+  const Babl *remodel;
+  const Babl *remodels;
   assert (BABL_IS_BABL (model));
 
   if (!space) space = babl_space ("sRGB");
@@ -459,18 +451,34 @@ babl_remodel_with_space (const Babl *model,
 
   assert (BABL_IS_BABL (model));
 
-  for (i = 0; i < babl_n_remodels; i++)
+  /* the remodels of a space are only ever prepended, until the space is
+   * torn down, and published by storing the head of the list
+   */
+  remodels = __atomic_load_n (&space->space.remodels, __ATOMIC_ACQUIRE);
+  for (remodel = remodels; remodel; remodel = remodel->model.next_remodel)
+  {
+    if (remodel->model.model == model)
+      return remodel;
+  }
+
+  babl_mutex_lock (babl_format_mutex);
+  for (remodel = space->space.remodels; remodel != remodels;
+       remodel = remodel->model.next_remodel)
   {
-    if (babl_remodels[i]->model.model == model &&
-        babl_remodels[i]->model.space == space)
-          return babl_remodels[i];
+    if (remodel->model.model == model)
+    {
+      babl_mutex_unlock (babl_format_mutex);
+      return remodel;
+    }
   }
 
   ret = babl_calloc (sizeof (BablModel), 1);
   memcpy (ret, model, sizeof (BablModel));
   ret->model.space = space;
   ret->model.model = (void*)model; /* use the data as a backpointer to original model */
-  return babl_remodels[babl_n_remodels++] = ret;
+  ret->model.next_remodel = space->space.remodels;
+  __atomic_store_n (&((Babl *) space)->space.remodels, ret, __ATOMIC_RELEASE);
+  babl_mutex_unlock (babl_format_mutex);
   return (Babl*)ret;
 }
 
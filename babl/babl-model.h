@@ -33,6 +33,7 @@ typedef struct
   const Babl       *space;
   void             *model;   /* back pointer to model with sRGB space */
   BablModelFlag     flags;
+  const Babl       *next_remodel; /* in the remodels of space */
 } BablModel;
 
 #endif
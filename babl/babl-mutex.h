@@ -28,8 +28,10 @@
 
 #ifdef _WIN32
   typedef  CRITICAL_SECTION   BablMutex;
+  typedef  CONDITION_VARIABLE BablCond;
 #else
   typedef  pthread_mutex_t   BablMutex;
+  typedef  pthread_cond_t    BablCond;
 #endif
 
 BablMutex* babl_mutex_new     (void);
@@ -37,4 +39,15 @@ void       babl_mutex_destroy (BablMutex *mutex);
 void       babl_mutex_lock    (BablMutex *mutex);
 void       babl_mutex_unlock  (BablMutex *mutex);
 
+/* condition variables, the mutex passed to babl_cond_wait must be held
+ * exactly once by the calling thread, even though babl mutexes are
+ * recursive.
+ */
+BablCond * babl_cond_new       (void);
+void       babl_cond_destroy   (BablCond  *cond);
+void       babl_cond_wait      (BablCond  *cond,
+                                BablMutex *mutex);
+void       babl_cond_signal    (BablCond  *cond);
+void       babl_cond_broadcast (BablCond  *cond);
+
 #endif
@@ -952,6 +952,7 @@ babl_palette_set_palette (const Babl *babl,
 {
   BablPalette **palptr = babl_get_user_data (babl);
   babl_palette_reset (babl);
+  babl_fish_cache_invalidate ();
 
   if (count > 256)
     {
@@ -983,4 +984,5 @@ babl_palette_reset (const Babl *babl)
       babl_palette_free (*palptr);
     }
   *palptr = default_palette ();
+  babl_fish_cache_invalidate ();
 }
@@ -0,0 +1,239 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* A small persistent pool of worker threads, used for splitting large
+ * requests into chunks that are processed concurrently. The threads are
+ * started on first use, and the thread calling babl_parallel_distribute
+ * takes part in the work itself.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct BablParallelJob
+{
+  BablParallelFunc  func;
+  void             *data;
+  int               n_chunks;
+  int               next_chunk;     /* updated atomically */
+  int               active_workers; /* protected by pool mutex */
+} BablParallelJob;
+
+static BablMutex       *pool_mutex;
+static BablCond        *pool_work_cond;
+static BablCond        *pool_done_cond;
+static BablParallelJob *pool_job;
+static long             pool_generation;
+static int              pool_quit;
+static int              pool_n_workers = -1;
+#ifdef _WIN32
+static HANDLE           pool_threads[BABL_MAX_THREADS];
+#else
+static pthread_t        pool_threads[BABL_MAX_THREADS];
+#endif
+
+static int
+cpu_count (void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo (&info);
+  return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  return sysconf (_SC_NPROCESSORS_ONLN);
+#else
+  return 1;
+#endif
+}
+
+int
+babl_parallel_get_n_threads (void)
+{
+  static int n_threads = 0;
+  const char *env;
+
+  if (n_threads != 0)
+    return n_threads;
+
+  env = getenv ("BABL_THREADS");
+  if (env && env[0] != '\0')
+    n_threads = atoi (env);
+  else
+    n_threads = cpu_count ();
+
+  if (n_threads > BABL_MAX_THREADS)
+    n_threads = BABL_MAX_THREADS;
+  else if (n_threads <= 0)
+    n_threads = 1;
+  return n_threads;
+}
+
+static void
+run_chunks (BablParallelJob *job)
+{
+  int chunk;
+
+  while ((chunk = __atomic_fetch_add (&job->next_chunk, 1,
+                                      __ATOMIC_RELAXED)) < job->n_chunks)
+    job->func (chunk, job->data);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+worker_main (LPVOID data)
+#else
+static void *
+worker_main (void *data)
+#endif
+{
+  long seen_generation = 0;
+
+  babl_mutex_lock (pool_mutex);
+  for (;;)
+    {
+      BablParallelJob *job;
+
+      while (!pool_quit &&
+             (pool_job == NULL || seen_generation == pool_generation))
+        babl_cond_wait (pool_work_cond, pool_mutex);
+
+      if (pool_quit)
+        break;
+
+      seen_generation = pool_generation;
+      job = pool_job;
+      job->active_workers++;
+      babl_mutex_unlock (pool_mutex);
+
+      run_chunks (job);
+
+      babl_mutex_lock (pool_mutex);
+      if (--job->active_workers == 0)
+        babl_cond_signal (pool_done_cond);
+    }
+  babl_mutex_unlock (pool_mutex);
+
+  return 0;
+}
+
+/* must be called with pool_mutex held */
+static void
+start_workers (void)
+{
+  int i;
+
+  pool_n_workers = babl_parallel_get_n_threads () - 1;
+
+  for (i = 0; i < pool_n_workers; i++)
+    {
+#ifdef _WIN32
+      pool_threads[i] = CreateThread (NULL, 0, worker_main, NULL, 0, NULL);
+      if (!pool_threads[i])
+        break;
+#else
+      if (pthread_create (&pool_threads[i], NULL, worker_main, NULL) != 0)
+        break;
+#endif
+    }
+  pool_n_workers = i;
+}
+
+void
+babl_parallel_distribute (int               n_chunks,
+                          BablParallelFunc  func,
+                          void             *data)
+{
+  BablParallelJob job;
+
+  job.func           = func;
+  job.data           = data;
+  job.n_chunks       = n_chunks;
+  job.next_chunk     = 0;
+  job.active_workers = 0;
+
+  if (n_chunks > 1 && babl_parallel_get_n_threads () > 1)
+    {
+      babl_mutex_lock (pool_mutex);
+      if (pool_n_workers < 0)
+        start_workers ();
+
+      /* the pool serves one request at a time, concurrent callers and
+       * nested use from within a worker fall back to doing all the work
+       * on the calling thread.
+       */
+      if (pool_job == NULL && pool_n_workers > 0)
+        {
+          pool_job = &job;
+          pool_generation++;
+          babl_cond_broadcast (pool_work_cond);
+          babl_mutex_unlock (pool_mutex);
+
+          run_chunks (&job);
+
+          babl_mutex_lock (pool_mutex);
+          pool_job = NULL;
+          while (job.active_workers > 0)
+            babl_cond_wait (pool_done_cond, pool_mutex);
+          babl_mutex_unlock (pool_mutex);
+          return;
+        }
+      babl_mutex_unlock (pool_mutex);
+    }
+
+  run_chunks (&job);
+}
+
+void
+babl_parallel_init (void)
+{
+  pool_mutex     = babl_mutex_new ();
+  pool_work_cond = babl_cond_new ();
+  pool_done_cond = babl_cond_new ();
+  pool_job       = NULL;
+  pool_quit      = 0;
+  pool_n_workers = -1;
+}
+
+void
+babl_parallel_destroy (void)
+{
+  int i;
+
+  babl_mutex_lock (pool_mutex);
+  pool_quit = 1;
+  babl_cond_broadcast (pool_work_cond);
+  babl_mutex_unlock (pool_mutex);
+
+  for (i = 0; i < pool_n_workers; i++)
+    {
+#ifdef _WIN32
+      WaitForSingleObject (pool_threads[i], INFINITE);
+      CloseHandle (pool_threads[i]);
+#else
+      pthread_join (pool_threads[i], NULL);
+#endif
+    }
+
+  babl_cond_destroy (pool_work_cond);
+  babl_cond_destroy (pool_done_cond);
+  babl_mutex_destroy (pool_mutex);
+}
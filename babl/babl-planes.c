@@ -0,0 +1,536 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Processing of buffers with the components of pixels in separate planes.
+ *
+ * Fishes work on interleaved pixels, babl_process_planes () gathers
+ * PLANES_TILE pixels at a time from the source planes into an interleaved
+ * tile, lets the fish convert it into a second tile and scatters that
+ * into the destination planes. The tiles stay in cache, so the planes are
+ * only read and written once. Planes that are laid out as interleaved
+ * pixels are handed to the fish directly, and a fish that does not change
+ * the format only copies the components from plane to plane.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "babl-internal.h"
+
+#if defined(USE_SSE2)
+#include <emmintrin.h>
+#endif
+
+#define PLANES_TILE 512
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+typedef struct
+{
+  int components;
+  int bpp;
+  int size[BABL_MAX_COMPONENTS];
+  int offset[BABL_MAX_COMPONENTS];
+} PlanesLayout;
+
+static void
+planes_layout (const Babl   *format,
+               PlanesLayout *layout)
+{
+  int i;
+
+  if (format->class_type == BABL_FORMAT)
+    {
+      layout->components = format->format.components;
+      for (i = 0; i < layout->components; i++)
+        layout->size[i] = format->format.type[i]->bits / 8;
+    }
+  else /* models are processed as double components */
+    {
+      layout->components = format->model.components;
+      for (i = 0; i < layout->components; i++)
+        layout->size[i] = sizeof (double);
+    }
+
+  layout->bpp = 0;
+  for (i = 0; i < layout->components; i++)
+    {
+      layout->offset[i] = layout->bpp;
+      layout->bpp      += layout->size[i];
+    }
+}
+
+/* whether the planes are the components of interleaved pixels */
+static int
+planes_are_interleaved (const PlanesLayout *layout,
+                        char              **planes,
+                        const int          *pitch)
+{
+  int i;
+
+  for (i = 0; i < layout->components; i++)
+    if (planes[i] != planes[0] + layout->offset[i] || pitch[i] != layout->bpp)
+      return 0;
+  return 1;
+}
+
+#define COPY_COMPONENT(type)                      \
+  for (i = 0; i < n; i++)                         \
+    {                                             \
+      memcpy (dst, src, sizeof (type));           \
+      src += src_pitch;                           \
+      dst += dst_pitch;                           \
+    }
+
+static inline void
+copy_component (const char *src,
+                int         src_pitch,
+                char       *dst,
+                int         dst_pitch,
+                int         size,
+                long        n)
+{
+  long i;
+
+  switch (size)
+    {
+      case 1: COPY_COMPONENT (uint8_t); break;
+      case 2: COPY_COMPONENT (uint16_t); break;
+      case 4: COPY_COMPONENT (uint32_t); break;
+      case 8: COPY_COMPONENT (uint64_t); break;
+      default:
+        for (i = 0; i < n; i++)
+          {
+            memcpy (dst, src, size);
+            src += src_pitch;
+            dst += dst_pitch;
+          }
+        break;
+    }
+}
+
+#if defined(USE_SSE2)
+
+/* four planes of 32bit components to and from interleaved pixels, four
+ * pixels at a time, transposing is its own inverse
+ */
+static inline void
+transpose_4x32 (__m128i *a,
+                __m128i *b,
+                __m128i *c,
+                __m128i *d)
+{
+  __m128i ab_lo = _mm_unpacklo_epi32 (*a, *b);
+  __m128i cd_lo = _mm_unpacklo_epi32 (*c, *d);
+  __m128i ab_hi = _mm_unpackhi_epi32 (*a, *b);
+  __m128i cd_hi = _mm_unpackhi_epi32 (*c, *d);
+
+  *a = _mm_unpacklo_epi64 (ab_lo, cd_lo);
+  *b = _mm_unpackhi_epi64 (ab_lo, cd_lo);
+  *c = _mm_unpacklo_epi64 (ab_hi, cd_hi);
+  *d = _mm_unpackhi_epi64 (ab_hi, cd_hi);
+}
+
+static long
+interleave_4x32_sse2 (const char **src,
+                      char        *dst,
+                      long         n)
+{
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      __m128i a = _mm_loadu_si128 ((const void *) (src[0] + i * 4));
+      __m128i b = _mm_loadu_si128 ((const void *) (src[1] + i * 4));
+      __m128i c = _mm_loadu_si128 ((const void *) (src[2] + i * 4));
+      __m128i d = _mm_loadu_si128 ((const void *) (src[3] + i * 4));
+
+      transpose_4x32 (&a, &b, &c, &d);
+      _mm_storeu_si128 ((void *) (dst + i * 16),      a);
+      _mm_storeu_si128 ((void *) (dst + i * 16 + 16), b);
+      _mm_storeu_si128 ((void *) (dst + i * 16 + 32), c);
+      _mm_storeu_si128 ((void *) (dst + i * 16 + 48), d);
+    }
+  return i;
+}
+
+static long
+deinterleave_4x32_sse2 (const char *src,
+                        char      **dst,
+                        long        n)
+{
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      __m128i a = _mm_loadu_si128 ((const void *) (src + i * 16));
+      __m128i b = _mm_loadu_si128 ((const void *) (src + i * 16 + 16));
+      __m128i c = _mm_loadu_si128 ((const void *) (src + i * 16 + 32));
+      __m128i d = _mm_loadu_si128 ((const void *) (src + i * 16 + 48));
+
+      transpose_4x32 (&a, &b, &c, &d);
+      _mm_storeu_si128 ((void *) (dst[0] + i * 4), a);
+      _mm_storeu_si128 ((void *) (dst[1] + i * 4), b);
+      _mm_storeu_si128 ((void *) (dst[2] + i * 4), c);
+      _mm_storeu_si128 ((void *) (dst[3] + i * 4), d);
+    }
+  return i;
+}
+
+/* four planes of 16bit components to and from interleaved pixels, eight
+ * pixels at a time
+ */
+static long
+interleave_4x16_sse2 (const char **src,
+                      char        *dst,
+                      long         n)
+{
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      __m128i a = _mm_loadu_si128 ((const void *) (src[0] + i * 2));
+      __m128i b = _mm_loadu_si128 ((const void *) (src[1] + i * 2));
+      __m128i c = _mm_loadu_si128 ((const void *) (src[2] + i * 2));
+      __m128i d = _mm_loadu_si128 ((const void *) (src[3] + i * 2));
+      __m128i ab_lo = _mm_unpacklo_epi16 (a, b);
+      __m128i ab_hi = _mm_unpackhi_epi16 (a, b);
+      __m128i cd_lo = _mm_unpacklo_epi16 (c, d);
+      __m128i cd_hi = _mm_unpackhi_epi16 (c, d);
+
+      _mm_storeu_si128 ((void *) (dst + i * 8),
+                        _mm_unpacklo_epi32 (ab_lo, cd_lo));
+      _mm_storeu_si128 ((void *) (dst + i * 8 + 16),
+                        _mm_unpackhi_epi32 (ab_lo, cd_lo));
+      _mm_storeu_si128 ((void *) (dst + i * 8 + 32),
+                        _mm_unpacklo_epi32 (ab_hi, cd_hi));
+      _mm_storeu_si128 ((void *) (dst + i * 8 + 48),
+                        _mm_unpackhi_epi32 (ab_hi, cd_hi));
+    }
+  return i;
+}
+
+static long
+deinterleave_4x16_sse2 (const char *src,
+                        char      **dst,
+                        long        n)
+{
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      __m128i p0 = _mm_loadu_si128 ((const void *) (src + i * 8));
+      __m128i p1 = _mm_loadu_si128 ((const void *) (src + i * 8 + 16));
+      __m128i p2 = _mm_loadu_si128 ((const void *) (src + i * 8 + 32));
+      __m128i p3 = _mm_loadu_si128 ((const void *) (src + i * 8 + 48));
+      __m128i t0 = _mm_unpacklo_epi16 (p0, p1);
+      __m128i t1 = _mm_unpackhi_epi16 (p0, p1);
+      __m128i t2 = _mm_unpacklo_epi16 (p2, p3);
+      __m128i t3 = _mm_unpackhi_epi16 (p2, p3);
+      __m128i ab_lo = _mm_unpacklo_epi16 (t0, t1);
+      __m128i cd_lo = _mm_unpackhi_epi16 (t0, t1);
+      __m128i ab_hi = _mm_unpacklo_epi16 (t2, t3);
+      __m128i cd_hi = _mm_unpackhi_epi16 (t2, t3);
+
+      _mm_storeu_si128 ((void *) (dst[0] + i * 2),
+                        _mm_unpacklo_epi64 (ab_lo, ab_hi));
+      _mm_storeu_si128 ((void *) (dst[1] + i * 2),
+                        _mm_unpackhi_epi64 (ab_lo, ab_hi));
+      _mm_storeu_si128 ((void *) (dst[2] + i * 2),
+                        _mm_unpacklo_epi64 (cd_lo, cd_hi));
+      _mm_storeu_si128 ((void *) (dst[3] + i * 2),
+                        _mm_unpackhi_epi64 (cd_lo, cd_hi));
+    }
+  return i;
+}
+
+/* four planes of 8bit components to and from interleaved pixels, sixteen
+ * pixels at a time
+ */
+static long
+interleave_4x8_sse2 (const char **src,
+                     char        *dst,
+                     long         n)
+{
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i a  = _mm_loadu_si128 ((const void *) (src[0] + i));
+      __m128i b  = _mm_loadu_si128 ((const void *) (src[1] + i));
+      __m128i c  = _mm_loadu_si128 ((const void *) (src[2] + i));
+      __m128i d  = _mm_loadu_si128 ((const void *) (src[3] + i));
+      __m128i ab_lo = _mm_unpacklo_epi8 (a, b);
+      __m128i ab_hi = _mm_unpackhi_epi8 (a, b);
+      __m128i cd_lo = _mm_unpacklo_epi8 (c, d);
+      __m128i cd_hi = _mm_unpackhi_epi8 (c, d);
+
+      _mm_storeu_si128 ((void *) (dst + i * 4),
+                        _mm_unpacklo_epi16 (ab_lo, cd_lo));
+      _mm_storeu_si128 ((void *) (dst + i * 4 + 16),
+                        _mm_unpackhi_epi16 (ab_lo, cd_lo));
+      _mm_storeu_si128 ((void *) (dst + i * 4 + 32),
+                        _mm_unpacklo_epi16 (ab_hi, cd_hi));
+      _mm_storeu_si128 ((void *) (dst + i * 4 + 48),
+                        _mm_unpackhi_epi16 (ab_hi, cd_hi));
+    }
+  return i;
+}
+
+static inline __m128i
+extract_8 (__m128i a,
+           __m128i b,
+           __m128i c,
+           __m128i d,
+           int     shift)
+{
+  const __m128i mask = _mm_set1_epi32 (0xff);
+
+  a = _mm_and_si128 (_mm_srli_epi32 (a, shift), mask);
+  b = _mm_and_si128 (_mm_srli_epi32 (b, shift), mask);
+  c = _mm_and_si128 (_mm_srli_epi32 (c, shift), mask);
+  d = _mm_and_si128 (_mm_srli_epi32 (d, shift), mask);
+
+  return _mm_packus_epi16 (_mm_packs_epi32 (a, b), _mm_packs_epi32 (c, d));
+}
+
+static long
+deinterleave_4x8_sse2 (const char *src,
+                       char      **dst,
+                       long        n)
+{
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const void *) (src + i * 4));
+      __m128i b = _mm_loadu_si128 ((const void *) (src + i * 4 + 16));
+      __m128i c = _mm_loadu_si128 ((const void *) (src + i * 4 + 32));
+      __m128i d = _mm_loadu_si128 ((const void *) (src + i * 4 + 48));
+
+      _mm_storeu_si128 ((void *) (dst[0] + i), extract_8 (a, b, c, d, 0));
+      _mm_storeu_si128 ((void *) (dst[1] + i), extract_8 (a, b, c, d, 8));
+      _mm_storeu_si128 ((void *) (dst[2] + i), extract_8 (a, b, c, d, 16));
+      _mm_storeu_si128 ((void *) (dst[3] + i), extract_8 (a, b, c, d, 24));
+    }
+  return i;
+}
+
+#endif
+
+/* whether the planes are four packed planes of components of size bytes,
+ * or four interleaved components of size bytes
+ */
+static inline int
+planes_are_packed_4 (const PlanesLayout *layout,
+                     const int          *pitch,
+                     int                 size)
+{
+  return layout->components == 4 && layout->bpp == size * 4 &&
+         pitch[0] == size && pitch[1] == size &&
+         pitch[2] == size && pitch[3] == size;
+}
+
+/* copies n pixels worth of components from the src planes to the dst
+ * planes, one of the sides is often interleaved pixels
+ */
+static void
+copy_planes (const PlanesLayout *layout,
+             char              **src,
+             const int          *src_pitch,
+             int                 src_interleaved,
+             char              **dst,
+             const int          *dst_pitch,
+             int                 dst_interleaved,
+             long                n)
+{
+  long done = 0;
+  int  i;
+
+#if defined(USE_SSE2)
+  if (dst_interleaved && planes_are_packed_4 (layout, src_pitch, 4))
+    done = interleave_4x32_sse2 ((const char **) src, dst[0], n);
+  else if (dst_interleaved && planes_are_packed_4 (layout, src_pitch, 2))
+    done = interleave_4x16_sse2 ((const char **) src, dst[0], n);
+  else if (dst_interleaved && planes_are_packed_4 (layout, src_pitch, 1))
+    done = interleave_4x8_sse2 ((const char **) src, dst[0], n);
+  else if (src_interleaved && planes_are_packed_4 (layout, dst_pitch, 4))
+    done = deinterleave_4x32_sse2 (src[0], dst, n);
+  else if (src_interleaved && planes_are_packed_4 (layout, dst_pitch, 2))
+    done = deinterleave_4x16_sse2 (src[0], dst, n);
+  else if (src_interleaved && planes_are_packed_4 (layout, dst_pitch, 1))
+    done = deinterleave_4x8_sse2 (src[0], dst, n);
+#endif
+
+  if (done == n)
+    return;
+
+  for (i = 0; i < layout->components; i++)
+    copy_component (src[i] + done * src_pitch[i], src_pitch[i],
+                    dst[i] + done * dst_pitch[i], dst_pitch[i],
+                    layout->size[i], n - done);
+}
+
+static inline void
+advance_planes (const PlanesLayout *layout,
+                char              **planes,
+                const int          *pitch,
+                long                n)
+{
+  int i;
+
+  for (i = 0; i < layout->components; i++)
+    planes[i] += pitch[i] * n;
+}
+
+static void
+tile_planes (const PlanesLayout *layout,
+             char               *tile,
+             char              **planes,
+             int                *pitch)
+{
+  int i;
+
+  for (i = 0; i < layout->components; i++)
+    {
+      planes[i] = tile + layout->offset[i];
+      pitch[i]  = layout->bpp;
+    }
+}
+
+static void
+process_planes (Babl               *babl,
+                const PlanesLayout *src,
+                char              **src_planes,
+                const int          *src_pitch,
+                const PlanesLayout *dst,
+                char              **dst_planes,
+                const int          *dst_pitch,
+                long                n)
+{
+  int   src_interleaved = planes_are_interleaved (src, src_planes, src_pitch);
+  int   dst_interleaved = planes_are_interleaved (dst, dst_planes, dst_pitch);
+  char *src_tile_planes[BABL_MAX_COMPONENTS];
+  char *dst_tile_planes[BABL_MAX_COMPONENTS];
+  int   src_tile_pitch[BABL_MAX_COMPONENTS];
+  int   dst_tile_pitch[BABL_MAX_COMPONENTS];
+  char *tiles;
+  long  done;
+
+  if (babl->fish.source == babl->fish.destination)
+    {
+      copy_planes (src, src_planes, src_pitch, src_interleaved,
+                   dst_planes, dst_pitch, dst_interleaved, n);
+      return;
+    }
+
+  if (src_interleaved && dst_interleaved)
+    {
+      babl->fish.dispatch (babl, src_planes[0], dst_planes[0], n,
+                           *babl->fish.data);
+      return;
+    }
+
+  tiles = babl_scratch_alloc (PLANES_TILE * (src->bpp + dst->bpp));
+  tile_planes (src, tiles, src_tile_planes, src_tile_pitch);
+  tile_planes (dst, tiles + PLANES_TILE * src->bpp,
+               dst_tile_planes, dst_tile_pitch);
+
+  for (done = 0; done < n; done += PLANES_TILE)
+    {
+      long  count = MIN (n - done, PLANES_TILE);
+      char *source;
+      char *destination;
+
+      if (src_interleaved)
+        {
+          source = src_planes[0];
+        }
+      else
+        {
+          copy_planes (src, src_planes, src_pitch, 0,
+                       src_tile_planes, src_tile_pitch, 1, count);
+          source = src_tile_planes[0];
+        }
+      destination = dst_interleaved ? dst_planes[0] : dst_tile_planes[0];
+
+      babl->fish.dispatch (babl, source, destination, count,
+                           *babl->fish.data);
+
+      if (!dst_interleaved)
+        copy_planes (dst, dst_tile_planes, dst_tile_pitch, 1,
+                     dst_planes, dst_pitch, 0, count);
+
+      advance_planes (src, src_planes, src_pitch, count);
+      advance_planes (dst, dst_planes, dst_pitch, count);
+    }
+
+  babl_scratch_free (tiles);
+}
+
+long
+babl_process_planes (const Babl  *fish,
+                     const void **source_planes,
+                     const int   *source_pitches,
+                     void       **dest_planes,
+                     const int   *dest_pitches,
+                     long         n)
+{
+  Babl         *babl = (Babl*)fish;
+  PlanesLayout  src;
+  PlanesLayout  dst;
+  char         *src_planes[BABL_MAX_COMPONENTS];
+  char         *dst_planes[BABL_MAX_COMPONENTS];
+  int           src_pitch[BABL_MAX_COMPONENTS];
+  int           dst_pitch[BABL_MAX_COMPONENTS];
+  int           i;
+
+  babl_assert (babl && BABL_IS_BABL (babl) && source_planes && dest_planes);
+
+  if (n <= 0)
+    return 0;
+
+  planes_layout (babl->fish.source, &src);
+  planes_layout (babl->fish.destination, &dst);
+
+  for (i = 0; i < src.components; i++)
+    {
+      src_planes[i] = (char *) source_planes[i];
+      src_pitch[i]  = source_pitches ? source_pitches[i] : src.size[i];
+    }
+  for (i = 0; i < dst.components; i++)
+    {
+      dst_planes[i] = dest_planes[i];
+      dst_pitch[i]  = dest_pitches ? dest_pitches[i] : dst.size[i];
+    }
+
+  if (babl_fish_stats_level)
+    {
+      int64_t start = babl_nanoseconds ();
+      process_planes (babl, &src, src_planes, src_pitch,
+                      &dst, dst_planes, dst_pitch, n);
+      _babl_fish_stats_add (babl, n, babl_nanoseconds () - start);
+    }
+  else
+    {
+      process_planes (babl, &src, src_planes, src_pitch,
+                      &dst, dst_planes, dst_pitch, n);
+    }
+  return n;
+}
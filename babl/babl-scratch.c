@@ -0,0 +1,224 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Per-thread scratch memory for the intermediate buffers of conversions.
+ *
+ * Each thread bumps its allocations off a block of its own, no locks are
+ * taken and no memory is handed back to the system between conversions.
+ * Buffers are expected to be freed in the reverse order of allocation,
+ * which gives their memory back right away; once every buffer of the
+ * thread has been freed the whole block is free again. When a block runs
+ * out a block twice the size is started, the earlier ones are kept for
+ * the buffers still in them and freed once the thread has no buffers
+ * left, so a thread stops allocating once it has seen its largest set of
+ * buffers.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#if defined(HAVE_TLS) && !defined(_WIN32)
+#define USE_SCRATCH 1
+#include <pthread.h>
+#endif
+
+#ifdef USE_SCRATCH
+
+#define SCRATCH_ALIGN      64
+#define SCRATCH_MIN_BLOCK  (64 * 1024)
+
+typedef struct ScratchBlock
+{
+  struct ScratchBlock *retired;  /* the block this one replaced */
+  size_t               size;
+  char                *data;     /* SCRATCH_ALIGN aligned */
+} ScratchBlock;
+
+/* stored right in front of each buffer */
+typedef struct ScratchHeader
+{
+  ScratchBlock *block;
+  size_t        start;    /* of the header */
+  size_t        end;      /* of the buffer */
+} ScratchHeader;
+
+typedef struct ScratchArena
+{
+  ScratchBlock *block;
+  size_t        used;     /* bytes of block in use */
+  long          buffers;  /* not yet freed */
+} ScratchArena;
+
+static __thread ScratchArena scratch;
+static pthread_key_t         scratch_key;
+static int                   scratch_key_valid;
+
+static void
+free_blocks (ScratchBlock *block)
+{
+  while (block)
+    {
+      ScratchBlock *retired = block->retired;
+      free (block);
+      block = retired;
+    }
+}
+
+/* frees the blocks of a thread that exits */
+static void
+scratch_thread_exit (void *data)
+{
+  ScratchArena *arena = data;
+
+  free_blocks (arena->block);
+  arena->block = NULL;
+}
+
+static ScratchBlock *
+block_new (size_t        size,
+           ScratchBlock *retired)
+{
+  ScratchBlock *block = malloc (sizeof (ScratchBlock) + size + SCRATCH_ALIGN);
+
+  if (!block)
+    babl_fatal ("failed allocating %li bytes of scratch memory", (long) size);
+
+  block->retired = retired;
+  block->size    = size;
+  block->data    = (char *) (((uintptr_t) (block + 1) + SCRATCH_ALIGN - 1) &
+                             ~(uintptr_t) (SCRATCH_ALIGN - 1));
+  return block;
+}
+
+static inline size_t
+scratch_start (size_t used)
+{
+  return (used + sizeof (ScratchHeader) + SCRATCH_ALIGN - 1) &
+         ~(size_t) (SCRATCH_ALIGN - 1);
+}
+
+void *
+babl_scratch_alloc (size_t size)
+{
+  ScratchArena  *arena = &scratch;
+  ScratchHeader *header;
+  size_t         start = scratch_start (arena->used);
+
+  if (!arena->block || start + size > arena->block->size)
+    {
+      size_t block_size = arena->block ? arena->block->size * 2
+                                       : SCRATCH_MIN_BLOCK;
+
+      while (block_size < scratch_start (0) + size)
+        block_size *= 2;
+
+      if (!arena->block && scratch_key_valid)
+        pthread_setspecific (scratch_key, arena);
+
+      /* a block without buffers in it can go right away */
+      if (arena->block && arena->buffers == 0)
+        {
+          free_blocks (arena->block);
+          arena->block = NULL;
+        }
+      arena->block = block_new (block_size, arena->block);
+      arena->used  = 0;
+      start        = scratch_start (0);
+    }
+
+  header = (ScratchHeader *) (arena->block->data + start) - 1;
+  header->block = arena->block;
+  header->start = arena->used;
+  header->end   = start + size;
+
+  arena->used = header->end;
+  arena->buffers++;
+  return arena->block->data + start;
+}
+
+void
+babl_scratch_free (void *ptr)
+{
+  ScratchArena  *arena = &scratch;
+  ScratchHeader *header;
+
+  if (!ptr)
+    return;
+
+  header = (ScratchHeader *) ptr - 1;
+  arena->buffers--;
+
+  if (arena->buffers == 0)
+    {
+      /* everything is free, keep only the largest block */
+      free_blocks (arena->block->retired);
+      arena->block->retired = NULL;
+      arena->used = 0;
+    }
+  else if (header->block == arena->block && header->end == arena->used)
+    {
+      /* the last buffer allocated */
+      arena->used = header->start;
+    }
+}
+
+void
+babl_scratch_init (void)
+{
+  scratch_key_valid = pthread_key_create (&scratch_key,
+                                          scratch_thread_exit) == 0;
+}
+
+void
+babl_scratch_destroy (void)
+{
+  /* other threads free their blocks when they exit */
+  scratch_thread_exit (&scratch);
+  if (scratch_key_valid)
+    pthread_key_delete (scratch_key);
+  scratch_key_valid = 0;
+}
+
+#else
+
+/* without thread local storage the buffers come from babl_malloc */
+
+void *
+babl_scratch_alloc (size_t size)
+{
+  return babl_malloc (size);
+}
+
+void
+babl_scratch_free (void *ptr)
+{
+  if (ptr)
+    babl_free (ptr);
+}
+
+void
+babl_scratch_init (void)
+{
+}
+
+void
+babl_scratch_destroy (void)
+{
+}
+
+#endif
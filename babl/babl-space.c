@@ -16,13 +16,24 @@
  * <https://www.gnu.org/licenses/>.
  */
 
-#define MAX_SPACES   100
+#define NEEDS_BABL_DB
 
 #include "config.h"
+#include <stddef.h>
 #include "babl-internal.h"
 #include "base/util.h"
 
-static BablSpace space_db[MAX_SPACES];
+/* spaces are registered by name in db, and in hash tables by the content
+ * of their dedup zone, by their TRCs - for babl_space_match_trc_matrix ()
+ * - and by the ICC profiles they were made from
+ */
+static BablHashTable *content_hash;
+static BablHashTable *trc_hash;
+static BablHashTable *icc_hash;
+
+#define DEDUP_OFFSET  offsetof (BablSpace, xr)
+#define DEDUP_SIZE    (offsetof (BablSpace, trc) + \
+                       sizeof (((BablSpace *) NULL)->trc) - DEDUP_OFFSET)
 
 static void babl_chromatic_adaptation_matrix (const double *whitepoint,
                                               const double *target_whitepoint,
@@ -215,57 +226,204 @@ babl_space_compute_matrices (BablSpace *space,
 const Babl *
 babl_space (const char *name)
 {
-  int i;
-  for (i = 0; space_db[i].instance.class_type; i++)
-    if (!strcmp (space_db[i].instance.name, name))
-      return (Babl*)&space_db[i];
-  return NULL;
+  return babl_db_exist_by_name (db, name);
+}
+
+static int
+space_hash_by_content (BablHashTable *htab,
+                       Babl          *item)
+{
+  return babl_hash_by_digest (htab, babl_digest (BABL_DIGEST_INIT,
+                                                 (char *) item + DEDUP_OFFSET,
+                                                 DEDUP_SIZE));
+}
+
+static int
+space_find_by_content (Babl *item,
+                       void *data)
+{
+  return !memcmp ((char *) item + DEDUP_OFFSET, (char *) data + DEDUP_OFFSET,
+                  DEDUP_SIZE);
+}
+
+static int
+space_hash_by_trc (BablHashTable *htab,
+                   Babl          *item)
+{
+  return babl_hash_by_digest (htab, babl_digest (BABL_DIGEST_INIT,
+                                                 item->space.trc,
+                                                 sizeof (item->space.trc)));
+}
+
+/* RGB spaces with the TRCs of data, and a matrix close to the one of data */
+static int
+space_find_by_trc_matrix (Babl *item,
+                          void *data)
+{
+  const BablSpace *space = &item->space;
+  const BablSpace *key   = data;
+  double           delta = 0.001;
+  int              i;
+
+  if (space->icc_type != BablICCTypeRGB ||
+      space->trc[0] != key->trc[0] ||
+      space->trc[1] != key->trc[1] ||
+      space->trc[2] != key->trc[2])
+    return 0;
+
+  for (i = 0; i < 9; i++)
+    if (!(fabs (key->RGBtoXYZ[i] - space->RGBtoXYZ[i]) < delta))
+      return 0;
+  return 1;
+}
+
+/* the digest of an ICC profile, made from the profile ID - the MD5 of the
+ * profile - when it has one
+ */
+static unsigned int
+icc_digest (const char *icc_data,
+            int         icc_length)
+{
+  static const char no_id[16] = { 0, };
+  unsigned int      digest    = babl_digest (BABL_DIGEST_INIT, &icc_length,
+                                             sizeof (icc_length));
+
+  if (icc_length >= 100 && memcmp (icc_data + 84, no_id, 16))
+    return babl_digest (digest, icc_data + 84, 16);
+  return babl_digest (digest, icc_data, icc_length);
+}
+
+static int
+space_hash_by_icc (BablHashTable *htab,
+                   Babl          *item)
+{
+  return babl_hash_by_digest (htab, item->space.icc_digest);
+}
+
+static int
+space_find_by_icc (Babl *item,
+                   void *data)
+{
+  const BablSpace *key = data;
+
+  return item->space.icc_length == key->icc_length &&
+         !memcmp (item->space.icc_profile, key->icc_profile, key->icc_length);
+}
+
+/* the registered space with the dedup zone of space, if any, called with
+ * the mutex of db held
+ */
+static Babl *
+space_find_duplicate (const BablSpace *space)
+{
+  return babl_hash_table_find (content_hash,
+                               space_hash_by_content (content_hash,
+                                                      (Babl *) space),
+                               NULL, (void *) space);
+}
+
+/* registers a copy of space, called with the mutex of db held */
+static BablSpace *
+space_register (const BablSpace *space,
+                int              deduplicate)
+{
+  BablSpace *copy = babl_malloc (sizeof (BablSpace));
+
+  int        i;
+
+  memcpy (copy, space, sizeof (BablSpace));
+  copy->instance.name = copy->name;
+  copy->ref_count     = 1;
+  for (i = 0; i < 3; i++)
+    if (copy->trc[i])
+      babl_trc_ref (copy->trc[i]);
+
+  babl_db_insert (db, (Babl *) copy);
+  if (deduplicate)
+    {
+      babl_hash_table_insert (content_hash, (Babl *) copy);
+      babl_hash_table_insert (trc_hash, (Babl *) copy);
+    }
+  babl_fish_cache_invalidate ();
+  return copy;
 }
 
 Babl *
-_babl_space_for_lcms (const char *icc_data,
-                      int         icc_length)
+_babl_space_for_icc (const char *icc_data,
+                     int         icc_length)
 {
-  int i=0;
-  BablSpace space = {0,};
+  BablSpace key;
+  Babl     *ret;
+
+  key.icc_profile = (char *) icc_data;
+  key.icc_length  = icc_length;
+
+  babl_mutex_lock (db->mutex);
+  ret = babl_hash_table_find (icc_hash,
+                              babl_hash_by_digest (icc_hash,
+                                icc_digest (icc_data, icc_length)),
+                              NULL, &key);
+  if (ret)
+    ret->space.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return ret;
+}
 
+void
+_babl_space_set_icc (Babl       *babl,
+                     const char *icc_data,
+                     int         icc_length)
+{
+  BablSpace *space = &babl->space;
 
-  for (i = 0; space_db[i].instance.class_type; i++)
-  {
-    if (space_db[i].icc_length ==
-        icc_length &&
-        (memcmp (space_db[i].icc_profile, icc_data, icc_length) == 0))
+  babl_mutex_lock (db->mutex);
+  if (!space->icc_registered)
     {
-        return (void*)&space_db[i];
+      space->icc_profile    = malloc (icc_length);
+      memcpy (space->icc_profile, icc_data, icc_length);
+      space->icc_length     = icc_length;
+      space->icc_digest     = icc_digest (icc_data, icc_length);
+      space->icc_registered = 1;
+      babl_hash_table_insert (icc_hash, babl);
     }
-  }
+  babl_mutex_unlock (db->mutex);
+}
 
-  memset (&space, 0, sizeof(space));
-  space.instance.class_type = BABL_SPACE;
-  space.instance.id         = 0;
-  space.icc_type = BablICCTypeCMYK;
+Babl *
+_babl_space_for_lcms (const char *icc_data,
+                      int         icc_length)
+{
+  static int lcms_spaces = 0;
+  BablSpace  space;
+  Babl      *ret;
 
-  if (i >= MAX_SPACES-1)
-  {
-    babl_log ("too many BablSpaces");
-    return NULL;
-  }
+  babl_mutex_lock (db->mutex);
 
-  /* initialize it with copy of srgb content */
+  ret = _babl_space_for_icc (icc_data, icc_length);
+  if (!ret)
   {
-    const BablSpace *srgb = &babl_space("sRGB")->space;
-    memcpy (&space.xw,
-            &srgb->xw,
-((char*)&srgb->icc_profile -
-(char*)&srgb->xw));
-  }
+    memset (&space, 0, sizeof(space));
+    space.instance.class_type = BABL_SPACE;
+    space.instance.id         = 0;
+    space.icc_type = BablICCTypeCMYK;
 
-  space_db[i]=space;
-  space_db[i].instance.name = space_db[i].name;
-  snprintf (space_db[i].name, sizeof (space_db[i].name), "space-lcms-%i", i);
+    /* initialize it with copy of srgb content */
+    {
+      const BablSpace *srgb = &babl_space("sRGB")->space;
+      memcpy (&space.xw,
+              &srgb->xw,
+  ((char*)&srgb->icc_profile -
+  (char*)&srgb->xw));
+    }
 
+    snprintf (space.name, sizeof (space.name), "space-lcms-%i",
+              lcms_spaces++);
+    ret = (Babl *) space_register (&space, 0);
+    _babl_space_set_icc (ret, icc_data, icc_length);
+  }
 
-  return (Babl*)&space_db[i];
+  babl_mutex_unlock (db->mutex);
+  return ret;
 }
 
 const Babl *
@@ -278,7 +436,7 @@ babl_space_from_rgbxyz_matrix (const char *name,
                                const Babl *trc_green,
                                const Babl *trc_blue)
 {
-  int i=0;
+  Babl *ret;
   BablSpace space = {0,};
   space.instance.class_type = BABL_SPACE;
   space.instance.id         = 0;
@@ -333,35 +491,26 @@ babl_space_from_rgbxyz_matrix (const char *name,
   space.trc[1] = trc_green?trc_green:trc_red;
   space.trc[2] = trc_blue?trc_blue:trc_red;
 
-  for (i = 0; space_db[i].instance.class_type; i++)
+  babl_mutex_lock (db->mutex);
+  ret = space_find_duplicate (&space);
+  if (!ret)
   {
-    int offset = ((char*)&space_db[i].xr) - (char*)(&space_db[i]);
-    int size   = ((char*)&space_db[i].trc) + sizeof(space_db[i].trc) - ((char*)&space_db[i].xr);
-
-    if (memcmp ((char*)(&space_db[i]) + offset, ((char*)&space) + offset, size)==0)
-      {
-        return (void*)&space_db[i];
-      }
-  }
-  if (i >= MAX_SPACES-1)
-  {
-    babl_log ("too many BablSpaces");
-    return NULL;
+    if (name)
+      snprintf (space.name, sizeof (space.name), "%s", name);
+    else
+            /* XXX: this can get longer than 256bytes ! */
+      snprintf (space.name, sizeof (space.name),
+               "space-%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%s,%s,%s",
+               wx,wy,rx,ry,bx,by,gx,gy,babl_get_name (space.trc[0]),
+               babl_get_name(space.trc[1]), babl_get_name(space.trc[2]));
+
+    ret = (Babl *) space_register (&space, 1);
+    babl_space_get_icc (ret, NULL);
   }
-
-  space_db[i]=space;
-  space_db[i].instance.name = space_db[i].name;
-  if (name)
-    snprintf (space_db[i].name, sizeof (space_db[i].name), "%s", name);
   else
-          /* XXX: this can get longer than 256bytes ! */
-    snprintf (space_db[i].name, sizeof (space_db[i].name),
-             "space-%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%s,%s,%s",
-             wx,wy,rx,ry,bx,by,gx,gy,babl_get_name (space.trc[0]),
-             babl_get_name(space.trc[1]), babl_get_name(space.trc[2]));
-
-  babl_space_get_icc ((Babl*)&space_db[i], NULL);
-  return (Babl*)&space_db[i];
+    ret->space.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return ret;
 }
 
 const Babl *
@@ -375,7 +524,7 @@ babl_space_from_chromaticities (const char *name,
                                 const Babl *trc_blue,
                                 BablSpaceFlags flags)
 {
-  int i=0;
+  Babl *ret;
   BablSpace space = {0,};
   space.instance.class_type = BABL_SPACE;
   space.instance.id         = 0;
@@ -397,37 +546,29 @@ babl_space_from_chromaticities (const char *name,
   space.whitepoint[2] = (1.0 - wx - wy) / wy;
   space.icc_type = BablICCTypeRGB;
 
-  for (i = 0; space_db[i].instance.class_type; i++)
-  {
-    int offset = ((char*)&space_db[i].xr) - (char*)(&space_db[i]);
-    int size   = ((char*)&space_db[i].trc) + sizeof(space_db[i].trc) - ((char*)&space_db[i].xr);
-
-    if (memcmp ((char*)(&space_db[i]) + offset, ((char*)&space) + offset, size)==0)
-      {
-        return (void*)&space_db[i];
-      }
-  }
-  if (i >= MAX_SPACES-1)
+  babl_mutex_lock (db->mutex);
+  ret = space_find_duplicate (&space);
+  if (!ret)
   {
-    babl_log ("too many BablSpaces");
-    return NULL;
+    if (name)
+      snprintf (space.name, sizeof (space.name), "%s", name);
+    else
+            /* XXX: this can get longer than 256bytes ! */
+      snprintf (space.name, sizeof (space.name),
+               "space-%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%s,%s,%s",
+               wx,wy,rx,ry,bx,by,gx,gy,babl_get_name (space.trc[0]),
+               babl_get_name(space.trc[1]), babl_get_name(space.trc[2]));
+
+    /* compute matrixes */
+    babl_space_compute_matrices (&space, flags);
+
+    ret = (Babl *) space_register (&space, 1);
+    babl_space_get_icc (ret, NULL);
   }
-  space_db[i]=space;
-  space_db[i].instance.name = space_db[i].name;
-  if (name)
-    snprintf (space_db[i].name, sizeof (space_db[i].name), "%s", name);
   else
-          /* XXX: this can get longer than 256bytes ! */
-    snprintf (space_db[i].name, sizeof (space_db[i].name),
-             "space-%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%.4f,%.4f_%s,%s,%s",
-             wx,wy,rx,ry,bx,by,gx,gy,babl_get_name (space.trc[0]),
-             babl_get_name(space.trc[1]), babl_get_name(space.trc[2]));
-
-  /* compute matrixes */
-  babl_space_compute_matrices (&space_db[i], flags);
-
-  babl_space_get_icc ((Babl*)&space_db[i], NULL);
-  return (Babl*)&space_db[i];
+    ret->space.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return ret;
 }
 
 const Babl *
@@ -435,7 +576,7 @@ babl_space_from_gray_trc (const char *name,
                           const Babl *trc_gray,
                           BablSpaceFlags flags)
 {
-  int i=0;
+  Babl *ret;
   BablSpace space = {0,};
   space.instance.class_type = BABL_SPACE;
   space.instance.id         = 0;
@@ -458,52 +599,243 @@ babl_space_from_gray_trc (const char *name,
   space.whitepoint[2] = (1.0 - space.xw - space.yw) / space.yw;
   space.icc_type = BablICCTypeGray;
 
-  for (i = 0; space_db[i].instance.class_type; i++)
+  babl_mutex_lock (db->mutex);
+  ret = space_find_duplicate (&space);
+  if (!ret)
   {
-    int offset = ((char*)&space_db[i].xr) - (char*)(&space_db[i]);
-    int size   = ((char*)&space_db[i].trc) + sizeof(space_db[i].trc) - ((char*)&space_db[i].xr);
-
-    if (memcmp ((char*)(&space_db[i]) + offset, ((char*)&space) + offset, size)==0)
-      {
-        return (void*)&space_db[i];
-      }
+    if (name)
+      snprintf (space.name, sizeof (space.name), "%s", name);
+    else
+            /* XXX: this can get longer than 256bytes ! */
+      snprintf (space.name, sizeof (space.name),
+               "space-gray-%s", babl_get_name(space.trc[0]));
+
+    /* compute matrixes */
+    babl_space_compute_matrices (&space, 1);
+
+    ret = (Babl *) space_register (&space, 1);
+    //babl_space_get_icc (ret, NULL);
   }
-  if (i >= MAX_SPACES-1)
-  {
-    babl_log ("too many BablSpaces");
-    return NULL;
-  }
-  space_db[i]=space;
-  space_db[i].instance.name = space_db[i].name;
-  if (name)
-    snprintf (space_db[i].name, sizeof (space_db[i].name), "%s", name);
   else
-          /* XXX: this can get longer than 256bytes ! */
-    snprintf (space_db[i].name, sizeof (space_db[i].name),
-             "space-gray-%s", babl_get_name(space.trc[0]));
+    ret->space.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return ret;
+}
+
+
+const Babl *
+babl_space_ref (const Babl *space)
+{
+  babl_mutex_lock (db->mutex);
+  ((Babl *) space)->space.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return space;
+}
+
+/* whether babl is a format or model in space, a conversion to or from one,
+ * or a fish converting through one
+ */
+static int
+babl_in_space (Babl *babl,
+               void *space)
+{
+  int i;
+
+  if (!babl)
+    return 0;
+
+  switch (babl->class_type)
+    {
+      case BABL_FORMAT:
+        return babl->format.space == space;
+      case BABL_MODEL:
+        return babl->model.space == space;
+      case BABL_CONVERSION:
+      case BABL_CONVERSION_LINEAR:
+      case BABL_CONVERSION_PLANE:
+      case BABL_CONVERSION_PLANAR:
+        return babl_in_space ((Babl *) babl->conversion.source, space) ||
+               babl_in_space ((Babl *) babl->conversion.destination, space);
+      case BABL_FISH:
+      case BABL_FISH_REFERENCE:
+      case BABL_FISH_SIMPLE:
+      case BABL_FISH_PATH:
+        if (babl_in_space ((Babl *) babl->fish.source, space) ||
+            babl_in_space ((Babl *) babl->fish.destination, space))
+          return 1;
+        if (babl->class_type == BABL_FISH_SIMPLE)
+          return babl_in_space ((Babl *) babl->fish_simple.conversion, space);
+        if (babl->class_type == BABL_FISH_PATH &&
+            babl->fish_path.conversion_list)
+          {
+            BablList *list = babl->fish_path.conversion_list;
+
+            for (i = 0; i < babl_list_size (list); i++)
+              if (babl_in_space (babl_list_get_n (list, i), space))
+                return 1;
+          }
+        return 0;
+      default:
+        return 0;
+    }
+}
+
+static int
+is_item (Babl *item,
+         void *data)
+{
+  return item == data;
+}
+
+typedef struct
+{
+  const Babl *space;
+  BablList   *items;
+} InSpace;
 
-  /* compute matrixes */
-  babl_space_compute_matrices (&space_db[i], 1);
+static int
+collect_in_space (Babl *babl,
+                  void *data)
+{
+  InSpace *in_space = data;
+
+  if (babl_in_space (babl, (void *) in_space->space))
+    babl_list_insert_last (in_space->items, babl);
+  return 0;
+}
+
+/* removes the items of db in space from it, and frees them */
+static void
+remove_in_space (BablDb     *db,
+                 const Babl *space,
+                 void      (*forget) (const Babl *babl))
+{
+  InSpace in_space = { space, babl_list_init () };
+  int     i;
+
+  babl_db_each (db, collect_in_space, &in_space);
+  babl_db_remove_matching (db, babl_in_space, (void *) space);
+
+  for (i = 0; i < babl_list_size (in_space.items); i++)
+    {
+      Babl *babl = babl_list_get_n (in_space.items, i);
 
-  //babl_space_get_icc ((Babl*)&space_db[i], NULL);
-  return (Babl*)&space_db[i];
+      if (forget)
+        forget (babl);
+      babl_free (babl);
+    }
+  babl_free (in_space.items);
+}
 
+static int
+forget_conversions_in_space (Babl *babl,
+                             void *space)
+{
+  if (babl->type.from_list)
+    babl_list_remove_matching (babl->type.from_list, babl_in_space, space);
+  return 0;
 }
 
+/* tears down space and everything made for it, called with the fish,
+ * format and space locks held
+ */
+static void
+space_destroy (Babl *space)
+{
+  const Babl *remodel;
+  int         i;
+
+  /* the fishes go first, they point at the conversions and formats */
+  babl_fish_table_remove_matching (babl_in_space, space);
+  remove_in_space (babl_fish_db (), space, _babl_fish_stats_forget);
+  remove_in_space (babl_fast_fish_db (), space, _babl_fish_stats_forget);
+
+  babl_db_each (babl_format_db (), forget_conversions_in_space, space);
+  babl_db_each (babl_model_db (), forget_conversions_in_space, space);
+  babl_db_each (babl_type_db (), forget_conversions_in_space, space);
+  remove_in_space (babl_conversion_db (), space, NULL);
+  remove_in_space (babl_format_db (), space, NULL);
+  remove_in_space (babl_model_db (), space, NULL);
+
+  /* remodels share the conversion list of their model, unless they got
+   * one of their own
+   */
+  remodel = space->space.remodels;
+  while (remodel)
+    {
+      Babl       *next  = (Babl *) remodel->model.next_remodel;
+      const Babl *model = remodel->model.model;
+
+      if (remodel->model.from_list &&
+          remodel->model.from_list != model->model.from_list)
+        babl_free (remodel->model.from_list);
+      babl_free ((Babl *) remodel);
+      remodel = next;
+    }
+
+  babl_hash_table_remove_matching (content_hash, is_item, space);
+  babl_hash_table_remove_matching (trc_hash, is_item, space);
+  babl_hash_table_remove_matching (icc_hash, is_item, space);
+  babl_db_remove_matching (db, is_item, space);
+
+  for (i = 0; i < 3; i++)
+    if (space->space.trc[i])
+      babl_trc_unref (space->space.trc[i]);
+  free (space->space.icc_profile);
+#ifdef HAVE_LCMS
+  if (space->space.cmyk.lcms_to_rgba)
+    cmsDeleteTransform (space->space.cmyk.lcms_to_rgba);
+  if (space->space.cmyk.lcms_from_rgba)
+    cmsDeleteTransform (space->space.cmyk.lcms_from_rgba);
+  if (space->space.cmyk.lcms_profile)
+    cmsCloseProfile (space->space.cmyk.lcms_profile);
+#endif
+
+  babl_free (space);
+  babl_fish_cache_invalidate ();
+}
 
 void
-babl_space_class_for_each (BablEachFunction each_fun,
-                           void            *user_data)
+babl_space_unref (const Babl *space)
 {
-  int i=0;
-  for (i = 0; space_db[i].instance.class_type; i++)
-    if (each_fun (BABL (&space_db[i]), user_data))
-      return;
+  if (!space)
+    return;
+
+  /* fishes being worked out in the background may be in the space */
+  babl_fish_async_wait ();
+
+  babl_mutex_lock (babl_fish_mutex);
+  babl_mutex_lock (babl_format_mutex);
+  babl_mutex_lock (db->mutex);
+  if (--((Babl *) space)->space.ref_count == 0)
+    {
+      space_destroy ((Babl *) space);
+      /* nothing else may be looking up fishes now */
+      babl_fish_table_free_retired ();
+      _babl_fish_stats_free_forgotten ();
+    }
+  babl_mutex_unlock (db->mutex);
+  babl_mutex_unlock (babl_format_mutex);
+  babl_mutex_unlock (babl_fish_mutex);
 }
 
+
+BABL_CLASS_MINIMAL_IMPLEMENT (space);
+
 void
 babl_space_class_init (void)
 {
+  babl_space_db ();
+  if (!content_hash)
+    {
+      content_hash = babl_hash_table_init (space_hash_by_content,
+                                           space_find_by_content);
+      trc_hash     = babl_hash_table_init (space_hash_by_trc,
+                                           space_find_by_trc_matrix);
+      icc_hash     = babl_hash_table_init (space_hash_by_icc,
+                                           space_find_by_icc);
+    }
+
 #if 0
   babl_space_from_chromaticities ("sRGB",
                0.3127,  0.3290, /* D65 */
@@ -521,6 +853,8 @@ babl_space_class_init (void)
                 0);
   /* hard-coded pre-quantized values - to match exactly what is used in standards see issue #18 */
 #endif
+  /* the formats of sRGB are the ones paths are made in to begin with */
+  ((Babl *) babl_space ("sRGB"))->space.prepared = 1;
 
   /* sRGB with linear TRCs is scRGB.
    */
@@ -678,16 +1012,35 @@ babl_space_get_rgbtoxyz (const Babl *space)
 ///////////////////
 
 
+/* pixels converted at a time by the u8 converters, in a float RGBA buffer
+ * on the stack
+ */
+#define UNIVERSAL_TILE     256
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+typedef struct
+{
+  float        matrixf[9];
+  const float *to_linear[3];  /* the u8 tables of the source TRCs */
+} UniversalData;
+
+static int
+universal_data_destroy (void *babl)
+{
+  babl_free (((Babl *) babl)->conversion.data);
+  return 0;
+}
+
 static void
 prep_conversion (const Babl *babl)
 {
   Babl *conversion = (void*) babl;
   const Babl *source_space = babl_conversion_get_source_space (conversion);
-  float *matrixf;
+  UniversalData *data;
   int i;
-  float *lut_red;
-  float *lut_green;
-  float *lut_blue;
 
   double matrix[9];
   babl_matrix_mul_matrix (
@@ -695,19 +1048,27 @@ prep_conversion (const Babl *babl)
      (conversion->conversion.source)->format.space->space.RGBtoXYZ,
      matrix);
 
-  matrixf = babl_calloc (sizeof (float), 9 + 256 * 3); // we leak this matrix , which is a singleton
-  babl_matrix_to_float (matrix, matrixf);
-  conversion->conversion.data = matrixf;
+  data = babl_calloc (sizeof (UniversalData), 1);
+  babl_matrix_to_float (matrix, data->matrixf);
+  conversion->conversion.data = data;
+  babl_set_destructor (conversion, universal_data_destroy);
 
-  lut_red = matrixf + 9;
-  lut_green = lut_red + 256;
-  lut_blue = lut_green + 256;
-  for (i = 0; i < 256; i++)
-  {
-    lut_red[i] = babl_trc_to_linear (source_space->space.trc[0], i/255.0);
-    lut_green[i] = babl_trc_to_linear (source_space->space.trc[1], i/255.0);
-    lut_blue[i] = babl_trc_to_linear (source_space->space.trc[2], i/255.0);
-  }
+  for (i = 0; i < 3; i++)
+    data->to_linear[i] = babl_trc_get_u8_to_linear (source_space->space.trc[i]);
+}
+
+/* the linear to u8 tables of the destination TRCs, made by the TRCs on
+ * first use
+ */
+static inline void
+get_u8_tables (const Babl            *conversion,
+               const BablTRCU8Table **tables)
+{
+  const Babl *space = conversion->conversion.destination->format.space;
+  int c;
+
+  for (c = 0; c < 3; c++)
+    tables[c] = babl_trc_get_u8_from_linear (space->space.trc[c]);
 }
 
 #define TRC_IN(rgba_in, rgba_out)  do{ int i;\
@@ -817,40 +1178,40 @@ universal_nonlinear_rgba_u8_converter (const Babl    *conversion,
                                        long           samples,
                                        void          *data)
 {
-  const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green  = in_trc_lut_red + 256;
-  float * in_trc_lut_blue  = in_trc_lut_green + 256;
-  int i;
+  UniversalData *udata = data;
+  const BablTRCU8Table *tables[3];
   uint8_t *rgba_in_u8 = (void*)src_char;
   uint8_t *rgba_out_u8 = (void*)dst_char;
+  float rgba[UNIVERSAL_TILE * 4];
 
-  float *rgb = babl_malloc (sizeof(float) * 4 * samples);
-
-  for (i = 0; i < samples; i++)
+  get_u8_tables (conversion, tables);
+  while (samples > 0)
   {
-    rgb[i*4+0]=in_trc_lut_red[rgba_in_u8[i*4+0]];
-    rgb[i*4+1]=in_trc_lut_green[rgba_in_u8[i*4+1]];
-    rgb[i*4+2]=in_trc_lut_blue[rgba_in_u8[i*4+2]];
-    rgba_out_u8[i*4+3] = rgba_in_u8[i*4+3];
-  }
+    int n = MIN (samples, UNIVERSAL_TILE);
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+      rgba[i*4+0] = udata->to_linear[0][rgba_in_u8[i*4+0]];
+      rgba[i*4+1] = udata->to_linear[1][rgba_in_u8[i*4+1]];
+      rgba[i*4+2] = udata->to_linear[2][rgba_in_u8[i*4+2]];
+      rgba[i*4+3] = 1.0f;
+    }
 
-  babl_matrix_mul_vectorff_buf4 (matrixf, rgb, rgb, samples);
+    babl_matrix_mul_vectorff_buf4 (udata->matrixf, rgba, rgba, n);
 
-  {
-    const Babl *from_trc_red   = (void*)destination_space->space.trc[0];
-    const Babl *from_trc_green = (void*)destination_space->space.trc[1];
-    const Babl *from_trc_blue  = (void*)destination_space->space.trc[2];
-    for (i = 0; i < samples * 4; i+=4)
+    for (i = 0; i < n; i++)
     {
-      rgba_out_u8[i+0] = babl_trc_from_linear (from_trc_red,   rgb[i+0]) * 255.5f;
-      rgba_out_u8[i+1] = babl_trc_from_linear (from_trc_green, rgb[i+1]) * 255.5f;
-      rgba_out_u8[i+2] = babl_trc_from_linear (from_trc_blue,  rgb[i+2]) * 255.5f;
+      rgba_out_u8[i*4+0] = babl_trc_u8_from_linear (tables[0], rgba[i*4+0]);
+      rgba_out_u8[i*4+1] = babl_trc_u8_from_linear (tables[1], rgba[i*4+1]);
+      rgba_out_u8[i*4+2] = babl_trc_u8_from_linear (tables[2], rgba[i*4+2]);
+      rgba_out_u8[i*4+3] = rgba_in_u8[i*4+3];
     }
+
+    rgba_in_u8  += n * 4;
+    rgba_out_u8 += n * 4;
+    samples     -= n;
   }
-  babl_free (rgb);
 }
 
 
@@ -911,38 +1272,39 @@ universal_nonlinear_rgb_u8_converter (const Babl    *conversion,
                                       long           samples,
                                       void          *data)
 {
-  const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green = in_trc_lut_red + 256;
-  float * in_trc_lut_blue = in_trc_lut_green + 256;
-  int i;
+  UniversalData *udata = data;
+  const BablTRCU8Table *tables[3];
   uint8_t *rgb_in_u8 = (void*)src_char;
   uint8_t *rgb_out_u8 = (void*)dst_char;
+  float rgba[UNIVERSAL_TILE * 4];
 
-  float *rgba_out = babl_malloc (sizeof(float) * 4 * samples);
-
-  for (i = 0; i < samples; i++)
+  get_u8_tables (conversion, tables);
+  while (samples > 0)
   {
-    rgba_out[i*4+0]=in_trc_lut_red[rgb_in_u8[i*3+0]];
-    rgba_out[i*4+1]=in_trc_lut_green[rgb_in_u8[i*3+1]];
-    rgba_out[i*4+2]=in_trc_lut_blue[rgb_in_u8[i*3+2]];
-    rgba_out[i*4+3]=rgb_in_u8[i*3+2] * 255.5f;
-  }
+    int n = MIN (samples, UNIVERSAL_TILE);
+    int i;
 
-  babl_matrix_mul_vectorff_buf4 (matrixf, rgba_out, rgba_out, samples);
+    for (i = 0; i < n; i++)
+    {
+      rgba[i*4+0] = udata->to_linear[0][rgb_in_u8[i*3+0]];
+      rgba[i*4+1] = udata->to_linear[1][rgb_in_u8[i*3+1]];
+      rgba[i*4+2] = udata->to_linear[2][rgb_in_u8[i*3+2]];
+      rgba[i*4+3] = 1.0f;
+    }
 
-  {
-    int c;
-    TRC_OUT(rgba_out, rgba_out);
+    babl_matrix_mul_vectorff_buf4 (udata->matrixf, rgba, rgba, n);
 
-    for (i = 0; i < samples; i++)
-      for (c = 0; c < 3; c ++)
-        rgb_out_u8[i*3+c] = rgba_out[i*4+c] * 255.5f;
-  }
+    for (i = 0; i < n; i++)
+    {
+      rgb_out_u8[i*3+0] = babl_trc_u8_from_linear (tables[0], rgba[i*4+0]);
+      rgb_out_u8[i*3+1] = babl_trc_u8_from_linear (tables[1], rgba[i*4+1]);
+      rgb_out_u8[i*3+2] = babl_trc_u8_from_linear (tables[2], rgba[i*4+2]);
+    }
 
-  babl_free (rgba_out);
+    rgb_in_u8  += n * 3;
+    rgb_out_u8 += n * 3;
+    samples    -= n;
+  }
 }
 
 
@@ -1012,6 +1374,42 @@ universal_rgba_converter_sse2 (const Babl *conversion,
   babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_in, rgba_out, samples);
 }
 
+/* converts the linear RGB of a tile to u8, 4 or 3 bytes apart */
+static inline void
+linear_to_u8_sse2 (const BablTRCU8Table **tables,
+                   const __v4sf          *rgba,
+                   uint8_t               *out,
+                   int                    pitch,
+                   int                    samples)
+{
+  const __v4sf zero = _mm_setzero_ps ();
+  const __v4sf one = _mm_set1_ps (1.0f);
+  const __m128i min_bits = _mm_set1_epi32 (BABL_TRC_TABLE_MIN_BITS);
+  int i;
+
+  for (i = 0; i < samples; i++)
+  {
+    union { __v4sf v; float f[4]; } value;
+    union { __m128i v; uint32_t i[4]; } index;
+    __m128i bits;
+
+    /* max() with zero as the second argument also maps NaN to zero */
+    value.v = _mm_min_ps (_mm_max_ps (rgba[i], zero), one);
+
+    /* the float bits of values from 0 to 1 sort like integers, smaller
+     * values than the table covers end up at its start
+     */
+    bits = _mm_sub_epi32 (_mm_castps_si128 (value.v), min_bits);
+    bits = _mm_andnot_si128 (_mm_srai_epi32 (bits, 31), bits);
+    index.v = _mm_srli_epi32 (bits, BABL_TRC_U8_TABLE_SHIFT);
+
+    out[0] = babl_trc_u8_table_lookup (tables[0], index.i[0], value.f[0]);
+    out[1] = babl_trc_u8_table_lookup (tables[1], index.i[1], value.f[1]);
+    out[2] = babl_trc_u8_table_lookup (tables[2], index.i[2], value.f[2]);
+    out += pitch;
+  }
+}
+
 static inline void
 universal_nonlinear_rgba_u8_converter_sse2 (const Babl    *conversion,
                                             unsigned char *src_char,
@@ -1019,38 +1417,36 @@ universal_nonlinear_rgba_u8_converter_sse2 (const Babl    *conversion,
                                             long           samples,
                                             void          *data)
 {
-  const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green = in_trc_lut_red + 256;
-  float * in_trc_lut_blue = in_trc_lut_green + 256;
-  int i;
+  UniversalData *udata = data;
+  const BablTRCU8Table *tables[3];
   uint8_t *rgba_in_u8 = (void*)src_char;
   uint8_t *rgba_out_u8 = (void*)dst_char;
+  __v4sf rgba[UNIVERSAL_TILE];
 
-  float *rgba_out = babl_malloc (sizeof(float) * 4 * samples);
-
-  for (i = 0; i < samples * 4; i+= 4)
+  get_u8_tables (conversion, tables);
+  while (samples > 0)
   {
-    rgba_out[i+0]=in_trc_lut_red[rgba_in_u8[i+0]];
-    rgba_out[i+1]=in_trc_lut_green[rgba_in_u8[i+1]];
-    rgba_out[i+2]=in_trc_lut_blue[rgba_in_u8[i+2]];
-    rgba_out_u8[i+3] = rgba_in_u8[i+3];
-  }
+    int n = MIN (samples, UNIVERSAL_TILE);
+    int i;
 
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_out, rgba_out, samples);
+    for (i = 0; i < n; i++)
+    {
+      rgba[i] = _mm_setr_ps (udata->to_linear[0][rgba_in_u8[i*4+0]],
+                             udata->to_linear[1][rgba_in_u8[i*4+1]],
+                             udata->to_linear[2][rgba_in_u8[i*4+2]],
+                             1.0f);
+      rgba_out_u8[i*4+3] = rgba_in_u8[i*4+3];
+    }
 
-  {
-    int c;
-    TRC_OUT(rgba_out, rgba_out);
+    babl_matrix_mul_vectorff_buf4_sse2 (udata->matrixf,
+                                        (float *) rgba, (float *) rgba, n);
 
-    for (i = 0; i < samples * 4; i+= 4)
-      for (c = 0; c < 3; c ++)
-        rgba_out_u8[i+c] = rgba_out[i+c] * 255.5f;
-  }
+    linear_to_u8_sse2 (tables, rgba, rgba_out_u8, 4, n);
 
-  babl_free (rgba_out);
+    rgba_in_u8  += n * 4;
+    rgba_out_u8 += n * 4;
+    samples     -= n;
+  }
 }
 
 static inline void
@@ -1060,37 +1456,33 @@ universal_nonlinear_rgb_u8_converter_sse2 (const Babl    *conversion,
                                            long           samples,
                                            void          *data)
 {
-  const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green = in_trc_lut_red + 256;
-  float * in_trc_lut_blue = in_trc_lut_green + 256;
-  int i;
+  UniversalData *udata = data;
+  const BablTRCU8Table *tables[3];
   uint8_t *rgb_in_u8 = (void*)src_char;
   uint8_t *rgb_out_u8 = (void*)dst_char;
+  __v4sf rgba[UNIVERSAL_TILE];
 
-  float *rgba_out = babl_malloc (sizeof(float) * 4 * samples);
-
-  for (i = 0; i < samples; i++)
+  get_u8_tables (conversion, tables);
+  while (samples > 0)
   {
-    rgba_out[i*4+0]=in_trc_lut_red[rgb_in_u8[i*3+0]];
-    rgba_out[i*4+1]=in_trc_lut_green[rgb_in_u8[i*3+1]];
-    rgba_out[i*4+2]=in_trc_lut_blue[rgb_in_u8[i*3+2]];
-  }
+    int n = MIN (samples, UNIVERSAL_TILE);
+    int i;
 
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_out, rgba_out, samples);
+    for (i = 0; i < n; i++)
+      rgba[i] = _mm_setr_ps (udata->to_linear[0][rgb_in_u8[i*3+0]],
+                             udata->to_linear[1][rgb_in_u8[i*3+1]],
+                             udata->to_linear[2][rgb_in_u8[i*3+2]],
+                             1.0f);
 
-  {
-    int c;
-    TRC_OUT(rgba_out, rgba_out);
+    babl_matrix_mul_vectorff_buf4_sse2 (udata->matrixf,
+                                        (float *) rgba, (float *) rgba, n);
 
-    for (i = 0; i < samples; i++)
-      for (c = 0; c < 3; c ++)
-        rgb_out_u8[i*3+c] = rgba_out[i*4+c] * 255.5f;
-  }
+    linear_to_u8_sse2 (tables, rgba, rgb_out_u8, 3, n);
 
-  babl_free (rgba_out);
+    rgb_in_u8  += n * 3;
+    rgb_out_u8 += n * 3;
+    samples    -= n;
+  }
 }
 
 
@@ -1131,13 +1523,224 @@ universal_linear_rgb_nonlinear_converter_sse2 (const Babl    *conversion,
 #endif
 
 
+#if defined(USE_AVX2) && defined(USE_FMA)
+
+typedef void (* UniversalConverter) (const Babl    *conversion,
+                                     unsigned char *src_char,
+                                     unsigned char *dst_char,
+                                     long           samples,
+                                     void          *data);
+
+/* runs a converter of RGBA float pixels UNIVERSAL_TILE pixels at a time,
+ * so the TRCs and the matrix of a tile are converted while it is in the
+ * cache rather than in passes over the whole buffer
+ */
+static inline void
+universal_tiled (UniversalConverter  converter,
+                 const Babl         *conversion,
+                 unsigned char      *src_char,
+                 unsigned char      *dst_char,
+                 long                samples,
+                 void               *data)
+{
+  while (samples > 0)
+  {
+    long n = MIN (samples, UNIVERSAL_TILE);
+
+    converter (conversion, src_char, dst_char, n, data);
+    src_char += n * 4 * sizeof (float);
+    dst_char += n * 4 * sizeof (float);
+    samples  -= n;
+  }
+}
+
+static inline void
+universal_nonlinear_rgba_tile_avx2 (const Babl    *conversion,
+                                    unsigned char *src_char,
+                                    unsigned char *dst_char,
+                                    long           samples,
+                                    void          *data)
+{
+  const Babl *source_space = babl_conversion_get_source_space (conversion);
+  const Babl *destination_space = babl_conversion_get_destination_space (conversion);
+  float * matrixf = data;
+  float *rgba_in = (void*)src_char;
+  float *rgba_out = (void*)dst_char;
+
+  TRC_IN(rgba_in, rgba_out);
+
+  babl_matrix_mul_vectorff_buf4_avx2 (matrixf, rgba_out, rgba_out, samples);
+
+  TRC_OUT(rgba_out, rgba_out);
+}
+
+static inline void
+universal_nonlinear_rgb_linear_tile_avx2 (const Babl    *conversion,
+                                          unsigned char *src_char,
+                                          unsigned char *dst_char,
+                                          long           samples,
+                                          void          *data)
+{
+  const Babl *source_space = babl_conversion_get_source_space (conversion);
+  float * matrixf = data;
+  float *rgba_in = (void*)src_char;
+  float *rgba_out = (void*)dst_char;
+
+  TRC_IN(rgba_in, rgba_out);
+
+  babl_matrix_mul_vectorff_buf4_avx2 (matrixf, rgba_out, rgba_out, samples);
+}
+
+static inline void
+universal_linear_rgb_nonlinear_tile_avx2 (const Babl    *conversion,
+                                          unsigned char *src_char,
+                                          unsigned char *dst_char,
+                                          long           samples,
+                                          void          *data)
+{
+  const Babl *destination_space = conversion->conversion.destination->format.space;
+  float * matrixf = data;
+  float *rgba_in = (void*)src_char;
+  float *rgba_out = (void*)dst_char;
+
+  babl_matrix_mul_vectorff_buf4_avx2 (matrixf, rgba_in, rgba_out, samples);
+
+  TRC_OUT(rgba_out, rgba_out);
+}
+
+static inline void
+universal_nonlinear_rgba_converter_avx2 (const Babl    *conversion,
+                                         unsigned char *src_char,
+                                         unsigned char *dst_char,
+                                         long           samples,
+                                         void          *data)
+{
+  universal_tiled (universal_nonlinear_rgba_tile_avx2,
+                   conversion, src_char, dst_char, samples, data);
+}
+
+static inline void
+universal_nonlinear_rgb_linear_converter_avx2 (const Babl    *conversion,
+                                               unsigned char *src_char,
+                                               unsigned char *dst_char,
+                                               long           samples,
+                                               void          *data)
+{
+  universal_tiled (universal_nonlinear_rgb_linear_tile_avx2,
+                   conversion, src_char, dst_char, samples, data);
+}
+
+static inline void
+universal_linear_rgb_nonlinear_converter_avx2 (const Babl    *conversion,
+                                               unsigned char *src_char,
+                                               unsigned char *dst_char,
+                                               long           samples,
+                                               void          *data)
+{
+  universal_tiled (universal_linear_rgb_nonlinear_tile_avx2,
+                   conversion, src_char, dst_char, samples, data);
+}
+
+static inline void
+universal_rgba_converter_avx2 (const Babl    *conversion,
+                               unsigned char *src_char,
+                               unsigned char *dst_char,
+                               long           samples,
+                               void          *data)
+{
+  float *matrixf = data;
+  float *rgba_in = (void*)src_char;
+  float *rgba_out = (void*)dst_char;
+
+  babl_matrix_mul_vectorff_buf4_avx2 (matrixf, rgba_in, rgba_out, samples);
+}
+
+static inline void
+universal_rgb_converter_avx2 (const Babl    *conversion,
+                              unsigned char *src_char,
+                              unsigned char *dst_char,
+                              long           samples,
+                              void          *data)
+{
+  float *matrixf = data;
+  float *rgb_in = (void*)src_char;
+  float *rgb_out = (void*)dst_char;
+
+  babl_matrix_mul_vectorff_buf3_avx2 (matrixf, rgb_in, rgb_out, samples);
+}
+#endif
+
+
 static int
 add_rgb_adapter (Babl *babl,
                  void *space)
 {
-  if (babl != space)
+  /* only to the spaces paths have been made in, the others get theirs
+   * when they are prepared
+   */
+  if (babl != space && babl->space.prepared)
   {
 
+#if defined(USE_AVX2) && defined(USE_FMA)
+    if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_AVX2) &&
+        (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_FMA))
+    {
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGBA float", space),
+                       babl_format_with_space("RGBA float", babl),
+                       "linear", universal_rgba_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGBA float", babl),
+                       babl_format_with_space("RGBA float", space),
+                       "linear", universal_rgba_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("R'G'B'A float", space),
+                       babl_format_with_space("R'G'B'A float", babl),
+                       "linear", universal_nonlinear_rgba_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("R'G'B'A float", babl),
+                       babl_format_with_space("R'G'B'A float", space),
+                       "linear", universal_nonlinear_rgba_converter_avx2,
+                       NULL));
+
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("R'G'B'A float", space),
+                       babl_format_with_space("RGBA float", babl),
+                       "linear", universal_nonlinear_rgb_linear_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("R'G'B'A float", babl),
+                       babl_format_with_space("RGBA float", space),
+                       "linear", universal_nonlinear_rgb_linear_converter_avx2,
+                       NULL));
+
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGBA float", babl),
+                       babl_format_with_space("R'G'B'A float", space),
+                       "linear", universal_linear_rgb_nonlinear_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGBA float", space),
+                       babl_format_with_space("R'G'B'A float", babl),
+                       "linear", universal_linear_rgb_nonlinear_converter_avx2,
+                       NULL));
+
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGB float", space),
+                       babl_format_with_space("RGB float", babl),
+                       "linear", universal_rgb_converter_avx2,
+                       NULL));
+       prep_conversion(babl_conversion_new(
+                       babl_format_with_space("RGB float", babl),
+                       babl_format_with_space("RGB float", space),
+                       "linear", universal_rgb_converter_avx2,
+                       NULL));
+    }
+#endif
+
 #if defined(USE_SSE2)
     if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE) &&
         (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE2))
@@ -1329,29 +1932,28 @@ babl_space_match_trc_matrix (const Babl *trc_red,
                              float gx, float gy, float gz,
                              float bx, float by, float bz)
 {
-  int i;
-  double delta = 0.001;
-  for (i = 0; space_db[i].instance.class_type; i++)
-  {
-    BablSpace *space = &space_db[i];
-    if (space->icc_type == BablICCTypeRGB &&
-        trc_red == space->trc[0] &&
-        trc_green == space->trc[1] &&
-        trc_blue == space->trc[2] &&
-        fabs(rx - space->RGBtoXYZ[0]) < delta &&
-        fabs(ry - space->RGBtoXYZ[3]) < delta &&
-        fabs(rz - space->RGBtoXYZ[6]) < delta &&
-        fabs(gx - space->RGBtoXYZ[1]) < delta &&
-        fabs(gy - space->RGBtoXYZ[4]) < delta &&
-        fabs(gz - space->RGBtoXYZ[7]) < delta &&
-        fabs(bx - space->RGBtoXYZ[2]) < delta &&
-        fabs(by - space->RGBtoXYZ[5]) < delta &&
-        fabs(bz - space->RGBtoXYZ[8]) < delta)
-     {
-       return (void*)&space_db[i];
-     }
-  }
-  return NULL;
+  BablSpace key;
+  Babl     *ret;
+
+  key.trc[0] = trc_red;
+  key.trc[1] = trc_green;
+  key.trc[2] = trc_blue;
+  key.RGBtoXYZ[0] = rx;
+  key.RGBtoXYZ[3] = ry;
+  key.RGBtoXYZ[6] = rz;
+  key.RGBtoXYZ[1] = gx;
+  key.RGBtoXYZ[4] = gy;
+  key.RGBtoXYZ[7] = gz;
+  key.RGBtoXYZ[2] = bx;
+  key.RGBtoXYZ[5] = by;
+  key.RGBtoXYZ[8] = bz;
+
+  babl_mutex_lock (db->mutex);
+  ret = babl_hash_table_find (trc_hash,
+                              space_hash_by_trc (trc_hash, (Babl *) &key),
+                              NULL, &key);
+  babl_mutex_unlock (db->mutex);
+  return ret;
 }
 
 const Babl *
@@ -1370,7 +1972,7 @@ babl_space_with_trc (const Babl *babl,
                   &xb, &yb,
                   &red_trc, &green_trc, &blue_trc);
   if (red_trc == trc && green_trc == trc && blue_trc == trc)
-    return babl;
+    return babl_space_ref (babl);
   return babl_space_from_chromaticities (NULL,
                                          xw, yw, xr, yr, xg, yg, xb, yb, trc, trc, trc,
                                          BABL_SPACE_FLAG_EQUALIZE);
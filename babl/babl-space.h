@@ -135,6 +135,14 @@ typedef struct
    */
   char *icc_profile;
   int   icc_length;
+  unsigned int icc_digest;     /* of icc_profile, when icc_registered */
+  int          icc_registered; /* icc_profile was imported, and is looked up */
+
+  int          ref_count;      /* see babl_space_unref () */
+  int          prepared;       /* the conversions for paths to other spaces
+                                  have been added */
+  const Babl  *remodels;       /* the models in the space, linked through
+                                  model.next_remodel */
   BablCMYK cmyk;
 } BablSpace;
 
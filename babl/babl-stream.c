@@ -0,0 +1,196 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Conversion of pixel data arriving in chunks of any size, see
+ * babl_stream_process ().
+ *
+ * Whole pixels are converted straight from the chunk of the caller into
+ * the destination of the caller. A stream only holds on to the bytes of a
+ * source pixel that is split between chunks, and to the converted bytes
+ * of a pixel that did not fit in the destination; neither is ever more
+ * than a pixel.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "babl-internal.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+struct _BablStream
+{
+  const Babl    *fish;
+  int            source_bpp;
+  int            dest_bpp;
+  int            in_pending;   /* bytes of a split source pixel in in */
+  int            out_pending;  /* converted bytes left in out */
+  int            out_offset;   /* of the first of those in out */
+  unsigned char *in;
+  unsigned char *out;
+};
+
+BablStream *
+babl_stream_new (const Babl *fish)
+{
+  BablStream *stream;
+  int         source_bpp;
+  int         dest_bpp;
+
+  babl_assert (fish && BABL_IS_BABL (fish));
+
+  source_bpp = babl_format_get_bytes_per_pixel (fish->fish.source);
+  dest_bpp   = babl_format_get_bytes_per_pixel (fish->fish.destination);
+
+  stream = babl_calloc (1, sizeof (BablStream) + source_bpp + dest_bpp);
+  stream->fish       = fish;
+  stream->source_bpp = source_bpp;
+  stream->dest_bpp   = dest_bpp;
+  stream->in         = (unsigned char *) (stream + 1);
+  stream->out        = stream->in + source_bpp;
+  return stream;
+}
+
+void
+babl_stream_free (BablStream *stream)
+{
+  babl_free (stream);
+}
+
+long
+babl_stream_get_pending (const BablStream *stream)
+{
+  return stream->in_pending;
+}
+
+void
+babl_stream_reset (BablStream *stream)
+{
+  stream->in_pending  = 0;
+  stream->out_pending = 0;
+  stream->out_offset  = 0;
+}
+
+/* moves converted bytes of a pixel that did not fit before to dest */
+static long
+flush_out (BablStream    *stream,
+           unsigned char *dest,
+           long           dest_length)
+{
+  long count = MIN (dest_length, stream->out_pending);
+
+  if (count)
+    memcpy (dest, stream->out + stream->out_offset, count);
+  stream->out_offset  += count;
+  stream->out_pending -= count;
+  return count;
+}
+
+/* converts a single pixel, into dest when it fits, otherwise into out
+ * with as much as fits moved on to dest
+ */
+static long
+convert_pixel (BablStream          *stream,
+               const unsigned char *source,
+               unsigned char       *dest,
+               long                 dest_length)
+{
+  if (dest_length >= stream->dest_bpp)
+    {
+      babl_process (stream->fish, source, dest, 1);
+      return stream->dest_bpp;
+    }
+
+  babl_process (stream->fish, source, stream->out, 1);
+  stream->out_offset  = 0;
+  stream->out_pending = stream->dest_bpp;
+  return flush_out (stream, dest, dest_length);
+}
+
+long
+babl_stream_process (BablStream *stream,
+                     const void *source,
+                     long        source_length,
+                     void       *dest,
+                     long        dest_length,
+                     long       *dest_written)
+{
+  const unsigned char *src      = source;
+  unsigned char       *dst      = dest;
+  long                 consumed = 0;
+  long                 written  = 0;
+  long                 pixels;
+
+  babl_assert (stream && (source || !source_length) && (dest || !dest_length));
+
+  written += flush_out (stream, dst, dest_length);
+
+  /* complete a source pixel split by the previous chunk */
+  if (stream->in_pending && !stream->out_pending && source_length)
+    {
+      long count = MIN (source_length,
+                        stream->source_bpp - stream->in_pending);
+
+      memcpy (stream->in + stream->in_pending, src, count);
+      stream->in_pending += count;
+      consumed           += count;
+
+      if (stream->in_pending == stream->source_bpp)
+        {
+          stream->in_pending = 0;
+          written += convert_pixel (stream, stream->in, dst + written,
+                                    dest_length - written);
+        }
+    }
+
+  if (!stream->in_pending && !stream->out_pending)
+    {
+      /* the whole pixels that fit */
+      pixels = MIN ((source_length - consumed) / stream->source_bpp,
+                    (dest_length - written) / stream->dest_bpp);
+      if (pixels)
+        {
+          babl_process (stream->fish, src + consumed, dst + written, pixels);
+          consumed += pixels * stream->source_bpp;
+          written  += pixels * stream->dest_bpp;
+        }
+
+      /* a pixel only partly fitting in dest */
+      if (written < dest_length &&
+          source_length - consumed >= stream->source_bpp)
+        {
+          written  += convert_pixel (stream, src + consumed, dst + written,
+                                     dest_length - written);
+          consumed += stream->source_bpp;
+        }
+
+      /* the start of a pixel split from the next chunk */
+      if (source_length - consumed < stream->source_bpp)
+        {
+          stream->in_pending = source_length - consumed;
+          if (stream->in_pending)
+            memcpy (stream->in, src + consumed, stream->in_pending);
+          consumed = source_length;
+        }
+    }
+
+  if (dest_written)
+    *dest_written = written;
+  return consumed;
+}
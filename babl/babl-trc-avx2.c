@@ -0,0 +1,71 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* TRC buffer evaluation 8 floats at a time with fused multiply-adds, see
+ * babl-trc-simd.h. This file is built with the avx2 and fma compiler
+ * flags, its functions are only used when babl_cpu_accel_get_support ()
+ * reports both.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#if defined(USE_AVX2) && defined(USE_FMA)
+
+#include <immintrin.h>
+
+#define VEC      __m256
+#define VEC_INT  __m256i
+#define VEC_SIZE 8
+
+#define SIMD(name) name##_avx2
+
+#define vec_set1(a)           _mm256_set1_ps (a)
+#define vec_load(a)           _mm256_loadu_ps (a)
+#define vec_store(a, b)       _mm256_storeu_ps ((a), (b))
+#define vec_add(a, b)         _mm256_add_ps ((a), (b))
+#define vec_sub(a, b)         _mm256_sub_ps ((a), (b))
+#define vec_mul(a, b)         _mm256_mul_ps ((a), (b))
+#define vec_div(a, b)         _mm256_div_ps ((a), (b))
+#define vec_madd(a, b, c)     _mm256_fmadd_ps ((a), (b), (c))
+#define vec_sqrt(a)           _mm256_sqrt_ps (a)
+#define vec_min(a, b)         _mm256_min_ps ((a), (b))
+#define vec_max(a, b)         _mm256_max_ps ((a), (b))
+#define vec_and(a, b)         _mm256_and_ps ((a), (b))
+#define vec_andnot(a, b)      _mm256_andnot_ps ((a), (b))
+#define vec_or(a, b)          _mm256_or_ps ((a), (b))
+#define vec_cmpgt(a, b)       _mm256_cmp_ps ((a), (b), _CMP_GT_OQ)
+#define vec_cmpge(a, b)       _mm256_cmp_ps ((a), (b), _CMP_GE_OQ)
+#define vec_cmple(a, b)       _mm256_cmp_ps ((a), (b), _CMP_LE_OQ)
+#define vec_cmpord(a, b)      _mm256_cmp_ps ((a), (b), _CMP_ORD_Q)
+#define vec_movemask(a)       _mm256_movemask_ps (a)
+#define vec_round_to_int(a)   _mm256_cvtps_epi32 (a)
+#define vec_int_to_float(a)   _mm256_cvtepi32_ps (a)
+#define vec_cast_int(a)       _mm256_castps_si256 (a)
+#define vec_cast_float(a)     _mm256_castsi256_ps (a)
+#define vec_int_set1(a)       _mm256_set1_epi32 (a)
+#define vec_int_add(a, b)     _mm256_add_epi32 ((a), (b))
+#define vec_int_sub(a, b)     _mm256_sub_epi32 ((a), (b))
+#define vec_int_and(a, b)     _mm256_and_si256 ((a), (b))
+#define vec_int_or(a, b)      _mm256_or_si256 ((a), (b))
+#define vec_int_srli(a, b)    _mm256_srli_epi32 ((a), (b))
+#define vec_int_slli(a, b)    _mm256_slli_epi32 ((a), (b))
+
+#include "babl-trc-simd.h"
+
+#endif /* defined(USE_AVX2) && defined(USE_FMA) */
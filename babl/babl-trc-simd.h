@@ -0,0 +1,346 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Vectorized buffer evaluation of the formula based TRCs, included by
+ * babl-trc-sse2.c and babl-trc-avx2.c once they have defined the vector
+ * type VEC of VEC_SIZE floats, the matching integer vector VEC_INT, the
+ * vec_ and vec_int_ operations used below, and SIMD (name), which appends
+ * the name of the instruction set to name.
+ *
+ * The branches of the scalar functions in babl-trc.c become selects
+ * between values computed for all lanes. The polynomial approximations of
+ * the gamma functions are evaluated with Horner's scheme in single
+ * precision, and powf () is replaced by exp2 (gamma * log2 (x)) with both
+ * evaluated by short polynomials, to within a few float ulps of powf ().
+ * The power is only computed when a lane is outside the range of the
+ * polynomial approximation.
+ *
+ * Buffers are processed VEC_SIZE floats at a time when pixels are packed,
+ * or when the stride between pixels divides VEC_SIZE, in which case the
+ * lanes of the components that are not to be converted keep the value
+ * already in out; other layouts use the scalar function of the TRC.
+ */
+
+#define SIMD_KERNEL(name, eval, convert)                               \
+static void                                                            \
+SIMD (name) (const Babl  *trc_,                                        \
+             const float *in,                                          \
+             float       *out,                                         \
+             int          in_gap,                                      \
+             int          out_gap,                                     \
+             int          components,                                  \
+             int          count)                                       \
+{                                                                      \
+  const BablTRC *trc = (void *) trc_;                                  \
+  SIMD (Curve)   curve;                                                \
+                                                                       \
+  SIMD (curve_prepare) (&curve, trc, convert);                         \
+  SIMD (process) (trc, &curve, SIMD (eval),                            \
+                  convert ? trc->fun_to_linear : trc->fun_from_linear, \
+                  in, out, in_gap, out_gap, components, count);        \
+}
+
+#define TO_LINEAR   1
+#define FROM_LINEAR 0
+
+typedef struct
+{
+  VEC poly[BABL_POLYNOMIAL_MAX_DEGREE + 1];
+  int degree;
+  int scale;
+  VEC x0;
+  VEC x1;
+  VEC gamma;
+  /* the parameters of formula sRGB TRCs */
+  VEC a;
+  VEC b;
+  VEC c;
+  VEC cd;
+  VEC rc;
+  VEC d;
+} SIMD (Curve);
+
+typedef VEC (* SIMD (EvalFunc)) (const SIMD (Curve) *curve,
+                                 VEC                 x);
+
+static inline VEC
+SIMD (select) (VEC mask,
+               VEC a,
+               VEC b)
+{
+  return vec_or (vec_and (mask, a), vec_andnot (mask, b));
+}
+
+/* log2 (x) for positive normal x, from the exponent and the series of
+ * atanh () for the logarithm of the mantissa in [sqrt(0.5), sqrt(2))
+ */
+static inline VEC
+SIMD (log2) (VEC x)
+{
+  VEC_INT bits = vec_cast_int (x);
+  VEC_INT e    = vec_int_sub (vec_int_srli (bits, 23), vec_int_set1 (127));
+  VEC     m    = vec_cast_float (vec_int_or (
+                   vec_int_and (bits, vec_int_set1 (0x007fffff)),
+                   vec_int_set1 (0x3f800000)));
+  VEC     big  = vec_cmpgt (m, vec_set1 ((float) M_SQRT2));
+  VEC     t, t2, r;
+
+  m = SIMD (select) (big, vec_mul (m, vec_set1 (0.5f)), m);
+  /* a true mask is -1 */
+  e = vec_int_sub (e, vec_cast_int (big));
+
+  t  = vec_div (vec_sub (m, vec_set1 (1.0f)), vec_add (m, vec_set1 (1.0f)));
+  t2 = vec_mul (t, t);
+  r  = vec_madd (vec_set1 (1.0f / 9.0f), t2, vec_set1 (1.0f / 7.0f));
+  r  = vec_madd (r, t2, vec_set1 (1.0f / 5.0f));
+  r  = vec_madd (r, t2, vec_set1 (1.0f / 3.0f));
+  r  = vec_madd (r, t2, vec_set1 (1.0f));
+  r  = vec_mul (r, vec_mul (t, vec_set1 ((float) (2.0 / M_LN2))));
+
+  return vec_add (vec_int_to_float (e), r);
+}
+
+/* 2^y, from the exponent and the taylor series of e^(f * ln 2) for the
+ * fraction f in [-0.5, 0.5]
+ */
+static inline VEC
+SIMD (exp2) (VEC y)
+{
+  VEC_INT i;
+  VEC     f, r;
+
+  y = vec_max (vec_min (y, vec_set1 (127.0f)), vec_set1 (-126.0f));
+  i = vec_round_to_int (y);
+  f = vec_mul (vec_sub (y, vec_int_to_float (i)), vec_set1 ((float) M_LN2));
+
+  r = vec_madd (vec_set1 (1.0f / 5040.0f), f, vec_set1 (1.0f / 720.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f / 120.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f / 24.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f / 6.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f / 2.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f));
+  r = vec_madd (r, f, vec_set1 (1.0f));
+
+  return vec_mul (r, vec_cast_float (
+    vec_int_slli (vec_int_add (i, vec_int_set1 (127)), 23)));
+}
+
+/* x^gamma for positive x, 0.0 otherwise */
+static inline VEC
+SIMD (pow) (VEC x,
+            VEC gamma)
+{
+  return vec_and (vec_cmpgt (x, vec_set1 (0.0f)),
+                  SIMD (exp2) (vec_mul (gamma, SIMD (log2) (x))));
+}
+
+static inline VEC
+SIMD (gamma) (const SIMD (Curve) *curve,
+              VEC                 x)
+{
+  VEC in_range = vec_and (vec_cmpge (x, curve->x0), vec_cmple (x, curve->x1));
+  VEC v        = curve->scale == 2 ? vec_sqrt (x) : x;
+  VEC r        = curve->poly[0];
+  int i;
+
+  for (i = 1; i <= curve->degree; i++)
+    r = vec_madd (r, v, curve->poly[i]);
+
+  if (vec_movemask (in_range) != (1 << VEC_SIZE) - 1)
+    r = SIMD (select) (in_range, r, SIMD (pow) (x, curve->gamma));
+
+  return r;
+}
+
+static void
+SIMD (curve_prepare) (SIMD (Curve)  *curve,
+                      const BablTRC *trc,
+                      int            to_linear)
+{
+  const BablPolynomial *poly;
+  int                   i;
+
+  if (to_linear)
+    {
+      poly         = &trc->poly_gamma_to_linear;
+      curve->x0    = vec_set1 (trc->poly_gamma_to_linear_x0);
+      curve->x1    = vec_set1 (trc->poly_gamma_to_linear_x1);
+      curve->gamma = vec_set1 (trc->gamma);
+    }
+  else
+    {
+      poly         = &trc->poly_gamma_from_linear;
+      curve->x0    = vec_set1 (trc->poly_gamma_from_linear_x0);
+      curve->x1    = vec_set1 (trc->poly_gamma_from_linear_x1);
+      curve->gamma = vec_set1 (trc->rgamma);
+    }
+
+  curve->degree = poly->degree;
+  curve->scale  = poly->scale;
+  for (i = 0; i <= poly->degree; i++)
+    curve->poly[i] = vec_set1 (poly->coeff[i]);
+
+  if (trc->type == BABL_TRC_FORMULA_SRGB)
+    {
+      curve->a  = vec_set1 (trc->lut[1]);
+      curve->b  = vec_set1 (trc->lut[2]);
+      curve->c  = vec_set1 (trc->lut[3]);
+      curve->cd = vec_set1 (trc->lut[3] * trc->lut[4]);
+      curve->rc = vec_set1 (trc->lut[3] > 0.0f ? 1.0f / trc->lut[3] : 0.0f);
+      curve->d  = vec_set1 (trc->lut[4]);
+    }
+}
+
+static inline void
+SIMD (process) (const BablTRC    *trc,
+                const SIMD (Curve) *curve,
+                SIMD (EvalFunc)   eval,
+                float          (* scalar) (const Babl *trc, float value),
+                const float      *in,
+                float            *out,
+                int               in_gap,
+                int               out_gap,
+                int               components,
+                int               count)
+{
+  VEC  keep  = vec_set1 (0.0f);
+  int  gap   = in_gap;
+  long n;
+  long i;
+
+  if (count <= 0)
+    return;
+
+  if (in_gap == components && out_gap == components)
+    {
+      count     *= components;
+      gap        = 1;
+      components = 1;
+    }
+  else if (in_gap != out_gap || VEC_SIZE % in_gap || components > in_gap)
+    {
+      int c;
+
+      for (i = 0; i < count; i++)
+        for (c = 0; c < components; c++)
+          out[out_gap * i + c] = scalar ((const Babl *) trc, in[in_gap * i + c]);
+      return;
+    }
+
+  if (components < gap)
+    {
+      union { int i[VEC_SIZE]; VEC v; } mask;
+
+      for (i = 0; i < VEC_SIZE; i++)
+        mask.i[i] = i % gap >= components ? -1 : 0;
+      keep = mask.v;
+    }
+
+  n = (count - 1L) * gap + components;
+
+  for (i = 0; i + VEC_SIZE <= n; i += VEC_SIZE)
+    {
+      VEC r = eval (curve, vec_load (in + i));
+
+      if (components < gap)
+        r = SIMD (select) (keep, vec_load (out + i), r);
+      vec_store (out + i, r);
+    }
+
+  for (; i < n; i++)
+    if (i % gap < components)
+      out[i] = scalar ((const Babl *) trc, in[i]);
+}
+
+static inline VEC
+SIMD (formula_srgb_to_linear_eval) (const SIMD (Curve) *curve,
+                                    VEC                 x)
+{
+  VEC v = SIMD (gamma) (curve, vec_madd (curve->a, x, curve->b));
+
+  return SIMD (select) (vec_cmpge (x, curve->d), v, vec_mul (curve->c, x));
+}
+
+static inline VEC
+SIMD (formula_srgb_from_linear_eval) (const SIMD (Curve) *curve,
+                                      VEC                 x)
+{
+  VEC v = vec_div (vec_sub (SIMD (gamma) (curve, x), curve->b), curve->a);
+
+  /* NaN becomes 0.0 */
+  v = vec_and (vec_cmpord (v, v), v);
+
+  return SIMD (select) (vec_cmpgt (x, curve->cd), v, vec_mul (x, curve->rc));
+}
+
+static inline VEC
+SIMD (srgb_to_linear_eval) (const SIMD (Curve) *curve,
+                            VEC                 x)
+{
+  VEC v = SIMD (pow) (vec_mul (vec_add (x, vec_set1 (0.055f)),
+                               vec_set1 (1.0f / 1.055f)),
+                      vec_set1 (2.4f));
+
+  return SIMD (select) (vec_cmpgt (x, vec_set1 (0.04045f)), v,
+                        vec_mul (x, vec_set1 (1.0f / 12.92f)));
+}
+
+static inline VEC
+SIMD (srgb_from_linear_eval) (const SIMD (Curve) *curve,
+                              VEC                 x)
+{
+  VEC v = vec_madd (vec_set1 (1.055f),
+                    SIMD (pow) (x, vec_set1 (1.0f / 2.4f)),
+                    vec_set1 (-(0.055f - 3.0f / (float) (1 << 24))));
+
+  return SIMD (select) (vec_cmpgt (x, vec_set1 (0.003130804954f)), v,
+                        vec_mul (x, vec_set1 (12.92f)));
+}
+
+SIMD_KERNEL (gamma_to_linear,          gamma,                    TO_LINEAR)
+SIMD_KERNEL (gamma_from_linear,        gamma,                    FROM_LINEAR)
+SIMD_KERNEL (formula_srgb_to_linear,   formula_srgb_to_linear_eval,   TO_LINEAR)
+SIMD_KERNEL (formula_srgb_from_linear, formula_srgb_from_linear_eval, FROM_LINEAR)
+SIMD_KERNEL (srgb_to_linear,           srgb_to_linear_eval,      TO_LINEAR)
+SIMD_KERNEL (srgb_from_linear,         srgb_from_linear_eval,    FROM_LINEAR)
+
+void
+SIMD (babl_trc_init) (BablTRC *trc)
+{
+  switch (trc->type)
+    {
+      case BABL_TRC_FORMULA_GAMMA:
+        trc->fun_to_linear_buf   = SIMD (gamma_to_linear);
+        trc->fun_from_linear_buf = SIMD (gamma_from_linear);
+        break;
+      case BABL_TRC_FORMULA_SRGB:
+        trc->fun_to_linear_buf   = SIMD (formula_srgb_to_linear);
+        trc->fun_from_linear_buf = SIMD (formula_srgb_from_linear);
+        break;
+      case BABL_TRC_SRGB:
+        trc->fun_to_linear_buf   = SIMD (srgb_to_linear);
+        trc->fun_from_linear_buf = SIMD (srgb_from_linear);
+        break;
+      default:
+        break;
+    }
+}
+
+#undef SIMD_KERNEL
+#undef TO_LINEAR
+#undef FROM_LINEAR
@@ -0,0 +1,67 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* TRC buffer evaluation 4 floats at a time, see babl-trc-simd.h */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#if defined(USE_SSE2)
+
+#include <emmintrin.h>
+
+#define VEC      __m128
+#define VEC_INT  __m128i
+#define VEC_SIZE 4
+
+#define SIMD(name) name##_sse2
+
+#define vec_set1(a)           _mm_set1_ps (a)
+#define vec_load(a)           _mm_loadu_ps (a)
+#define vec_store(a, b)       _mm_storeu_ps ((a), (b))
+#define vec_add(a, b)         _mm_add_ps ((a), (b))
+#define vec_sub(a, b)         _mm_sub_ps ((a), (b))
+#define vec_mul(a, b)         _mm_mul_ps ((a), (b))
+#define vec_div(a, b)         _mm_div_ps ((a), (b))
+#define vec_madd(a, b, c)     _mm_add_ps (_mm_mul_ps ((a), (b)), (c))
+#define vec_sqrt(a)           _mm_sqrt_ps (a)
+#define vec_min(a, b)         _mm_min_ps ((a), (b))
+#define vec_max(a, b)         _mm_max_ps ((a), (b))
+#define vec_and(a, b)         _mm_and_ps ((a), (b))
+#define vec_andnot(a, b)      _mm_andnot_ps ((a), (b))
+#define vec_or(a, b)          _mm_or_ps ((a), (b))
+#define vec_cmpgt(a, b)       _mm_cmpgt_ps ((a), (b))
+#define vec_cmpge(a, b)       _mm_cmpge_ps ((a), (b))
+#define vec_cmple(a, b)       _mm_cmple_ps ((a), (b))
+#define vec_cmpord(a, b)      _mm_cmpord_ps ((a), (b))
+#define vec_movemask(a)       _mm_movemask_ps (a)
+#define vec_round_to_int(a)   _mm_cvtps_epi32 (a)
+#define vec_int_to_float(a)   _mm_cvtepi32_ps (a)
+#define vec_cast_int(a)       _mm_castps_si128 (a)
+#define vec_cast_float(a)     _mm_castsi128_ps (a)
+#define vec_int_set1(a)       _mm_set1_epi32 (a)
+#define vec_int_add(a, b)     _mm_add_epi32 ((a), (b))
+#define vec_int_sub(a, b)     _mm_sub_epi32 ((a), (b))
+#define vec_int_and(a, b)     _mm_and_si128 ((a), (b))
+#define vec_int_or(a, b)      _mm_or_si128 ((a), (b))
+#define vec_int_srli(a, b)    _mm_srli_epi32 ((a), (b))
+#define vec_int_slli(a, b)    _mm_slli_epi32 ((a), (b))
+
+#include "babl-trc-simd.h"
+
+#endif /* defined(USE_SSE2) */
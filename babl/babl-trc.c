@@ -16,7 +16,7 @@
  * <https://www.gnu.org/licenses/>.
  */
 
-#define MAX_TRCS   100
+#define NEEDS_BABL_DB
 
 /* FIXME: choose parameters more intelligently */
 #define POLY_GAMMA_X0     (  0.5 / 255.0)
@@ -28,7 +28,14 @@
 #include "babl-internal.h"
 #include "base/util.h"
 
-static BablTRC trc_db[MAX_TRCS];
+/* TRCs by their curve - the type, gamma and the parameters or LUT - for
+ * deduplication
+ */
+static BablHashTable *curve_hash;
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
 
 static inline float 
 _babl_trc_linear (const Babl *trc_, 
@@ -290,75 +297,103 @@ static inline void _babl_trc_linear_buf (const Babl  *trc_,
 const Babl *
 babl_trc (const char *name)
 {
-  int i;
-  for (i = 0; trc_db[i].instance.class_type; i++)
-    if (!strcmp (trc_db[i].instance.name, name))
-    {
-      return (Babl*)&trc_db[i];
-    }
-  babl_log("failed to find trc '%s'\n", name);
-  return NULL;
+  Babl *babl = babl_db_exist_by_name (db, name);
+
+  if (!babl)
+    babl_log("failed to find trc '%s'\n", name);
+  return babl;
 }
 
-const Babl *
-babl_trc_new (const char *name,
-              BablTRCType type,
-              double      gamma,
-              int         n_lut,
-              float      *lut)
+/* the number of floats in lut that are part of the curve */
+static int
+trc_n_params (const BablTRC *trc)
 {
-  int i=0;
-  static BablTRC trc;
-  trc.instance.class_type = BABL_TRC;
-  trc.instance.id         = 0;
-  trc.type = type;
-  trc.gamma  = gamma > 0.0    ? gamma       : 0.0;
-  trc.rgamma = gamma > 0.0001 ? 1.0 / gamma : 0.0;
+  if (trc->lut_size)
+    return trc->lut_size;
+  if (trc->type == BABL_TRC_FORMULA_SRGB)
+    return 5;
+  return 0;
+}
 
-  if (n_lut )
-  {
-    for (i = 0; trc_db[i].instance.class_type; i++)
-    {
-    if ( trc_db[i].lut_size == n_lut &&
-         (memcmp (trc_db[i].lut, lut, sizeof (float) * n_lut)==0)
-       )
-      {
-        return (void*)&trc_db[i];
-      }
-    }
-  }
-  else
-  for (i = 0; trc_db[i].instance.class_type; i++)
-  {
-    int offset = ((char*)&trc_db[i].type) - (char*)(&trc_db[i]);
-    int size   = ((char*)&trc_db[i].gamma + sizeof(double)) - ((char*)&trc_db[i].type);
+static unsigned int
+trc_curve_digest (const BablTRC *trc)
+{
+  unsigned int digest = BABL_DIGEST_INIT;
+
+  digest = babl_digest (digest, &trc->type, sizeof (trc->type));
+  digest = babl_digest (digest, &trc->gamma, sizeof (trc->gamma));
+  digest = babl_digest (digest, &trc->lut_size, sizeof (trc->lut_size));
+  return babl_digest (digest, trc->lut, sizeof (float) * trc_n_params (trc));
+}
+
+static int
+trc_hash_by_curve (BablHashTable *htab,
+                   Babl          *item)
+{
+  return babl_hash_by_digest (htab, trc_curve_digest (&item->trc));
+}
+
+static int
+trc_find_by_curve (Babl *item,
+                   void *data)
+{
+  const BablTRC *trc = &item->trc;
+  const BablTRC *key = data;
+  int            n   = trc_n_params (key);
+
+  return trc->type == key->type &&
+         trc->gamma == key->gamma &&
+         trc->lut_size == key->lut_size &&
+         (!n || !memcmp (trc->lut, key->lut, sizeof (float) * n));
+}
+
+static int
+babl_trc_destroy (void *data)
+{
+  BablTRC *trc = data;
+
+  babl_free (trc->lut);
+  babl_free (trc->inv_lut);
+  babl_free (trc->u8_to_linear);
+  babl_free (trc->u16_to_linear);
+  babl_free (trc->u8_from_linear);
+  babl_free (trc->u16_from_linear);
+  babl_free (trc->to_linear_lookup);
+  babl_free (trc->from_linear_lookup);
+  return 0;
+}
+
+static BablTRC *
+babl_trc_new_curve (const char  *name,
+                    BablTRCType  type,
+                    double       gamma,
+                    int          n_lut,
+                    float       *lut)
+{
+  BablTRC *trc = babl_calloc (sizeof (BablTRC), 1);
+
+  babl_set_destructor (trc, babl_trc_destroy);
+  trc->instance.class_type = BABL_TRC;
+  trc->instance.id         = 0;
+  trc->instance.name       = trc->name;
+  trc->type   = type;
+  trc->gamma  = gamma > 0.0    ? gamma       : 0.0;
+  trc->rgamma = gamma > 0.0001 ? 1.0 / gamma : 0.0;
 
-    if (memcmp ((char*)(&trc_db[i]) + offset, ((char*)&trc) + offset, size)==0)
-      {
-        return (void*)&trc_db[i];
-      }
-  }
-  if (i >= MAX_TRCS-1)
-  {
-    babl_log ("too many BablTRCs");
-    return NULL;
-  }
-  trc_db[i]=trc;
-  trc_db[i].instance.name = trc_db[i].name;
   if (name)
-    snprintf (trc_db[i].name, sizeof (trc_db[i].name), "%s", name);
+    snprintf (trc->name, sizeof (trc->name), "%s", name);
   else if (n_lut)
-    snprintf (trc_db[i].name, sizeof (trc_db[i].name), "lut-trc");
+    snprintf (trc->name, sizeof (trc->name), "lut-trc");
   else
-    snprintf (trc_db[i].name, sizeof (trc_db[i].name), "trc-%i-%f", type, gamma);
+    snprintf (trc->name, sizeof (trc->name), "trc-%i-%f", type, gamma);
 
   if (n_lut)
   {
     int j;
-    trc_db[i].lut_size = n_lut;
-    trc_db[i].lut = babl_calloc (sizeof (float), n_lut);
-    memcpy (trc_db[i].lut, lut, sizeof (float) * n_lut);
-    trc_db[i].inv_lut = babl_calloc (sizeof (float), n_lut);
+    trc->lut_size = n_lut;
+    trc->lut = babl_calloc (sizeof (float), n_lut);
+    memcpy (trc->lut, lut, sizeof (float) * n_lut);
+    trc->inv_lut = babl_calloc (sizeof (float), n_lut);
 
     for (j = 0; j < n_lut; j++)
     {
@@ -368,7 +403,7 @@ babl_trc_new (const char *name,
       for (k = 0; k < 16; k++)
       {
         double guess = (min + max) / 2;
-        float reversed_index = babl_trc_lut_to_linear (BABL(&trc_db[i]), guess) * (n_lut-1.0);
+        float reversed_index = babl_trc_lut_to_linear (BABL(trc), guess) * (n_lut-1.0);
 
         if (reversed_index < j)
         {
@@ -379,81 +414,158 @@ babl_trc_new (const char *name,
           max = guess;
         }
       }
-      trc_db[i].inv_lut[j] = (min + max) / 2;
+      trc->inv_lut[j] = (min + max) / 2;
     }
   }
 
-  trc_db[i].fun_to_linear_buf = _babl_trc_to_linear_buf_generic;
-  trc_db[i].fun_from_linear_buf = _babl_trc_from_linear_buf_generic;
+  trc->fun_to_linear_buf = _babl_trc_to_linear_buf_generic;
+  trc->fun_from_linear_buf = _babl_trc_from_linear_buf_generic;
 
-  switch (trc_db[i].type)
+  switch (trc->type)
   {
     case BABL_TRC_LINEAR:
-      trc_db[i].fun_to_linear = _babl_trc_linear;
-      trc_db[i].fun_from_linear = _babl_trc_linear;
-      trc_db[i].fun_from_linear_buf = _babl_trc_linear_buf;
-      trc_db[i].fun_to_linear_buf = _babl_trc_linear_buf;
+      trc->fun_to_linear = _babl_trc_linear;
+      trc->fun_from_linear = _babl_trc_linear;
+      trc->fun_from_linear_buf = _babl_trc_linear_buf;
+      trc->fun_to_linear_buf = _babl_trc_linear_buf;
       break;
     case BABL_TRC_FORMULA_GAMMA:
-      trc_db[i].fun_to_linear = _babl_trc_gamma_to_linear;
-      trc_db[i].fun_from_linear = _babl_trc_gamma_from_linear;
-      trc_db[i].fun_to_linear_buf = _babl_trc_gamma_to_linear_buf;
-      trc_db[i].fun_from_linear_buf = _babl_trc_gamma_from_linear_buf;
-
-      trc_db[i].poly_gamma_to_linear_x0 = POLY_GAMMA_X0;
-      trc_db[i].poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_to_linear,
-                                         trc_db[i].gamma,
-                                         trc_db[i].poly_gamma_to_linear_x0,
-                                         trc_db[i].poly_gamma_to_linear_x1,
+      trc->fun_to_linear = _babl_trc_gamma_to_linear;
+      trc->fun_from_linear = _babl_trc_gamma_from_linear;
+      trc->fun_to_linear_buf = _babl_trc_gamma_to_linear_buf;
+      trc->fun_from_linear_buf = _babl_trc_gamma_from_linear_buf;
+
+      trc->poly_gamma_to_linear_x0 = POLY_GAMMA_X0;
+      trc->poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
+      babl_polynomial_approximate_gamma (&trc->poly_gamma_to_linear,
+                                         trc->gamma,
+                                         trc->poly_gamma_to_linear_x0,
+                                         trc->poly_gamma_to_linear_x1,
                                          POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
 
-      trc_db[i].poly_gamma_from_linear_x0 = POLY_GAMMA_X0;
-      trc_db[i].poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_from_linear,
-                                         trc_db[i].rgamma,
-                                         trc_db[i].poly_gamma_from_linear_x0,
-                                         trc_db[i].poly_gamma_from_linear_x1,
+      trc->poly_gamma_from_linear_x0 = POLY_GAMMA_X0;
+      trc->poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
+      babl_polynomial_approximate_gamma (&trc->poly_gamma_from_linear,
+                                         trc->rgamma,
+                                         trc->poly_gamma_from_linear_x0,
+                                         trc->poly_gamma_from_linear_x1,
                                          POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
       break;
     case BABL_TRC_FORMULA_SRGB:
-      trc_db[i].lut = babl_calloc (sizeof (float), 5);
+      trc->lut = babl_calloc (sizeof (float), 5);
       {
         int j;
         for (j = 0; j < 5; j++)
-          trc_db[i].lut[j] = lut[j];
+          trc->lut[j] = lut[j];
       }
-      trc_db[i].fun_to_linear = _babl_trc_formula_srgb_to_linear;
-      trc_db[i].fun_from_linear = _babl_trc_formula_srgb_from_linear;
-
-      trc_db[i].poly_gamma_to_linear_x0 = lut[4];
-      trc_db[i].poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_to_linear,
-                                         trc_db[i].gamma,
-                                         trc_db[i].poly_gamma_to_linear_x0,
-                                         trc_db[i].poly_gamma_to_linear_x1,
+      trc->fun_to_linear = _babl_trc_formula_srgb_to_linear;
+      trc->fun_from_linear = _babl_trc_formula_srgb_from_linear;
+
+      trc->poly_gamma_to_linear_x0 = lut[4];
+      trc->poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
+      babl_polynomial_approximate_gamma (&trc->poly_gamma_to_linear,
+                                         trc->gamma,
+                                         trc->poly_gamma_to_linear_x0,
+                                         trc->poly_gamma_to_linear_x1,
                                          POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
 
-      trc_db[i].poly_gamma_from_linear_x0 = lut[3] * lut[4];
-      trc_db[i].poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_from_linear,
-                                         trc_db[i].rgamma,
-                                         trc_db[i].poly_gamma_from_linear_x0,
-                                         trc_db[i].poly_gamma_from_linear_x1,
+      trc->poly_gamma_from_linear_x0 = lut[3] * lut[4];
+      trc->poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
+      babl_polynomial_approximate_gamma (&trc->poly_gamma_from_linear,
+                                         trc->rgamma,
+                                         trc->poly_gamma_from_linear_x0,
+                                         trc->poly_gamma_from_linear_x1,
                                          POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
       break;
     case BABL_TRC_SRGB:
-      trc_db[i].fun_to_linear = _babl_trc_srgb_to_linear;
-      trc_db[i].fun_from_linear = _babl_trc_srgb_from_linear;
-      trc_db[i].fun_from_linear_buf = _babl_trc_srgb_from_linear_buf;
-      trc_db[i].fun_to_linear_buf = _babl_trc_srgb_to_linear_buf;
+      trc->fun_to_linear = _babl_trc_srgb_to_linear;
+      trc->fun_from_linear = _babl_trc_srgb_from_linear;
+      trc->fun_from_linear_buf = _babl_trc_srgb_from_linear_buf;
+      trc->fun_to_linear_buf = _babl_trc_srgb_to_linear_buf;
       break;
     case BABL_TRC_LUT:
-      trc_db[i].fun_to_linear = babl_trc_lut_to_linear;
-      trc_db[i].fun_from_linear = babl_trc_lut_from_linear;
+      trc->fun_to_linear = babl_trc_lut_to_linear;
+      trc->fun_from_linear = babl_trc_lut_from_linear;
       break;
   }
-  return (Babl*)&trc_db[i];
+
+#if defined(USE_AVX2) && defined(USE_FMA)
+  if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_AVX2) &&
+      (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_FMA))
+    babl_trc_init_avx2 (trc);
+  else
+#endif
+#if defined(USE_SSE2)
+  if (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE2)
+    babl_trc_init_sse2 (trc);
+#endif
+
+  return trc;
+}
+
+const Babl *
+babl_trc_new (const char *name,
+              BablTRCType type,
+              double      gamma,
+              int         n_lut,
+              float      *lut)
+{
+  BablTRC  key;
+  BablTRC *trc;
+
+  memset (&key, 0, sizeof (key));
+  key.type     = type;
+  key.gamma    = gamma > 0.0 ? gamma : 0.0;
+  key.lut_size = n_lut;
+  key.lut      = lut;
+
+  babl_mutex_lock (db->mutex);
+
+  trc = (void *) babl_hash_table_find (curve_hash,
+                                       babl_hash_by_digest (curve_hash,
+                                         trc_curve_digest (&key)),
+                                       NULL, &key);
+  if (!trc)
+    {
+      trc = babl_trc_new_curve (name, type, gamma, n_lut, lut);
+      babl_db_insert (db, (Babl *) trc);
+      babl_hash_table_insert (curve_hash, (Babl *) trc);
+    }
+  trc->ref_count++;
+
+  babl_mutex_unlock (db->mutex);
+  return (Babl *) trc;
+}
+
+const Babl *
+babl_trc_ref (const Babl *trc)
+{
+  babl_mutex_lock (db->mutex);
+  ((Babl *) trc)->trc.ref_count++;
+  babl_mutex_unlock (db->mutex);
+  return trc;
+}
+
+static int
+is_item (Babl *item,
+         void *data)
+{
+  return item == data;
+}
+
+void
+babl_trc_unref (const Babl *trc)
+{
+  Babl *babl = (Babl *) trc;
+
+  babl_mutex_lock (db->mutex);
+  if (--babl->trc.ref_count == 0)
+    {
+      babl_hash_table_remove_matching (curve_hash, is_item, babl);
+      babl_db_remove_matching (db, is_item, babl);
+      babl_free (babl);
+    }
+  babl_mutex_unlock (db->mutex);
 }
 
 const Babl * 
@@ -464,15 +576,7 @@ babl_trc_lut (const char *name,
   return babl_trc_new (name, BABL_TRC_LUT, 0, n, entries);
 }
 
-void
-babl_trc_class_for_each (BablEachFunction each_fun,
-                         void            *user_data)
-{
-  int i=0;
-  for (i = 0; trc_db[i].instance.class_type; i++)
-    if (each_fun (BABL (&trc_db[i]), user_data))
-      return;
-}
+BABL_CLASS_MINIMAL_IMPLEMENT (trc);
 
 const Babl *
 babl_trc_formula_srgb (double g, 
@@ -490,7 +594,7 @@ babl_trc_formula_srgb (double g,
       fabs (b - 0.052) < 0.01 &&
       fabs (c - 0.077) < 0.01 &&
       fabs (d - 0.040) < 0.01)
-    return babl_trc ("sRGB");
+    return babl_trc_ref (babl_trc ("sRGB"));
 
   snprintf (name, sizeof (name), "%.6f %.6f %.4f %.4f %.4f", g, a, b, c, d);
   for (i = 0; name[i]; i++)
@@ -519,6 +623,10 @@ babl_trc_gamma (double gamma)
 void
 babl_trc_class_init (void)
 {
+  babl_trc_db ();
+  if (!curve_hash)
+    curve_hash = babl_hash_table_init (trc_hash_by_curve, trc_find_by_curve);
+
   babl_trc_new ("sRGB",  BABL_TRC_SRGB, 2.2, 0, NULL);
   babl_trc_gamma (2.2);
   babl_trc_gamma (1.8);
@@ -601,7 +709,7 @@ babl_trc_lut_find (float *lut,
     }
   }
   if (match)
-    return babl_trc ("sRGB");
+    return babl_trc_ref (babl_trc ("sRGB"));
 
   if (babl_lut_match_gamma (lut, lut_size, 2.2))
     return babl_trc_gamma(2.2);
@@ -611,3 +719,336 @@ babl_trc_lut_find (float *lut,
 
   return NULL;
 }
+
+
+/* integer tables */
+
+/* the linear value of the first float bits of each entry of a code table */
+#define BABL_TRC_TABLE_VALUE(u, entry, shift)                           \
+  do {                                                                  \
+    (u).i = BABL_TRC_TABLE_MIN_BITS + ((uint32_t) (entry) << (shift));  \
+    if ((entry) == 0)                                                   \
+      (u).f = 0.0f;                                                     \
+  } while (0)
+
+/* encodes count values in place with the buffer function of the TRC,
+ * value is padded to a multiple of 16 to keep the tail out of the scalar
+ * code of the vectorized buffer functions
+ */
+static void
+babl_trc_encode_buf (const Babl *trc,
+                     float      *value,
+                     int         count,
+                     int         max)
+{
+  int i;
+
+  for (i = count; i % 16; i++)
+    value[i] = value[count - 1];
+
+  babl_trc_from_linear_buf (trc, value, value, 1, 1, 1, i);
+  for (i = 0; i < count; i++)
+    value[i] = value[i] * max + 0.5f;
+}
+
+/* the thresholds of a TRC encoded with max, the lowest linear value that
+ * from_linear (value) * max + 0.5 takes to each code. The encodings of the
+ * starts of the entries of the code table narrow each threshold down to
+ * an entry, where it is bisected for, for all codes at once with the
+ * buffer functions of the TRC.
+ */
+static void
+babl_trc_make_thresholds (const Babl *trc,
+                          float      *threshold,
+                          int         max,
+                          int         shift)
+{
+  int       entries = BABL_TRC_TABLE_SIZE (shift);
+  float    *value   = babl_malloc (sizeof (float) * (MAX (entries, max) + 16));
+  uint32_t *low     = babl_malloc (sizeof (uint32_t) * (max + 1) * 2);
+  uint32_t *high    = low + max + 1;
+  int      *active  = babl_malloc (sizeof (int) * max);
+  int       n_active = 0;
+  int       code;
+  int       i;
+
+  for (i = 0; i < entries; i++)
+    {
+      union { float f; uint32_t i; } u;
+
+      BABL_TRC_TABLE_VALUE (u, i, shift);
+      value[i] = u.f;
+    }
+  babl_trc_encode_buf (trc, value, entries, max);
+
+  /* the codes are kept increasing, for TRCs that do not */
+  for (i = 1; i < entries; i++)
+    if (value[i] < value[i - 1])
+      value[i] = value[i - 1];
+
+  i = 0;
+  for (code = 1; code <= max; code++)
+    {
+      union { float f; uint32_t i; } u;
+
+      while (i < entries && value[i] < code)
+        i++;
+
+      if (i == 0)
+        {
+          low[code] = high[code] = 0;
+        }
+      else if (i == entries)
+        {
+          low[code] = high[code] = BABL_TRC_TABLE_MAX_BITS;
+        }
+      else
+        {
+          BABL_TRC_TABLE_VALUE (u, i - 1, shift);
+          low[code] = u.i + 1;
+          BABL_TRC_TABLE_VALUE (u, i, shift);
+          high[code] = u.i;
+          active[n_active++] = code;
+        }
+    }
+
+  while (n_active)
+    {
+      int remaining = 0;
+
+      for (i = 0; i < n_active; i++)
+        {
+          union { float f; uint32_t i; } u;
+
+          code = active[i];
+          u.i = low[code] + (high[code] - low[code]) / 2;
+          value[i] = u.f;
+        }
+      babl_trc_encode_buf (trc, value, n_active, max);
+
+      for (i = 0; i < n_active; i++)
+        {
+          code = active[i];
+          if (value[i] >= code)
+            high[code] = low[code] + (high[code] - low[code]) / 2;
+          else
+            low[code] += (high[code] - low[code]) / 2 + 1;
+
+          if (low[code] < high[code])
+            active[remaining++] = code;
+        }
+      n_active = remaining;
+    }
+
+  threshold[0] = -1.0f;
+  for (code = 1; code <= max; code++)
+    {
+      union { float f; uint32_t i; } u;
+
+      u.i = low[code];
+      threshold[code] = MAX (u.f, threshold[code - 1]);
+    }
+  threshold[max + 1] = 2.0f;
+
+  babl_free (value);
+  babl_free (low);
+  babl_free (active);
+}
+
+static void *
+babl_trc_make_u8_from_linear (const Babl *trc)
+{
+  BablTRCU8Table *table = babl_malloc (sizeof (BablTRCU8Table));
+  int             code  = 0;
+  int             i;
+
+  babl_trc_make_thresholds (trc, table->threshold, 255,
+                            BABL_TRC_U8_TABLE_SHIFT);
+
+  for (i = 0; i < BABL_TRC_TABLE_SIZE (BABL_TRC_U8_TABLE_SHIFT); i++)
+    {
+      union { float f; uint32_t i; } u;
+
+      BABL_TRC_TABLE_VALUE (u, i, BABL_TRC_U8_TABLE_SHIFT);
+      while (code < 255 && u.f >= table->threshold[code + 1])
+        code++;
+      table->code[i] = code;
+    }
+
+  return table;
+}
+
+static void *
+babl_trc_make_u16_from_linear (const Babl *trc)
+{
+  BablTRCU16Table *table = babl_malloc (sizeof (BablTRCU16Table));
+  int              code  = 0;
+  int              i;
+
+  babl_trc_make_thresholds (trc, table->threshold, 65535,
+                            BABL_TRC_U16_TABLE_SHIFT);
+
+  for (i = 0; i < BABL_TRC_TABLE_SIZE (BABL_TRC_U16_TABLE_SHIFT); i++)
+    {
+      union { float f; uint32_t i; } u;
+
+      BABL_TRC_TABLE_VALUE (u, i, BABL_TRC_U16_TABLE_SHIFT);
+      while (code < 65535 && u.f >= table->threshold[code + 1])
+        code++;
+      table->code[i] = code;
+    }
+
+  return table;
+}
+
+static void *
+babl_trc_make_to_linear (const Babl *trc,
+                         int         max)
+{
+  float *table = babl_malloc (sizeof (float) * (max + 1));
+  int    i;
+
+  for (i = 0; i <= max; i++)
+    table[i] = i / (float) max;
+  babl_trc_to_linear_buf (trc, table, table, 1, 1, 1, max + 1);
+
+  return table;
+}
+
+static void *
+babl_trc_make_u8_to_linear (const Babl *trc)
+{
+  return babl_trc_make_to_linear (trc, 255);
+}
+
+static void *
+babl_trc_make_u16_to_linear (const Babl *trc)
+{
+  return babl_trc_make_to_linear (trc, 65535);
+}
+
+/* the lookup of fun, with an entry and the slope to the next one for each
+ * step of 1/512 octave
+ */
+static void *
+babl_trc_make_lookup (const Babl *trc,
+                      float     (*fun) (const Babl *trc, float value))
+{
+  BablTRCLookup *lookup = babl_malloc (sizeof (BablTRCLookup));
+  int            i;
+
+  lookup->trc = trc;
+  lookup->fun = fun;
+  for (i = 0; i < BABL_TRC_LOOKUP_SIZE; i++)
+    {
+      union { float f; uint32_t i; } u;
+
+      u.i = BABL_TRC_TABLE_MIN_BITS + ((uint32_t) i << BABL_TRC_LOOKUP_SHIFT);
+      lookup->value[i] = fun (trc, u.f);
+    }
+
+  for (i = 0; i < BABL_TRC_LOOKUP_SIZE - 1; i++)
+    {
+      union { float f; uint32_t i; } start, end;
+
+      start.i = BABL_TRC_TABLE_MIN_BITS + ((uint32_t) i << BABL_TRC_LOOKUP_SHIFT);
+      end.i   = start.i + (1u << BABL_TRC_LOOKUP_SHIFT);
+      lookup->slope[i] = ((double) lookup->value[i + 1] - lookup->value[i]) /
+                         ((double) end.f - start.f);
+    }
+  lookup->slope[i] = 0.0f;
+
+  return lookup;
+}
+
+static void *
+babl_trc_make_to_linear_lookup (const Babl *trc)
+{
+  return babl_trc_make_lookup (trc, trc->trc.fun_to_linear);
+}
+
+static void *
+babl_trc_make_from_linear_lookup (const Babl *trc)
+{
+  return babl_trc_make_lookup (trc, trc->trc.fun_from_linear);
+}
+
+/* the table in slot, made by make if there is none yet; when threads race
+ * to make it, one table wins and the others are freed
+ */
+static void *
+babl_trc_get_table (const Babl  *trc,
+                    void       **slot,
+                    void      *(*make) (const Babl *trc))
+{
+  void *table = __atomic_load_n (slot, __ATOMIC_ACQUIRE);
+
+  if (!table)
+    {
+      void *none = NULL;
+
+      table = make (trc);
+      if (!__atomic_compare_exchange_n (slot, &none, table, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+          babl_free (table);
+          table = none;
+        }
+    }
+
+  return table;
+}
+
+const float *
+babl_trc_get_u8_to_linear (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->u8_to_linear,
+                             babl_trc_make_u8_to_linear);
+}
+
+const float *
+babl_trc_get_u16_to_linear (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->u16_to_linear,
+                             babl_trc_make_u16_to_linear);
+}
+
+const BablTRCU8Table *
+babl_trc_get_u8_from_linear (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->u8_from_linear,
+                             babl_trc_make_u8_from_linear);
+}
+
+const BablTRCU16Table *
+babl_trc_get_u16_from_linear (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->u16_from_linear,
+                             babl_trc_make_u16_from_linear);
+}
+
+const BablTRCLookup *
+babl_trc_get_to_linear_lookup (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->to_linear_lookup,
+                             babl_trc_make_to_linear_lookup);
+}
+
+const BablTRCLookup *
+babl_trc_get_from_linear_lookup (const Babl *trc_)
+{
+  BablTRC *trc = (void *) trc_;
+
+  return babl_trc_get_table (trc_, (void **) &trc->from_linear_lookup,
+                             babl_trc_make_from_linear_lookup);
+}
@@ -20,6 +20,7 @@
 #define _BABL_TRC_H
 
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include "base/util.h"
 #include "babl-polynomial.h"
@@ -33,6 +34,45 @@ typedef enum {BABL_TRC_LINEAR,
               BABL_TRC_LUT}
 BablTRCType;
 
+/* linear to integer tables are indexed by the upper bits of the float,
+ * between 2^-24 and 1.0. An entry holds the code of the start of its range,
+ * which is stepped up past the linear thresholds of the following codes;
+ * this rounds like from_linear (value) * max + 0.5 does.
+ */
+#define BABL_TRC_TABLE_MIN_BITS  (103u << 23)  /* 2^-24 */
+#define BABL_TRC_TABLE_MAX_BITS  (127u << 23)  /* 1.0 */
+#define BABL_TRC_U8_TABLE_SHIFT  14            /* 512 entries per octave */
+#define BABL_TRC_U16_TABLE_SHIFT 10            /* 8192 entries per octave */
+#define BABL_TRC_TABLE_SIZE(shift) \
+  (((BABL_TRC_TABLE_MAX_BITS - BABL_TRC_TABLE_MIN_BITS) >> (shift)) + 1)
+
+typedef struct
+{
+  float    threshold[257];      /* lowest linear value of each code */
+  uint8_t  code[BABL_TRC_TABLE_SIZE (BABL_TRC_U8_TABLE_SHIFT)];
+} BablTRCU8Table;
+
+typedef struct
+{
+  float    threshold[65537];
+  uint16_t code[BABL_TRC_TABLE_SIZE (BABL_TRC_U16_TABLE_SHIFT)];
+} BablTRCU16Table;
+
+/* piecewise linear approximations of the functions of a TRC, from 2^-24 to
+ * 1.0 in entries of 1/512 octave, see babl_trc_get_to_linear_lookup ();
+ * values outside of the range go to the function
+ */
+#define BABL_TRC_LOOKUP_SHIFT 14
+#define BABL_TRC_LOOKUP_SIZE  BABL_TRC_TABLE_SIZE (BABL_TRC_LOOKUP_SHIFT)
+
+typedef struct
+{
+  const Babl *trc;
+  float     (*fun) (const Babl *trc, float value);
+  float       value[BABL_TRC_LOOKUP_SIZE];  /* at the start of each entry */
+  float       slope[BABL_TRC_LOOKUP_SIZE];
+} BablTRCLookup;
+
 typedef struct
 {
   BablInstance     instance;
@@ -66,6 +106,14 @@ typedef struct
   float           *lut;
   float           *inv_lut;
   char             name[128];
+  /* made on first use, see babl_trc_get_u8_to_linear () */
+  float           *u8_to_linear;
+  float           *u16_to_linear;
+  BablTRCU8Table  *u8_from_linear;
+  BablTRCU16Table *u16_from_linear;
+  BablTRCLookup   *to_linear_lookup;
+  BablTRCLookup   *from_linear_lookup;
+  int              ref_count;  /* see babl_trc_unref () */
 } BablTRC;
 
 static inline void babl_trc_from_linear_buf (const Babl *trc_,
@@ -103,4 +151,122 @@ static inline float babl_trc_to_linear (const Babl *trc_, float value)
 void
 babl_trc_class_init (void);
 
+/* shared tables for integer encodings of the TRC, made on first use: the
+ * linear values of the 256 u8 and the 65536 u16 codes, and the tables for
+ * babl_trc_u8_from_linear () and babl_trc_u16_from_linear ()
+ */
+const float *
+babl_trc_get_u8_to_linear (const Babl *trc);
+
+const float *
+babl_trc_get_u16_to_linear (const Babl *trc);
+
+const BablTRCU8Table *
+babl_trc_get_u8_from_linear (const Babl *trc);
+
+const BablTRCU16Table *
+babl_trc_get_u16_from_linear (const Babl *trc);
+
+/* shared lookups of the TRC, made on first use; for converters that trade
+ * exactness for speed, the per value and buffer functions stay exact
+ */
+const BablTRCLookup *
+babl_trc_get_to_linear_lookup (const Babl *trc);
+
+const BablTRCLookup *
+babl_trc_get_from_linear_lookup (const Babl *trc);
+
+static inline float
+babl_trc_lookup (const BablTRCLookup *lookup,
+                 float                value)
+{
+  union { float f; uint32_t i; } u, start;
+  uint32_t index;
+
+  u.f = value;
+  /* negative values and NaN have the sign or all exponent bits set */
+  if (u.i < BABL_TRC_TABLE_MIN_BITS || u.i > BABL_TRC_TABLE_MAX_BITS)
+    return lookup->fun (lookup->trc, value);
+
+  index   = (u.i - BABL_TRC_TABLE_MIN_BITS) >> BABL_TRC_LOOKUP_SHIFT;
+  start.i = u.i & ~((1u << BABL_TRC_LOOKUP_SHIFT) - 1);
+  return lookup->value[index] + lookup->slope[index] * (value - start.f);
+}
+
+/* the offset of value in the code table of a linear to integer table, with
+ * value clamped to [0.0, 1.0] and NaN made 0.0; this looks at the float bits
+ * only, which keeps working when NaN compares are optimized away
+ */
+static inline uint32_t
+babl_trc_table_index (float *value,
+                      int    shift)
+{
+  union { float f; uint32_t i; } u;
+
+  u.f = *value;
+  if (u.i > 0x7f800000u)  /* negative or NaN */
+    {
+      *value = 0.0f;
+      return 0;
+    }
+  if (u.i >= BABL_TRC_TABLE_MAX_BITS)
+    {
+      *value = 1.0f;
+      return (BABL_TRC_TABLE_MAX_BITS - BABL_TRC_TABLE_MIN_BITS) >> shift;
+    }
+  if (u.i < BABL_TRC_TABLE_MIN_BITS)
+    return 0;
+  return (u.i - BABL_TRC_TABLE_MIN_BITS) >> shift;
+}
+
+/* the u8 code of a value in [0.0, 1.0], starting at its table entry */
+static inline uint8_t
+babl_trc_u8_table_lookup (const BablTRCU8Table *table,
+                          uint32_t              index,
+                          float                 value)
+{
+  int code = table->code[index];
+
+  while (value >= table->threshold[code + 1])
+    code++;
+  return code;
+}
+
+static inline uint16_t
+babl_trc_u16_table_lookup (const BablTRCU16Table *table,
+                           uint32_t               index,
+                           float                  value)
+{
+  int code = table->code[index];
+
+  while (value >= table->threshold[code + 1])
+    code++;
+  return code;
+}
+
+static inline uint8_t
+babl_trc_u8_from_linear (const BablTRCU8Table *table,
+                         float                 value)
+{
+  uint32_t index = babl_trc_table_index (&value, BABL_TRC_U8_TABLE_SHIFT);
+
+  return babl_trc_u8_table_lookup (table, index, value);
+}
+
+static inline uint16_t
+babl_trc_u16_from_linear (const BablTRCU16Table *table,
+                          float                  value)
+{
+  uint32_t index = babl_trc_table_index (&value, BABL_TRC_U16_TABLE_SHIFT);
+
+  return babl_trc_u16_table_lookup (table, index, value);
+}
+
+/* install the vectorized buffer functions of babl-trc-simd.h */
+void
+babl_trc_init_sse2 (BablTRC *trc);
+
+void
+babl_trc_init_avx2 (BablTRC *trc);
+
 #endif
@@ -54,6 +54,17 @@ babl_ticks (void)
   QueryPerformanceCounter(&end_time);
   return (end_time.QuadPart - start_time.QuadPart) * (1000000.0 / timer_freq.QuadPart);
 }
+
+int64_t
+babl_nanoseconds (void)
+{
+  LARGE_INTEGER end_time;
+
+  init_ticks ();
+
+  QueryPerformanceCounter(&end_time);
+  return (end_time.QuadPart - start_time.QuadPart) * (1000000000.0 / timer_freq.QuadPart);
+}
 #else
 static struct timeval start_time;
 
@@ -78,6 +89,18 @@ babl_ticks (void)
   gettimeofday (&measure_time, NULL);
   return usecs (measure_time) - usecs (start_time);
 }
+
+int64_t
+babl_nanoseconds (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec measure_time;
+  clock_gettime (CLOCK_MONOTONIC, &measure_time);
+  return (int64_t) measure_time.tv_sec * 1000000000 + measure_time.tv_nsec;
+#else
+  return (int64_t) babl_ticks () * 1000;
+#endif
+}
 #endif
 
 double
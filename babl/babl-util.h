@@ -22,6 +22,9 @@
 long
 babl_ticks     (void);
 
+int64_t
+babl_nanoseconds (void);
+
 double
 babl_rel_avg_error (const double *imgA,
                     const double *imgB,
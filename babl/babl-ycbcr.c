@@ -0,0 +1,746 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Frames of chroma subsampled Y'CbCr video, see babl_process_from_ycbcr ()
+ * and babl_process_to_ycbcr ().
+ *
+ * Decoding unpacks each row into 16bit luma and chroma relative to their
+ * offsets, repeating every chroma sample for the pixels sharing it, and
+ * turns those into R'G'B'A u8 or u16 with a fixed point matrix. Encoding
+ * computes luma for every pixel and averages the chroma of the pixels
+ * sharing a chroma sample. Rows are decoded directly into R'G'B'A u8 or
+ * u16 destinations in the space of the video; other formats are
+ * converted to and from these with a fish, a row at a time.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "babl-internal.h"
+
+#if defined(USE_SSE2)
+#include <emmintrin.h>
+#endif
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+typedef struct
+{
+  int sample_size;  /* bytes per sample, samples of 2 bytes are stored
+                       little endian in the high bits */
+  int bits;
+  int vertical;     /* number of rows sharing a row of chroma */
+  int luma_step;    /* samples between consecutive luma samples */
+  int cb_plane;
+  int cb_offset;    /* samples before the first Cb sample of a row */
+  int cr_plane;
+  int cr_offset;
+  int chroma_step;  /* samples between consecutive Cb or Cr samples */
+} YCbCrLayout;
+
+static const YCbCrLayout layouts[] =
+{
+  /* BABL_YCBCR_I420 */
+  { 1, 8,  2, 1, 1, 0, 2, 0, 1 },
+  /* BABL_YCBCR_NV12 */
+  { 1, 8,  2, 1, 1, 0, 1, 1, 2 },
+  /* BABL_YCBCR_YUY2 */
+  { 1, 8,  1, 2, 0, 1, 0, 3, 4 },
+  /* BABL_YCBCR_P010 */
+  { 2, 10, 2, 1, 1, 0, 1, 1, 2 },
+};
+
+typedef struct
+{
+  double kr;
+  double kb;
+  int    y_offset;
+  int    c_offset;
+  double y_range;
+  double c_range;
+} YCbCrCoding;
+
+static void
+ycbcr_coding (const YCbCrLayout *layout,
+              BablYCbCrMatrix    matrix,
+              int                full_range,
+              YCbCrCoding       *coding)
+{
+  double scale = 1 << (layout->bits - 8);
+
+  switch (matrix)
+    {
+      case BABL_YCBCR_BT601:
+        coding->kr = 0.299;
+        coding->kb = 0.114;
+        break;
+      case BABL_YCBCR_BT709:
+      default:
+        coding->kr = 0.2126;
+        coding->kb = 0.0722;
+        break;
+      case BABL_YCBCR_BT2020:
+        coding->kr = 0.2627;
+        coding->kb = 0.0593;
+        break;
+    }
+
+  coding->c_offset = 128 << (layout->bits - 8);
+  if (full_range)
+    {
+      coding->y_offset = 0;
+      coding->y_range  = (1 << layout->bits) - 1;
+      coding->c_range  = (1 << layout->bits) - 1;
+    }
+  else
+    {
+      coding->y_offset = 16 << (layout->bits - 8);
+      coding->y_range  = 219 * scale;
+      coding->c_range  = 224 * scale;
+    }
+}
+
+/* the R'G'B'A u8 or u16 format in the space of the video that rows are
+ * decoded into and encoded from
+ */
+static const Babl *
+ycbcr_rgba_format (BablYCbCrMatrix matrix,
+                   const Babl     *format)
+{
+  const Babl *space = babl_space (matrix == BABL_YCBCR_BT2020 ? "Rec2020" :
+                                                               "sRGB");
+
+  if (babl_format_get_type (format, 0) == babl_type_from_id (BABL_U8))
+    return babl_format_with_space ("R'G'B'A u8", space);
+  return babl_format_with_space ("R'G'B'A u16", space);
+}
+
+static inline int
+load_sample (const YCbCrLayout *layout,
+             const uint8_t     *row,
+             int                index)
+{
+  if (layout->sample_size == 1)
+    return row[index];
+  return (row[index * 2] | (row[index * 2 + 1] << 8)) >> (16 - layout->bits);
+}
+
+static inline void
+store_sample (const YCbCrLayout *layout,
+              uint8_t           *row,
+              int                index,
+              int                value)
+{
+  if (layout->sample_size == 1)
+    {
+      row[index] = value;
+    }
+  else
+    {
+      value <<= 16 - layout->bits;
+      row[index * 2]     = value & 0xff;
+      row[index * 2 + 1] = value >> 8;
+    }
+}
+
+static inline int
+clamp_code (int value,
+            int max)
+{
+  return value < 0 ? 0 : value > max ? max : value;
+}
+
+
+/* decoding */
+
+typedef struct
+{
+  int16_t y;
+  int16_t r_cr;
+  int16_t g_cb;
+  int16_t g_cr;
+  int16_t b_cb;
+  int     shift;
+  int     max;
+} DecodeMatrix;
+
+static void
+decode_matrix (const YCbCrCoding *coding,
+               int                max,
+               DecodeMatrix      *m)
+{
+  double kg = 1.0 - coding->kr - coding->kb;
+  double y  = max / coding->y_range;
+  double c  = max / coding->c_range;
+  double k[5];
+  double largest = 0.0;
+  double scale;
+  int    i;
+
+  k[0] = y;
+  k[1] = 2.0 * (1.0 - coding->kr) * c;
+  k[2] = -2.0 * coding->kb * (1.0 - coding->kb) / kg * c;
+  k[3] = -2.0 * coding->kr * (1.0 - coding->kr) / kg * c;
+  k[4] = 2.0 * (1.0 - coding->kb) * c;
+
+  for (i = 0; i < 5; i++)
+    if (fabs (k[i]) > largest)
+      largest = fabs (k[i]);
+
+  /* the largest shift that keeps the coefficients in 16 bits */
+  for (m->shift = 0; m->shift < 24 && largest * (2 << m->shift) < 32767.0;
+       m->shift++);
+  scale = 1 << m->shift;
+
+  m->y    = floor (k[0] * scale + 0.5);
+  m->r_cr = floor (k[1] * scale + 0.5);
+  m->g_cb = floor (k[2] * scale + 0.5);
+  m->g_cr = floor (k[3] * scale + 0.5);
+  m->b_cb = floor (k[4] * scale + 0.5);
+  m->max  = max;
+}
+
+static void
+unpack_row (const YCbCrLayout *layout,
+            const YCbCrCoding *coding,
+            const uint8_t     *luma,
+            const uint8_t     *cb,
+            const uint8_t     *cr,
+            int16_t           *y_out,
+            int16_t           *cb_out,
+            int16_t           *cr_out,
+            int                width)
+{
+  int i;
+
+  if (layout->sample_size == 1 && layout->luma_step == 1)
+    {
+      for (i = 0; i < width; i++)
+        y_out[i] = luma[i] - coding->y_offset;
+    }
+  else
+    {
+      for (i = 0; i < width; i++)
+        y_out[i] = load_sample (layout, luma, i * layout->luma_step) -
+                   coding->y_offset;
+    }
+
+  if (layout->sample_size == 1)
+    {
+      const uint8_t *cb_in = cb + layout->cb_offset;
+      const uint8_t *cr_in = cr + layout->cr_offset;
+      int            step  = layout->chroma_step;
+
+      for (i = 0; i + 1 < width; i += 2)
+        {
+          int16_t cb_value = cb_in[(i / 2) * step] - coding->c_offset;
+          int16_t cr_value = cr_in[(i / 2) * step] - coding->c_offset;
+
+          cb_out[i] = cb_out[i + 1] = cb_value;
+          cr_out[i] = cr_out[i + 1] = cr_value;
+        }
+    }
+  else
+    {
+      for (i = 0; i + 1 < width; i += 2)
+        {
+          int index = (i / 2) * layout->chroma_step;
+
+          cb_out[i] = cb_out[i + 1] =
+            load_sample (layout, cb, layout->cb_offset + index) -
+            coding->c_offset;
+          cr_out[i] = cr_out[i + 1] =
+            load_sample (layout, cr, layout->cr_offset + index) -
+            coding->c_offset;
+        }
+    }
+
+  if (i < width) /* the last pixel of odd widths shares its chroma with none */
+    {
+      int index = (i / 2) * layout->chroma_step;
+
+      cb_out[i] = load_sample (layout, cb, layout->cb_offset + index) -
+                  coding->c_offset;
+      cr_out[i] = load_sample (layout, cr, layout->cr_offset + index) -
+                  coding->c_offset;
+    }
+}
+
+static inline void
+decode_pixel (const DecodeMatrix *m,
+              int                 y,
+              int                 cb,
+              int                 cr,
+              int                *rgb)
+{
+  int round = (1 << m->shift) >> 1;
+
+  rgb[0] = clamp_code ((m->y * y + m->r_cr * cr + round) >> m->shift, m->max);
+  rgb[1] = clamp_code ((m->y * y + m->g_cb * cb + m->g_cr * cr + round) >>
+                       m->shift, m->max);
+  rgb[2] = clamp_code ((m->y * y + m->b_cb * cb + round) >> m->shift, m->max);
+}
+
+#if defined(USE_SSE2)
+
+typedef struct
+{
+  __m128i y_r_cr;
+  __m128i y_g_cb;
+  __m128i g_cr;
+  __m128i y_b_cb;
+  __m128i round;
+  __m128i shift;
+} DecodeMatrixSSE2;
+
+static void
+decode_matrix_sse2 (const DecodeMatrix *m,
+                    DecodeMatrixSSE2   *v)
+{
+  v->y_r_cr = _mm_setr_epi16 (m->y, m->r_cr, m->y, m->r_cr,
+                              m->y, m->r_cr, m->y, m->r_cr);
+  v->y_g_cb = _mm_setr_epi16 (m->y, m->g_cb, m->y, m->g_cb,
+                              m->y, m->g_cb, m->y, m->g_cb);
+  v->g_cr   = _mm_setr_epi16 (m->g_cr, 0, m->g_cr, 0, m->g_cr, 0, m->g_cr, 0);
+  v->y_b_cb = _mm_setr_epi16 (m->y, m->b_cb, m->y, m->b_cb,
+                              m->y, m->b_cb, m->y, m->b_cb);
+  v->round  = _mm_set1_epi32 ((1 << m->shift) >> 1);
+  v->shift  = _mm_cvtsi32_si128 (m->shift);
+}
+
+/* eight pixels of R', G' and B' as 32bit values, for the low and high
+ * four pixels
+ */
+static inline void
+decode_8_sse2 (const DecodeMatrixSSE2 *v,
+               const int16_t          *y_in,
+               const int16_t          *cb_in,
+               const int16_t          *cr_in,
+               __m128i                *rgb)
+{
+  __m128i y     = _mm_loadu_si128 ((const void *) y_in);
+  __m128i cb    = _mm_loadu_si128 ((const void *) cb_in);
+  __m128i cr    = _mm_loadu_si128 ((const void *) cr_in);
+  __m128i ycr_l = _mm_unpacklo_epi16 (y, cr);
+  __m128i ycr_h = _mm_unpackhi_epi16 (y, cr);
+  __m128i ycb_l = _mm_unpacklo_epi16 (y, cb);
+  __m128i ycb_h = _mm_unpackhi_epi16 (y, cb);
+  __m128i cr_l  = _mm_unpacklo_epi16 (cr, cr);
+  __m128i cr_h  = _mm_unpackhi_epi16 (cr, cr);
+
+#define DECODE_SCALE(x) _mm_sra_epi32 (_mm_add_epi32 ((x), v->round), v->shift)
+  rgb[0] = DECODE_SCALE (_mm_madd_epi16 (ycr_l, v->y_r_cr));
+  rgb[1] = DECODE_SCALE (_mm_madd_epi16 (ycr_h, v->y_r_cr));
+  rgb[2] = DECODE_SCALE (_mm_add_epi32 (_mm_madd_epi16 (ycb_l, v->y_g_cb),
+                                        _mm_madd_epi16 (cr_l, v->g_cr)));
+  rgb[3] = DECODE_SCALE (_mm_add_epi32 (_mm_madd_epi16 (ycb_h, v->y_g_cb),
+                                        _mm_madd_epi16 (cr_h, v->g_cr)));
+  rgb[4] = DECODE_SCALE (_mm_madd_epi16 (ycb_l, v->y_b_cb));
+  rgb[5] = DECODE_SCALE (_mm_madd_epi16 (ycb_h, v->y_b_cb));
+#undef DECODE_SCALE
+}
+
+static int
+decode_row_u8_sse2 (const DecodeMatrix *m,
+                    const int16_t      *y,
+                    const int16_t      *cb,
+                    const int16_t      *cr,
+                    uint8_t            *rgba,
+                    int                 width)
+{
+  const __m128i    alpha = _mm_set1_epi8 ((char) 0xff);
+  DecodeMatrixSSE2 v;
+  int              i;
+
+  decode_matrix_sse2 (m, &v);
+
+  for (i = 0; i + 8 <= width; i += 8)
+    {
+      __m128i rgb[6];
+      __m128i r, g, b, rg, ba;
+
+      decode_8_sse2 (&v, y + i, cb + i, cr + i, rgb);
+      r  = _mm_packs_epi32 (rgb[0], rgb[1]);
+      g  = _mm_packs_epi32 (rgb[2], rgb[3]);
+      b  = _mm_packs_epi32 (rgb[4], rgb[5]);
+      rg = _mm_unpacklo_epi8 (_mm_packus_epi16 (r, r), _mm_packus_epi16 (g, g));
+      ba = _mm_unpacklo_epi8 (_mm_packus_epi16 (b, b), alpha);
+
+      _mm_storeu_si128 ((void *) (rgba + i * 4),      _mm_unpacklo_epi16 (rg, ba));
+      _mm_storeu_si128 ((void *) (rgba + i * 4 + 16), _mm_unpackhi_epi16 (rg, ba));
+    }
+  return i;
+}
+
+/* packs 32bit values to 16bit, saturating to 0..65535 */
+static inline __m128i
+pack_u16 (__m128i lo,
+          __m128i hi)
+{
+  const __m128i bias = _mm_set1_epi32 (32768);
+
+  return _mm_xor_si128 (_mm_packs_epi32 (_mm_sub_epi32 (lo, bias),
+                                         _mm_sub_epi32 (hi, bias)),
+                        _mm_set1_epi16 ((short) 0x8000));
+}
+
+static int
+decode_row_u16_sse2 (const DecodeMatrix *m,
+                     const int16_t      *y,
+                     const int16_t      *cb,
+                     const int16_t      *cr,
+                     uint16_t           *rgba,
+                     int                 width)
+{
+  const __m128i    alpha = _mm_set1_epi16 ((short) 0xffff);
+  DecodeMatrixSSE2 v;
+  int              i;
+
+  decode_matrix_sse2 (m, &v);
+
+  for (i = 0; i + 8 <= width; i += 8)
+    {
+      __m128i rgb[6];
+      __m128i r, g, b, rg_l, rg_h, ba_l, ba_h;
+
+      decode_8_sse2 (&v, y + i, cb + i, cr + i, rgb);
+      r    = pack_u16 (rgb[0], rgb[1]);
+      g    = pack_u16 (rgb[2], rgb[3]);
+      b    = pack_u16 (rgb[4], rgb[5]);
+      rg_l = _mm_unpacklo_epi16 (r, g);
+      rg_h = _mm_unpackhi_epi16 (r, g);
+      ba_l = _mm_unpacklo_epi16 (b, alpha);
+      ba_h = _mm_unpackhi_epi16 (b, alpha);
+
+      _mm_storeu_si128 ((void *) (rgba + i * 4),      _mm_unpacklo_epi32 (rg_l, ba_l));
+      _mm_storeu_si128 ((void *) (rgba + i * 4 + 8),  _mm_unpackhi_epi32 (rg_l, ba_l));
+      _mm_storeu_si128 ((void *) (rgba + i * 4 + 16), _mm_unpacklo_epi32 (rg_h, ba_h));
+      _mm_storeu_si128 ((void *) (rgba + i * 4 + 24), _mm_unpackhi_epi32 (rg_h, ba_h));
+    }
+  return i;
+}
+
+#endif
+
+static void
+decode_row_u8 (const DecodeMatrix *m,
+               const int16_t      *y,
+               const int16_t      *cb,
+               const int16_t      *cr,
+               uint8_t            *rgba,
+               int                 width)
+{
+  int i = 0;
+
+#if defined(USE_SSE2)
+  i = decode_row_u8_sse2 (m, y, cb, cr, rgba, width);
+#endif
+
+  for (; i < width; i++)
+    {
+      int rgb[3];
+
+      decode_pixel (m, y[i], cb[i], cr[i], rgb);
+      rgba[i * 4 + 0] = rgb[0];
+      rgba[i * 4 + 1] = rgb[1];
+      rgba[i * 4 + 2] = rgb[2];
+      rgba[i * 4 + 3] = 0xff;
+    }
+}
+
+static void
+decode_row_u16 (const DecodeMatrix *m,
+                const int16_t      *y,
+                const int16_t      *cb,
+                const int16_t      *cr,
+                uint16_t           *rgba,
+                int                 width)
+{
+  int i = 0;
+
+#if defined(USE_SSE2)
+  i = decode_row_u16_sse2 (m, y, cb, cr, rgba, width);
+#endif
+
+  for (; i < width; i++)
+    {
+      int rgb[3];
+
+      decode_pixel (m, y[i], cb[i], cr[i], rgb);
+      rgba[i * 4 + 0] = rgb[0];
+      rgba[i * 4 + 1] = rgb[1];
+      rgba[i * 4 + 2] = rgb[2];
+      rgba[i * 4 + 3] = 0xffff;
+    }
+}
+
+long
+babl_process_from_ycbcr (BablYCbCrLayout layout,
+                         BablYCbCrMatrix matrix,
+                         int             full_range,
+                         const void    **planes,
+                         const int      *plane_strides,
+                         const Babl     *format,
+                         void           *dest,
+                         int             dest_stride,
+                         int             width,
+                         int             height)
+{
+  const YCbCrLayout *l;
+  YCbCrCoding        coding;
+  DecodeMatrix       m;
+  const Babl        *rgba;
+  const Babl        *fish = NULL;
+  int                u8;
+  char              *buffers;
+  int16_t           *y;
+  int16_t           *cb;
+  int16_t           *cr;
+  char              *row_rgba;
+  int                row;
+
+  babl_assert (planes && plane_strides && format && dest);
+  babl_assert (layout >= 0 && layout < sizeof (layouts) / sizeof (layouts[0]));
+
+  if (width <= 0 || height <= 0)
+    return 0;
+
+  l    = &layouts[layout];
+  rgba = ycbcr_rgba_format (matrix, format);
+  u8   = babl_format_get_bytes_per_pixel (rgba) == 4;
+  if (rgba != format)
+    fish = babl_fish (rgba, format);
+
+  ycbcr_coding (l, matrix, full_range, &coding);
+  decode_matrix (&coding, u8 ? 0xff : 0xffff, &m);
+
+  buffers  = babl_scratch_alloc (width * (3 * sizeof (int16_t) +
+                                          (fish ? 8 : 0)));
+  y        = (int16_t *) buffers;
+  cb       = y + width;
+  cr       = cb + width;
+  row_rgba = (char *) (cr + width);
+
+  for (row = 0; row < height; row++)
+    {
+      int            chroma_row = row / l->vertical;
+      const uint8_t *luma = (const uint8_t *) planes[0] +
+                            (long) row * plane_strides[0];
+      const uint8_t *cb_row = (const uint8_t *) planes[l->cb_plane] +
+                              (long) chroma_row * plane_strides[l->cb_plane];
+      const uint8_t *cr_row = (const uint8_t *) planes[l->cr_plane] +
+                              (long) chroma_row * plane_strides[l->cr_plane];
+      char          *dest_row = (char *) dest + (long) row * dest_stride;
+      char          *out      = fish ? row_rgba : dest_row;
+
+      unpack_row (l, &coding, luma, cb_row, cr_row, y, cb, cr, width);
+
+      if (u8)
+        decode_row_u8 (&m, y, cb, cr, (uint8_t *) out, width);
+      else
+        decode_row_u16 (&m, y, cb, cr, (uint16_t *) out, width);
+
+      if (fish)
+        babl_process (fish, out, dest_row, width);
+    }
+
+  babl_scratch_free (buffers);
+  return (long) width * height;
+}
+
+
+/* encoding */
+
+#define ENCODE_SHIFT 16
+
+typedef struct
+{
+  int y[3];
+  int cb[3];
+  int cr[3];
+  int y_offset;
+  int c_offset;
+  int max;
+} EncodeMatrix;
+
+static void
+encode_matrix (const YCbCrCoding *coding,
+               int                rgb_max,
+               int                bits,
+               EncodeMatrix      *m)
+{
+  double kg    = 1.0 - coding->kr - coding->kb;
+  double scale = (1 << ENCODE_SHIFT) / (double) rgb_max;
+  double y     = coding->y_range * scale;
+  double cb    = coding->c_range * scale / (2.0 * (1.0 - coding->kb));
+  double cr    = coding->c_range * scale / (2.0 * (1.0 - coding->kr));
+
+  m->y[0]  = floor (coding->kr * y + 0.5);
+  m->y[1]  = floor (kg * y + 0.5);
+  m->y[2]  = floor (coding->kb * y + 0.5);
+  m->cb[0] = floor (-coding->kr * cb + 0.5);
+  m->cb[1] = floor (-kg * cb + 0.5);
+  m->cb[2] = floor ((1.0 - coding->kb) * cb + 0.5);
+  m->cr[0] = floor ((1.0 - coding->kr) * cr + 0.5);
+  m->cr[1] = floor (-kg * cr + 0.5);
+  m->cr[2] = floor (-coding->kb * cr + 0.5);
+  m->y_offset = coding->y_offset;
+  m->c_offset = coding->c_offset;
+  m->max      = (1 << bits) - 1;
+}
+
+/* luma of a row, and the sums of the scaled chroma of pairs of pixels */
+#define ENCODE_ROW(type)                                                      \
+  for (i = 0; i < width; i++)                                                 \
+    {                                                                         \
+      const type *p = (const type *) rgba + i * 4;                            \
+      int Y = (m->y[0] * p[0] + m->y[1] * p[1] + m->y[2] * p[2] +            \
+               (m->y_offset << ENCODE_SHIFT) + (1 << (ENCODE_SHIFT - 1))) >> \
+              ENCODE_SHIFT;                                                   \
+                                                                              \
+      store_sample (l, luma, i * l->luma_step, clamp_code (Y, m->max));      \
+      cb_sum[i / 2] += m->cb[0] * p[0] + m->cb[1] * p[1] + m->cb[2] * p[2];  \
+      cr_sum[i / 2] += m->cr[0] * p[0] + m->cr[1] * p[1] + m->cr[2] * p[2];  \
+    }
+
+static void
+encode_row (const YCbCrLayout  *l,
+            const EncodeMatrix *m,
+            const void         *rgba,
+            int                 u8,
+            uint8_t            *luma,
+            int                *cb_sum,
+            int                *cr_sum,
+            int                 width)
+{
+  int i;
+
+  if (u8)
+    ENCODE_ROW (uint8_t)
+  else
+    ENCODE_ROW (uint16_t)
+}
+
+static void
+store_chroma (const YCbCrLayout  *l,
+              const EncodeMatrix *m,
+              const int          *cb_sum,
+              const int          *cr_sum,
+              uint8_t            *cb_row,
+              uint8_t            *cr_row,
+              int                 width,
+              int                 rows)
+{
+  int i;
+
+  for (i = 0; i < (width + 1) / 2; i++)
+    {
+      int count = rows * (i * 2 + 1 < width ? 2 : 1);
+      int shift = ENCODE_SHIFT + (count == 4 ? 2 : count - 1);
+      int index = i * l->chroma_step;
+      int cb    = (cb_sum[i] + (m->c_offset << shift) + (1 << (shift - 1))) >> shift;
+      int cr    = (cr_sum[i] + (m->c_offset << shift) + (1 << (shift - 1))) >> shift;
+
+      store_sample (l, cb_row, l->cb_offset + index, clamp_code (cb, m->max));
+      store_sample (l, cr_row, l->cr_offset + index, clamp_code (cr, m->max));
+    }
+}
+
+long
+babl_process_to_ycbcr (const Babl     *format,
+                       const void     *source,
+                       int             source_stride,
+                       BablYCbCrLayout layout,
+                       BablYCbCrMatrix matrix,
+                       int             full_range,
+                       void          **planes,
+                       const int      *plane_strides,
+                       int             width,
+                       int             height)
+{
+  const YCbCrLayout *l;
+  YCbCrCoding        coding;
+  EncodeMatrix       m;
+  const Babl        *rgba;
+  const Babl        *fish = NULL;
+  int                u8;
+  int                chroma_width = (width + 1) / 2;
+  char              *buffers;
+  int               *cb_sum;
+  int               *cr_sum;
+  char              *row_rgba;
+  int                row;
+
+  babl_assert (planes && plane_strides && format && source);
+  babl_assert (layout >= 0 && layout < sizeof (layouts) / sizeof (layouts[0]));
+
+  if (width <= 0 || height <= 0)
+    return 0;
+
+  l    = &layouts[layout];
+  rgba = ycbcr_rgba_format (matrix, format);
+  u8   = babl_format_get_bytes_per_pixel (rgba) == 4;
+  if (rgba != format)
+    fish = babl_fish (format, rgba);
+
+  ycbcr_coding (l, matrix, full_range, &coding);
+  encode_matrix (&coding, u8 ? 0xff : 0xffff, l->bits, &m);
+
+  buffers  = babl_scratch_alloc (chroma_width * 2 * sizeof (int) +
+                                 (fish ? width * 8 : 0));
+  cb_sum   = (int *) buffers;
+  cr_sum   = cb_sum + chroma_width;
+  row_rgba = (char *) (cr_sum + chroma_width);
+
+  for (row = 0; row < height; row += l->vertical)
+    {
+      int rows = MIN (l->vertical, height - row);
+      int chroma_row = row / l->vertical;
+      int i;
+
+      memset (cb_sum, 0, chroma_width * 2 * sizeof (int));
+
+      for (i = 0; i < rows; i++)
+        {
+          const char *src_row = (const char *) source +
+                                (long) (row + i) * source_stride;
+          uint8_t    *luma    = (uint8_t *) planes[0] +
+                                (long) (row + i) * plane_strides[0];
+
+          if (fish)
+            {
+              babl_process (fish, src_row, row_rgba, width);
+              src_row = row_rgba;
+            }
+          encode_row (l, &m, src_row, u8, luma, cb_sum, cr_sum, width);
+        }
+
+      store_chroma (l, &m, cb_sum, cr_sum,
+                    (uint8_t *) planes[l->cb_plane] +
+                    (long) chroma_row * plane_strides[l->cb_plane],
+                    (uint8_t *) planes[l->cr_plane] +
+                    (long) chroma_row * plane_strides[l->cr_plane],
+                    width, rows);
+    }
+
+  babl_scratch_free (buffers);
+  return (long) width * height;
+}
@@ -145,6 +145,7 @@ babl_init (void)
       babl_conversion_db ();
       babl_extension_db ();
       babl_fish_db ();
+      babl_fast_fish_db ();
       babl_core_init ();
       babl_sanity ();
       babl_extension_base ();
@@ -163,17 +164,20 @@ babl_exit (void)
 {
   if (!-- ref_count)
     {
+      babl_fish_async_stop ();
       babl_store_db ();
 
       babl_extension_deinit ();
       babl_free (babl_extension_db ());;
       babl_free (babl_fish_db ());;
+      babl_free (babl_fast_fish_db ());;
       babl_free (babl_conversion_db ());;
       babl_free (babl_format_db ());;
       babl_free (babl_model_db ());;
       babl_free (babl_component_db ());;
       babl_free (babl_type_db ());;
 
+      babl_fish_cache_invalidate ();
       babl_internal_destroy ();
 #if BABL_DEBUG_MEM
       babl_memory_sanity ();
@@ -23,6 +23,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #define BABL_INSIDE_BABL_H
 #include <babl/babl-macros.h>
 #include <babl/babl-types.h>
@@ -222,9 +224,9 @@ const Babl * babl_fish (const void *source_format,
  * increasing order of speed gain are:
  *    "exact" "precise" "fast" "glitch"
  *
- * Fast fishes should be cached, since they are not internally kept track
- * of/made into singletons by babl and many creations of fast fishes will
- * otherwise be a leak.
+ * Like the fishes of babl_fish(), fast fishes are singletons kept by babl
+ * for each pair of formats and performance, and are stored in the on-disk
+ * fish cache; asking for the same fast fish again is a cheap lookup.
  *
  */
 const Babl * babl_fast_fish (const void *source_format,
@@ -251,6 +253,227 @@ long         babl_process_rows (const Babl *babl_fish,
                                 long        n,
                                 int         rows);
 
+/**
+ * babl_process_rows_parallel:
+ *
+ *  Like babl_process_rows(), but large requests are split into chunks
+ *  of rows, or of pixels within rows, that are processed concurrently by
+ *  an internal pool of worker threads; the call returns once all rows
+ *  have been converted. Small requests are processed on the calling
+ *  thread. The number of threads used defaults to the number of CPU
+ *  cores, and can be overridden with the BABL_THREADS environment
+ *  variable. Returns number of pixels converted.
+ */
+long         babl_process_rows_parallel (const Babl *babl_fish,
+                                         const void *source,
+                                         int         source_stride,
+                                         void       *dest,
+                                         int         dest_stride,
+                                         long        n,
+                                         int         rows);
+
+/**
+ * babl_process_planes:
+ *
+ *  Like babl_process(), but with the components of the source and
+ *  destination pixels in separate planes. source_planes and dest_planes
+ *  hold the address of the first pixel of each component, in the order
+ *  of the components of the formats of the fish, and the pitches the
+ *  distance in bytes between consecutive pixels of each plane, NULL for
+ *  planes with the components of consecutive pixels next to each other.
+ *  The planes are converted in tiles that stay in cache, without a
+ *  separate pass to interleave them. Returns number of pixels converted.
+ */
+long         babl_process_planes (const Babl  *babl_fish,
+                                  const void **source_planes,
+                                  const int   *source_pitches,
+                                  void       **dest_planes,
+                                  const int   *dest_pitches,
+                                  long         n);
+
+/**
+ * BablYCbCrLayout:
+ * @BABL_YCBCR_I420: 8bit Y', Cb and Cr in three planes, chroma halved
+ *                   horizontally and vertically.
+ * @BABL_YCBCR_NV12: 8bit Y' in one plane and interleaved Cb and Cr in a
+ *                   second plane, chroma halved horizontally and vertically.
+ * @BABL_YCBCR_YUY2: 8bit Y'0 Cb Y'1 Cr for each pair of pixels in one plane,
+ *                   chroma halved horizontally.
+ * @BABL_YCBCR_P010: like NV12 with 16bit little endian samples holding 10bit
+ *                   values in their high bits.
+ *
+ * Layouts of frames of chroma subsampled Y'CbCr video.
+ */
+typedef enum
+{
+  BABL_YCBCR_I420,
+  BABL_YCBCR_NV12,
+  BABL_YCBCR_YUY2,
+  BABL_YCBCR_P010
+} BablYCbCrLayout;
+
+/**
+ * BablYCbCrMatrix:
+ *
+ * The luma coefficients of Y'CbCr video, R'G'B' of BT.2020 video is in
+ * the "Rec2020" space, that of BT.601 and BT.709 video in "sRGB".
+ */
+typedef enum
+{
+  BABL_YCBCR_BT601,
+  BABL_YCBCR_BT709,
+  BABL_YCBCR_BT2020
+} BablYCbCrMatrix;
+
+/**
+ * babl_process_from_ycbcr:
+ *
+ *  Converts a width x height frame of Y'CbCr video with the given layout,
+ *  matrix and range, from planes with plane_strides bytes between rows,
+ *  into rows of pixels in format with dest_stride bytes between them.
+ *  Every chroma sample is used for all the pixels sharing it. Frames are
+ *  decoded directly into R'G'B'A u8 or u16 in the space of the video,
+ *  other formats are converted from those. Returns number of pixels
+ *  converted.
+ */
+long         babl_process_from_ycbcr (BablYCbCrLayout layout,
+                                      BablYCbCrMatrix matrix,
+                                      int             full_range,
+                                      const void    **planes,
+                                      const int      *plane_strides,
+                                      const Babl     *format,
+                                      void           *dest,
+                                      int             dest_stride,
+                                      int             width,
+                                      int             height);
+
+/**
+ * babl_process_to_ycbcr:
+ *
+ *  The inverse of babl_process_from_ycbcr(), converts rows of pixels in
+ *  format into a frame of Y'CbCr video, chroma samples are the average of
+ *  the pixels sharing them. Returns number of pixels converted.
+ */
+long         babl_process_to_ycbcr   (const Babl     *format,
+                                      const void     *source,
+                                      int             source_stride,
+                                      BablYCbCrLayout layout,
+                                      BablYCbCrMatrix matrix,
+                                      int             full_range,
+                                      void          **planes,
+                                      const int      *plane_strides,
+                                      int             width,
+                                      int             height);
+
+/**
+ * BablStream:
+ *
+ * Converts pixel data with a fish as it arrives in chunks of any size.
+ */
+typedef struct _BablStream BablStream;
+
+/**
+ * babl_stream_new:
+ *
+ *  Creates a stream converting with fish, free it with babl_stream_free().
+ */
+BablStream * babl_stream_new         (const Babl       *babl_fish);
+
+/**
+ * babl_stream_free:
+ */
+void         babl_stream_free        (BablStream       *stream);
+
+/**
+ * babl_stream_process:
+ *
+ *  Converts the bytes of source, in chunks that do not need to hold whole
+ *  pixels, writing the converted bytes to dest, that does not need to
+ *  have room for whole pixels either. Whole pixels are converted directly
+ *  from source to dest, the stream holds on to the start of a source
+ *  pixel continued in the next chunk, and to the rest of a converted
+ *  pixel that did not fit in dest, which is written at the start of dest
+ *  in the next call. Source is consumed as far as its conversion fits in
+ *  dest. Returns the number of bytes of source consumed, the number of
+ *  bytes written to dest is stored in dest_written.
+ */
+long         babl_stream_process     (BablStream       *stream,
+                                      const void       *source,
+                                      long              source_length,
+                                      void             *dest,
+                                      long              dest_length,
+                                      long             *dest_written);
+
+/**
+ * babl_stream_get_pending:
+ *
+ *  Returns the number of bytes of an incomplete source pixel the stream
+ *  holds on to, when the data ends this should be 0.
+ */
+long         babl_stream_get_pending (const BablStream *stream);
+
+/**
+ * babl_stream_reset:
+ *
+ *  Drops the partial pixels held by the stream, for starting over with
+ *  new data.
+ */
+void         babl_stream_reset       (BablStream       *stream);
+
+/**
+ * BablFishStats:
+ * @calls: number of babl_process() calls, each call of the row
+ *         processing functions counts as one.
+ * @pixels: number of pixels converted.
+ * @nanoseconds: time spent converting.
+ *
+ * Runtime statistics of a fish, summed over all threads.
+ */
+typedef struct _BablFishStats
+{
+  int64_t calls;
+  int64_t pixels;
+  int64_t nanoseconds;
+} BablFishStats;
+
+/**
+ * babl_fish_get_stats:
+ *
+ *  Fill in @stats with the runtime statistics of @babl_fish. Statistics
+ *  are only collected when the BABL_STATS environment variable is set, the
+ *  counters are kept per thread and add little overhead. Returns whether
+ *  statistics are being collected.
+ */
+int          babl_fish_get_stats (const Babl    *babl_fish,
+                                  BablFishStats *stats);
+
+/**
+ * babl_fish_get_step_stats:
+ *
+ *  Fill in @stats with the statistics of the conversion at index @step of
+ *  the path of @babl_fish, and store the conversion in @conversion when it
+ *  is not NULL. The nanoseconds are those spent in this step, they are
+ *  only measured when BABL_STATS is set to "steps". Returns 0 when
+ *  @babl_fish has no such step.
+ */
+int          babl_fish_get_step_stats (const Babl     *babl_fish,
+                                       int             step,
+                                       const Babl    **conversion,
+                                       BablFishStats  *stats);
+
+typedef int (*BablFishStatsFunc) (const Babl          *babl_fish,
+                                  const BablFishStats *stats,
+                                  void                *user_data);
+
+/**
+ * babl_fish_stats_foreach:
+ *
+ *  Call @func for each fish that has been used since statistics
+ *  collection started, iteration stops when @func returns non-zero.
+ */
+void         babl_fish_stats_foreach (BablFishStatsFunc  func,
+                                      void              *user_data);
+
 
 /**
  * babl_get_name:
@@ -728,6 +951,37 @@ const char * babl_format_get_encoding (const Babl *babl);
 int babl_space_is_cmyk (const Babl *space);
 int babl_space_is_gray (const Babl *space);
 
+/**
+ * babl_space_ref:
+ * @space: a babl space
+ *
+ * Adds a reference to @space. The functions making spaces,
+ * babl_space_from_icc (), babl_space_from_chromaticities (),
+ * babl_space_from_rgbxyz_matrix (), babl_space_from_gray_trc () and
+ * babl_space_with_trc (), return the space with a reference added as
+ * well, also when the same space was made before. babl_space () looks a space up without adding one.
+ *
+ * Returns: @space
+ */
+const Babl *babl_space_ref (const Babl *space);
+
+/**
+ * babl_space_unref:
+ * @space: a babl space
+ *
+ * Releases a reference to @space. When the last reference is released the
+ * space is torn down, with the formats and models in it, the conversions
+ * and fishes from, to and through them, and the TRCs only it used; the
+ * pointers to any of them become invalid. References that are never
+ * released keep a space for the lifetime of babl, as the spaces of babl
+ * itself do.
+ *
+ * Releasing the last reference waits for fishes being made in the
+ * background, and must not happen while other threads convert, look up
+ * formats and fishes or read statistics of fishes.
+ */
+void babl_space_unref (const Babl *space);
+
 /* values below this are stored associated with this value, it should also be
  * used as a generic alpha zero epsilon in GEGL to keep the threshold effects
  * on one known value.
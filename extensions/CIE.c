@@ -239,6 +239,18 @@ double residual_3x3( double A[3][3], double x[3], double b[3] ){
 const Babl *colorant_babl;
 double *colorant_data;
 
+/* used when the host application has not provided colorants, initialized
+ * from the sRGB primaries in init ()
+ */
+static double fallback_colorant_data[9];
+
+static inline double *
+get_colorant_data (void)
+{
+  double *data = colorant_babl ? babl_get_user_data (colorant_babl) : NULL;
+  return data ? data : fallback_colorant_data;
+}
+
 
 static const Babl * babl_get_space_from_gimp (void);
 
@@ -253,17 +265,20 @@ babl_get_space_from_gimp (void)
   const char *name = myprofilename;
   const Babl *trc = babl_trc_gamma (1.0);
 
-    rx = colorant_data[0];
-    gx = colorant_data[3];
-    bx = colorant_data[6];
+  if (!colorant_data)
+    colorant_data = fallback_colorant_data;
+
+  rx = colorant_data[0];
+  gx = colorant_data[3];
+  bx = colorant_data[6];
 
-    ry = colorant_data[1];
-    gy = colorant_data[4];
-    by = colorant_data[7];
+  ry = colorant_data[1];
+  gy = colorant_data[4];
+  by = colorant_data[7];
 
-    rz = colorant_data[2];
-    gz = colorant_data[5];
-    bz = colorant_data[8];
+  rz = colorant_data[2];
+  gz = colorant_data[5];
+  bz = colorant_data[8];
 //Uncomment the code below to print colorants to screen:
 //printf("CIE.c babl_get_user_data: Y values=%.8f %.8f %.8f\n", ry, gy, by);
 
@@ -297,6 +312,13 @@ int init (void);
 int
 init (void)
 {
+  const double *srgb_rgbtoxyz = babl_space_get_rgbtoxyz (babl_space ("sRGB"));
+  int i, j;
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      fallback_colorant_data[i * 3 + j] = srgb_rgbtoxyz[j * 3 + i];
+
   types ();
   components ();
   models ();
@@ -509,7 +531,7 @@ static inline void RGB_to_XYZ (double R,
                                double *to_Y,
                                double *to_Z)
 {
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
   double colorants[3][3];
   colorants[0][0] = new_colorant_data[0];
   colorants[0][1] = new_colorant_data[3];
@@ -549,7 +571,7 @@ XYZ_to_RGB (double X,
             double *to_B)
 {
   double inverse_colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
   double colorants[3][3];
 
   colorants[0][0] = new_colorant_data[0];
@@ -2061,7 +2083,7 @@ rgbf_to_Labf (const Babl *conversion,
 {//printf("5c\n");
   //const Babl *space = babl_get_space_from_gimp ();
   //double colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
 
   float m_0_0 = new_colorant_data[0] / D50_WHITE_REF_X;
   float m_0_1 = new_colorant_data[3] / D50_WHITE_REF_X;
@@ -2112,7 +2134,7 @@ rgbaf_to_Lf (const Babl *conversion,
 {//printf("6c\n");
   //const Babl *space = babl_get_space_from_gimp ();
   //double colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
 
   //float m_0_0 = new_colorant_data[0] / D50_WHITE_REF_X;
   //float m_0_1 = new_colorant_data[3] / D50_WHITE_REF_X;
@@ -2152,7 +2174,7 @@ rgbaf_to_Labf (const Babl *conversion,
 {//printf("7c\n");
   //const Babl *space = babl_get_space_from_gimp ();
   //double colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
 
   float m_0_0 = new_colorant_data[0] / D50_WHITE_REF_X;
   float m_0_1 = new_colorant_data[3] / D50_WHITE_REF_X;
@@ -2203,7 +2225,7 @@ rgbaf_to_Labaf (const Babl *conversion,
 {//printf("8c\n");
   //const Babl *space = babl_get_space_from_gimp ();
   //double colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
 
   float m_0_0 = new_colorant_data[0] / D50_WHITE_REF_X;
   float m_0_1 = new_colorant_data[3] / D50_WHITE_REF_X;
@@ -2381,7 +2403,7 @@ Labaf_to_rgbaf (const Babl *conversion,
 {//printf("11\n");
   //const Babl *space = babl_get_space_from_gimp ();
   double inverse_colorants[3][3], colorants[3][3];
-  double *new_colorant_data = babl_get_user_data (colorant_babl);
+  double *new_colorant_data = get_colorant_data ();
   float m_0_0, m_0_1, m_0_2, m_1_0, m_1_1, m_1_2, m_2_0, m_2_1, m_2_2;
   long n = samples;
 
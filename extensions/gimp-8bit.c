@@ -28,43 +28,24 @@
 #include "extensions/util.h"
 
 
-/* lookup tables used in conversion */
-
-#define MAX_SPACES 32
-static const Babl *spaces[MAX_SPACES]={NULL,};
+/* lookup tables used in conversion, the ones of the TRCs of spaces are
+ * kept by the TRCs
+ */
 
 static float lut_linear[1 << 8];
-static float lut_gamma_2_2[MAX_SPACES][1 << 8];
 
 
-static int
-tables_init (const Babl *space)
+static void
+tables_init (void)
 {
-  int i, j;
-
-  for (j = 0; spaces[j]; j++)
-  {
-    if (spaces[j] == space)
-      return j;
-  }
-  spaces[j] = space;
+  int i;
 
   /* fill tables for conversion from 8 bit integer to float */
-  if (j == 0)
   for (i = 0; i < 1 << 8; i++)
     {
       double value = i / 255.0;
       lut_linear[i]    = value;
     }
-
-  /* fill tables for conversion from 8 bit integer to float */
-  for (i = 0; i < 1 << 8; i++)
-    {
-      double value = i / 255.0;
-      lut_gamma_2_2[j][i] = babl_trc_to_linear (space->space.trc[0], value);
-    }
-
-  return j;
 }
 
 static inline void
@@ -108,12 +89,13 @@ u8_gamma_2_2_to_float_linear (const Babl    *conversion,
                               unsigned char *dst,
                               long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
-    *d++ = lut_gamma_2_2[space_no][*src++];
+    *d++ = lut_gamma_2_2[*src++];
 }
 
 static void
@@ -141,15 +123,16 @@ conv_rgba8_gamma_2_2_rgbaF_linear (const Babl    *conversion,
                                    unsigned char *dst,
                                    long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
     {
-      *d++ = lut_gamma_2_2[space_no][*src++];
-      *d++ = lut_gamma_2_2[space_no][*src++];
-      *d++ = lut_gamma_2_2[space_no][*src++];
+      *d++ = lut_gamma_2_2[*src++];
+      *d++ = lut_gamma_2_2[*src++];
+      *d++ = lut_gamma_2_2[*src++];
       *d++ = lut_linear[*src++];
     }
 }
@@ -198,15 +181,16 @@ conv_rgb8_gamma_2_2_rgbaF_linear (const Babl    *conversion,
                                   unsigned char *dst,
                                   long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
     {
-      *d++ = lut_gamma_2_2[space_no][*src++];
-      *d++ = lut_gamma_2_2[space_no][*src++];
-      *d++ = lut_gamma_2_2[space_no][*src++];
+      *d++ = lut_gamma_2_2[*src++];
+      *d++ = lut_gamma_2_2[*src++];
+      *d++ = lut_gamma_2_2[*src++];
       *d++ = 1.0;
     }
 }
@@ -226,13 +210,14 @@ conv_ga8_gamma_2_2_gaF_linear (const Babl    *conversion,
                                unsigned char *dst,
                                long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
     {
-      *d++ = lut_gamma_2_2[space_no][*src++];
+      *d++ = lut_gamma_2_2[*src++];
       *d++ = lut_linear[*src++];
     }
 }
@@ -280,13 +265,14 @@ conv_ga8_gamma_2_2_rgbaF_linear (const Babl    *conversion,
                                  unsigned char *dst,
                                  long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
     {
-      float value = lut_gamma_2_2[space_no][*src++];
+      float value = lut_gamma_2_2[*src++];
 
       *d++ = value;
       *d++ = value;
@@ -339,13 +325,14 @@ conv_g8_gamma_2_2_rgbaF_linear (const Babl    *conversion,
                                 unsigned char *dst,
                                 long           samples)
 {
-  int   space_no = tables_init (conversion->conversion.source->format.space);
+  const float *lut_gamma_2_2 = babl_trc_get_u8_to_linear (
+                    conversion->conversion.source->format.space->space.trc[0]);
   float *d = (float *) dst;
   long   n = samples;
 
   while (n--)
     {
-      float value = lut_gamma_2_2[space_no][*src++];
+      float value = lut_gamma_2_2[*src++];
 
       *d++ = value;
       *d++ = value;
@@ -497,7 +484,7 @@ init (void)
     babl_component ("Y'"),
     NULL);
 
-  tables_init (babl_space("sRGB"));
+  tables_init ();
 
 #define o(src, dst) \
   babl_conversion_new (src, dst, "linear", conv_ ## src ## _ ## dst, NULL)
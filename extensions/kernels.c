@@ -0,0 +1,610 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Type specialized kernels between every gray and RGB format of the
+ * u8, u16, u32, half, float and double types - with and without alpha,
+ * with separate or associated alpha, linear, nonlinear and perceptual - and
+ * linear RGBA float.
+ *
+ * The kernels are stamped out by the macros at the end of this file, with
+ * the number of components, the kind of alpha and the TRC known at compile
+ * time. They unpack or pack whole runs of pixels and apply TRCs through
+ * the buffer functions of the TRCs, or for u8 and u16 through the shared
+ * lookup tables of the TRCs. This gives path search a path of at
+ * most two fast steps between any two of these formats where no hand
+ * written conversion exists, instead of falling back to the reference
+ * fish.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "babl-internal.h"
+#include "extensions/util.h"
+#include "base/util.h"
+
+#define ALPHA_NONE        0
+#define ALPHA_SEPARATE    1
+#define ALPHA_ASSOCIATED  2
+
+#define TRC_LINEAR        0
+#define TRC_NONLINEAR     1  /* the TRCs of the space */
+#define TRC_PERCEPTUAL    2  /* the sRGB TRC */
+
+static const Babl *perceptual_trcs[3];
+
+
+/* loading and storing of the types, from and to floats */
+
+#define SIZE_u8      1
+#define SIZE_u16     2
+#define SIZE_u32     4
+#define SIZE_half    2
+#define SIZE_float   4
+#define SIZE_double  8
+
+static inline float
+half_to_float (uint16_t half)
+{
+  union { float f; uint32_t i; } u;
+  uint32_t sign     = (uint32_t) (half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+
+  if (exponent == 0x1f)
+    u.i = sign | 0x7f800000 | (mantissa << 13);
+  else if (exponent)
+    u.i = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else
+    {
+      u.f = mantissa * (1.0f / 16777216.0f);
+      u.i |= sign;
+    }
+  return u.f;
+}
+
+/* rounds to nearest even */
+static inline uint16_t
+float_to_half (float value)
+{
+  union { float f; uint32_t i; } u, denormal_magic;
+  uint32_t sign;
+  uint16_t half;
+
+  denormal_magic.i = ((127 - 15) + (23 - 10) + 1) << 23;
+
+  u.f   = value;
+  sign  = u.i & 0x80000000u;
+  u.i  ^= sign;
+
+  if (u.i >= (127 + 16) << 23)
+    half = u.i > 0x7f800000u ? 0x7e00 : 0x7c00;
+  else if (u.i < (113 << 23))
+    {
+      u.f += denormal_magic.f;
+      half = u.i - denormal_magic.i;
+    }
+  else
+    {
+      uint32_t odd = (u.i >> 13) & 1;
+
+      u.i -= 112u << 23;
+      u.i += 0xfff + odd;
+      half = u.i >> 13;
+    }
+  return half | (sign >> 16);
+}
+
+static inline void
+load_u8 (const unsigned char *src,
+         float               *c,
+         int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = src[i] * (1.0f / 255.0f);
+}
+
+static inline void
+load_u16 (const unsigned char *src,
+          float               *c,
+          int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = ((const uint16_t *) src)[i] * (1.0f / 65535.0f);
+}
+
+static inline void
+load_u32 (const unsigned char *src,
+          float               *c,
+          int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = ((const uint32_t *) src)[i] * (1.0 / 4294967295.0);
+}
+
+static inline void
+load_half (const unsigned char *src,
+           float               *c,
+           int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = half_to_float (((const uint16_t *) src)[i]);
+}
+
+static inline void
+load_float (const unsigned char *src,
+            float               *c,
+            int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = ((const float *) src)[i];
+}
+
+static inline void
+load_double (const unsigned char *src,
+             float               *c,
+             int                  components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    c[i] = ((const double *) src)[i];
+}
+
+/* integers are clamped, NaN becomes 0 */
+static inline void
+store_u8 (unsigned char *dst,
+          const float   *c,
+          int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    {
+      float v = c[i];
+      dst[i] = !(v > 0.0f) ? 0 : v >= 1.0f ? 255 : v * 255.0f + 0.5f;
+    }
+}
+
+static inline void
+store_u16 (unsigned char *dst,
+           const float   *c,
+           int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    {
+      float v = c[i];
+      ((uint16_t *) dst)[i] = !(v > 0.0f) ? 0 :
+                              v >= 1.0f ? 65535 : v * 65535.0f + 0.5f;
+    }
+}
+
+static inline void
+store_u32 (unsigned char *dst,
+           const float   *c,
+           int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    {
+      double v = c[i];
+      ((uint32_t *) dst)[i] = !(v > 0.0) ? 0 :
+                              v >= 1.0 ? 4294967295u : v * 4294967295.0 + 0.5;
+    }
+}
+
+static inline void
+store_half (unsigned char *dst,
+            const float   *c,
+            int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    ((uint16_t *) dst)[i] = float_to_half (c[i]);
+}
+
+static inline void
+store_float (unsigned char *dst,
+             const float   *c,
+             int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    ((float *) dst)[i] = c[i];
+}
+
+static inline void
+store_double (unsigned char *dst,
+              const float   *c,
+              int            components)
+{
+  int i;
+  for (i = 0; i < components; i++)
+    ((double *) dst)[i] = c[i];
+}
+
+
+/* the passes over pixels between the components of a model and linear RGBA,
+ * with pixels 4 floats apart
+ */
+
+#define KERNEL_TILE  256
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+static inline const Babl **
+kernel_trcs (const Babl *space,
+             int         trc)
+{
+  if (trc == TRC_PERCEPTUAL)
+    return perceptual_trcs;
+  return (void *) space->space.trc;
+}
+
+static inline void
+trc_to_linear (const Babl **trcs,
+               float       *rgba,
+               int          colors,
+               long         samples)
+{
+  int c;
+
+  if (colors == 1 || (trcs[0] == trcs[1] && trcs[1] == trcs[2]))
+    {
+      babl_trc_to_linear_buf (trcs[0], rgba, rgba, 4, 4, colors, samples);
+      return;
+    }
+  for (c = 0; c < colors; c++)
+    babl_trc_to_linear_buf (trcs[c], rgba + c, rgba + c, 4, 4, 1, samples);
+}
+
+static inline void
+trc_from_linear (const Babl **trcs,
+                 float       *rgba,
+                 int          colors,
+                 long         samples)
+{
+  int c;
+
+  if (colors == 1 || (trcs[0] == trcs[1] && trcs[1] == trcs[2]))
+    {
+      babl_trc_from_linear_buf (trcs[0], rgba, rgba, 4, 4, colors, samples);
+      return;
+    }
+  for (c = 0; c < colors; c++)
+    babl_trc_from_linear_buf (trcs[c], rgba + c, rgba + c, 4, 4, 1, samples);
+}
+
+/* u8 and u16 colors of nonlinear formats without associated alpha are
+ * decoded through the shared lookup tables of the TRCs, and u8 colors
+ * encoded through them. The u16 encoding table is too large to beat the
+ * vectorized TRCs on scattered values and is not used here, other types
+ * never take these paths.
+ */
+#define DECODE_TABLES_u8      1
+#define DECODE_TABLES_u16     1
+#define DECODE_TABLES_u32     0
+#define DECODE_TABLES_half    0
+#define DECODE_TABLES_float   0
+#define DECODE_TABLES_double  0
+
+#define ENCODE_TABLES_u8      1
+#define ENCODE_TABLES_u16     0
+#define ENCODE_TABLES_u32     0
+#define ENCODE_TABLES_half    0
+#define ENCODE_TABLES_float   0
+#define ENCODE_TABLES_double  0
+
+#define decode_u32     decode_u8
+#define decode_half    decode_u8
+#define decode_float   decode_u8
+#define decode_double  decode_u8
+#define encode_u16     encode_u8
+#define encode_u32     encode_u8
+#define encode_half    encode_u8
+#define encode_float   encode_u8
+#define encode_double  encode_u8
+
+static inline void
+decode_u8 (const Babl         **trcs,
+           const unsigned char *src,
+           float               *rgba,
+           int                  components,
+           int                  colors,
+           long                 samples)
+{
+  const float *tables[3];
+  long         i;
+  int          c;
+
+  for (c = 0; c < colors; c++)
+    tables[c] = babl_trc_get_u8_to_linear (trcs[c]);
+
+  for (i = 0; i < samples; i++)
+    {
+      for (c = 0; c < colors; c++)
+        rgba[c] = tables[c][src[c]];
+      rgba[3] = colors < components ? src[colors] / 255.0f : 1.0f;
+      src  += components;
+      rgba += 4;
+    }
+}
+
+static inline void
+decode_u16 (const Babl         **trcs,
+            const unsigned char *src_char,
+            float               *rgba,
+            int                  components,
+            int                  colors,
+            long                 samples)
+{
+  const uint16_t *src = (const uint16_t *) src_char;
+  const float    *tables[3];
+  long            i;
+  int             c;
+
+  for (c = 0; c < colors; c++)
+    tables[c] = babl_trc_get_u16_to_linear (trcs[c]);
+
+  for (i = 0; i < samples; i++)
+    {
+      for (c = 0; c < colors; c++)
+        rgba[c] = tables[c][src[c]];
+      rgba[3] = colors < components ? src[colors] / 65535.0f : 1.0f;
+      src  += components;
+      rgba += 4;
+    }
+}
+
+static inline void
+encode_u8 (const Babl   **trcs,
+           const float   *rgba,
+           unsigned char *dst,
+           int            components,
+           int            colors,
+           long           samples)
+{
+  const BablTRCU8Table *tables[3];
+  long                  i;
+  int                   c;
+
+  for (c = 0; c < colors; c++)
+    tables[c] = babl_trc_get_u8_from_linear (trcs[c]);
+
+  for (i = 0; i < samples; i++)
+    {
+      for (c = 0; c < colors; c++)
+        dst[c] = babl_trc_u8_from_linear (tables[c], rgba[c]);
+      if (colors < components)
+        store_u8 (dst + colors, rgba + 3, 1);
+      rgba += 4;
+      dst  += components;
+    }
+}
+
+/* loads pixels, with separate alpha */
+#define UNPACK(type, src, rgba, components, alpha, samples)                  \
+  do {                                                                       \
+    int  colors_ = alpha ? components - 1 : components;                      \
+    long i_;                                                                 \
+    for (i_ = 0; i_ < samples; i_++)                                         \
+      {                                                                      \
+        float *c_ = rgba + i_ * 4;                                           \
+        int    k_;                                                           \
+                                                                             \
+        load_ ## type (src + i_ * components * SIZE_ ## type, c_, components); \
+        if (!alpha)                                                          \
+          c_[3] = 1.0f;                                                      \
+        else if (colors_ == 1)                                               \
+          c_[3] = c_[1];                                                     \
+        if (alpha == ALPHA_ASSOCIATED)                                       \
+          {                                                                  \
+            float recip_alpha = 1.0f / babl_epsilon_for_zero_float (c_[3]);  \
+            for (k_ = 0; k_ < colors_; k_++)                                 \
+              c_[k_] *= recip_alpha;                                         \
+          }                                                                  \
+      }                                                                      \
+  } while (0)
+
+/* stores pixels, associating alpha when needed */
+#define PACK(type, rgba, dst, components, alpha, samples)                    \
+  do {                                                                       \
+    int  colors_ = alpha ? components - 1 : components;                      \
+    long i_;                                                                 \
+    for (i_ = 0; i_ < samples; i_++)                                         \
+      {                                                                      \
+        float *c_ = rgba + i_ * 4;                                           \
+        int    k_;                                                           \
+                                                                             \
+        if (alpha == ALPHA_ASSOCIATED)                                       \
+          {                                                                  \
+            float used_alpha = babl_epsilon_for_zero_float (c_[3]);          \
+            for (k_ = 0; k_ < colors_; k_++)                                 \
+              c_[k_] *= used_alpha;                                          \
+          }                                                                  \
+        if (alpha && colors_ == 1)                                           \
+          c_[1] = c_[3];                                                     \
+        store_ ## type (dst + i_ * components * SIZE_ ## type, c_, components); \
+      }                                                                      \
+  } while (0)
+
+
+/* the kernels */
+
+#define KERNEL_TO_RGBAF(type, model, components, alpha, trc)                 \
+static void                                                                  \
+conv_ ## model ## _ ## type ## _rgbaF_linear (const Babl    *conversion,     \
+                                              unsigned char *src,            \
+                                              unsigned char *dst,            \
+                                              long           samples)        \
+{                                                                            \
+  const Babl **trcs   = kernel_trcs (                                        \
+                          babl_conversion_get_source_space (conversion), trc); \
+  const int    colors = alpha ? components - 1 : components;                 \
+  float       *rgba   = (float *) dst;                                       \
+  long         i;                                                            \
+                                                                             \
+  if (DECODE_TABLES_ ## type && trc != TRC_LINEAR &&                        \
+      alpha != ALPHA_ASSOCIATED)                                             \
+    {                                                                        \
+      decode_ ## type (trcs, src, rgba, components, colors, samples);        \
+    }                                                                        \
+  else                                                                       \
+    {                                                                        \
+      UNPACK (type, src, rgba, components, alpha, samples);                  \
+      if (trc != TRC_LINEAR)                                                 \
+        trc_to_linear (trcs, rgba, colors, samples);                         \
+    }                                                                        \
+                                                                             \
+  if (colors == 1)                                                           \
+    for (i = 0; i < samples; i++)                                            \
+      rgba[i * 4 + 1] = rgba[i * 4 + 2] = rgba[i * 4];                       \
+}
+
+#define KERNEL_FROM_RGBAF(type, model, components, alpha, trc)               \
+static void                                                                  \
+conv_rgbaF_linear_ ## model ## _ ## type (const Babl    *conversion,         \
+                                          unsigned char *src,                \
+                                          unsigned char *dst,                \
+                                          long           samples)            \
+{                                                                            \
+  const Babl  *space  = babl_conversion_get_destination_space (conversion);  \
+  const Babl **trcs   = kernel_trcs (space, trc);                            \
+  const int    colors = alpha ? components - 1 : components;                 \
+  const float  lum_r  = space->space.RGBtoXYZ[3];                            \
+  const float  lum_g  = space->space.RGBtoXYZ[4];                            \
+  const float  lum_b  = space->space.RGBtoXYZ[5];                            \
+  const float *rgba   = (const float *) src;                                 \
+  float        tile[KERNEL_TILE * 4];                                        \
+                                                                             \
+  while (samples > 0)                                                        \
+    {                                                                        \
+      long n = MIN (samples, KERNEL_TILE);                                   \
+      long i;                                                                \
+                                                                             \
+      if (colors == 1)                                                       \
+        for (i = 0; i < n; i++)                                              \
+          {                                                                  \
+            tile[i * 4 + 0] = rgba[i * 4 + 0] * lum_r +                      \
+                              rgba[i * 4 + 1] * lum_g +                      \
+                              rgba[i * 4 + 2] * lum_b;                       \
+            tile[i * 4 + 3] = rgba[i * 4 + 3];                               \
+          }                                                                  \
+      else                                                                   \
+        memcpy (tile, rgba, n * 4 * sizeof (float));                         \
+                                                                             \
+      if (ENCODE_TABLES_ ## type && trc != TRC_LINEAR &&                     \
+          alpha != ALPHA_ASSOCIATED)                                         \
+        {                                                                    \
+          encode_ ## type (trcs, tile, dst, components, colors, n);          \
+        }                                                                    \
+      else                                                                   \
+        {                                                                    \
+          if (trc != TRC_LINEAR)                                             \
+            trc_from_linear (trcs, tile, colors, n);                         \
+          PACK (type, tile, dst, components, alpha, n);                      \
+        }                                                                    \
+                                                                             \
+      rgba    += n * 4;                                                      \
+      dst     += n * components * SIZE_ ## type;                             \
+      samples -= n;                                                          \
+    }                                                                        \
+}
+
+/* the models, with the name of their formats and the macro arguments */
+#define MODELS(M, type)                                                      \
+  M (type, y_linear,        "Y",          1, ALPHA_NONE,       TRC_LINEAR)      \
+  M (type, ya_linear,       "YA",         2, ALPHA_SEPARATE,   TRC_LINEAR)      \
+  M (type, yA_linear,       "YaA",        2, ALPHA_ASSOCIATED, TRC_LINEAR)      \
+  M (type, y_gamma,         "Y'",         1, ALPHA_NONE,       TRC_NONLINEAR)   \
+  M (type, ya_gamma,        "Y'A",        2, ALPHA_SEPARATE,   TRC_NONLINEAR)   \
+  M (type, yA_gamma,        "Y'aA",       2, ALPHA_ASSOCIATED, TRC_NONLINEAR)   \
+  M (type, y_perceptual,    "Y~",         1, ALPHA_NONE,       TRC_PERCEPTUAL)  \
+  M (type, ya_perceptual,   "Y~A",        2, ALPHA_SEPARATE,   TRC_PERCEPTUAL)  \
+  M (type, yA_perceptual,   "Y~aA",       2, ALPHA_ASSOCIATED, TRC_PERCEPTUAL)  \
+  M (type, rgb_linear,      "RGB",        3, ALPHA_NONE,       TRC_LINEAR)      \
+  M (type, rgba_linear,     "RGBA",       4, ALPHA_SEPARATE,   TRC_LINEAR)      \
+  M (type, rgbA_linear,     "RaGaBaA",    4, ALPHA_ASSOCIATED, TRC_LINEAR)      \
+  M (type, rgb_gamma,       "R'G'B'",     3, ALPHA_NONE,       TRC_NONLINEAR)   \
+  M (type, rgba_gamma,      "R'G'B'A",    4, ALPHA_SEPARATE,   TRC_NONLINEAR)   \
+  M (type, rgbA_gamma,      "R'aG'aB'aA", 4, ALPHA_ASSOCIATED, TRC_NONLINEAR)   \
+  M (type, rgb_perceptual,  "R~G~B~",     3, ALPHA_NONE,       TRC_PERCEPTUAL)  \
+  M (type, rgba_perceptual, "R~G~B~A",    4, ALPHA_SEPARATE,   TRC_PERCEPTUAL)  \
+  M (type, rgbA_perceptual, "R~aG~aB~aA", 4, ALPHA_ASSOCIATED, TRC_PERCEPTUAL)
+
+#define TYPES(T) \
+  T (u8)         \
+  T (u16)        \
+  T (u32)        \
+  T (half)       \
+  T (float)      \
+  T (double)
+
+#define KERNELS(type, model, name, components, alpha, trc) \
+  KERNEL_TO_RGBAF (type, model, components, alpha, trc)    \
+  KERNEL_FROM_RGBAF (type, model, components, alpha, trc)
+
+#define TYPE_KERNELS(type) MODELS (KERNELS, type)
+
+TYPES (TYPE_KERNELS)
+
+
+static void
+register_kernels (const char     *name,
+                  BablFuncLinear  to_rgbaF,
+                  BablFuncLinear  from_rgbaF)
+{
+  const Babl *rgbaF_linear = babl_format ("RGBA float");
+  const Babl *format       = babl_format (name);
+
+  if (format == rgbaF_linear)
+    return;
+
+  babl_conversion_new (format, rgbaF_linear, "linear", to_rgbaF, NULL);
+  babl_conversion_new (rgbaF_linear, format, "linear", from_rgbaF, NULL);
+}
+
+#define REGISTER(type, model, name, components, alpha, trc)                  \
+  register_kernels (name " " #type,                                          \
+                    (BablFuncLinear) conv_ ## model ## _ ## type ## _rgbaF_linear, \
+                    (BablFuncLinear) conv_rgbaF_linear_ ## model ## _ ## type);
+
+#define TYPE_REGISTER(type) MODELS (REGISTER, type)
+
+int init (void);
+
+int
+init (void)
+{
+  perceptual_trcs[0] = babl_trc ("sRGB");
+  perceptual_trcs[1] = perceptual_trcs[0];
+  perceptual_trcs[2] = perceptual_trcs[0];
+
+  TYPES (TYPE_REGISTER)
+
+  return 0;
+}
@@ -20,14 +20,61 @@
 #include "config.h"
 
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <pthread.h>
+#include <sys/time.h>
 
-#include "babl.h"
+#include "babl-internal.h"
 
 
 #define N_THREADS               10
 #define N_ITERATIONS_PER_THREAD 100
 
+/* the lookup benchmark runs with 1, 2, 4 .. N_MAX_BENCH_THREADS threads */
+#define N_MAX_BENCH_THREADS     32
+#define N_LOOKUPS_PER_THREAD    200000
+#define N_BENCH_FORMATS         4
+
+static const char *bench_format_names[N_BENCH_FORMATS] =
+{
+  "R'G'B'A u8",
+  "RGBA float",
+  "R'G'B' u16",
+  "Y float"
+};
+
+static const Babl *bench_formats[N_BENCH_FORMATS];
+static const Babl *bench_fishes[N_BENCH_FORMATS][N_BENCH_FORMATS];
+
+/* the reference benchmark converts rows of pixels with reference fishes,
+ * which run the conversions of the models involved one after the other
+ */
+#define N_REFERENCE_PAIRS       3
+#define N_REFERENCE_PIXELS      256
+#define N_REFERENCE_ROWS        400
+
+static const char *reference_pairs[N_REFERENCE_PAIRS][2] =
+{
+  {"CMYK float",  "R'G'B'A u8"},   /* double precision code path */
+  {"Y'A u16",     "R'G'B'A float"}, /* single precision code path */
+  {"R'G'B'A u8",  "Y float"},
+};
+
+static const Babl    *reference_fishes[N_REFERENCE_PAIRS];
+static int            reference_bpp[N_REFERENCE_PAIRS];
+static unsigned char  reference_source[N_REFERENCE_PIXELS * 16];
+static unsigned char  reference_expected[N_REFERENCE_PAIRS][N_REFERENCE_PIXELS * 16];
+
+
+static long
+usecs_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
 
 static void *
 babl_fish_path_stress_test_thread_func (void *not_used)
@@ -48,12 +95,211 @@ babl_fish_path_stress_test_thread_func (void *not_used)
   return NULL;
 }
 
+typedef struct
+{
+  int  by_name;    /* pass format names rather than formats */
+  long mismatches;
+} BenchThread;
+
+static void *
+babl_fish_lookup_bench_thread_func (void *data)
+{
+  BenchThread *bench = data;
+  int          i;
+
+  for (i = 0; i < N_LOOKUPS_PER_THREAD; i++)
+    {
+      int         s = i % N_BENCH_FORMATS;
+      int         d = (i / N_BENCH_FORMATS) % N_BENCH_FORMATS;
+      const Babl *fish;
+
+      if (bench->by_name)
+        fish = babl_fish (bench_format_names[s], bench_format_names[d]);
+      else
+        fish = babl_fish (bench_formats[s], bench_formats[d]);
+
+      if (fish != bench_fishes[s][d])
+        bench->mismatches++;
+    }
+
+  return NULL;
+}
+
+/* returns the number of lookups per second, or -1 if some thread got
+ * a different fish than expected
+ */
+static double
+babl_fish_lookup_bench_run (int n_threads,
+                            int by_name)
+{
+  pthread_t   threads[N_MAX_BENCH_THREADS];
+  BenchThread bench[N_MAX_BENCH_THREADS];
+  long        start = usecs_now ();
+  long        usecs;
+  int         OK = 1;
+  int         i;
+
+  for (i = 0; i < n_threads; i++)
+    {
+      bench[i].by_name    = by_name;
+      bench[i].mismatches = 0;
+      pthread_create (&threads[i], NULL,
+                      babl_fish_lookup_bench_thread_func, &bench[i]);
+    }
+
+  for (i = 0; i < n_threads; i++)
+    {
+      pthread_join (threads[i], NULL);
+      if (bench[i].mismatches)
+        OK = 0;
+    }
+
+  usecs = usecs_now () - start;
+  if (usecs <= 0)
+    usecs = 1;
+
+  if (!OK)
+    return -1;
+  return (double) n_threads * N_LOOKUPS_PER_THREAD * 1000000.0 / usecs;
+}
+
+static int
+babl_fish_lookup_bench (void)
+{
+  int n_threads;
+  int s, d;
+  int OK = 1;
+
+  for (s = 0; s < N_BENCH_FORMATS; s++)
+    bench_formats[s] = babl_format (bench_format_names[s]);
+
+  for (s = 0; s < N_BENCH_FORMATS; s++)
+    for (d = 0; d < N_BENCH_FORMATS; d++)
+      bench_fishes[s][d] = babl_fish (bench_formats[s], bench_formats[d]);
+
+  printf ("threads  lookups/sec  lookups/sec by name\n");
+
+  for (n_threads = 1; n_threads <= N_MAX_BENCH_THREADS; n_threads *= 2)
+    {
+      double by_format = babl_fish_lookup_bench_run (n_threads, 0);
+      double by_name   = babl_fish_lookup_bench_run (n_threads, 1);
+
+      if (by_format < 0 || by_name < 0)
+        OK = 0;
+
+      printf ("%7i  %11.0f  %19.0f\n", n_threads, by_format, by_name);
+    }
+
+  if (!OK)
+    fprintf (stderr, "babl_fish returned different fishes for the same formats\n");
+
+  return OK;
+}
+
+static void *
+babl_fish_reference_bench_thread_func (void *data)
+{
+  BenchThread   *bench = data;
+  unsigned char  destination[N_REFERENCE_PIXELS * 16];
+  int            i;
+
+  for (i = 0; i < N_REFERENCE_ROWS; i++)
+    {
+      int p = i % N_REFERENCE_PAIRS;
+
+      babl_process (reference_fishes[p], reference_source, destination,
+                    N_REFERENCE_PIXELS);
+      if (memcmp (destination, reference_expected[p],
+                  N_REFERENCE_PIXELS * reference_bpp[p]))
+        bench->mismatches++;
+    }
+
+  return NULL;
+}
+
+/* returns the number of pixels per second converted with reference fishes,
+ * or -1 if some thread got different pixels than a single thread does
+ */
+static double
+babl_fish_reference_bench_run (int n_threads)
+{
+  pthread_t   threads[N_MAX_BENCH_THREADS];
+  BenchThread bench[N_MAX_BENCH_THREADS];
+  long        start = usecs_now ();
+  long        usecs;
+  int         OK = 1;
+  int         i;
+
+  for (i = 0; i < n_threads; i++)
+    {
+      bench[i].mismatches = 0;
+      pthread_create (&threads[i], NULL,
+                      babl_fish_reference_bench_thread_func, &bench[i]);
+    }
+
+  for (i = 0; i < n_threads; i++)
+    {
+      pthread_join (threads[i], NULL);
+      if (bench[i].mismatches)
+        OK = 0;
+    }
+
+  usecs = usecs_now () - start;
+  if (usecs <= 0)
+    usecs = 1;
+
+  if (!OK)
+    return -1;
+  return (double) n_threads * N_REFERENCE_ROWS * N_REFERENCE_PIXELS *
+         1000000.0 / usecs;
+}
+
+static int
+babl_fish_reference_bench (void)
+{
+  int n_threads;
+  int i;
+  int OK = 1;
+
+  for (i = 0; i < (int) sizeof (reference_source); i++)
+    reference_source[i] = (i * 7919) >> 3;
+
+  for (i = 0; i < N_REFERENCE_PAIRS; i++)
+    {
+      reference_fishes[i] =
+        babl_fish_reference (babl_format (reference_pairs[i][0]),
+                             babl_format (reference_pairs[i][1]));
+      reference_bpp[i] =
+        babl_format_get_bytes_per_pixel (babl_format (reference_pairs[i][1]));
+      babl_process (reference_fishes[i], reference_source,
+                    reference_expected[i], N_REFERENCE_PIXELS);
+    }
+
+  printf ("threads  reference pixels/sec\n");
+
+  for (n_threads = 1; n_threads <= N_MAX_BENCH_THREADS; n_threads *= 2)
+    {
+      double pixels = babl_fish_reference_bench_run (n_threads);
+
+      if (pixels < 0)
+        OK = 0;
+
+      printf ("%7i  %20.0f\n", n_threads, pixels);
+    }
+
+  if (!OK)
+    fprintf (stderr, "reference fishes converted differently on threads\n");
+
+  return OK;
+}
+
 int
 main (int    argc,
       char **argv)
 {
   pthread_t threads[N_THREADS];
   int       i;
+  int       OK;
 
   babl_init ();
 
@@ -73,10 +319,21 @@ main (int    argc,
                     NULL /* thread_return */);
     }
 
+  /* Then measure how lookups of existing fishes scale with the number
+   * of threads doing them
+   */
+  OK = babl_fish_lookup_bench ();
+
+  /* and how conversions with reference fishes, which do not take any
+   * locks, scale
+   */
+  if (!babl_fish_reference_bench ())
+    OK = 0;
+
   babl_exit ();
 
-  /* If we didn't crash we assume we're OK. We might want to add more
-   * asserts in the test later
+  /* If we didn't crash, and all threads got the same fishes, we assume
+   * we're OK.
    */
-  return 0;
+  return !OK;
 }
@@ -0,0 +1,88 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that babl_fast_fish hands out the same fish each time it is asked
+ * for a pair of formats and a performance, and distinct fishes for
+ * distinct tolerances.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include "babl-internal.h"
+
+static const char *performances[] =
+{
+  "exact", "precise", "fast", "glitch", "0.002"
+};
+#define N_PERFORMANCES (sizeof (performances) / sizeof (performances[0]))
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl *source;
+  const Babl *destination;
+  const Babl *fishes[N_PERFORMANCES];
+  int         OK = 1;
+  int         i, j;
+
+  babl_init ();
+
+  source      = babl_format ("R'G'B'A u8");
+  destination = babl_format ("RGBA float");
+
+  for (i = 0; i < N_PERFORMANCES; i++)
+    {
+      fishes[i] = babl_fast_fish (source, destination, performances[i]);
+      if (!fishes[i])
+        {
+          babl_log ("no %s fish", performances[i]);
+          OK = 0;
+          continue;
+        }
+      if (fishes[i] == babl_fish (source, destination))
+        {
+          babl_log ("%s fish is the default fish", performances[i]);
+          OK = 0;
+        }
+      for (j = 0; j < i; j++)
+        if (fishes[i] == fishes[j])
+          {
+            babl_log ("%s and %s fish are the same",
+                      performances[i], performances[j]);
+            OK = 0;
+          }
+    }
+
+  for (i = 0; i < N_PERFORMANCES; i++)
+    if (babl_fast_fish (source, destination, performances[i]) != fishes[i])
+      {
+        babl_log ("%s fish differs when asked for again", performances[i]);
+        OK = 0;
+      }
+
+  if (babl_fast_fish (source, destination, "0.001") != fishes[2])
+    {
+      babl_log ("\"0.001\" and \"fast\" fish differ");
+      OK = 0;
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
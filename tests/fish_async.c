@@ -0,0 +1,112 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that with BABL_FISH_ASYNC set babl_fish returns a working fish
+ * right away, and that the same fish is upgraded to an optimized path
+ * by the background search.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <math.h>
+#include "babl-internal.h"
+
+#define PIXELS    4096
+#define TOLERANCE 0.01
+
+static unsigned char source_buf [PIXELS * 4];
+static float         reference_buf [PIXELS * 4];
+static float         destination_buf [PIXELS * 4];
+
+static int
+compare (const char *when)
+{
+  int i;
+
+  for (i = 0; i < PIXELS * 4; i++)
+    if (fabs (destination_buf[i] - reference_buf[i]) > TOLERANCE)
+      {
+        babl_log ("%s: %i is %f should be %f",
+                  when, i, destination_buf[i], reference_buf[i]);
+        return 0;
+      }
+  return 1;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl *space;
+  const Babl *source;
+  const Babl *destination;
+  const Babl *fish;
+  int         OK = 1;
+  int         i;
+
+  setenv ("BABL_FISH_ASYNC", "1", 1);
+
+  babl_init ();
+
+  /* a space of our own, to make sure the fish is not in the on-disk cache */
+  space = babl_space_from_chromaticities ("fish-async-test",
+                                          0.3127, 0.3290,
+                                          0.6400, 0.3300,
+                                          0.2100, 0.7100,
+                                          0.1500, 0.0600,
+                                          babl_trc ("sRGB"), NULL, NULL, 0);
+  source      = babl_format_with_space ("R'G'B'A u8", space);
+  destination = babl_format ("RGBA float");
+
+  for (i = 0; i < PIXELS * 4; i++)
+    source_buf[i] = (i * 7 + i / 13) & 0xff;
+
+  babl_process (babl_fish_reference (source, destination),
+                source_buf, reference_buf, PIXELS);
+
+  fish = babl_fish (source, destination);
+  if (fish->class_type != BABL_FISH_PATH)
+    {
+      babl_log ("expected a path fish");
+      OK = 0;
+    }
+
+  /* usable while the search is in progress */
+  babl_process (fish, source_buf, destination_buf, PIXELS);
+  OK &= compare ("before upgrade");
+
+  babl_fish_async_wait ();
+
+  if (fish->fish_path.conversion_list->count == 0)
+    {
+      babl_log ("fish was not upgraded");
+      OK = 0;
+    }
+  if (babl_fish (source, destination) != fish)
+    {
+      babl_log ("lookup returned a different fish");
+      OK = 0;
+    }
+
+  babl_process (fish, source_buf, destination_buf, PIXELS);
+  OK &= compare ("after upgrade");
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,186 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that fishes stored in the on-disk fish cache by babl_exit come
+ * back with the same conversion paths after the next babl_init, both those
+ * of babl_fish and the fast fishes of babl_fast_fish, from the system cache
+ * as well as from the cache of the user layered on top of it.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "babl-internal.h"
+
+#define N_PAIRS 4
+
+static const char *pairs[N_PAIRS][2] =
+{
+  {"R'G'B'A u8",  "RGBA float"},
+  {"RGBA float",  "R'G'B'A u8"},
+  {"R'G'B' u16",  "Y float"},
+  {"YA double",   "R'G'B'A half"},
+};
+
+static void
+describe_path (char       *buf,
+               int         size,
+               const Babl *fish)
+{
+  int j;
+
+  if (fish && fish->class_type == BABL_FISH_PATH)
+    {
+      BablList *list = fish->fish_path.conversion_list;
+
+      for (j = 0; j < list->count; j++)
+        snprintf (buf + strlen (buf), size - strlen (buf), "%s|",
+                  babl_get_name (list->items[j]));
+    }
+  snprintf (buf + strlen (buf), size - strlen (buf), "\n");
+}
+
+/* describes the paths of the fishes for each pair, one line per fish */
+static void
+describe_paths (char *buf,
+                int   size)
+{
+  int i;
+
+  buf[0] = '\0';
+  for (i = 0; i < N_PAIRS; i++)
+    {
+      const Babl *source      = babl_format (pairs[i][0]);
+      const Babl *destination = babl_format (pairs[i][1]);
+
+      describe_path (buf, size, babl_fish (source, destination));
+      describe_path (buf, size, babl_fast_fish (source, destination, "fast"));
+      describe_path (buf, size, babl_fast_fish (source, destination, "glitch"));
+    }
+}
+
+/* runs babl in a child process, since babl can not be initialized again
+ * after babl_exit, and returns the paths of its fishes
+ */
+static int
+describe_paths_in_child (char *buf,
+                         int   size)
+{
+  int   fds[2];
+  int   status;
+  long  length = 0;
+  long  got;
+  pid_t pid;
+
+  if (pipe (fds) != 0)
+    return 0;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      close (fds[0]);
+      babl_init ();
+      describe_paths (buf, size);
+      babl_exit ();
+      if (write (fds[1], buf, strlen (buf)) < 0)
+        _exit (1);
+      _exit (0);
+    }
+
+  close (fds[1]);
+  while ((got = read (fds[0], buf + length, size - 1 - length)) > 0)
+    length += got;
+  buf[length] = '\0';
+  close (fds[0]);
+  return waitpid (pid, &status, 0) == pid && WIFEXITED (status) &&
+         WEXITSTATUS (status) == 0 && length > 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  char  dir[] = "/tmp/babl-fish-cache-XXXXXX";
+  char  system_path[256];
+  char  path[256];
+  char  stored[8192];
+  char  restored[8192];
+  int   OK = 1;
+
+  if (!mkdtemp (dir))
+    return 1;
+  setenv ("XDG_CACHE_HOME", dir, 1);
+  unsetenv ("BABL_INSTRUMENT");
+  snprintf (system_path, sizeof (system_path), "%s/system.bin", dir);
+
+  /* fill a system cache */
+  setenv ("BABL_FISH_DB", "", 1);
+  setenv ("BABL_FISH_CACHE", system_path, 1);
+  if (!describe_paths_in_child (stored, sizeof (stored)))
+    {
+      babl_log ("filling the system cache failed");
+      OK = 0;
+    }
+
+  /* the fishes come from the system cache, and are stored in the then
+   * empty cache of the user
+   */
+  setenv ("BABL_FISH_DB", system_path, 1);
+  unsetenv ("BABL_FISH_CACHE");
+  if (!describe_paths_in_child (restored, sizeof (restored)))
+    {
+      babl_log ("using the system cache failed");
+      OK = 0;
+    }
+  if (OK && strcmp (stored, restored))
+    {
+      babl_log ("fishes from the system cache differ:\n%s\n%s",
+                stored, restored);
+      OK = 0;
+    }
+
+  /* cached fishes with a pixel count matching the time of startup modulo
+   * 100 are dropped, keep clear of that for our uncounted fishes
+   */
+  while (time (NULL) % 100 == 0 || time (NULL) % 100 == 99)
+    sleep (1);
+
+  setenv ("BABL_FISH_DB", "", 1);
+  babl_init ();
+  describe_paths (restored, sizeof (restored));
+  babl_exit ();
+
+  if (OK && strcmp (stored, restored))
+    {
+      babl_log ("fishes restored from the cache differ:\n%s\n%s",
+                stored, restored);
+      OK = 0;
+    }
+
+  unlink (system_path);
+  snprintf (path, sizeof (path), "%s/babl/babl-fishes-cce210.bin", dir);
+  unlink (path);
+  snprintf (path, sizeof (path), "%s/babl", dir);
+  rmdir (path);
+  rmdir (dir);
+
+  return !OK;
+}
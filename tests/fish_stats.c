@@ -0,0 +1,133 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that the statistics of a fish used from several threads at once
+ * add up to the calls and pixels processed.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include "babl-internal.h"
+
+#define N_THREADS 8
+#define N_CALLS   1000
+#define PIXELS    100
+
+static const Babl *fish;
+
+static void *
+thread_proc (void *data)
+{
+  unsigned char src[PIXELS * 4] = {0, };
+  float         dst[PIXELS * 4];
+  int           i;
+
+  for (i = 0; i < N_CALLS; i++)
+    babl_process (fish, src, dst, PIXELS);
+  babl_process_rows (fish, src, 0, dst, 0, PIXELS, 2);
+  return NULL;
+}
+
+static int
+find_fish (const Babl          *babl,
+           const BablFishStats *stats,
+           void                *user_data)
+{
+  if (babl == fish)
+    {
+      *(int *) user_data = 1;
+      return 1;
+    }
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  pthread_t     threads[N_THREADS];
+  BablFishStats stats;
+  BablFishStats step_stats;
+  const Babl   *conversion;
+  int64_t       step_nanoseconds = 0;
+  int           found = 0;
+  int           OK = 1;
+  int           i;
+
+  setenv ("BABL_STATS", "steps", 1);
+  babl_init ();
+
+  fish = babl_fish ("R'G'B'A u8", "RGBA float");
+
+  for (i = 0; i < N_THREADS; i++)
+    pthread_create (&threads[i], NULL, thread_proc, NULL);
+  for (i = 0; i < N_THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  if (!babl_fish_get_stats (fish, &stats))
+    {
+      babl_log ("statistics are not collected");
+      OK = 0;
+    }
+  if (stats.calls != N_THREADS * (N_CALLS + 1) ||
+      stats.pixels != N_THREADS * (N_CALLS + 2) * PIXELS)
+    {
+      babl_log ("%lli calls %lli pixels, expected %i calls %i pixels",
+                (long long) stats.calls, (long long) stats.pixels,
+                N_THREADS * (N_CALLS + 1), N_THREADS * (N_CALLS + 2) * PIXELS);
+      OK = 0;
+    }
+  if (stats.nanoseconds <= 0)
+    {
+      babl_log ("no time measured");
+      OK = 0;
+    }
+
+  if (fish->class_type == BABL_FISH_PATH)
+    {
+      for (i = 0; babl_fish_get_step_stats (fish, i, &conversion, &step_stats); i++)
+        {
+          if (!conversion || step_stats.calls != stats.calls)
+            {
+              babl_log ("step %i has wrong statistics", i);
+              OK = 0;
+            }
+          step_nanoseconds += step_stats.nanoseconds;
+        }
+      if (i != fish->fish_path.conversion_list->count ||
+          step_nanoseconds <= 0 || step_nanoseconds > stats.nanoseconds)
+        {
+          babl_log ("steps took %lli ns of %lli ns",
+                    (long long) step_nanoseconds,
+                    (long long) stats.nanoseconds);
+          OK = 0;
+        }
+    }
+
+  babl_fish_stats_foreach (find_fish, &found);
+  if (!found)
+    {
+      babl_log ("fish not listed");
+      OK = 0;
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
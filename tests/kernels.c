@@ -0,0 +1,123 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* converts every gray and RGB format of the base types to and from
+ * RGBA float, comparing the results with the reference
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define PIXELS     1000
+#define TOLERANCE  0.01
+
+static const char *types[] = { "u8", "u16", "u32", "half", "float", "double" };
+static const char *models[] = {
+  "Y", "YA", "YaA", "Y'", "Y'A", "Y'aA", "Y~", "Y~A", "Y~aA",
+  "RGB", "RGBA", "RaGaBaA", "R'G'B'", "R'G'B'A", "R'aG'aB'aA",
+  "R~G~B~", "R~G~B~A", "R~aG~aB~aA" };
+
+static double rgba[PIXELS * 4];
+
+/* compares two buffers of format as RGBA double */
+static int
+compare (const Babl *format,
+         void       *a,
+         void       *b)
+{
+  const Babl *rgba_double = babl_format ("RGBA double");
+  double a_rgba[PIXELS * 4];
+  double b_rgba[PIXELS * 4];
+  int i;
+
+  babl_process (babl_fish_reference (format, rgba_double), a, a_rgba, PIXELS);
+  babl_process (babl_fish_reference (format, rgba_double), b, b_rgba, PIXELS);
+
+  for (i = 0; i < PIXELS * 4; i++)
+    if (fabs (a_rgba[i] - b_rgba[i]) > TOLERANCE)
+      return -1;
+  return 0;
+}
+
+static int
+test_format (const Babl *format)
+{
+  const Babl *rgba_float = babl_format ("RGBA float");
+  const Babl *rgba_double = babl_format ("RGBA double");
+  char   pixels[PIXELS * 32];
+  float  result[PIXELS * 4];
+  float  reference[PIXELS * 4];
+  char   packed[PIXELS * 32];
+  char   packed_reference[PIXELS * 32];
+  int    i;
+
+  babl_process (babl_fish_reference (rgba_double, format),
+                rgba, pixels, PIXELS);
+
+  babl_process (babl_fish (format, rgba_float), pixels, result, PIXELS);
+  babl_process (babl_fish_reference (format, rgba_float),
+                pixels, reference, PIXELS);
+  for (i = 0; i < PIXELS * 4; i++)
+    if (fabs (result[i] - reference[i]) > TOLERANCE)
+      {
+        fprintf (stderr, "%s to RGBA float: %i is %f should be %f\n",
+                 babl_get_name (format), i, result[i], reference[i]);
+        return -1;
+      }
+
+  babl_process (babl_fish (rgba_float, format), reference, packed, PIXELS);
+  babl_process (babl_fish_reference (rgba_float, format),
+                reference, packed_reference, PIXELS);
+  if (compare (format, packed, packed_reference))
+    {
+      fprintf (stderr, "RGBA float to %s differs\n", babl_get_name (format));
+      return -1;
+    }
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int OK = 1;
+  int t, m, i;
+
+  babl_init ();
+
+  srandom (1);
+  for (i = 0; i < PIXELS * 4; i++)
+    rgba[i] = (i % 4 == 3) ? 0.25 + random () / (RAND_MAX * 1.5)
+                           : random () / (double) RAND_MAX;
+
+  for (t = 0; t < sizeof (types) / sizeof (types[0]); t++)
+    for (m = 0; m < sizeof (models) / sizeof (models[0]); m++)
+      {
+        char name[64];
+
+        snprintf (name, sizeof (name), "%s %s", models[m], types[t]);
+        if (test_format (babl_format (name)))
+          OK = 0;
+      }
+
+  babl_exit ();
+  return !OK;
+}
@@ -0,0 +1,196 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/* checks that babl_process_planes yields the same result as babl_process
+ * on interleaved pixels, for packed planes, planes with gaps between the
+ * components and planes that are interleaved pixels.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "babl.h"
+
+#define PACKED      0
+#define STRIDED     1
+#define INTERLEAVED 2
+
+typedef struct
+{
+  int            components;
+  int            bpp;
+  int            size[16];
+  int            offset[16];
+  int            pitch[16];
+  unsigned char *plane[16];
+  unsigned char *buffer;
+} Planes;
+
+static void
+planes_new (Planes     *planes,
+            const Babl *format,
+            int         layout,
+            long        n)
+{
+  int i;
+
+  planes->components = babl_format_get_n_components (format);
+  planes->bpp        = babl_format_get_bytes_per_pixel (format);
+  planes->buffer     = calloc (n * 2, planes->bpp);
+
+  for (i = 0; i < planes->components; i++)
+    {
+      const Babl *type = babl_format_get_type (format, i);
+
+      planes->size[i]   = babl_format_get_bytes_per_pixel (babl_format_n (type, 1));
+      planes->offset[i] = i ? planes->offset[i - 1] + planes->size[i - 1] : 0;
+
+      switch (layout)
+        {
+          case PACKED:
+            planes->pitch[i] = planes->size[i];
+            planes->plane[i] = planes->buffer + planes->offset[i] * n;
+            break;
+          case STRIDED:
+            planes->pitch[i] = planes->size[i] * 2;
+            planes->plane[i] = planes->buffer + planes->offset[i] * n * 2;
+            break;
+          case INTERLEAVED:
+            planes->pitch[i] = planes->bpp;
+            planes->plane[i] = planes->buffer + planes->offset[i];
+            break;
+        }
+    }
+}
+
+/* copies between interleaved pixels and the planes */
+static void
+planes_copy (Planes        *planes,
+             unsigned char *pixels,
+             long           n,
+             int            to_planes)
+{
+  long j;
+  int  i;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < planes->components; i++)
+      {
+        unsigned char *plane = planes->plane[i] + j * planes->pitch[i];
+        unsigned char *pixel = pixels + j * planes->bpp + planes->offset[i];
+
+        if (to_planes)
+          memcpy (plane, pixel, planes->size[i]);
+        else
+          memcpy (pixel, plane, planes->size[i]);
+      }
+}
+
+static int
+check (const char *source_format,
+       const char *dest_format,
+       long        n,
+       int         source_layout,
+       int         dest_layout)
+{
+  const Babl    *src_format = babl_format (source_format);
+  const Babl    *dst_format = babl_format (dest_format);
+  const Babl    *fish       = babl_fish (src_format, dst_format);
+  int            src_bpp    = babl_format_get_bytes_per_pixel (src_format);
+  int            dst_bpp    = babl_format_get_bytes_per_pixel (dst_format);
+  unsigned char *pattern    = malloc (n * 4);
+  unsigned char *src        = malloc (n * src_bpp);
+  unsigned char *ref        = calloc (n, dst_bpp);
+  unsigned char *dst        = calloc (n, dst_bpp);
+  Planes         src_planes;
+  Planes         dst_planes;
+  long           i;
+  int            OK = 1;
+
+  /* fill the source with valid pixel data, converted from a u8 pattern */
+  for (i = 0; i < n * 4; i++)
+    pattern[i] = (i * 3 + i / 13) & 0xff;
+  babl_process (babl_fish ("R'G'B'A u8", src_format), pattern, src, n);
+  babl_process (fish, src, ref, n);
+
+  planes_new (&src_planes, src_format, source_layout, n);
+  planes_new (&dst_planes, dst_format, dest_layout, n);
+  planes_copy (&src_planes, src, n, 1);
+
+  if (babl_process_planes (fish,
+                           (const void **) src_planes.plane,
+                           source_layout == PACKED ? NULL : src_planes.pitch,
+                           (void **) dst_planes.plane,
+                           dest_layout == PACKED ? NULL : dst_planes.pitch,
+                           n) != n)
+    OK = 0;
+
+  planes_copy (&dst_planes, dst, n, 0);
+  if (memcmp (ref, dst, n * dst_bpp))
+    OK = 0;
+
+  if (!OK)
+    fprintf (stderr, "%s to %s, layouts %i to %i, %li pixels differs\n",
+             source_format, dest_format, source_layout, dest_layout, n);
+
+  free (src_planes.buffer);
+  free (dst_planes.buffer);
+  free (pattern);
+  free (src);
+  free (ref);
+  free (dst);
+  return OK;
+}
+
+static const char *pairs[][2] =
+{
+  { "RGBA float",  "R'G'B'A u8" },
+  { "R'G'B'A u8",  "RGBA float" },
+  { "R'G'B'A u8",  "R'G'B'A u8" },
+  { "RGBA float",  "RGBA float" },
+  { "R'G'B' u16",  "RGBA half" },
+  { "RGBA float",  "R'G'B'A u16" },
+  { "Y'A u8",      "RGBA double" },
+  { "RGBA double", "Y' u8" },
+};
+
+int
+main (int    argc,
+      char **argv)
+{
+  int OK = 1;
+  int i;
+
+  babl_init ();
+
+  for (i = 0; i < sizeof (pairs) / sizeof (pairs[0]); i++)
+    {
+      int src_layout, dst_layout;
+
+      for (src_layout = PACKED; src_layout <= INTERLEAVED; src_layout++)
+        for (dst_layout = PACKED; dst_layout <= INTERLEAVED; dst_layout++)
+          {
+            OK &= check (pairs[i][0], pairs[i][1], 1, src_layout, dst_layout);
+            OK &= check (pairs[i][0], pairs[i][1], 4099, src_layout, dst_layout);
+          }
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
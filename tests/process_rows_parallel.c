@@ -0,0 +1,99 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that babl_process_rows_parallel yields the same result as
+ * babl_process_rows, both when splitting into bands of rows and when
+ * splitting single wide rows.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "babl.h"
+
+static int
+check (const char *source_format,
+       const char *dest_format,
+       long        width,
+       int         rows)
+{
+  const Babl    *fish       = babl_fish (source_format, dest_format);
+  int            src_bpp    = babl_format_get_bytes_per_pixel (babl_format (source_format));
+  int            dst_bpp    = babl_format_get_bytes_per_pixel (babl_format (dest_format));
+  int            src_stride = width * src_bpp + 12;
+  int            dst_stride = width * dst_bpp + 4;
+  unsigned char *src        = calloc ((size_t) src_stride, rows);
+  unsigned char *pattern    = malloc (width * 4);
+  unsigned char *ref        = calloc ((size_t) dst_stride, rows);
+  unsigned char *dst        = calloc ((size_t) dst_stride, rows);
+  long           i;
+  int            OK = 1;
+
+  /* fill the source with valid pixel data, converted from a u8 pattern */
+  for (i = 0; i < rows; i++)
+    {
+      long j;
+      for (j = 0; j < width * 4; j++)
+        pattern[j] = (i * 7 + j * 3 + j / 13) & 0xff;
+      babl_process (babl_fish ("R'G'B'A u8", source_format),
+                    pattern, src + i * src_stride, width);
+    }
+
+  babl_process_rows (fish, src, src_stride, ref, dst_stride, width, rows);
+  if (babl_process_rows_parallel (fish, src, src_stride,
+                                  dst, dst_stride, width, rows) != width * rows)
+    OK = 0;
+
+  for (i = 0; OK && i < rows; i++)
+    if (memcmp (ref + i * dst_stride, dst + i * dst_stride, width * dst_bpp))
+      OK = 0;
+
+  if (!OK)
+    fprintf (stderr, "%s to %s %lix%i differs\n",
+             source_format, dest_format, width, rows);
+
+  free (pattern);
+  free (src);
+  free (ref);
+  free (dst);
+  return OK;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int OK = 1;
+
+  /* make sure the worker pool is exercised on single core machines */
+  setenv ("BABL_THREADS", "4", 0);
+
+  babl_init ();
+
+  OK &= check ("R'G'B'A u8", "RGBA float", 1024, 256);
+  OK &= check ("R'G'B' u8", "R'G'B'A u16", 777, 333);
+  OK &= check ("RGBA float", "R'G'B'A u8", 300000, 1);
+  OK &= check ("R'G'B'A u16", "YA double", 100003, 2);
+  OK &= check ("RGBA float", "RGBA float", 512, 512);
+  OK &= check ("R'G'B'A u8", "RGBA float", 64, 4);
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,168 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks every conversion registered between float formats of sRGB and
+ * other RGB spaces - the scalar, sse2 and avx2 ones alike - against the
+ * reference, with pixel counts around the blocks and tiles converted at a
+ * time, and in place
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define PIXELS    1000
+#define TOLERANCE 0.0001
+
+static const char *spaces[]  = { "Apple", "ProPhoto", "Rec2020" };
+static const char *formats[] = { "RGBA float", "R'G'B'A float", "RGB float" };
+static const long  counts[]  = { 1, 7, 8, 9, 17, 255, 256, 257, PIXELS };
+
+typedef struct
+{
+  const Babl *source;
+  const Babl *destination;
+  int         tested;
+  int         bad;
+} Check;
+
+static int
+check_counts (const Babl  *conversion,
+              Check       *check,
+              const float *src,
+              const float *ref)
+{
+  int    components = babl_format_get_n_components (check->destination);
+  float *dst        = malloc ((PIXELS + 1) * 4 * sizeof (float));
+  int    bad        = 0;
+  int    c, i;
+
+  for (c = 0; c < sizeof (counts) / sizeof (counts[0]) && !bad; c++)
+    {
+      long n = counts[c];
+
+      /* the pixels after the last converted are left alone, and
+       * converting in place gives the same
+       */
+      for (i = 0; i < (PIXELS + 1) * components; i++)
+        dst[i] = -1000.0f;
+      conversion->conversion.function.linear (conversion, (void *) src,
+                                              (void *) dst, n,
+                                              conversion->conversion.data);
+      if (dst[n * components] != -1000.0f)
+        {
+          printf ("%s: wrote past %li pixels\n", babl_get_name (conversion), n);
+          bad++;
+        }
+
+      for (i = 0; i < n * components && !bad; i++)
+        if (!(fabsf (dst[i] - ref[i]) <= TOLERANCE * fmaxf (fabsf (ref[i]), 1.0f)))
+          {
+            printf ("%s: %li pixels, pixel %i component %i is %f should be %f\n",
+                    babl_get_name (conversion), n, i / components,
+                    i % components, dst[i], ref[i]);
+            bad++;
+          }
+
+      memcpy (dst, src, n * components * sizeof (float));
+      conversion->conversion.function.linear (conversion, (void *) dst,
+                                              (void *) dst, n,
+                                              conversion->conversion.data);
+      for (i = 0; i < n * components && !bad; i++)
+        if (!(fabsf (dst[i] - ref[i]) <= TOLERANCE * fmaxf (fabsf (ref[i]), 1.0f)))
+          {
+            printf ("%s: %li pixels in place, pixel %i component %i is %f "
+                    "should be %f\n", babl_get_name (conversion), n,
+                    i / components, i % components, dst[i], ref[i]);
+            bad++;
+          }
+    }
+
+  free (dst);
+  return bad;
+}
+
+static int
+each_conversion (Babl *babl,
+                 void *data)
+{
+  Check *check = data;
+  float *src;
+  float *ref;
+  int    i;
+
+  if (babl->conversion.source != check->source ||
+      babl->conversion.destination != check->destination)
+    return 0;
+
+  src = malloc (PIXELS * 4 * sizeof (float));
+  ref = malloc (PIXELS * 4 * sizeof (float));
+
+  /* within and out of gamut, with alpha */
+  for (i = 0; i < PIXELS * 4; i++)
+    src[i] = ((i * 37 + i / 4 * 11) % 1301) / 1000.0f - 0.15f;
+
+  babl_process (babl_fish_reference (check->source, check->destination),
+                src, ref, PIXELS);
+
+  check->tested++;
+  check->bad += check_counts (babl, check, src, ref);
+
+  free (src);
+  free (ref);
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int bad = 0;
+  int s, f;
+
+  babl_init ();
+
+  for (s = 0; s < sizeof (spaces) / sizeof (spaces[0]); s++)
+    for (f = 0; f < sizeof (formats) / sizeof (formats[0]); f++)
+      {
+        const Babl *srgb  = babl_format (formats[f]);
+        const Babl *other = babl_format_with_space (formats[f],
+                                                    babl_space (spaces[s]));
+        Check       there = { srgb, other, 0, 0 };
+        Check       back  = { other, srgb, 0, 0 };
+
+        /* the conversions between the spaces are made with the first fish */
+        babl_fish (srgb, other);
+
+        babl_conversion_class_for_each (each_conversion, &there);
+        babl_conversion_class_for_each (each_conversion, &back);
+        if (!there.tested || !back.tested)
+          {
+            printf ("no conversions between %s and %s\n",
+                    babl_get_name (srgb), babl_get_name (other));
+            bad++;
+          }
+        bad += there.bad + back.bad;
+      }
+
+  babl_exit ();
+
+  return bad != 0;
+}
@@ -0,0 +1,93 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks that 8bit conversions between RGB spaces are within one of the
+ * reference, with pixel counts that are not a multiple of the blocks
+ * converted at a time
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define PIXELS  (64 * 64 * 64 + 61)
+
+static const char *spaces[] = { "Apple", "Adobish", "ProPhoto", "Rec2020" };
+static const char *formats[] = { "R'G'B'A u8", "R'G'B' u8" };
+
+static int
+test_conversion (const Babl    *source,
+                 const Babl    *destination,
+                 unsigned char *src,
+                 unsigned char *dst,
+                 unsigned char *ref)
+{
+  int  bpp = babl_format_get_bytes_per_pixel (destination);
+  long i;
+
+  babl_process (babl_fish (source, destination), src, dst, PIXELS);
+  babl_process (babl_fish_reference (source, destination), src, ref, PIXELS);
+
+  for (i = 0; i < PIXELS * bpp; i++)
+    {
+      if (abs (dst[i] - ref[i]) > 1)
+        {
+          fprintf (stderr, "%s to %s: pixel %li component %li is %i should be %i\n",
+                   babl_get_name (source), babl_get_name (destination),
+                   i / bpp, i % bpp, dst[i], ref[i]);
+          return -1;
+        }
+    }
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  unsigned char *src = malloc (PIXELS * 4);
+  unsigned char *dst = malloc (PIXELS * 4);
+  unsigned char *ref = malloc (PIXELS * 4);
+  int OK = 1;
+  int s, f;
+  long i;
+
+  babl_init ();
+
+  for (i = 0; i < PIXELS * 4; i++)
+    src[i] = (i * 4 + i / 4 * 3 + i / 1024) & 255;
+
+  for (s = 0; s < sizeof (spaces) / sizeof (spaces[0]); s++)
+    for (f = 0; f < sizeof (formats) / sizeof (formats[0]); f++)
+      {
+        const Babl *srgb  = babl_format (formats[f]);
+        const Babl *other = babl_format_with_space (formats[f],
+                                                    babl_space (spaces[s]));
+
+        if (test_conversion (srgb, other, src, dst, ref) ||
+            test_conversion (other, srgb, src, dst, ref))
+          OK = 0;
+      }
+
+  babl_exit ();
+  free (src);
+  free (dst);
+  free (ref);
+  return !OK;
+}
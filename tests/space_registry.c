@@ -0,0 +1,251 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* registers more spaces than the old fixed tables held, made from
+ * parameters and imported from ICC profiles, and checks that the same
+ * parameters and the same profiles give the same spaces again, and that
+ * differing curves are kept apart
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define SPACES   300
+#define PROFILES 200
+
+static void
+write_u32 (unsigned char *data,
+           unsigned int   value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static unsigned int
+read_u32 (const unsigned char *data)
+{
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/* a profile of the primaries of Adobish with the TRCs replaced by an ICC
+ * parametric curve of type, with 1 or 5 params
+ */
+static unsigned char *
+para_profile (int           type,
+              const double *params,
+              int          *ret_length)
+{
+  int            n_params = type == 0 ? 1 : 5;
+  int            size     = 12 + 4 * n_params;
+  int            length;
+  const char    *icc;
+  unsigned char *data;
+  unsigned int   tags;
+  unsigned int   t;
+  int            i;
+
+  icc  = babl_space_to_icc (babl_space ("Adobish"), "para", NULL, 0, &length);
+  data = calloc (length + size, 1);
+  memcpy (data, icc, length);
+
+  memcpy (data + length, "para", 4);
+  data[length + 9] = type;
+  for (i = 0; i < n_params; i++)
+    write_u32 (data + length + 12 + 4 * i, (int) (params[i] * 65536.0 + 0.5));
+  write_u32 (data, length + size);
+
+  tags = read_u32 (data + 128);
+  for (t = 0; t < tags; t++)
+    {
+      unsigned char *tag = data + 132 + 12 * t;
+
+      if (!memcmp (tag + 1, "TRC", 3))
+        {
+          write_u32 (tag + 4, length);
+          write_u32 (tag + 8, size);
+        }
+    }
+
+  *ret_length = length + size;
+  return data;
+}
+
+static const Babl *
+import (const unsigned char *data,
+        int                  length)
+{
+  const char *error = NULL;
+  const Babl *space;
+
+  space = babl_space_from_icc ((const char *) data, length,
+                               BABL_ICC_INTENT_RELATIVE_COLORIMETRIC, &error);
+  if (!space)
+    printf ("failed to read profile: %s\n", error);
+  return space;
+}
+
+static const Babl *
+chromaticities (int i)
+{
+  return babl_space_from_chromaticities (NULL,
+                                         0.3127, 0.3290,
+                                         0.6400 - i * 0.0001, 0.3300,
+                                         0.3000, 0.6000,
+                                         0.1500, 0.0600,
+                                         babl_trc ("sRGB"),
+                                         babl_trc ("sRGB"),
+                                         babl_trc ("sRGB"),
+                                         BABL_SPACE_FLAG_NONE);
+}
+
+static int
+check_chromaticities (void)
+{
+  static const Babl *spaces[SPACES];
+  int                bad = 0;
+  int                i;
+
+  for (i = 0; i < SPACES; i++)
+    {
+      spaces[i] = chromaticities (i);
+      if (!spaces[i] || (i && spaces[i] == spaces[i - 1]))
+        {
+          printf ("space %i: not a new space\n", i);
+          return 1;
+        }
+    }
+
+  for (i = 0; i < SPACES; i++)
+    {
+      if (chromaticities (i) != spaces[i])
+        {
+          if (bad++ < 4)
+            printf ("space %i: the same chromaticities gave a new space\n", i);
+        }
+      if (babl_space (babl_get_name (spaces[i])) != spaces[i])
+        {
+          if (bad++ < 4)
+            printf ("space %i: not found by name %s\n", i,
+                    babl_get_name (spaces[i]));
+        }
+    }
+  return bad;
+}
+
+static int
+check_profiles (void)
+{
+  static const Babl *spaces[PROFILES];
+  int                bad = 0;
+  int                i;
+
+  for (i = 0; i < PROFILES; i++)
+    {
+      double         gamma = 1.5 + i * 0.005;
+      int            length;
+      unsigned char *data  = para_profile (0, &gamma, &length);
+      unsigned char *copy;
+      const char    *icc;
+      int            icc_length;
+
+      spaces[i] = import (data, length);
+      if (!spaces[i] || (i && spaces[i] == spaces[i - 1]))
+        {
+          printf ("profile %i: not a new space\n", i);
+          free (data);
+          return bad + 1;
+        }
+
+      /* from another buffer, the way a profile is read again */
+      copy = malloc (length);
+      memcpy (copy, data, length);
+      if (import (copy, length) != spaces[i])
+        {
+          if (bad++ < 4)
+            printf ("profile %i: the same profile gave a new space\n", i);
+        }
+
+      icc = babl_space_get_icc (spaces[i], &icc_length);
+      if (icc_length != length || memcmp (icc, data, length))
+        {
+          if (bad++ < 4)
+            printf ("profile %i: the space has another profile\n", i);
+        }
+      free (copy);
+      free (data);
+    }
+  return bad;
+}
+
+/* formula sRGB curves with the same gamma and different params */
+static int
+check_formula_srgb (void)
+{
+  const double   rec709[5]  = { 1.0 / 0.45, 1.0 / 1.099, 0.099 / 1.099,
+                                1.0 / 4.5, 0.081 };
+  const double   steeper[5] = { 1.0 / 0.45, 1.0 / 1.099, 0.099 / 1.099,
+                                1.0 / 3.5, 0.061 };
+  unsigned char *data[2];
+  int            length[2];
+  const Babl    *space[2];
+  int            bad = 0;
+
+  data[0]  = para_profile (3, rec709, &length[0]);
+  data[1]  = para_profile (3, steeper, &length[1]);
+  space[0] = import (data[0], length[0]);
+  space[1] = import (data[1], length[1]);
+
+  if (!space[0] || !space[1])
+    bad++;
+  else if (space[0]->space.trc[0] == space[1]->space.trc[0] ||
+           space[0] == space[1])
+    {
+      printf ("formula sRGB curves with different params were merged\n");
+      bad++;
+    }
+  else if (import (data[0], length[0]) != space[0])
+    {
+      printf ("formula sRGB profile gave a new space\n");
+      bad++;
+    }
+
+  free (data[0]);
+  free (data[1]);
+  return bad;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int bad = 0;
+
+  babl_init ();
+
+  bad += check_chromaticities ();
+  bad += check_profiles ();
+  bad += check_formula_srgb ();
+
+  babl_exit ();
+
+  return bad != 0;
+}
@@ -0,0 +1,241 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* makes spaces, from parameters and from a profile, converts with them and
+ * releases them again, checking that the formats, conversions and fishes
+ * made for them go away with the last reference, that a space made again
+ * converts the same, and that sRGB is left alone
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define PIXELS 64
+
+typedef struct
+{
+  int formats;
+  int conversions;
+  int fishes;
+} Counts;
+
+static int
+count (Babl *babl,
+       void *data)
+{
+  (*(int *) data)++;
+  return 0;
+}
+
+static int
+in_other_space (const Babl *babl)
+{
+  return babl->class_type == BABL_FORMAT &&
+         babl->format.space != babl_space ("sRGB");
+}
+
+/* the fishes between formats of sRGB made when measuring conversions for
+ * the paths searched depend on timing, only the others are counted
+ */
+static int
+count_fish (Babl *babl,
+            void *data)
+{
+  if (in_other_space (babl->fish.source) ||
+      in_other_space (babl->fish.destination))
+    (*(int *) data)++;
+  return 0;
+}
+
+static Counts
+get_counts (void)
+{
+  Counts counts = { 0, 0, 0 };
+
+  babl_format_class_for_each (count, &counts.formats);
+  babl_conversion_class_for_each (count, &counts.conversions);
+  babl_db_each (babl_fish_db (), count_fish, &counts.fishes);
+  return counts;
+}
+
+static const Babl *
+make_space (void)
+{
+  return babl_space_from_chromaticities (NULL,
+                                         0.3127, 0.3290,
+                                         0.6700, 0.3300,
+                                         0.2100, 0.7100,
+                                         0.1400, 0.0800,
+                                         babl_trc ("2.2"),
+                                         babl_trc ("2.2"),
+                                         babl_trc ("2.2"),
+                                         BABL_SPACE_FLAG_NONE);
+}
+
+/* converts u8 pixels of space to sRGB and back through float */
+static void
+convert (const Babl    *space,
+         unsigned char *out)
+{
+  unsigned char in[PIXELS * 4];
+  float         linear[PIXELS * 4];
+  int           i;
+
+  for (i = 0; i < PIXELS * 4; i++)
+    in[i] = i * 7;
+
+  babl_process (babl_fish (babl_format_with_space ("R'G'B'A u8", space),
+                           babl_format ("RGBA float")),
+                in, linear, PIXELS);
+  babl_process (babl_fish (babl_format ("RGBA float"),
+                           babl_format_with_space ("R'G'B'A u8", space)),
+                linear, out, PIXELS);
+  babl_process (babl_fish (babl_format_with_space ("R'G'B' u8", space),
+                           babl_format ("R'G'B' u8")),
+                in, out + PIXELS * 4, PIXELS);
+}
+
+static const Babl *
+import (const char *profile,
+        int         length)
+{
+  const char *error = NULL;
+  const Babl *space;
+
+  space = babl_space_from_icc (profile, length,
+                               BABL_ICC_INTENT_RELATIVE_COLORIMETRIC, &error);
+  if (!space)
+    {
+      printf ("failed to read profile: %s\n", error);
+      exit (1);
+    }
+  return space;
+}
+
+static int
+check_counts (const char   *when,
+              const Counts *expected)
+{
+  Counts counts = get_counts ();
+
+  if (counts.formats     != expected->formats ||
+      counts.conversions != expected->conversions ||
+      counts.fishes      != expected->fishes)
+    {
+      printf ("%s: %i formats, %i conversions and %i fishes, "
+              "expected %i, %i and %i\n", when,
+              counts.formats, counts.conversions, counts.fishes,
+              expected->formats, expected->conversions, expected->fishes);
+      return 1;
+    }
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  unsigned char first[PIXELS * 7];
+  unsigned char again[PIXELS * 7];
+  const Babl   *space;
+  const char   *icc;
+  char         *profile;
+  int           length;
+  char          name[512];
+  Counts        baseline;
+  int           bad = 0;
+
+  babl_init ();
+
+  space   = make_space ();
+  icc     = babl_space_get_icc (space, &length);
+  profile = malloc (length);
+  memcpy (profile, icc, length);
+  babl_space_unref (space);
+
+  /* the fishes of sRGB made on the way are there before the baseline */
+  space = import (profile, length);
+  convert (space, first);
+  babl_space_unref (space);
+  baseline = get_counts ();
+
+  /* the profile is read as a space of its own, the second time with a
+   * reference added to it
+   */
+  space = import (profile, length);
+  snprintf (name, sizeof (name), "%s", babl_get_name (space));
+  convert (space, first);
+  if (import (profile, length) != space)
+    {
+      printf ("the profile gave another space the second time\n");
+      bad++;
+    }
+
+  babl_space_unref (space);
+  if (babl_space (name) != space)
+    {
+      printf ("the space went away with a reference left\n");
+      bad++;
+    }
+  convert (space, again);
+
+  babl_space_unref (space);
+  if (babl_space (name))
+    {
+      printf ("the space is still there after the last reference\n");
+      bad++;
+    }
+  bad += check_counts ("after the last reference", &baseline);
+
+  space = import (profile, length);
+  convert (space, again);
+  if (memcmp (first, again, sizeof (first)))
+    {
+      printf ("the space made again converts differently\n");
+      bad++;
+    }
+  babl_space_unref (space);
+  bad += check_counts ("after making the space again", &baseline);
+  free (profile);
+
+  if (!babl_space ("sRGB"))
+    {
+      printf ("sRGB went away\n");
+      bad++;
+    }
+  else
+    {
+      unsigned char srgb[4] = { 0, 128, 255, 255 };
+      float         linear[4];
+
+      babl_process (babl_fish ("R'G'B'A u8", "RGBA float"), srgb, linear, 1);
+      if (linear[0] != 0.0f || linear[2] != 1.0f ||
+          linear[1] < 0.215f || linear[1] > 0.217f)
+        {
+          printf ("sRGB converts wrong: %f %f %f\n",
+                  linear[0], linear[1], linear[2]);
+          bad++;
+        }
+    }
+
+  babl_exit ();
+
+  return bad != 0;
+}
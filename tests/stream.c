@@ -0,0 +1,110 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/* checks that converting with a BablStream, fed with chunks of random
+ * sizes into destinations of random sizes, yields the same bytes as
+ * babl_process.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "babl.h"
+
+#define PIXELS 10007
+
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+
+static int
+check (const char *source_format,
+       const char *dest_format,
+       int         max_chunk)
+{
+  const Babl    *fish     = babl_fish (source_format, dest_format);
+  int            src_bpp  = babl_format_get_bytes_per_pixel (babl_format (source_format));
+  int            dst_bpp  = babl_format_get_bytes_per_pixel (babl_format (dest_format));
+  unsigned char *pattern  = malloc (PIXELS * 4);
+  unsigned char *src      = malloc (PIXELS * src_bpp);
+  unsigned char *ref      = malloc (PIXELS * dst_bpp);
+  unsigned char *dst      = calloc (PIXELS, dst_bpp);
+  BablStream    *stream   = babl_stream_new (fish);
+  long           consumed = 0;
+  long           written  = 0;
+  long           i;
+  int            OK = 1;
+
+  for (i = 0; i < PIXELS * 4; i++)
+    pattern[i] = (i * 3 + i / 13) & 0xff;
+  babl_process (babl_fish ("R'G'B'A u8", source_format), pattern, src, PIXELS);
+  babl_process (fish, src, ref, PIXELS);
+
+  for (i = 0; i < (1 << 24) && written < PIXELS * dst_bpp; i++)
+    {
+      long source_length = rand () % max_chunk;
+      long dest_length   = rand () % max_chunk;
+      long dest_written  = -1;
+
+      source_length = MIN (source_length, PIXELS * src_bpp - consumed);
+      dest_length   = MIN (dest_length, PIXELS * dst_bpp - written);
+
+      consumed += babl_stream_process (stream, src + consumed, source_length,
+                                       dst + written, dest_length,
+                                       &dest_written);
+      written  += dest_written;
+    }
+
+  if (consumed != PIXELS * src_bpp || written != PIXELS * dst_bpp ||
+      babl_stream_get_pending (stream) != 0 ||
+      memcmp (ref, dst, PIXELS * dst_bpp))
+    {
+      fprintf (stderr, "%s to %s in chunks of up to %i differs, "
+                       "consumed %li written %li\n",
+               source_format, dest_format, max_chunk, consumed, written);
+      OK = 0;
+    }
+
+  babl_stream_free (stream);
+  free (pattern);
+  free (src);
+  free (ref);
+  free (dst);
+  return OK;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int OK = 1;
+  int max_chunk;
+
+  babl_init ();
+
+  for (max_chunk = 2; max_chunk <= 4096; max_chunk *= 4)
+    {
+      OK &= check ("R'G'B' u8", "RGBA float", max_chunk);
+      OK &= check ("RGBA float", "R'G'B' u8", max_chunk);
+      OK &= check ("R'G'B'A u16", "Y'A u8", max_chunk);
+      OK &= check ("RGBA double", "RGBA half", max_chunk);
+      OK &= check ("R'G'B'A u8", "R'G'B'A u8", max_chunk);
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
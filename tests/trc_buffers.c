@@ -0,0 +1,234 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* compares the buffer functions of TRCs with their per value functions,
+ * for packed and strided buffers, in place and not, and checks that the
+ * components that are not to be converted are left alone
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define SAMPLES   4099
+#define TOLERANCE 0.00002
+#define ALPHA     0.25f
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+static float in[SAMPLES * 4];
+static float out[SAMPLES * 4];
+
+static void
+write_u32 (unsigned char *data,
+           unsigned int   value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static unsigned int
+read_u32 (const unsigned char *data)
+{
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/* the TRC of a profile with the Rec. 709 curve written as an ICC
+ * parametric curve, read back as a formula sRGB TRC
+ */
+static const Babl *
+formula_srgb_trc (void)
+{
+  const double   params[5] = { 1.0 / 0.45, 1.0 / 1.099, 0.099 / 1.099,
+                               1.0 / 4.5, 0.081 };
+  int            length;
+  const char    *icc;
+  unsigned char *data;
+  unsigned int   offset;
+  unsigned int   tags;
+  unsigned int   t;
+  const Babl    *space;
+  const char    *error = NULL;
+  int            i;
+
+  icc  = babl_space_to_icc (babl_space ("Adobish"), "formula", NULL, 0,
+                            &length);
+  data = calloc (length + 32, 1);
+  memcpy (data, icc, length);
+
+  offset = length;
+  memcpy (data + offset, "para", 4);
+  data[offset + 9] = 3;
+  for (i = 0; i < 5; i++)
+    write_u32 (data + offset + 12 + 4 * i, (int) (params[i] * 65536.0 + 0.5));
+  write_u32 (data, length + 32);
+
+  tags = read_u32 (data + 128);
+  for (t = 0; t < tags; t++)
+    {
+      unsigned char *tag = data + 132 + 12 * t;
+
+      if (!memcmp (tag + 1, "TRC", 3))
+        {
+          write_u32 (tag + 4, offset);
+          write_u32 (tag + 8, 32);
+        }
+    }
+
+  space = babl_space_from_icc ((char *) data, length + 32,
+                               BABL_ICC_INTENT_RELATIVE_COLORIMETRIC, &error);
+  free (data);
+  if (!space)
+    {
+      printf ("failed to read profile: %s\n", error);
+      return NULL;
+    }
+  return space->space.trc[0];
+}
+
+static int
+check (const Babl *trc,
+       int         to_linear,
+       int         in_place,
+       int         gap,
+       int         components,
+       int         offset)
+{
+  int   count = SAMPLES - 1;
+  int   i;
+  int   bad   = 0;
+  float max   = 0.0f;
+
+  for (i = 0; i < SAMPLES * 4; i++)
+    out[i] = ALPHA;
+
+  if (in_place)
+    memcpy (out, in, sizeof (in));
+
+  if (to_linear)
+    babl_trc_to_linear_buf (trc, (in_place ? out : in) + offset, out + offset,
+                            gap, gap, components, count);
+  else
+    babl_trc_from_linear_buf (trc, (in_place ? out : in) + offset,
+                              out + offset, gap, gap, components, count);
+
+  for (i = 0; i < SAMPLES * 4; i++)
+    {
+      int   pixel     = (i - offset) / gap;
+      int   component = (i - offset) % gap;
+      float expected;
+
+      if (i < offset || pixel >= count || component >= components)
+        expected = in_place ? in[i] : ALPHA;
+      else if (to_linear)
+        expected = babl_trc_to_linear (trc, in[i]);
+      else
+        expected = babl_trc_from_linear (trc, in[i]);
+
+      if (fabsf (out[i] - expected) > TOLERANCE * MAX (fabsf (expected), 1.0f))
+        {
+          if (bad++ < 4)
+            printf ("%s %s %s gap %i components %i: %.9f gave %.9f "
+                    "expected %.9f\n",
+                    babl_get_name (trc), to_linear ? "to" : "from",
+                    in_place ? "in place" : "", gap, components, in[i],
+                    out[i], expected);
+        }
+      max = MAX (max, fabsf (out[i] - expected));
+    }
+
+  if (getenv ("BABL_DEBUG_CONVERSIONS"))
+    printf ("%s %s linear gap %i components %i: %g\n", babl_get_name (trc),
+            to_linear ? "to" : "from", gap, components, max);
+  return bad;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl *trcs[4];
+  int         layouts[][3] = {
+    /* gap, components, offset */
+    { 1, 1, 0 },
+    { 3, 3, 0 },
+    { 4, 3, 0 },
+    { 4, 1, 2 },
+    { 2, 1, 0 },
+    { 3, 1, 1 },
+  };
+  int         bad = 0;
+  int         i, l;
+
+  babl_init ();
+
+  trcs[0] = babl_trc ("sRGB");
+  trcs[1] = babl_trc_gamma (2.2);
+  trcs[2] = babl_trc_gamma (1.8);
+  trcs[3] = formula_srgb_trc ();
+  if (!trcs[3] || trcs[3]->trc.type != BABL_TRC_FORMULA_SRGB)
+    {
+      printf ("no formula sRGB TRC\n");
+      return 1;
+    }
+
+  /* values around and between the ranges of the approximations */
+  srandom (1);
+  for (i = 0; i < SAMPLES * 4; i++)
+    {
+      switch (i % 4)
+        {
+          case 0:
+            in[i] = i / (SAMPLES * 4.0f);
+            break;
+          case 1:
+            in[i] = random () / (float) RAND_MAX * 0.01f;
+            break;
+          case 2:
+            in[i] = random () / (float) RAND_MAX * 4.0f - 0.5f;
+            break;
+          case 3:
+            in[i] = (i / 4) % 7 == 0 ? 1.0f : random () / (float) RAND_MAX;
+            break;
+        }
+    }
+  in[0] = 0.0f;
+  in[4] = 1.0f;
+  in[8] = 0.5f / 255.0f;
+
+  for (i = 0; i < 4; i++)
+    for (l = 0; l < sizeof (layouts) / sizeof (layouts[0]); l++)
+      {
+        int to_linear, in_place;
+
+        for (to_linear = 0; to_linear < 2; to_linear++)
+          for (in_place = 0; in_place < 2; in_place++)
+            bad += check (trcs[i], to_linear, in_place, layouts[l][0],
+                          layouts[l][1], layouts[l][2]);
+      }
+
+  babl_exit ();
+
+  return bad != 0;
+}
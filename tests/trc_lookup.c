@@ -0,0 +1,269 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* compares the lookups of TRCs with their per value functions, with the
+ * lookups made by threads racing for them on first use, and checks that
+ * the buffer functions of a TRC read from a curve of an ICC profile give
+ * exactly the values of its per value functions
+ */
+
+#include "config.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define THREADS   8
+#define SAMPLES   100000
+#define LUT_SIZE  1024
+/* the functions of gamma TRCs step from their polynomials to powf () close
+ * to 1.0, the lookups interpolate over the step
+ */
+#define TOLERANCE 0.00005
+
+typedef struct
+{
+  const Babl          *trc;
+  int                  to_linear;
+  const BablTRCLookup *lookup;
+  float                sum;
+} Job;
+
+static pthread_barrier_t barrier;
+
+static void
+write_u32 (unsigned char *data,
+           unsigned int   value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static unsigned int
+read_u32 (const unsigned char *data)
+{
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/* the TRC of a profile with the CIE L* curve as an ICC curve of LUT_SIZE
+ * entries, read back as a LUT TRC
+ */
+static const Babl *
+lut_trc (void)
+{
+  int            size = 12 + 2 * LUT_SIZE;
+  int            length;
+  const char    *icc;
+  unsigned char *data;
+  unsigned int   tags;
+  unsigned int   t;
+  const Babl    *space;
+  const char    *error = NULL;
+  int            i;
+
+  icc  = babl_space_to_icc (babl_space ("Adobish"), "lut", NULL, 0, &length);
+  data = calloc (length + size, 1);
+  memcpy (data, icc, length);
+
+  memcpy (data + length, "curv", 4);
+  write_u32 (data + length + 8, LUT_SIZE);
+  for (i = 0; i < LUT_SIZE; i++)
+    {
+      double x = i / (LUT_SIZE - 1.0);
+      double y = x > 0.08 ? pow ((x * 100.0 + 16.0) / 116.0, 3.0)
+                          : x * 100.0 / 903.3;
+      int    v = y * 65535.0 + 0.5;
+
+      data[length + 12 + 2 * i]     = v >> 8;
+      data[length + 12 + 2 * i + 1] = v;
+    }
+  write_u32 (data, length + size);
+
+  tags = read_u32 (data + 128);
+  for (t = 0; t < tags; t++)
+    {
+      unsigned char *tag = data + 132 + 12 * t;
+
+      if (!memcmp (tag + 1, "TRC", 3))
+        {
+          write_u32 (tag + 4, length);
+          write_u32 (tag + 8, size);
+        }
+    }
+
+  space = babl_space_from_icc ((char *) data, length + size,
+                               BABL_ICC_INTENT_RELATIVE_COLORIMETRIC, &error);
+  free (data);
+  if (!space)
+    {
+      printf ("failed to read profile: %s\n", error);
+      return NULL;
+    }
+  return space->space.trc[0];
+}
+
+static float
+sample (int i)
+{
+  float value = (i % 1000) / 999.0f;
+
+  /* spread over the exponents, and out of range */
+  if (i % 3 == 1)
+    value = powf (value, 8.0f);
+  else if (i % 3 == 2)
+    value = value * 2.0f - 0.5f;
+  return value;
+}
+
+static void *
+race (void *data)
+{
+  Job *job = data;
+  int  i;
+
+  pthread_barrier_wait (&barrier);
+  if (job->to_linear)
+    job->lookup = babl_trc_get_to_linear_lookup (job->trc);
+  else
+    job->lookup = babl_trc_get_from_linear_lookup (job->trc);
+
+  for (i = 0; i < SAMPLES; i++)
+    job->sum += babl_trc_lookup (job->lookup, sample (i));
+  return NULL;
+}
+
+static int
+check (const Babl *trc,
+       int         to_linear)
+{
+  pthread_t            threads[THREADS];
+  Job                  jobs[THREADS];
+  const BablTRCLookup *lookup;
+  float                max = 0.0f;
+  int                  bad = 0;
+  int                  i;
+
+  for (i = 0; i < THREADS; i++)
+    {
+      jobs[i].trc       = trc;
+      jobs[i].to_linear = to_linear;
+      jobs[i].sum       = 0.0f;
+      pthread_create (&threads[i], NULL, race, &jobs[i]);
+    }
+  for (i = 0; i < THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  lookup = jobs[0].lookup;
+  for (i = 1; i < THREADS; i++)
+    if (jobs[i].lookup != lookup || jobs[i].sum != jobs[0].sum)
+      {
+        printf ("%s %s linear: threads got different lookups\n",
+                babl_get_name (trc), to_linear ? "to" : "from");
+        return 1;
+      }
+
+  for (i = 0; i < SAMPLES; i++)
+    {
+      float value    = sample (i);
+      float expected = to_linear ? babl_trc_to_linear (trc, value)
+                                 : babl_trc_from_linear (trc, value);
+      float got      = babl_trc_lookup (lookup, value);
+      float error    = fabsf (got - expected);
+
+      if (error > TOLERANCE * fmaxf (fabsf (expected), 1.0f))
+        {
+          if (bad++ < 4)
+            printf ("%s %s linear: %.9g gave %.9g expected %.9g\n",
+                    babl_get_name (trc), to_linear ? "to" : "from",
+                    value, got, expected);
+        }
+      max = fmaxf (max, error);
+    }
+
+  if (getenv ("BABL_DEBUG_CONVERSIONS"))
+    printf ("%s %s linear: %g\n", babl_get_name (trc),
+            to_linear ? "to" : "from", max);
+  return bad;
+}
+
+/* the buffer functions of TRCs without vectorized ones call the per value
+ * functions, the lookups are not used for them
+ */
+static int
+check_buffers (const Babl *trc)
+{
+  float in[SAMPLES];
+  float out[SAMPLES];
+  int   bad = 0;
+  int   i;
+
+  for (i = 0; i < SAMPLES; i++)
+    in[i] = sample (i);
+
+  babl_trc_to_linear_buf (trc, in, out, 1, 1, 1, SAMPLES);
+  for (i = 0; i < SAMPLES; i++)
+    if (out[i] != babl_trc_to_linear (trc, in[i]))
+      bad++;
+
+  babl_trc_from_linear_buf (trc, in, out, 1, 1, 1, SAMPLES);
+  for (i = 0; i < SAMPLES; i++)
+    if (out[i] != babl_trc_from_linear (trc, in[i]))
+      bad++;
+
+  if (bad)
+    printf ("%s: %i values of the buffer functions differ from the functions\n",
+            babl_get_name (trc), bad);
+  return bad;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl *trcs[4];
+  int         bad = 0;
+  int         t;
+
+  babl_init ();
+
+  trcs[0] = babl_trc ("sRGB");
+  trcs[1] = babl_trc ("2.2");
+  trcs[2] = babl_trc ("1.8");
+  trcs[3] = lut_trc ();
+  if (!trcs[3] || trcs[3]->trc.type != BABL_TRC_LUT)
+    {
+      printf ("no LUT TRC\n");
+      return 1;
+    }
+
+  pthread_barrier_init (&barrier, NULL, THREADS);
+  for (t = 0; t < 4; t++)
+    {
+      bad += check (trcs[t], 1);
+      bad += check (trcs[t], 0);
+    }
+  bad += check_buffers (trcs[3]);
+  pthread_barrier_destroy (&barrier);
+
+  babl_exit ();
+
+  return bad != 0;
+}
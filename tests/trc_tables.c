@@ -0,0 +1,205 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* checks the shared integer tables of TRCs against the per value
+ * functions: decoding within float precision, and encoding to the code
+ * whose threshold - the lowest value that from_linear (value) * max + 0.5
+ * takes to the code - is the closest below the value. Where the
+ * approximations of the TRCs increase monotonically this is the same
+ * code as rounding from_linear (value) * max gives.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+#define SAMPLES   100000
+#define TOLERANCE 0.00002
+
+/* from_linear (value) * max + 0.5 with the vectorized buffer function
+ * the tables are made with
+ */
+static float
+encode (const Babl *trc,
+        float       value,
+        int         max)
+{
+  float buf[16];
+  int   i;
+
+  for (i = 0; i < 16; i++)
+    buf[i] = value;
+  babl_trc_from_linear_buf (trc, buf, buf, 1, 1, 1, 16);
+  return buf[0] * max + 0.5f;
+}
+
+static int
+check_to_linear (const Babl  *trc,
+                 const float *table,
+                 int          max)
+{
+  int bad = 0;
+  int i;
+
+  for (i = 0; i <= max; i++)
+    {
+      float expected = babl_trc_to_linear (trc, i / (float) max);
+
+      if (fabsf (table[i] - expected) > TOLERANCE * fmaxf (expected, 1.0f))
+        {
+          if (bad++ < 4)
+            printf ("%s %i to linear: %.9f expected %.9f\n",
+                    babl_get_name (trc), i, table[i], expected);
+        }
+    }
+  return bad;
+}
+
+/* the thresholds are where the encoding of the TRC reaches each code, or
+ * the one of the code below where it reaches codes out of order
+ */
+static int
+check_thresholds (const Babl  *trc,
+                  const float *threshold,
+                  int          max)
+{
+  int bad = 0;
+  int code;
+
+  for (code = 1; code <= max; code++)
+    {
+      float t = threshold[code];
+
+      if (t < threshold[code - 1] ||
+          (t > threshold[code - 1] && t < 1.0f &&
+           (encode (trc, t, max) < code ||
+            encode (trc, nextafterf (t, 0.0f), max) >= code)))
+        {
+          if (bad++ < 4)
+            printf ("%s threshold of %i of %i: %.9g encodes to %f\n",
+                    babl_get_name (trc), code, max, t, encode (trc, t, max));
+        }
+    }
+  return bad;
+}
+
+static int
+check_code (const Babl  *trc,
+            float        value,
+            const float *threshold,
+            int          code,
+            int          max)
+{
+  union { float f; uint32_t i; } u = { value };
+
+  /* negative values and NaN encode like 0.0, large values like 1.0 */
+  if (u.i > 0x7f800000u)
+    value = 0.0f;
+  else if (value > 1.0f)
+    value = 1.0f;
+
+  if (code >= 0 && code <= max &&
+      threshold[code] <= value && value < threshold[code + 1])
+    return 0;
+
+  printf ("%s %.9g to %i: %i, from_linear gives %f\n",
+          babl_get_name (trc), u.f, max, code, encode (trc, value, max));
+  return 1;
+}
+
+static int
+check_from_linear (const Babl *trc,
+                   float       value)
+{
+  const BablTRCU8Table  *u8  = babl_trc_get_u8_from_linear (trc);
+  const BablTRCU16Table *u16 = babl_trc_get_u16_from_linear (trc);
+
+  return check_code (trc, value, u8->threshold,
+                     babl_trc_u8_from_linear (u8, value), 255) +
+         check_code (trc, value, u16->threshold,
+                     babl_trc_u16_from_linear (u16, value), 65535);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl *trcs[4];
+  const float special[] = { 0.0f, -0.0f, -1.0f, 1.0f, 2.0f, 1e-30f, 1e-8f,
+                            0.5f, 1.0f - 1e-7f, NAN, INFINITY, -INFINITY };
+  int         bad = 0;
+  int         t, i;
+
+  babl_init ();
+
+  trcs[0] = babl_trc ("sRGB");
+  trcs[1] = babl_trc_gamma (2.2);
+  trcs[2] = babl_trc_gamma (1.8);
+  trcs[3] = babl_trc ("linear");
+
+  srandom (1);
+  for (t = 0; t < 4; t++)
+    {
+      const Babl *trc = trcs[t];
+
+      if (babl_trc_get_u8_to_linear (trc) != babl_trc_get_u8_to_linear (trc) ||
+          babl_trc_get_u16_from_linear (trc) !=
+          babl_trc_get_u16_from_linear (trc))
+        {
+          printf ("%s: tables are not shared\n", babl_get_name (trc));
+          bad++;
+        }
+
+      bad += check_to_linear (trc, babl_trc_get_u8_to_linear (trc), 255);
+      bad += check_to_linear (trc, babl_trc_get_u16_to_linear (trc), 65535);
+      bad += check_thresholds (trc,
+                               babl_trc_get_u8_from_linear (trc)->threshold,
+                               255);
+      bad += check_thresholds (trc,
+                               babl_trc_get_u16_from_linear (trc)->threshold,
+                               65535);
+
+      for (i = 0; i < sizeof (special) / sizeof (special[0]); i++)
+        bad += check_from_linear (trc, special[i]);
+
+      /* the thresholds of the codes, and values around them */
+      for (i = 0; i <= 255; i++)
+        {
+          float threshold = babl_trc_get_u8_from_linear (trc)->threshold[i];
+
+          bad += check_from_linear (trc, threshold);
+          bad += check_from_linear (trc, nextafterf (threshold, -1.0f));
+        }
+
+      for (i = 0; i < SAMPLES; i++)
+        {
+          float value = random () / (float) RAND_MAX;
+
+          /* spread over the exponents as well */
+          if (i % 2)
+            value = powf (value, 8.0f);
+          bad += check_from_linear (trc, value);
+        }
+    }
+
+  babl_exit ();
+
+  return bad != 0;
+}
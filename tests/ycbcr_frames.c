@@ -0,0 +1,327 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/* checks babl_process_from_ycbcr against Y'CbCr decoded in double
+ * precision, and that frames encoded with babl_process_to_ycbcr decode
+ * to their source pixels, for all layouts, matrices and ranges.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "babl.h"
+
+#define WIDTH  37
+#define HEIGHT 23
+
+typedef struct
+{
+  int            n_planes;
+  int            strides[3];
+  unsigned char *planes[3];
+} Frame;
+
+static const char *layout_names[] = { "I420", "NV12", "YUY2", "P010" };
+static const char *matrix_names[] = { "BT.601", "BT.709", "BT.2020" };
+
+static void
+frame_new (Frame          *frame,
+           BablYCbCrLayout layout)
+{
+  int chroma_width = (WIDTH + 1) / 2;
+  int i;
+
+  memset (frame, 0, sizeof (Frame));
+  switch (layout)
+    {
+      case BABL_YCBCR_I420:
+        frame->n_planes   = 3;
+        frame->strides[0] = WIDTH + 3;
+        frame->strides[1] = chroma_width + 1;
+        frame->strides[2] = chroma_width + 5;
+        break;
+      case BABL_YCBCR_NV12:
+        frame->n_planes   = 2;
+        frame->strides[0] = WIDTH;
+        frame->strides[1] = chroma_width * 2 + 2;
+        break;
+      case BABL_YCBCR_YUY2:
+        frame->n_planes   = 1;
+        frame->strides[0] = chroma_width * 4;
+        break;
+      case BABL_YCBCR_P010:
+        frame->n_planes   = 2;
+        frame->strides[0] = WIDTH * 2 + 6;
+        frame->strides[1] = chroma_width * 4;
+        break;
+    }
+  for (i = 0; i < frame->n_planes; i++)
+    frame->planes[i] = calloc (frame->strides[i], HEIGHT);
+}
+
+static void
+frame_free (Frame *frame)
+{
+  int i;
+
+  for (i = 0; i < frame->n_planes; i++)
+    free (frame->planes[i]);
+}
+
+static int
+sample (const unsigned char *row,
+        int                  index,
+        int                  wide)
+{
+  if (wide)
+    return (row[index * 2] | (row[index * 2 + 1] << 8)) >> 6;
+  return row[index];
+}
+
+/* the codes of Y', Cb and Cr of a pixel */
+static void
+frame_get (const Frame    *frame,
+           BablYCbCrLayout layout,
+           int             x,
+           int             y,
+           int            *codes)
+{
+  const unsigned char *luma = frame->planes[0] + y * frame->strides[0];
+  const unsigned char *chroma;
+
+  switch (layout)
+    {
+      case BABL_YCBCR_I420:
+        codes[0] = luma[x];
+        codes[1] = frame->planes[1][y / 2 * frame->strides[1] + x / 2];
+        codes[2] = frame->planes[2][y / 2 * frame->strides[2] + x / 2];
+        break;
+      case BABL_YCBCR_NV12:
+      case BABL_YCBCR_P010:
+        chroma   = frame->planes[1] + y / 2 * frame->strides[1];
+        codes[0] = sample (luma, x, layout == BABL_YCBCR_P010);
+        codes[1] = sample (chroma, x / 2 * 2, layout == BABL_YCBCR_P010);
+        codes[2] = sample (chroma, x / 2 * 2 + 1, layout == BABL_YCBCR_P010);
+        break;
+      case BABL_YCBCR_YUY2:
+        codes[0] = luma[x * 2];
+        codes[1] = luma[x / 2 * 4 + 1];
+        codes[2] = luma[x / 2 * 4 + 3];
+        break;
+    }
+}
+
+static void
+decode (BablYCbCrLayout layout,
+        BablYCbCrMatrix matrix,
+        int             full_range,
+        const int      *codes,
+        double         *rgb)
+{
+  double kr = matrix == BABL_YCBCR_BT601 ? 0.299 :
+              matrix == BABL_YCBCR_BT709 ? 0.2126 : 0.2627;
+  double kb = matrix == BABL_YCBCR_BT601 ? 0.114 :
+              matrix == BABL_YCBCR_BT709 ? 0.0722 : 0.0593;
+  double kg = 1.0 - kr - kb;
+  double scale = layout == BABL_YCBCR_P010 ? 4.0 : 1.0;
+  double max   = layout == BABL_YCBCR_P010 ? 1023.0 : 255.0;
+  double y, cb, cr;
+
+  if (full_range)
+    {
+      y  = codes[0] / max;
+      cb = (codes[1] - 128 * scale) / max;
+      cr = (codes[2] - 128 * scale) / max;
+    }
+  else
+    {
+      y  = (codes[0] - 16 * scale) / (219 * scale);
+      cb = (codes[1] - 128 * scale) / (224 * scale);
+      cr = (codes[2] - 128 * scale) / (224 * scale);
+    }
+
+  rgb[0] = y + 2.0 * (1.0 - kr) * cr;
+  rgb[1] = y - 2.0 * kb * (1.0 - kb) / kg * cb - 2.0 * kr * (1.0 - kr) / kg * cr;
+  rgb[2] = y + 2.0 * (1.0 - kb) * cb;
+}
+
+static const Babl *
+rgba_format (BablYCbCrMatrix matrix,
+             const char     *name)
+{
+  return babl_format_with_space (name, babl_space (matrix == BABL_YCBCR_BT2020 ?
+                                                   "Rec2020" : "sRGB"));
+}
+
+static int
+check_decode (BablYCbCrLayout layout,
+              BablYCbCrMatrix matrix,
+              int             full_range)
+{
+  Frame           frame;
+  unsigned char  *u8  = malloc (WIDTH * HEIGHT * 4);
+  unsigned short *u16 = malloc (WIDTH * HEIGHT * 8);
+  float          *f   = malloc (WIDTH * HEIGHT * 16);
+  double          max_u8 = 0.0, max_u16 = 0.0, max_float = 0.0;
+  int             x, y, i;
+  int             OK = 1;
+
+  frame_new (&frame, layout);
+  for (i = 0; i < frame.n_planes; i++)
+    for (x = 0; x < frame.strides[i] * HEIGHT; x++)
+      frame.planes[i][x] = rand ();
+
+  babl_process_from_ycbcr (layout, matrix, full_range,
+                           (const void **) frame.planes, frame.strides,
+                           rgba_format (matrix, "R'G'B'A u8"), u8, WIDTH * 4,
+                           WIDTH, HEIGHT);
+  babl_process_from_ycbcr (layout, matrix, full_range,
+                           (const void **) frame.planes, frame.strides,
+                           rgba_format (matrix, "R'G'B'A u16"), u16, WIDTH * 8,
+                           WIDTH, HEIGHT);
+  babl_process_from_ycbcr (layout, matrix, full_range,
+                           (const void **) frame.planes, frame.strides,
+                           rgba_format (matrix, "R'G'B'A float"), f, WIDTH * 16,
+                           WIDTH, HEIGHT);
+
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      {
+        int    codes[3];
+        double rgb[3];
+        int    p = (y * WIDTH + x) * 4;
+
+        frame_get (&frame, layout, x, y, codes);
+        decode (layout, matrix, full_range, codes, rgb);
+
+        for (i = 0; i < 3; i++)
+          {
+            double value = rgb[i] < 0.0 ? 0.0 : rgb[i] > 1.0 ? 1.0 : rgb[i];
+
+            max_u8    = fmax (max_u8, fabs (u8[p + i] - value * 255.0));
+            max_u16   = fmax (max_u16, fabs (u16[p + i] - value * 65535.0));
+            max_float = fmax (max_float, fabs (f[p + i] - value));
+          }
+        if (u8[p + 3] != 255 || u16[p + 3] != 65535 || f[p + 3] != 1.0f)
+          OK = 0;
+      }
+
+  /* rounding to u8 and u16, with a margin for the fixed point matrix */
+  if (max_u8 > 0.52 || max_u16 > 4.0 || max_float > 0.0001 || !OK)
+    {
+      fprintf (stderr, "decoding %s %s %s range: off by %f u8 %f u16 %f\n",
+               layout_names[layout], matrix_names[matrix],
+               full_range ? "full" : "limited", max_u8, max_u16, max_float);
+      OK = 0;
+    }
+
+  frame_free (&frame);
+  free (u8);
+  free (u16);
+  free (f);
+  return OK;
+}
+
+/* pixels sharing chroma have the same color, so frames can hold them */
+static int
+check_roundtrip (BablYCbCrLayout layout,
+                 BablYCbCrMatrix matrix,
+                 int             full_range,
+                 const char     *format_name,
+                 int             tolerance)
+{
+  const Babl     *format = rgba_format (matrix, format_name);
+  int             u16    = strstr (format_name, "u16") != NULL;
+  unsigned short *source = malloc (WIDTH * HEIGHT * 8);
+  unsigned short *dest   = malloc (WIDTH * HEIGHT * 8);
+  int             stride = WIDTH * (u16 ? 8 : 4);
+  Frame           frame;
+  int             max_diff = 0;
+  int             x, y, i;
+
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      for (i = 0; i < 4; i++)
+        {
+          int value = i == 3 ? 65535 :
+                      ((y / 2) * 7919 + (x / 2) * 104729 + i * 15485863) % 65536;
+
+          if (u16)
+            source[(y * WIDTH + x) * 4 + i] = value;
+          else
+            ((unsigned char *) source)[(y * WIDTH + x) * 4 + i] = value >> 8;
+        }
+
+  frame_new (&frame, layout);
+  babl_process_to_ycbcr (format, source, stride, layout, matrix, full_range,
+                         (void **) frame.planes, frame.strides, WIDTH, HEIGHT);
+  babl_process_from_ycbcr (layout, matrix, full_range,
+                           (const void **) frame.planes, frame.strides,
+                           format, dest, stride, WIDTH, HEIGHT);
+
+  for (i = 0; i < WIDTH * HEIGHT * 4; i++)
+    {
+      int a = u16 ? source[i] : ((unsigned char *) source)[i];
+      int b = u16 ? dest[i] : ((unsigned char *) dest)[i];
+
+      if (abs (a - b) > max_diff)
+        max_diff = abs (a - b);
+    }
+
+  frame_free (&frame);
+  free (source);
+  free (dest);
+
+  if (max_diff > tolerance)
+    {
+      fprintf (stderr, "%s %s %s range %s: roundtrip off by %i\n",
+               layout_names[layout], matrix_names[matrix],
+               full_range ? "full" : "limited", format_name, max_diff);
+      return 0;
+    }
+  return 1;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int OK = 1;
+  int layout, matrix, full_range;
+
+  babl_init ();
+
+  for (layout = BABL_YCBCR_I420; layout <= BABL_YCBCR_P010; layout++)
+    for (matrix = BABL_YCBCR_BT601; matrix <= BABL_YCBCR_BT2020; matrix++)
+      for (full_range = 0; full_range <= 1; full_range++)
+        {
+          /* within a few codes of the samples of the frames */
+          int wide = layout == BABL_YCBCR_P010;
+
+          OK &= check_decode (layout, matrix, full_range);
+          OK &= check_roundtrip (layout, matrix, full_range,
+                                 "R'G'B'A u8", wide ? 1 : 2);
+          OK &= check_roundtrip (layout, matrix, full_range,
+                                 "R'G'B'A u16", wide ? 3 * 64 : 3 * 256);
+        }
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,439 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* converts a file of raw pixels between two formats, and reports the
+ * throughput of each stage:
+ *
+ *   babl-convert [options] <input> <output>
+ *
+ * The input is memory mapped and converted a chunk at a time with
+ * babl_process_rows_parallel (), on all cores unless --threads says
+ * otherwise. The output is memory mapped as well, or written with
+ * O_DIRECT from an aligned buffer with --direct. The time spent bringing
+ * the pages of a chunk of the input into memory is counted as reading,
+ * the time spent on msync () or write () as writing.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "babl-internal.h"
+
+#define DIRECT_ALIGNMENT 4096
+
+#ifndef MIN
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#endif
+
+typedef struct
+{
+  long read;
+  long convert;
+  long write;
+} Timings;
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr,
+    "usage: %s [options] <input> <output>\n"
+    " where recognized options are:\n"
+    "    -s, --source-format <name>   format of the input, R'G'B'A u8 by default\n"
+    "    -d, --dest-format <name>     format of the output, R'G'B'A u8 by default\n"
+    "    --source-space <name>        named babl space of the input\n"
+    "    --dest-space <name>          named babl space of the output\n"
+    "    --source-icc <path>          ICC profile of the input\n"
+    "    --dest-icc <path>            ICC profile of the output\n"
+    "    --skip <bytes>               header bytes of the input to leave out\n"
+    "    -j, --threads <count>        conversion threads, all cores by default\n"
+    "    -c, --chunk <MiB>            input converted at a time, 64 by default\n"
+    "    --direct                     write with O_DIRECT instead of mmap\n"
+    "    --drop-cache                 evict converted data from the page cache\n"
+    "    -r, --repeat <count>         convert the file this many times\n",
+    name);
+}
+
+static const Babl *
+space_from_icc (const char *path)
+{
+  FILE       *file = fopen (path, "rb");
+  const char *error = NULL;
+  const Babl *space = NULL;
+  char       *data;
+  long        length;
+
+  if (!file)
+    {
+      fprintf (stderr, "babl-convert: can not open %s\n", path);
+      return NULL;
+    }
+  fseek (file, 0, SEEK_END);
+  length = ftell (file);
+  fseek (file, 0, SEEK_SET);
+  data = malloc (length);
+  if (fread (data, 1, length, file) == (size_t) length)
+    space = babl_space_from_icc (data, length,
+                                 BABL_ICC_INTENT_RELATIVE_COLORIMETRIC,
+                                 &error);
+  fclose (file);
+  free (data);
+
+  if (!space)
+    fprintf (stderr, "babl-convert: %s: %s\n", path,
+             error ? error : "can not read the profile");
+  return space;
+}
+
+static const Babl *
+format_with_space (const char *format,
+                   const char *space_name,
+                   const char *icc_path)
+{
+  const Babl *space = NULL;
+
+  if (!babl_format_exists (format))
+    {
+      fprintf (stderr, "babl-convert: unknown format %s\n", format);
+      return NULL;
+    }
+  if (icc_path)
+    {
+      space = space_from_icc (icc_path);
+      if (!space)
+        return NULL;
+    }
+  else if (space_name)
+    {
+      space = babl_space (space_name);
+      if (!space)
+        {
+          fprintf (stderr, "babl-convert: unknown space %s\n", space_name);
+          return NULL;
+        }
+    }
+  return babl_format_with_space (format, space);
+}
+
+/* brings the pages of a chunk of the input into memory, reading through a
+ * volatile pointer so the loads are not optimized away
+ */
+static void
+fault_in (const unsigned char *data,
+          long                 length)
+{
+  const volatile unsigned char *pages = data;
+  long                          page  = sysconf (_SC_PAGESIZE);
+  long                          i;
+
+  for (i = 0; i < length; i += page)
+    (void) pages[i];
+}
+
+static double
+gb_per_second (double bytes,
+               long   microseconds)
+{
+  if (microseconds <= 0)
+    return 0.0;
+  return bytes / 1e9 / (microseconds / 1e6);
+}
+
+static void
+report (const char *stage,
+        double      bytes,
+        long        microseconds)
+{
+  printf ("%-8s %10.3f GB %10.3f s %10.3f GB/s\n", stage, bytes / 1e9,
+          microseconds / 1e6, gb_per_second (bytes, microseconds));
+}
+
+static int
+convert (const Babl          *fish,
+         const unsigned char *source,
+         int                  input_fd,
+         long                 skip,
+         int                  output_fd,
+         unsigned char       *dest,
+         unsigned char       *buffer,
+         long                 pixels,
+         long                 chunk_pixels,
+         int                  drop_cache,
+         Timings             *timings)
+{
+  int  src_bpp = babl_format_get_bytes_per_pixel (fish->fish.source);
+  int  dst_bpp = babl_format_get_bytes_per_pixel (fish->fish.destination);
+  long done;
+
+  for (done = 0; done < pixels; done += chunk_pixels)
+    {
+      long                 count = MIN (chunk_pixels, pixels - done);
+      const unsigned char *src   = source + skip + done * src_bpp;
+      unsigned char       *dst   = dest ? dest + done * dst_bpp : buffer;
+      long                 start;
+
+      start = babl_ticks ();
+      fault_in (src, count * src_bpp);
+      timings->read += babl_ticks () - start;
+
+      start = babl_ticks ();
+      babl_process_rows_parallel (fish, src, 0, dst, 0, count, 1);
+      timings->convert += babl_ticks () - start;
+
+      start = babl_ticks ();
+      if (dest)
+        {
+          if (drop_cache)
+            {
+              /* msync () needs page aligned addresses */
+              long page  = sysconf (_SC_PAGESIZE);
+              long first = (done * dst_bpp) / page * page;
+              long end   = (done + count) * dst_bpp;
+
+              msync (dest + first, end - first, MS_SYNC);
+              posix_fadvise (output_fd, first, end - first,
+                             POSIX_FADV_DONTNEED);
+            }
+        }
+      else
+        {
+          long length = count * dst_bpp;
+          long offset = done * dst_bpp;
+
+          /* the last chunk might not be a whole number of blocks, it is
+           * written without O_DIRECT
+           */
+          if (length % DIRECT_ALIGNMENT)
+            fcntl (output_fd, F_SETFL,
+                   fcntl (output_fd, F_GETFL) & ~O_DIRECT);
+          if (pwrite (output_fd, buffer, length, offset) != length)
+            {
+              perror ("babl-convert: write");
+              return -1;
+            }
+        }
+      timings->write += babl_ticks () - start;
+
+      if (drop_cache)
+        posix_fadvise (input_fd, skip + done * src_bpp, count * src_bpp,
+                       POSIX_FADV_DONTNEED);
+    }
+
+  if (dest)
+    {
+      long start = babl_ticks ();
+      msync (dest, pixels * dst_bpp, MS_SYNC);
+      timings->write += babl_ticks () - start;
+    }
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const char    *source_format = "R'G'B'A u8";
+  const char    *dest_format   = "R'G'B'A u8";
+  const char    *source_space  = NULL;
+  const char    *dest_space    = NULL;
+  const char    *source_icc    = NULL;
+  const char    *dest_icc      = NULL;
+  const char    *input         = NULL;
+  const char    *output        = NULL;
+  long           skip          = 0;
+  long           chunk_mib     = 64;
+  int            direct        = 0;
+  int            drop_cache    = 0;
+  int            repeat        = 1;
+  const Babl    *src_format;
+  const Babl    *dst_format;
+  const Babl    *fish;
+  int            src_bpp;
+  int            dst_bpp;
+  int            input_fd;
+  int            output_fd;
+  struct stat    stat_buf;
+  unsigned char *source;
+  unsigned char *dest   = NULL;
+  unsigned char *buffer = NULL;
+  long           pixels;
+  long           chunk_pixels;
+  Timings        timings = { 0, };
+  long           start;
+  long           total;
+  int            i;
+
+  for (i = 1; argv[i]; i++)
+    {
+      const char *value = argv[i + 1];
+
+      if ((!strcmp (argv[i], "-s") ||
+           !strcmp (argv[i], "--source-format")) && value)
+        source_format = argv[++i];
+      else if ((!strcmp (argv[i], "-d") ||
+                !strcmp (argv[i], "--dest-format")) && value)
+        dest_format = argv[++i];
+      else if (!strcmp (argv[i], "--source-space") && value)
+        source_space = argv[++i];
+      else if (!strcmp (argv[i], "--dest-space") && value)
+        dest_space = argv[++i];
+      else if (!strcmp (argv[i], "--source-icc") && value)
+        source_icc = argv[++i];
+      else if (!strcmp (argv[i], "--dest-icc") && value)
+        dest_icc = argv[++i];
+      else if (!strcmp (argv[i], "--skip") && value)
+        skip = atol (argv[++i]);
+      else if ((!strcmp (argv[i], "-j") ||
+                !strcmp (argv[i], "--threads")) && value)
+        setenv ("BABL_THREADS", argv[++i], 1);
+      else if ((!strcmp (argv[i], "-c") ||
+                !strcmp (argv[i], "--chunk")) && value)
+        chunk_mib = atol (argv[++i]);
+      else if (!strcmp (argv[i], "--direct"))
+        direct = 1;
+      else if (!strcmp (argv[i], "--drop-cache"))
+        drop_cache = 1;
+      else if ((!strcmp (argv[i], "-r") ||
+                !strcmp (argv[i], "--repeat")) && value)
+        repeat = atoi (argv[++i]);
+      else if (argv[i][0] == '-')
+        {
+          fprintf (stderr, "unknown option, or option without value, %s\n", argv[i]);
+          usage (argv[0]);
+          return -1;
+        }
+      else if (!input)
+        input = argv[i];
+      else if (!output)
+        output = argv[i];
+    }
+
+  if (!input || !output || chunk_mib <= 0 || repeat <= 0 || skip < 0)
+    {
+      usage (argv[0]);
+      return -1;
+    }
+
+  babl_init ();
+
+  src_format = format_with_space (source_format, source_space, source_icc);
+  dst_format = format_with_space (dest_format, dest_space, dest_icc);
+  if (!src_format || !dst_format)
+    return -1;
+  fish    = babl_fish (src_format, dst_format);
+  src_bpp = babl_format_get_bytes_per_pixel (src_format);
+  dst_bpp = babl_format_get_bytes_per_pixel (dst_format);
+
+  input_fd = open (input, O_RDONLY);
+  if (input_fd < 0 || fstat (input_fd, &stat_buf) != 0)
+    {
+      fprintf (stderr, "babl-convert: can not open %s\n", input);
+      return -1;
+    }
+  if (stat_buf.st_size <= skip)
+    {
+      fprintf (stderr, "babl-convert: %s has no pixels\n", input);
+      return -1;
+    }
+  pixels = (stat_buf.st_size - skip) / src_bpp;
+  if ((stat_buf.st_size - skip) % src_bpp)
+    fprintf (stderr, "babl-convert: ignoring %li bytes after the last pixel\n",
+             (long) ((stat_buf.st_size - skip) % src_bpp));
+
+  source = mmap (NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, input_fd, 0);
+  if (source == MAP_FAILED)
+    {
+      perror ("babl-convert: mmap");
+      return -1;
+    }
+  madvise (source, stat_buf.st_size, MADV_SEQUENTIAL);
+
+  /* whole pages of output for each chunk, as O_DIRECT needs */
+  chunk_pixels = chunk_mib * 1024 * 1024 / src_bpp;
+  while ((chunk_pixels * dst_bpp) % DIRECT_ALIGNMENT)
+    chunk_pixels++;
+
+  output_fd = open (output, O_RDWR | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0),
+                    0644);
+  if (output_fd < 0)
+    {
+      fprintf (stderr, "babl-convert: can not create %s\n", output);
+      return -1;
+    }
+  if (ftruncate (output_fd, pixels * dst_bpp) != 0)
+    {
+      perror ("babl-convert: ftruncate");
+      return -1;
+    }
+
+  if (direct)
+    {
+      if (posix_memalign ((void **) &buffer, DIRECT_ALIGNMENT,
+                          chunk_pixels * dst_bpp) != 0)
+        return -1;
+    }
+  else
+    {
+      dest = mmap (NULL, pixels * dst_bpp, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   output_fd, 0);
+      if (dest == MAP_FAILED)
+        {
+          perror ("babl-convert: mmap");
+          return -1;
+        }
+      madvise (dest, pixels * dst_bpp, MADV_SEQUENTIAL);
+    }
+
+  printf ("%s to %s, %li pixels, %s threads, chunks of %li pixels\n",
+          babl_get_name (src_format), babl_get_name (dst_format), pixels,
+          getenv ("BABL_THREADS") ? getenv ("BABL_THREADS") : "all",
+          chunk_pixels);
+
+  start = babl_ticks ();
+  for (i = 0; i < repeat; i++)
+    {
+      if (direct)
+        fcntl (output_fd, F_SETFL, fcntl (output_fd, F_GETFL) | O_DIRECT);
+      if (convert (fish, source, input_fd, skip, output_fd, dest, buffer,
+                   pixels, chunk_pixels, drop_cache, &timings))
+        return -1;
+    }
+  total = babl_ticks () - start;
+
+  report ("read",    (double) pixels * src_bpp * repeat, timings.read);
+  report ("convert", (double) pixels * src_bpp * repeat, timings.convert);
+  report ("write",   (double) pixels * dst_bpp * repeat, timings.write);
+  report ("total",   (double) pixels * src_bpp * repeat, total);
+  printf ("%.2f megapixels/s\n",
+          (double) pixels * repeat / (total / 1e6) / 1e6);
+
+  if (dest)
+    munmap (dest, pixels * dst_bpp);
+  free (buffer);
+  munmap (source, stat_buf.st_size);
+  close (output_fd);
+  close (input_fd);
+
+  babl_exit ();
+  return 0;
+}
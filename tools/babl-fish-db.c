@@ -0,0 +1,182 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* generates the system fish cache installed with babl, by searching the
+ * conversion paths for a matrix of formats and spaces read from a file:
+ *
+ *   babl-fish-db <matrix> <output>
+ *
+ * Each line of the matrix is one of
+ *
+ *   format <name>          a format, in each of the spaces
+ *   space <name>           a space, formats are converted among each
+ *                          other within it and to and from sRGB
+ *   performance <name>     also create fast fishes for this performance
+ *                          of babl_fast_fish
+ *
+ * empty lines and lines starting with # are skipped.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "babl-internal.h"
+
+#define MAX_ENTRIES 256
+
+static char *formats[MAX_ENTRIES];
+static char *spaces[MAX_ENTRIES];
+static char *performances[MAX_ENTRIES];
+static int   n_formats;
+static int   n_spaces;
+static int   n_performances;
+static long  n_fishes;
+
+static int
+read_matrix (const char *path)
+{
+  FILE *file = fopen (path, "r");
+  char  line[1024];
+  int   line_no = 0;
+
+  if (!file)
+    {
+      fprintf (stderr, "babl-fish-db: can not open %s\n", path);
+      return -1;
+    }
+
+  while (fgets (line, sizeof (line), file))
+    {
+      char  *value;
+      char **list  = NULL;
+      int   *count = NULL;
+
+      line_no++;
+      line[strcspn (line, "\r\n")] = '\0';
+      if (line[0] == '\0' || line[0] == '#')
+        continue;
+
+      value = strchr (line, ' ');
+      if (value)
+        *value++ = '\0';
+
+      if (!strcmp (line, "format"))
+        list = formats, count = &n_formats;
+      else if (!strcmp (line, "space"))
+        list = spaces, count = &n_spaces;
+      else if (!strcmp (line, "performance"))
+        list = performances, count = &n_performances;
+
+      if (!list || !value || *count >= MAX_ENTRIES)
+        {
+          fprintf (stderr, "babl-fish-db: %s:%i: can not parse line\n",
+                   path, line_no);
+          fclose (file);
+          return -1;
+        }
+      list[(*count)++] = strdup (value);
+    }
+
+  fclose (file);
+  return 0;
+}
+
+static void
+make_fishes (const Babl *source,
+             const Babl *destination)
+{
+  int i;
+
+  if (source == destination)
+    return;
+
+  babl_fish (source, destination);
+  for (i = 0; i < n_performances; i++)
+    babl_fast_fish (source, destination, performances[i]);
+  n_fishes++;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  char tmp_path[4096];
+  int  s, i, j;
+
+  if (argc != 3)
+    {
+      fprintf (stderr, "usage: %s <matrix> <output>\n", argv[0]);
+      return 1;
+    }
+  if (read_matrix (argv[1]) != 0)
+    return 1;
+  if (n_spaces == 0)
+    spaces[n_spaces++] = "sRGB";
+
+  /* search every path afresh, and have babl_exit store the fishes in the
+   * output file rather than in the cache of the user
+   */
+  snprintf (tmp_path, sizeof (tmp_path), "%s~", argv[2]);
+  remove (argv[2]);
+  remove (tmp_path);
+  setenv ("BABL_FISH_DB", "", 1);
+  setenv ("BABL_FISH_CACHE", argv[2], 1);
+  unsetenv ("BABL_FISH_ASYNC");
+
+  babl_init ();
+
+  for (i = 0; i < n_formats; i++)
+    if (!babl_format_exists (formats[i]))
+      {
+        fprintf (stderr, "babl-fish-db: unknown format %s\n", formats[i]);
+        return 1;
+      }
+
+  for (s = 0; s < n_spaces; s++)
+    {
+      const Babl *space = babl_space (spaces[s]);
+      const Babl *srgb  = babl_space ("sRGB");
+
+      if (!space)
+        {
+          fprintf (stderr, "babl-fish-db: unknown space %s\n", spaces[s]);
+          return 1;
+        }
+
+      for (i = 0; i < n_formats; i++)
+        for (j = 0; j < n_formats; j++)
+          {
+            const Babl *source = babl_format_with_space (formats[i], space);
+
+            make_fishes (source, babl_format_with_space (formats[j], space));
+            if (space != srgb)
+              {
+                make_fishes (source,
+                             babl_format_with_space (formats[j], srgb));
+                make_fishes (babl_format_with_space (formats[j], srgb),
+                             source);
+              }
+          }
+    }
+
+  babl_exit ();
+
+  printf ("%li pairs of formats in %s\n", n_fishes, argv[2]);
+  return 0;
+}
@@ -0,0 +1,179 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2019, Øyvind Kolås and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* makes spaces the way an application opening many differently tagged
+ * images does, converts with each of them and releases them again:
+ *
+ *   babl-space-churn [--rounds <count>] [--spaces <count>] [--keep]
+ *
+ * Every round makes spaces that have not been seen before, and prints how
+ * many formats, conversions and fishes there are after it, the number of
+ * slots of the table babl_fish () looks fishes up in, and the resident
+ * memory where /proc/self/statm tells. With --keep the spaces
+ * are never released, for comparison.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "babl-internal.h"
+
+#define PIXELS 256
+
+static int
+count (Babl *babl,
+       void *data)
+{
+  (*(int *) data)++;
+  return 0;
+}
+
+/* resident memory in MiB, or -1.0 where not known */
+static double
+resident_mib (void)
+{
+  FILE  *file = fopen ("/proc/self/statm", "r");
+  long   size;
+  long   resident = -1;
+
+  if (!file)
+    return -1.0;
+  if (fscanf (file, "%li %li", &size, &resident) != 2)
+    resident = -1;
+  fclose (file);
+  if (resident < 0)
+    return -1.0;
+  return resident * (double) sysconf (_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static const Babl *
+make_space (int n)
+{
+  static const char *trcs[] = { "sRGB", "2.2", "1.8", "linear" };
+
+  return babl_space_from_chromaticities (NULL,
+                                         0.3127, 0.3290,
+                                         0.6400 + (n % 1000) * 0.00005,
+                                         0.3300,
+                                         0.3000 - (n / 1000) * 0.00005,
+                                         0.6000,
+                                         0.1500, 0.0600,
+                                         babl_trc (trcs[n % 4]),
+                                         NULL, NULL,
+                                         BABL_SPACE_FLAG_NONE);
+}
+
+static void
+convert (const Babl *space)
+{
+  static unsigned char pixels[PIXELS * 4];
+  static float         linear[PIXELS * 4];
+
+  babl_process (babl_fish (babl_format_with_space ("R'G'B'A u8", space),
+                           babl_format ("RGBA float")),
+                pixels, linear, PIXELS);
+  babl_process (babl_fish (babl_format ("RGBA float"),
+                           babl_format_with_space ("R'G'B'A u8", space)),
+                linear, pixels, PIXELS);
+  babl_process (babl_fish (babl_format_with_space ("RGBA float", space),
+                           babl_format ("R'G'B'A float")),
+                linear, linear, PIXELS);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  const Babl **spaces;
+  int          rounds   = 10;
+  int          n_spaces = 4;
+  int          keep     = 0;
+  int          held     = 0;
+  int          made     = 0;
+  int          round;
+  int          i;
+
+  for (i = 1; argv[i]; i++)
+    {
+      const char *value = argv[i + 1];
+
+      if (!strcmp (argv[i], "--rounds") && value)
+        rounds = atoi (argv[++i]);
+      else if (!strcmp (argv[i], "--spaces") && value)
+        n_spaces = atoi (argv[++i]);
+      else if (!strcmp (argv[i], "--keep"))
+        keep = 1;
+      else
+        {
+          fprintf (stderr,
+                   "usage: %s [--rounds <count>] [--spaces <count>] [--keep]\n",
+                   argv[0]);
+          return 1;
+        }
+    }
+
+  babl_init ();
+
+  spaces = calloc (n_spaces, sizeof (Babl *));
+  printf ("%5s %8s %8s %12s %8s %8s %10s %10s\n", "round", "spaces",
+          "formats", "conversions", "fishes", "slots", "RSS MiB", "ms");
+
+  for (round = 0; round < rounds; round++)
+    {
+      long   start = babl_ticks ();
+      int    formats = 0;
+      int    conversions = 0;
+      int    fishes = 0;
+      double resident;
+
+      for (i = 0; i < n_spaces; i++)
+        {
+          spaces[i] = make_space (made++);
+          convert (spaces[i]);
+        }
+      held += n_spaces;
+
+      if (!keep)
+        {
+          for (i = 0; i < n_spaces; i++)
+            babl_space_unref (spaces[i]);
+          held -= n_spaces;
+        }
+
+      babl_format_class_for_each (count, &formats);
+      babl_conversion_class_for_each (count, &conversions);
+      babl_db_each (babl_fish_db (), count, &fishes);
+      resident = resident_mib ();
+
+      printf ("%5i %8i %8i %12i %8i %8li ", round, held, formats,
+              conversions, fishes, babl_fish_table_size ());
+      if (resident < 0.0)
+        printf ("%10s", "-");
+      else
+        printf ("%10.1f", resident);
+      printf (" %10.1f\n", (babl_ticks () - start) / 1000.0);
+      fflush (stdout);
+    }
+
+  free (spaces);
+  babl_exit ();
+
+  return 0;
+}